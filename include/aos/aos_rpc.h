@@ -16,6 +16,7 @@
 #define _LIB_BARRELFISH_AOS_MESSAGES_H
 
 #include <aos/aos.h>
+#include <aos/rpc_bulk.h>
 
 // Maximum 255 opcodes
 enum message_opcodes {
@@ -31,16 +32,23 @@ enum message_opcodes {
 
     RPC_RAM_CAP_QUERY,
     RPC_RAM_CAP_RESPONSE,
+    RPC_RAM_CAP_BATCH_QUERY,
+    RPC_RAM_CAP_BATCH_RESPONSE,
+    RPC_RAM_CACHE_STATS,
+    RPC_RAM_CAP_FREE,
 
     RPC_NUMBER,
     RPC_STRING,
     RPC_PUT_CHAR,
     RPC_GET_CHAR,
     RPC_SPAWN,
+    RPC_SPAWN_BATCH,
     RPC_EXIT,
 
     RPC_GET_NAME,
     RPC_GET_PID,
+    RPC_PROCESS_SNAPSHOT,
+    RPC_PROCESS_USAGE,
 
     RPC_CREATE_SERVER_SOCKET,
     RPC_CONNECT_TO_SOCKET,
@@ -52,6 +60,7 @@ enum message_opcodes {
 
     RPC_SET_LED,
     RPC_MEMTEST,
+    RPC_BULK_CONTINUE,
     RPC_NUM_OPCODES,
 };
 
@@ -60,6 +69,7 @@ enum message_flags {
     RPC_FLAG_ACK        = 0x1,
     RPC_FLAG_INCOMPLETE = 0x2,
     RPC_FLAG_ERROR      = 0x4,
+    RPC_FLAG_BULK       = 0x8,  // Payload in the bulk ring, length in the next word
 };
 
 #define RPC_OPCODE_BITS 8
@@ -85,9 +95,24 @@ typedef errval_t (*aos_rpc_handler)(struct aos_rpc_session* sess, struct lmp_rec
 struct aos_rpc_message_handler_closure{
     aos_rpc_handler message_handler;
     bool send_ack;
+    bool slow;          // Runs on the session's worker, if the server has workers
     void* args;
 };
 
+/*
+ * Server thread with a waitset of its own. Every session is given a worker
+ * when it registers; its slow requests run there, so that they don't hold
+ * up the accept loop. The session is not received from until the worker
+ * is done, which keeps its requests in order.
+ */
+struct aos_rpc_worker {
+    struct aos_rpc* rpc;
+    struct thread* thread;
+    struct waitset ws;
+    size_t sessions;
+    size_t jobs;
+};
+
 struct aos_rpc {
     // For client only:
     struct aos_rpc_session* server_sess; // Server chan for client
@@ -95,18 +120,40 @@ struct aos_rpc {
     // For client and server
     struct waitset* ws;
     struct aos_rpc_message_handler_closure aos_rpc_message_handler_closure[RPC_NUM_OPCODES];
+
+    // For server only: see aos_rpc_start_workers
+    struct aos_rpc_worker* workers;
+    size_t num_workers;
+    size_t next_worker;
+    struct thread_mutex workers_lock;   // Guards next_worker and sessions
 };
 
 struct aos_rpc_session {
     struct lmp_chan lc;
     bool can_send;
     bool ack_received;
+    bool fast_path;     // Client: send/receive directly, waitset on transient errors only
     struct aos_rpc* rpc;
 
     // Shared buffer
     struct capref shared_buffer_cap;
     void* shared_buffer;
     size_t shared_buffer_size;
+    struct rpc_bulk bulk;
+
+    // Server: payload of the bulk request being handled, and its answer
+    char* bulk_in;
+    size_t bulk_in_len;
+    size_t bulk_in_size;
+    char* bulk_out;
+    size_t bulk_out_len;
+    size_t bulk_out_sent;
+
+    // Server: worker for slow requests, and the request handed over to it
+    struct aos_rpc_worker* worker;
+    struct waitset_chanstate job_chan;
+    struct lmp_recv_msg job_msg;
+    struct capref job_cap;
 };
 
 struct number_handler_closure {
@@ -128,9 +175,32 @@ errval_t aos_rpc_register_handler(struct aos_rpc* rpc, enum message_opcodes opco
 errval_t aos_rpc_register_handler_with_context(struct aos_rpc* rpc, enum message_opcodes opcode,
         aos_rpc_handler message_handler, bool send_ack, void* context);
 
+/**
+ * \brief Starts $count worker threads for the slow handlers of $rpc.
+ * Sessions registered afterwards are spread over them round-robin.
+ */
+errval_t aos_rpc_start_workers(struct aos_rpc* rpc, size_t count);
+
+/**
+ * \brief Marks the handler of $opcode slow (run on a worker) or fast (inline).
+ */
+errval_t aos_rpc_set_handler_slow(struct aos_rpc* rpc, enum message_opcodes opcode, bool slow);
+
 errval_t aos_rpc_accept(struct aos_rpc* rpc);
 errval_t aos_rpc_map_shared_buffer(struct aos_rpc_session* sess, size_t size);
 
+/**
+ * \brief Server side: payload of the bulk request being handled. It is
+ * NUL-terminated and valid until the handler returns.
+ */
+void aos_rpc_bulk_request(struct aos_rpc_session* sess, char** data, size_t* len);
+
+/**
+ * \brief Server side: answer the request being handled with $len bytes.
+ * They are copied and streamed back through the bulk ring with the ack.
+ */
+errval_t aos_rpc_bulk_reply(struct aos_rpc_session* sess, const void* data, size_t len);
+
 errval_t aos_rpc_create_server_socket(struct aos_rpc *rpc, struct capref shared_buffer, size_t port);
 errval_t aos_connect_to_port(struct aos_rpc *rpc, uint32_t port, struct capref *retcap);
 
@@ -156,6 +226,41 @@ errval_t aos_rpc_send_string(struct aos_rpc *chan, const char *string);
 errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t bytes, size_t alignment,
                              struct capref *retcap, size_t *ret_bytes);
 
+/// Max number of caps returned by a single RPC_RAM_CAP_BATCH_QUERY
+#define RPC_RAM_CAP_BATCH_MAX 32
+
+/**
+ * \brief request `count` RAM capabilities of `bytes` each in one round-trip.
+ * The server streams back one cap per LMP message.
+ */
+errval_t aos_rpc_get_ram_cap_batch(struct aos_rpc *chan, size_t count, size_t bytes,
+                                   size_t alignment, struct capref *retcaps);
+
+/**
+ * \brief give a RAM capability back to init. Init revokes it, so our copy
+ * is gone afterwards, but the slot is not freed.
+ */
+errval_t aos_rpc_free_ram_cap(struct aos_rpc *chan, struct capref cap, size_t bytes);
+
+/**
+ * \brief Counters of init's per-core RAM cap magazines
+ */
+struct aos_ram_cache_stats {
+    uint32_t hits;              ///< Requests served from a magazine
+    uint32_t misses;            ///< Requests that found their magazine empty
+    uint32_t refills;           ///< Batched refills from the core's mm
+    uint32_t refilled_caps;     ///< Caps fetched by all refills
+    uint32_t frees_cached;      ///< Freed caps put back into a magazine
+    uint32_t frees_returned;    ///< Freed caps given back to the mm
+    uint32_t cached_small;      ///< Caps currently cached, 4 KiB class
+    uint32_t cached_large;      ///< Caps currently cached, 64 KiB class
+};
+
+/**
+ * \brief request the RAM cache counters of init on the core we run on.
+ */
+errval_t aos_rpc_get_ram_cache_stats(struct aos_rpc *chan, struct aos_ram_cache_stats *stats);
+
 enum aos_rpc_cap_type{
     AOS_CAP_IRQ,
     AOS_CAP_NETWORK_UART,
@@ -191,6 +296,29 @@ errval_t aos_rpc_process_spawn_with_args(struct aos_rpc *chan,
                               coreid_t core, char* const argv[], int argc,
                               domainid_t *newpid);
 
+/// Max number of processes started by a single RPC_SPAWN_BATCH
+#define RPC_SPAWN_BATCH_MAX 1024
+
+/// RPC_SPAWN_BATCH payload: the header, then the serialized argv
+struct aos_rpc_spawn_batch {
+    uint32_t count;
+    uint32_t core_mask;
+    char args[0];
+};
+
+/**
+ * \brief Request process manager to start $count copies of a process,
+ * spread evenly over the cores in $core_mask (bit n is core n). The cores
+ * spawn their share in parallel.
+ * \arg pids the process ids of the spawned processes, in order. Will be
+ * allocated by the rpc implementation. Freeing is the caller's responsibility.
+ * \arg spawned the number of entries in `pids'. Below $count if some of
+ * the processes could not be spawned.
+ */
+errval_t aos_rpc_process_spawn_batch(struct aos_rpc *chan, char* const argv[], int argc,
+                               size_t count, uint32_t core_mask,
+                               domainid_t **pids, size_t *spawned);
+
 /**
  * \brief Get name of process with id pid.
  * \arg pid the process id to lookup
@@ -211,6 +339,59 @@ errval_t aos_rpc_process_get_name(struct aos_rpc *chan, domainid_t pid,
 errval_t aos_rpc_process_get_all_pids(struct aos_rpc *chan,
                                       domainid_t **pids, size_t *pid_count);
 
+enum aos_process_state {
+    AOS_PROCESS_STARTING,       ///< PID assigned, still being spawned
+    AOS_PROCESS_RUNNING,
+};
+
+/// One process of a snapshot, see aos_rpc_process_snapshot
+struct aos_process_info {
+    domainid_t pid;
+    coreid_t core_id;
+    enum aos_process_state state;
+    char *name;
+};
+
+/// RPC_PROCESS_SNAPSHOT answer: one record per process, each padded to 4 bytes
+struct aos_process_record {
+    domainid_t pid;
+    uint8_t core_id;
+    uint8_t state;
+    uint16_t name_size;         ///< Including the NUL
+    char name[0];
+};
+
+#define AOS_PROCESS_RECORD_SIZE(name_size) \
+    ROUND_UP(sizeof(struct aos_process_record) + (name_size), 4)
+
+/**
+ * \brief Get pid, core, state and name of all processes in one round-trip
+ * \arg procs An array of `count' entries in PID order, allocated by the rpc
+ * implementation together with the names. Freeing it is the caller's
+ * responsibility.
+ */
+errval_t aos_rpc_process_snapshot(struct aos_rpc *chan,
+                                  struct aos_process_info **procs, size_t *count);
+
+/// RPC_PROCESS_USAGE answer: resources held by one process
+struct aos_process_usage {
+    domainid_t pid;
+    uint32_t core_id;
+    uint64_t cpu_us;            ///< CPU time, in microseconds
+    uint32_t dispatches;        ///< Times the kernel switched to it
+    uint32_t ram_caps;          ///< RAM caps handed out and not returned
+    uint64_t ram_bytes;         ///< Size of those caps
+    uint64_t spawn_bytes;       ///< RAM allocated by init to spawn it
+};
+
+/**
+ * \brief Get the CPU time and RAM of all processes, on all cores
+ * \arg usage An array of `count' entries in PID order, allocated by the rpc
+ * implementation. Freeing it is the caller's responsibility.
+ */
+errval_t aos_rpc_process_usage(struct aos_rpc *chan,
+                               struct aos_process_usage **usage, size_t *count);
+
 errval_t aos_rpc_process_exit(struct aos_rpc *chan);
 
 errval_t aos_rpc_udp_create_server(struct aos_rpc *rpc, struct capref urpc_frame, uint16_t port);
@@ -242,16 +423,21 @@ errval_t aos_rpc_nameserver_init(struct aos_rpc *rpc, struct capref nsep);
 errval_t aos_rpc_bind_to_nameserver(struct aos_rpc *rpc_init, struct aos_rpc *ret_rpc);
 
 /**
- * \brief
+ * \brief Looks up the service registered as $name. If *$generation is the
+ * generation of the registered service, the caller's binding is still good
+ * and *$ret_ep is NULL_CAP. Otherwise *$ret_ep is a new endpoint and
+ * *$generation is updated.
  * \param rpc  the rpc channel
+ * \param registry_generation returns the generation of the whole registry
  */
-errval_t aos_rpc_nameserver_lookup(struct aos_rpc *rpc, char *name, struct capref *ret_ep);
+errval_t aos_rpc_nameserver_lookup(struct aos_rpc *rpc, char *name, uint32_t *generation,
+        uint32_t *registry_generation, struct capref *ret_ep);
 
 /**
- * \brief
+ * \brief Lists the registered names starting with $prefix, in order
  * \param rpc  the rpc channel
  */
-errval_t aos_rpc_nameserver_enumerate(struct aos_rpc *rpc, size_t *num, char ***result);
+errval_t aos_rpc_nameserver_enumerate(struct aos_rpc *rpc, char *prefix, size_t *num, char ***result);
 
 /**
  * \brief
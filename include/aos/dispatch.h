@@ -64,6 +64,14 @@ void disp_arch_init(dispatcher_handle_t handle);
  */
 void disp_resume(dispatcher_handle_t handle, arch_registers_state_t *archregs);
 
+/**
+ * \brief Resume execution of a given register state, staying disabled
+ *
+ * Like disp_resume, for the trap save area of a disabled fault that the
+ * dispatcher resolved.
+ */
+void disp_resume_disabled(dispatcher_handle_t handle, arch_registers_state_t *archregs);
+
 /**
  * \brief Switch execution between two register states, and turn off
  * disabled activations.
@@ -22,6 +22,7 @@
 
 struct lmp_chan;
 struct deferred_event;
+struct paging_cow_table;
 
 // Architecture generic user only dispatcher struct
 struct dispatcher_generic {
@@ -87,6 +88,9 @@ struct dispatcher_generic {
 
     /// list of polled channels
     struct waitset_chanstate *polled_channels;
+
+    /// copy-on-write pages, set up by the parent (NULL if none)
+    struct paging_cow_table *cow_table;
 };
 
 #endif // BARRELFISH_DISPATCHER_H
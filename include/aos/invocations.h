@@ -297,6 +297,13 @@ static inline errval_t invoke_dispatcher_dump_capabilities(struct capref dispcap
     return cap_invoke1(dispcap, DispatcherCmd_DumpCapabilities).error;
 }
 
+static inline errval_t invoke_dispatcher_get_stats(struct capref dispcap,
+                                                   struct dispatcher_stats *ret)
+{
+    assert(ret != NULL);
+    return cap_invoke2(dispcap, DispatcherCmd_GetStats, (uintptr_t)ret).error;
+}
+
 /**
  * IRQ manipulations
  */
@@ -1,10 +1,20 @@
 #ifndef INCLUDE_AOS_NAMESERVER_H_
 #define INCLUDE_AOS_NAMESERVER_H_
 
+/**
+ * \brief Binds a new session to the service registered as $name. The
+ * service's endpoint is cached: binding to it again shortly after costs
+ * no nameserver round-trip.
+ */
 errval_t nameserver_lookup(char *name, struct aos_rpc *ret_rpc);
 
 errval_t nameserver_enumerate(size_t *num, char ***result);
 
+/**
+ * \brief Lists the registered names starting with $prefix, in order
+ */
+errval_t nameserver_enumerate_prefix(char *prefix, size_t *num, char ***result);
+
 errval_t nameserver_register(char *name, struct aos_rpc *rpc);
 
 errval_t nameserver_deregister(char *name);
@@ -20,6 +20,7 @@
 #include <aos/capabilities.h>
 #include <aos/slab.h>
 #include <aos/paging_datastruct.h>
+#include <barrelfish_kpi/dispatcher_handle.h>
 #include <barrelfish_kpi/paging_arm_v7.h>
 
 typedef int paging_flags_t;
@@ -28,6 +29,9 @@ typedef int paging_flags_t;
 
 #define PAGING_SLAB_BUFSIZE 12
 
+/// Number of page-sized RAM caps the pagefault handler fetches per RPC
+#define PAGING_FAULT_RAM_BATCH 16
+
 #define VREGION_FLAGS_READ     0x01 // Reading allowed
 #define VREGION_FLAGS_WRITE    0x02 // Writing allowed
 #define VREGION_FLAGS_EXECUTE  0x04 // Execute allowed
@@ -48,7 +52,78 @@ typedef int paging_flags_t;
 // struct to store the paging status of a process
 struct l2_vnode_ref {
     bool used;
+    bool section;   // L1 slot maps a 1 MiB section instead of an L2 table
     struct capref vnode_ref;
+    struct capref l1_mapping;   // Mapping cap of the L2 table in the L1
+    size_t mapped_pages;        // The L2 table is freed when this drops to 0
+};
+
+/// Pages mapped by a single fault: the faulting page and its neighbours
+#define PAGING_FAULT_AROUND_DEFAULT (4 * BASE_PAGE_SIZE)
+#define PAGING_FAULT_AROUND_MAX     (16 * BASE_PAGE_SIZE)
+
+struct paging_fault_stats {
+    size_t faults;      // Page faults handled
+    size_t pages;       // Pages mapped by the fault handler
+    size_t clusters;    // Faults that mapped more than one page
+    size_t sections;    // Faults that mapped a 1 MiB section
+    size_t freed;       // Pages of the fault handler unmapped and given back
+    size_t cow_breaks;  // Copy-on-write pages copied on their first write
+};
+
+/*
+ * Copy-on-write pages of a spawned domain. The parent maps pages of its
+ * writable ELF segments read-only from a template frame shared by all
+ * children, one mapping per page, and describes them in this table (see
+ * dispatcher_generic.cow_table). A write fault on a shared page copies it
+ * into a page of the reserve and maps the copy instead. This happens in
+ * the dispatcher's fault upcall, as the first writes come long before the
+ * pager runs; the pager only refills the reserve. Caps are in the child's
+ * cspace, the table is private to the child.
+ */
+#define PAGING_COW_MAX_PAGES    160
+#define PAGING_COW_RESERVE      32
+/// Below this, write faults of threads that can take them go to the pager
+#define PAGING_COW_RESERVE_LOW  8
+
+/// A page mapped writable, for the copy
+struct paging_cow_frame {
+    struct capref frame;
+    struct capref ram;      // Pages the pager added only, NULL_CAP otherwise
+    size_t offset;
+    lvaddr_t vaddr;         // Writable alias, in the reserve
+};
+
+struct paging_cow_page {
+    lvaddr_t vaddr;
+    struct capref l2;       // L2 table the page is mapped in
+    struct capref mapping;  // Mapping of the template page, then of the copy
+    bool shared;
+    struct paging_cow_frame copy;   // Once copied: the reserve page it got
+};
+
+struct paging_cow_table {
+    size_t num_pages;       // Sorted by vaddr
+    size_t num_reserve;     // Changed with the dispatcher disabled only
+    size_t breaks;
+    struct paging_cow_frame reserve[PAGING_COW_RESERVE];
+    struct paging_cow_page pages[PAGING_COW_MAX_PAGES];
+    // Pages copied into a page the pager added, whose alias the next
+    // refill unmaps. Changed with the dispatcher disabled only.
+    size_t num_aliases;
+    uint32_t aliases[PAGING_COW_RESERVE];
+};
+
+/// Faults that can be mapping at the same time, further faults wait
+#define PAGING_MAX_INFLIGHT_FAULTS  8
+/// L2 tables are locked by stripe: slot i uses l2_locks[i % stripes]
+#define PAGING_L2_LOCK_STRIPES      16
+
+/// Range claimed by a fault that is being mapped
+struct paging_fault_inflight {
+    lvaddr_t start;
+    lvaddr_t end;
+    bool active;
 };
 
 //#define PAGING_KEEP_GAPS 40
@@ -60,6 +135,8 @@ struct paging_state {
     struct l2_vnode_ref l2nodes[ARM_L1_MAX_ENTRIES];
     struct vm_block slab_init_buffer[15];    //Lets give some buffer for slab to allocate
     struct slab_allocator slabs;    //slab allocator used for allocating vm_blocks
+    struct vm_mapping mapping_init_buffer[16];
+    struct slab_allocator mapping_slabs;    // vm_mappings, protected by blocks_lock
     vm_block_struct_t blocks;
     struct capref l1_pagetable;
 
@@ -67,21 +144,38 @@ struct paging_state {
 
     bool is_refilling_slab;
 
-    struct thread_mutex page_fault_lock;
+    // Page-sized RAM caps prefetched for the pagefault handler
+    struct capref fault_ram[PAGING_FAULT_RAM_BATCH];
+    size_t fault_ram_count;
+
+    // Fault-around policy, see paging_set_fault_around
+    size_t fault_around;
+    bool fault_sections;
+    struct paging_fault_stats fault_stats;
+
+    // Faults being mapped, protected by blocks_lock
+    struct paging_fault_inflight fault_inflight[PAGING_MAX_INFLIGHT_FAULTS];
+    struct thread_cond fault_done;
+
+    struct thread_mutex page_fault_lock;    // fault_ram and fault_stats
     struct thread_mutex blocks_lock;
+    struct thread_mutex l2_locks[PAGING_L2_LOCK_STRIPES];
 };
 
 #define DATA_STRUCT_LOCK(st) { thread_mutex_lock_nested(&(st)->blocks_lock);}
 #define DATA_STRUCT_UNLOCK(st) { thread_mutex_unlock(&(st)->blocks_lock);}
+#define PAGING_L2_LOCK(st, l1_slot) (&(st)->l2_locks[(l1_slot) % PAGING_L2_LOCK_STRIPES])
 
 struct thread;
-/// Initialize paging_state struct
+/// Initialize paging_state struct, which must be zeroed
 errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
         struct capref pdir, struct slot_allocator * ca);
 /// initialize self-paging module
 errval_t paging_init(void);
 /// setup paging on new thread (used for user-level threads)
-void paging_init_onthread(struct thread *t);
+errval_t paging_init_onthread(struct thread *t);
+/// free the paging state of a thread, e.g. its exception stack
+void paging_destroy_onthread(struct thread *t);
 
 errval_t paging_region_init(struct paging_state *st,
                             struct paging_region *pr, size_t size);
@@ -108,6 +202,7 @@ errval_t paging_region_unmap(struct paging_region *pr, lvaddr_t base, size_t byt
 errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes, struct vm_block** block);
 errval_t paging_alloc_fixed_address(struct paging_state *st, lvaddr_t desired_address, size_t bytes);
 errval_t paging_mark_as_paged_address(struct paging_state *st, lvaddr_t desired_address, size_t bytes);
+errval_t paging_unmark_paged_address(struct paging_state *st, lvaddr_t desired_address, size_t bytes);
 
 /**
  * Functions to map a user provided frame.
@@ -120,6 +215,25 @@ errval_t paging_map_frame_attr(struct paging_state *st, void **buf,
 errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
                                struct capref frame, size_t bytes, size_t offset,
                                int flags, struct vm_block* block);
+/// Map the first MiB of a user provided frame as a section at a 1 MiB aligned VA
+errval_t paging_map_section_attr(struct paging_state *st, lvaddr_t vaddr,
+                                 struct capref frame, int flags, struct vm_block* block);
+
+/**
+ * \brief Sets how much the page-fault handler maps per fault.
+ * `bytes` is a power of two up to PAGING_FAULT_AROUND_MAX, backed by a
+ * single frame. With `sections`, touching a lazily allocated range that
+ * covers a whole 1 MiB aligned section maps it as one section.
+ */
+errval_t paging_set_fault_around(struct paging_state *st, size_t bytes, bool sections);
+void paging_get_fault_stats(struct paging_state *st, struct paging_fault_stats *stats);
+
+/**
+ * \brief Copies the copy-on-write page at `addr` on a write fault, from
+ * the dispatcher's fault upcall. Returns false if `addr` is no such page,
+ * or if the fault should go to the pager to refill the reserve.
+ */
+bool paging_cow_fault_disabled(dispatcher_handle_t handle, lvaddr_t addr, bool disabled);
 
 /**
  * refill slab allocator without causing a page fault
@@ -127,12 +241,19 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
 errval_t slab_refill_no_pagefault(struct slab_allocator *slabs, struct capref frame, size_t minbytes);
 
 /**
- * \brief unmap region starting at address `region`.
- * NOTE: this function is currently here to make libbarrelfish compile. As
- * noted on paging_region_unmap we ignore unmap requests right now.
+ * \brief unmap the block starting at address `region` and free its virtual
+ * address space. Frames mapped by the pagefault handler go back to init,
+ * frames provided by the user stay with the user.
  */
 errval_t paging_unmap(struct paging_state *st, const void *region);
 
+/**
+ * \brief unmap and free all pages in [base, base + bytes), e.g. to give
+ * heap memory back. Mapped blocks that only partly overlap the range are
+ * left alone.
+ */
+errval_t paging_free_range(struct paging_state *st, lvaddr_t base, size_t bytes);
+
 
 /// Map user provided frame while allocating VA space for it
 static inline errval_t paging_map_frame(struct paging_state *st, void **buf,
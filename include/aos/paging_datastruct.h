@@ -15,22 +15,52 @@ struct paging_region {
 enum virtual_block_type {
     VirtualBlock_Free,
     VirtualBlock_Allocated,
-    VirtualBlock_Paged
+    VirtualBlock_Paged,
+    VirtualBlock_Unmapping  // Paged block whose mappings are going away
 };
 
 /*************************************
  * Data structure for storing mem blocks
  *************************************/
 
+struct paging_state;
+
+#ifdef PAGING_STORE_AS_LIST
+/// Intrusive AVL links, one set per index a block can be part of
+struct vm_block_link {
+    struct vm_block* left;
+    struct vm_block* right;
+    int height;
+};
+#endif
+
+/// A frame (or part of one) mapped into a single L2 table or L1 section
+struct vm_mapping {
+    struct vm_mapping* next;
+    lvaddr_t vaddr;
+    size_t bytes;
+    struct capref mapping;  // Mapping cap from vnode_map
+    struct capref frame;    // Only kept if owned
+    struct capref ram;      // RAM cap the frame was retyped from, if owned
+    bool owned;             // Allocated by the pager: freed on unmap
+    bool section;
+};
+
+/*
+ * NOTE: With PAGING_STORE_AS_LIST, `type` and `size` are keys of the free
+ * index. Change them with vm_block_set_type/vm_block_set_size only.
+ */
 struct vm_block {
     enum virtual_block_type type;
     size_t size;
     int map_flags;  // Only needed when lazy-allocated
-    struct capref mapping;
+    struct vm_mapping* mappings;    // Only for Paged blocks
 #ifdef PAGING_STORE_AS_LIST
     struct vm_block* next;
     struct vm_block* prev;
     lvaddr_t start_address;
+    struct vm_block_link addr_link; // All blocks, keyed by start_address
+    struct vm_block_link free_link; // Free blocks, keyed by (size, start_address)
 #endif
 };
 
@@ -38,10 +68,27 @@ struct vm_block {
 #ifdef PAGING_STORE_AS_LIST
 
 typedef struct vm_block* vm_block_key_t;
-typedef struct vm_block* vm_block_struct_t;
+
+/*
+ * Blocks are kept in an address-ordered list (for O(1) neighbour merges),
+ * indexed by two AVL trees: every block by address for find_block_before,
+ * and free blocks by size for best-fit find_free_block_with_size.
+ */
+typedef struct vm_block_struct
+{
+    struct vm_block* head;
+    struct vm_block* addr_root;
+    struct vm_block* free_root;
+    size_t num_blocks;
+    size_t num_free;
+    bool self_check;    // Verify all indices on CHECK_DATA_CORRECTNESS
+} vm_block_struct_t;
 
 #define ADDRESS_FROM_VM_BLOCK_KEY(key) (key->start_address)
-#define CHECK_DATA_CORRECTNESS(st, verbose)
+void vm_block_check_correctness(struct paging_state* st, bool verbose);
+void vm_block_set_self_check(struct paging_state* st, bool enable);
+#define CHECK_DATA_CORRECTNESS(st, verbose) {if ((st)->blocks.self_check) \
+    vm_block_check_correctness(st, verbose);}
 #define PAGING_SLAB_REFILL(st)
 #endif
 
@@ -75,7 +122,6 @@ void check_tree_correctness(struct bpt_node* root, bool verbose);
     aos_slab_refill(&st->blocks.slab_nodes);}
 #endif
 
-struct paging_state;
 struct vm_block* find_free_block_with_size(struct paging_state *st, size_t min_size, vm_block_key_t* key);
 
 struct vm_block* find_block_before(struct paging_state *st,
@@ -84,6 +130,8 @@ struct vm_block* add_block_after(struct paging_state *st, vm_block_key_t origina
     lvaddr_t ad_address, vm_block_key_t* new_key);
 struct vm_block* create_root(struct paging_state* st, size_t start_address);
 void vm_block_merge_free_neighbors(struct paging_state* st, vm_block_key_t virtual_addr);
+void vm_block_set_type(struct paging_state* st, struct vm_block* block, enum virtual_block_type type);
+void vm_block_set_size(struct paging_state* st, struct vm_block* block, size_t size);
 
 
 #endif
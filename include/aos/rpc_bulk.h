@@ -0,0 +1,51 @@
+/**
+ * \file
+ * \brief Byte rings on an aos_rpc session's shared buffer
+ */
+
+#ifndef _LIB_BARRELFISH_AOS_RPC_BULK_H
+#define _LIB_BARRELFISH_AOS_RPC_BULK_H
+
+#include <aos/aos.h>
+
+/*
+ * The shared buffer of a session holds two single-producer/single-consumer
+ * byte rings: client -> server first, then server -> client. LMP only
+ * carries the doorbell: opcode, RPC_FLAG_BULK and the number of bytes just
+ * written. Payloads larger than a ring go in ring-sized chunks, flagged
+ * RPC_FLAG_INCOMPLETE until the last one. head and tail are byte offsets
+ * into the ring, each on its own cache line. Like struct urpc_ring, each
+ * side keeps its own index privately and only publishes it: the peer's
+ * index is checked against the ring size before it is used.
+ */
+
+#define RPC_BULK_CACHE_LINE 64
+
+struct rpc_bulk_shared
+{
+    volatile uint32_t head;         // Written by the producer only
+    char padding0[RPC_BULK_CACHE_LINE - sizeof(uint32_t)];
+    volatile uint32_t tail;         // Written by the consumer only
+    char padding1[RPC_BULK_CACHE_LINE - sizeof(uint32_t)];
+    char data[0];
+};
+
+struct rpc_bulk_ring
+{
+    struct rpc_bulk_shared* shared;
+    uint32_t size;
+    uint32_t head;                  // Producer's copy of shared->head
+    uint32_t tail;                  // Consumer's copy of shared->tail
+};
+
+struct rpc_bulk
+{
+    struct rpc_bulk_ring tx;        // We produce
+    struct rpc_bulk_ring rx;        // We consume
+};
+
+errval_t rpc_bulk_init(struct rpc_bulk* bulk, void* buffer, size_t bytes, bool is_client);
+errval_t rpc_bulk_write(struct rpc_bulk_ring* ring, const void* data, size_t len, size_t* written);
+errval_t rpc_bulk_read(struct rpc_bulk_ring* ring, void* data, size_t len, size_t* read);
+
+#endif
@@ -11,7 +11,9 @@ struct urpc_message
 {
     uint32_t opcode;
     uint32_t length; // Length of $data
-    void* data;
+    void* data;      // In the ring or the pool, valid until answered
+    bool in_pool;
+    bool keep;       // Set by the handler to own a pool buffer (see urpc_pool_return)
 };
 
 enum urpc_channel_type{
@@ -31,7 +33,7 @@ struct urpc_channel{
     struct urpc_buffer buffer_rcv;
 
     struct thread* server_thread;
-    bool server_stop_now;
+    volatile bool server_stop_now;
 
     struct urpc_message_closure* callbacks_table;
 };
@@ -44,5 +46,8 @@ errval_t urpc_server_register_handler(struct urpc_channel* channel, uint32_t opc
         urpc_callback_func_t message_handler, void* context);
 errval_t urpc_channel_init(struct urpc_channel* channel, void* fullbuffer, size_t length,
         enum urpc_channel_type, size_t callback_number);
+void urpc_channel_set_wait(struct urpc_channel* channel, enum urpc_wait_mode mode, uint32_t spin_cycles);
+errval_t urpc_channel_attach_pool(struct urpc_channel* channel, void* pool, size_t length,
+        enum urpc_channel_type channel_type);
 
 #endif
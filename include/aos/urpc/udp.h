@@ -7,6 +7,14 @@
 
 #define NS_NETWORKING_NAME "networking"
 
+/*
+ * A socket's frame holds the URPC rings, followed by a pool: the network
+ * controller unescapes received datagrams straight into pool pages, and
+ * the data handler gets a pointer into them.
+ */
+#define UDP_URPC_POOL_SIZE  (32 * BASE_PAGE_SIZE)
+#define UDP_URPC_FRAME_SIZE (URPC_DEFAULT_FRAME_SIZE + UDP_URPC_POOL_SIZE)
+
 struct __attribute__((packed)) udp_packet{
     uint16_t source_port;
     uint16_t dest_port;
@@ -20,6 +28,7 @@ struct udp_socket{
     uint32_t socket_id;
 };
 
+// $data is only valid until the handler returns
 typedef void (*udp_packet_received_handler)(struct udp_socket socket, uint32_t from, struct udp_packet* data, size_t len);
 typedef void (*udp_connection_created)(struct udp_socket socket);
 
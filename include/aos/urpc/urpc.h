@@ -2,32 +2,154 @@
 #define _HEADER_INIT_URPC
 
 #include <aos/aos.h>
+#include <aos/waitset.h>
+
+/*
+ * A URPC buffer holds two single-producer/single-consumer rings on shared
+ * memory: requests (client -> server) and replies (server -> client).
+ * Each ring is an array of cache-line sized slots. A message takes as many
+ * consecutive slots as it needs and starts with a urpc_slot_header. The
+ * producer and consumer indices live on cache lines of their own, so the
+ * two cores only exchange the lines they actually hand over.
+ * Every request carries a tag that the server copies into its answer, so
+ * a server may answer out of order (see urpc_server_defer) and a client
+ * may have many requests in flight (see urpc_client_send_async).
+ * An all-zero buffer is a valid pair of empty rings.
+ */
+
+/// Cache line size of the Cortex-A9, also the size of one ring slot
+#define URPC_CACHE_LINE 64
+#define URPC_SLOT_SIZE URPC_CACHE_LINE
+
+/// Frame size for channels that carry more than short control messages
+#define URPC_DEFAULT_FRAME_SIZE (4 * BASE_PAGE_SIZE)
 
 enum urpc_buffer_status
 {
-    URPC_NO_DATA,
+    URPC_NO_DATA,              // Padding up to the end of the ring
     URPC_CLIENT_SENT_DATA,
     URPC_SERVER_REPLIED_DATA,
     URPC_SERVER_REPLIED_ERROR,
 };
 
-struct urpc_buffer_data
+struct urpc_slot_header
 {
-    volatile uint32_t status;
-    size_t data_len;
+    uint32_t status;        // enum urpc_buffer_status
+    uint32_t num_slots;     // Slots taken by this message, header included
     uint32_t opcode;
+    uint32_t tag;           // Chosen by the client, copied into the answer
+    uint32_t flags;         // URPC_FLAG_*
+    uint32_t data_len;
     char data[0];
 };
 
-#define URPC_BUF_HEADER_LENGTH (sizeof(struct urpc_buffer_data))
-#define URPC_MAX_DATA_SIZE(buf) (buf->buffer_len - URPC_BUF_HEADER_LENGTH)
+/// The message data is a urpc_desc pointing into the sender's pool
+#define URPC_FLAG_DESC 0x1
+
+/*
+ * Payloads too big for the ring go through a pool of pages on shared
+ * memory. The producer allocates pages and writes the payload in place,
+ * the ring only carries an (offset, length) descriptor, and the consumer
+ * hands the pages back with urpc_pool_return once it is done with them.
+ * Each page has a state byte: only the producer sets it, only the consumer
+ * clears it.
+ */
+struct urpc_desc
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct urpc_pool
+{
+    volatile uint8_t* used;
+    char* pages;
+    uint32_t num_pages;
+    uint32_t next;          // Producer: first page of the next search
+};
+
+struct urpc_ring_index
+{
+    volatile uint32_t value;
+    char padding[URPC_CACHE_LINE - sizeof(uint32_t)];
+};
+
+struct urpc_ring_shared
+{
+    struct urpc_ring_index head;    // Written by the producer only
+    struct urpc_ring_index tail;    // Written by the consumer only
+    char slots[0];
+};
+
+struct urpc_ring
+{
+    struct urpc_ring_shared* shared;
+    uint32_t num_slots;
+    uint32_t head;                  // Producer's copy of shared->head
+    uint32_t tail;                  // Consumer's copy of shared->tail
+};
+
+/*
+ * How a thread waits for the other core. Spinning polls the ring with
+ * thread_yield. Parking blocks the thread on a polled channel of the
+ * dispatcher (CHANTYPE_UMP_IN): the ring is then checked once per dispatch,
+ * from poll_channels_disabled, and the thread costs nothing until it is woken.
+ */
+enum urpc_wait_mode
+{
+    URPC_WAIT_SPIN,
+    URPC_WAIT_ADAPTIVE,     // Spin for spin_cycles, then park
+    URPC_WAIT_PARK,
+};
+
+#define URPC_DEFAULT_SPIN_CYCLES 100000
+
+#define URPC_BUF_HEADER_LENGTH (sizeof(struct urpc_slot_header))
+#define URPC_MAX_DATA_SIZE(buf) ((buf)->requests.num_slots * URPC_SLOT_SIZE - URPC_BUF_HEADER_LENGTH)
+
+struct urpc_future;
 
 struct urpc_buffer
 {
     bool is_server;
     size_t buffer_len;
-    struct thread_mutex buff_lock;
-    struct urpc_buffer_data* buffer;
+    struct thread_mutex buff_lock;      // Ring we produce, pending requests
+    struct urpc_ring requests;
+    struct urpc_ring replies;
+    struct urpc_pool request_pool;      // Allocated by the client
+    struct urpc_pool reply_pool;        // Allocated by the server
+    struct urpc_slot_header* current;   // Server: request being served
+    uint32_t next_tag;                  // Client: tag of the next request
+    struct urpc_future* pending;        // Client: requests waiting for an answer
+    struct thread* pump_thread;         // Client: completes futures with a closure
+    volatile bool pump_stop;
+    struct thread_mutex chunk_lock;     // Client: held from first to final chunk
+    char* chunk_data;
+    size_t chunk_len;
+    errval_t chunk_err;                 // First failed chunk, returned by the final one
+    enum urpc_wait_mode wait_mode;
+    uint32_t spin_cycles;
+    uint32_t parks;                     // Times a thread had to park
+};
+
+/**
+ * An outstanding request. If the answer buffer is NULL with size 0, the
+ * answer is malloc'ed and the caller frees $answer, unless the server
+ * answered with a pool buffer: then $answer points into the pool.
+ * A future given a closure must stay valid until the closure has run.
+ */
+struct urpc_future
+{
+    struct urpc_buffer* urpc;
+    struct urpc_future* next;
+    uint32_t tag;
+    volatile bool done;
+    errval_t err;
+    void* answer;
+    size_t answer_size;
+    size_t answer_len;
+    bool answer_in_pool;                // Malloc mode only: return with urpc_pool_return
+    struct waitset_chanstate chan;      // Triggered once the answer is in
 };
 
 errval_t urpc_server_init(struct urpc_buffer* urpc, void* fullbuffer, size_t length);
@@ -40,7 +162,52 @@ errval_t urpc_server_answer(struct urpc_buffer* urpc, void* data, size_t len);
 errval_t urpc_server_answer_error(struct urpc_buffer* urpc, errval_t error);
 errval_t urpc_server_dummy_answer_if_need(struct urpc_buffer* urpc);
 
-//Transaction sending
+//Waiting: choose how threads wait for this buffer (ADAPTIVE by default).
+//urpc_buffer_wait returns once the ring we read from has data, or *$done
+//is set (may be NULL).
+void urpc_buffer_set_wait(struct urpc_buffer* urpc, enum urpc_wait_mode mode, uint32_t spin_cycles);
+void urpc_buffer_wait(struct urpc_buffer* urpc, volatile bool* done);
+bool urpc_doorbell_poll(struct waitset_chanstate* chan);
+
+//Asynchronous sending: returns as soon as the request is in the ring.
+//If $ws is given, $closure runs on it once the answer is in, otherwise
+//wait with urpc_future_wait.
+errval_t urpc_client_send_async(struct urpc_buffer* urpc, uint32_t opcode, void* data, size_t len,
+        void* answer, size_t answer_size, struct urpc_future* future,
+        struct waitset* ws, struct event_closure closure);
+errval_t urpc_future_wait(struct urpc_future* future);
+//Stops and joins the thread that runs the closures, if there is one.
+//Answers still outstanding are completed by the next urpc_future_wait.
+errval_t urpc_client_stop_pump(struct urpc_buffer* urpc);
+
+//Deferred answers: take the tag of the current request, answer it later
+//(possibly from another thread). The message data is not kept.
+errval_t urpc_server_defer(struct urpc_buffer* urpc, uint32_t* tag);
+errval_t urpc_server_answer_tag(struct urpc_buffer* urpc, uint32_t tag, void* data, size_t len);
+errval_t urpc_server_answer_error_tag(struct urpc_buffer* urpc, uint32_t tag, errval_t error);
+
+//Shared pool: urpc_buffer_attach_pool must be called on both sides with
+//the same region. Payloads are allocated with urpc_{client,server}_alloc,
+//filled in place and sent as a descriptor. The receiver owns the buffer
+//until it calls urpc_pool_return.
+errval_t urpc_buffer_attach_pool(struct urpc_buffer* urpc, void* pool, size_t length);
+errval_t urpc_client_alloc(struct urpc_buffer* urpc, size_t bytes, void** buf);
+errval_t urpc_server_alloc(struct urpc_buffer* urpc, size_t bytes, void** buf);
+void urpc_pool_return(struct urpc_buffer* urpc, void* buf, size_t bytes);
+errval_t urpc_client_send_desc_async(struct urpc_buffer* urpc, uint32_t opcode, void* buf, size_t len,
+        void* answer, size_t answer_size, struct urpc_future* future,
+        struct waitset* ws, struct event_closure closure);
+errval_t urpc_client_send_desc_receive_fixed_size(struct urpc_buffer* urpc, uint32_t opcode, void* buf, size_t len,
+        void* answer, size_t answer_size, size_t* actual_answer_size);
+errval_t urpc_server_answer_desc(struct urpc_buffer* urpc, void* buf, size_t len);
+
+//Zero-copy receive: $data points into the ring, or into the pool if
+//$in_pool. Ring data stays valid until the request is answered or deferred.
+errval_t urpc_server_peek(struct urpc_buffer* urpc, void** data, size_t* datalen, uint32_t* opcode,
+        bool* in_pool, bool* has_data);
+
+//Transaction sending: the final chunk must always be sent, it ends the
+//transaction and returns the error of any chunk that failed.
 errval_t urpc_client_send_chunck(struct urpc_buffer* urpc, void* data, size_t len, bool first_chunck);
 errval_t urpc_client_send_final_chunck_receive_fixed_size(struct urpc_buffer* urpc, uint32_t opcode,
         void* data, size_t len, void* answer, size_t answer_size, size_t* actual_answer_size);
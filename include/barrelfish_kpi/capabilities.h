@@ -450,6 +450,7 @@ enum dispatcher_cmd {
     DispatcherCmd_Vmwrite,          ///< Execute vmwrite on the current and active VMCS
     DispatcherCmd_Vmptrld,          ///< Make VMCS clear and inactive
     DispatcherCmd_Vmclear,          ///< Make VMCS current and active 
+    DispatcherCmd_GetStats,         ///< Read CPU accounting of dispatcher
 };
 
 /**
@@ -561,6 +562,15 @@ struct frame_identity {
     gensize_t  bytes;  ///< Size of frame, in bytes
 };
 
+/**
+ * \brief Values returned from the dispatcher stats invocation
+ */
+struct dispatcher_stats {
+    uint64_t cpu_time;      ///< Time spent running, in timestamp ticks
+    uint32_t cpu_freq;      ///< Timestamp ticks per second
+    uint32_t dispatches;    ///< Number of times the dispatcher was switched to
+};
+
 /**
  * \brief Values returned from the VNode identify invocation
  */
@@ -2,6 +2,7 @@
 #define _LIBC_K_R_MALLOC_H_
 
 #include <sys/cdefs.h>
+#include <stddef.h>
 
 __BEGIN_DECLS
 
@@ -21,7 +22,8 @@ union header {			/* block header */
 typedef union header Header;
 
 Header  *morecore(unsigned nu);
-void lesscore(void);
+void *lesscore(size_t *bytes);
+void lesscore_release(void *base, size_t bytes);
 void __free_locked(void *ap);
 void __malloc_init(void*, void*);
 
@@ -31,6 +31,18 @@ enum nodetype {
     NodeType_Allocated  ///< This region exists and is allocated
 };
 
+/**
+ * \brief Strategy used by mm_alloc_aligned() and mm_free() to find nodes
+ */
+enum mm_search_policy {
+    MM_SEARCH_INDEXED,  ///< Segregated free bins + address-ordered AVL tree
+    MM_SEARCH_LINEAR,   ///< First-fit walk of the node list (legacy)
+};
+
+/// Number of power-of-two free bins. Bin i holds free nodes whose size is in
+/// [2^(BASE_PAGE_BITS+i), 2^(BASE_PAGE_BITS+i+1)), the last bin holds the rest.
+#define MM_NUM_BINS 32
+
 struct capinfo {
     struct capref cap;
     genpaddr_t base;
@@ -47,6 +59,12 @@ struct mmnode {
     struct mmnode *next;   ///< Next node in the list.
     genpaddr_t base;       ///< Base address of this region
     gensize_t size;        ///< Size of this free region in cap
+
+    struct mmnode *bin_prev;   ///< Previous free node in the same size bin
+    struct mmnode *bin_next;   ///< Next free node in the same size bin
+    struct mmnode *tree_left;  ///< Address index: nodes with a lower base
+    struct mmnode *tree_right; ///< Address index: nodes with a higher base
+    int tree_height;           ///< Address index: height of this subtree
 };
 
 /**
@@ -63,6 +81,11 @@ struct mm {
     enum objtype objtype;        ///< Type of capabilities stored
     struct mmnode *head;         ///< Head of doubly-linked list of nodes in order
     struct thread_mutex nodes_lock;
+
+    enum mm_search_policy policy;            ///< How nodes are looked up
+    struct mmnode *bins[MM_NUM_BINS];        ///< Segregated lists of free nodes
+    uint32_t bins_map;                       ///< Bit i set iff bins[i] is not empty
+    struct mmnode *tree_root;                ///< AVL tree of all nodes, keyed by base
 };
 
 #define LIBMM_STRUCT_LOCK(st) { thread_mutex_lock_nested(&(st)->nodes_lock);}
@@ -78,6 +101,7 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment,
                               struct capref *retcap);
 errval_t mm_alloc(struct mm *mm, size_t size, struct capref *retcap);
 errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t size);
+void mm_set_search_policy(struct mm *mm, enum mm_search_policy policy);
 void mm_print_nodes(struct mm *mm);
 void mm_destroy(struct mm *mm);
 
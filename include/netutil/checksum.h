@@ -38,7 +38,21 @@
 
 /**
  * Calculate the internet checksum according to RFC1071
+ *
+ * Sums the data a word at a time (with NEON where the compiler enables
+ * it), at any alignment. The result is in network order.
  */
 uint16_t inet_checksum(void *dataptr, uint16_t len);
 
+/**
+ * Patch $checksum for a 16 bit field that changed from $old_value to
+ * $new_value, according to RFC1624. Fields are taken as they are in memory.
+ */
+uint16_t inet_checksum_update16(uint16_t checksum, uint16_t old_value, uint16_t new_value);
+
+/**
+ * Same as inet_checksum_update16, for a 32 bit field such as an address
+ */
+uint16_t inet_checksum_update32(uint16_t checksum, uint32_t old_value, uint32_t new_value);
+
 #endif
@@ -28,11 +28,25 @@
 #define UART4_IRQ (32+70)
 
 
+struct serial_stats {
+    uint32_t rx_bytes;
+    uint32_t rx_batches;        ///< serial_input calls
+    uint32_t rx_fifo_overruns;  ///< Bytes lost because the RX FIFO was full
+    uint32_t tx_bytes;
+    uint32_t tx_ring_full;      ///< Times serial_write waited for the TX ring
+};
+
 /**
- * Blocking write to serial port.
+ * Queues bytes for the THR interrupt to send. Only blocks while the
+ * transmit ring is full. Not thread-safe: callers serialize writes.
  */
 void serial_write(uint8_t *buf, size_t len);
 
+/**
+ * Copies the driver's counters.
+ */
+void serial_get_stats(struct serial_stats *ret);
+
 /**
  * Initialize UART. Device frame must be mapped
  * at address vbase.
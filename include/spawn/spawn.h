@@ -44,6 +44,7 @@ struct spawninfo {
 
     lvaddr_t got;
     genvaddr_t child_entry_point;
+    lvaddr_t cow_table;     // Copy-on-write table, in the child's vspace
 
     struct child_slot_allocator slot_alloc;
 
@@ -58,6 +59,9 @@ struct spawninfo {
     arch_registers_state_t* enabled_area;
 
     coreid_t core_id;
+
+    // RAM allocated for the child, not counting the shared image
+    size_t ram_bytes;
 };
 
 /*
@@ -15,6 +15,29 @@
 #include <kernel.h>
 #include <dispatch.h>
 #include <paging_kernel_arch.h>
+#include <platform.h>
+
+/// Timestamp at which dcb_current was last charged
+static uint64_t dispatch_last_timestamp;
+
+/**
+ * \brief Charge the time since the last switch to 'dcb_current'.
+ *
+ * Called whenever the core switches to 'next', or goes idle if 'next' is NULL.
+ * Time spent idle is not charged to anybody.
+ */
+void
+dispatch_account(struct dcb *next) {
+    uint64_t now = timestamp_read();
+
+    if (dcb_current != NULL) {
+        dcb_current->cpu_time += now - dispatch_last_timestamp;
+    }
+    if (next != NULL) {
+        next->dispatches++;
+    }
+    dispatch_last_timestamp = now;
+}
 
 /**
  * \brief Switch context to 'dcb'.
@@ -24,7 +24,8 @@
 
 void handle_user_page_fault(lvaddr_t fault_address,
                             arch_registers_state_t* save_area,
-                            struct dispatcher_shared_arm *disp)
+                            struct dispatcher_shared_arm *disp,
+                            uint32_t dfsr)
 {
     // XXX
     // Set dcb_current->disabled correctly.  This should really be
@@ -57,6 +58,12 @@ void handle_user_page_fault(lvaddr_t fault_address,
 
     if (dcb_current->disabled) {
         handler = disp->d.dispatcher_pagefault_disabled;
+        // The dispatcher resolves some disabled faults (copy-on-write),
+        // only faulting again on the same address means it is stuck
+        if (fault_address != dcb_current->last_disabled_fault) {
+            dcb_current->last_disabled_fault = fault_address;
+            dcb_current->faults_taken = 0;
+        }
         dcb_current->faults_taken++;
     } else {
         handler = disp->d.dispatcher_pagefault;
@@ -83,7 +90,7 @@ void handle_user_page_fault(lvaddr_t fault_address,
         resume_area.named.pc   = handler;
         resume_area.named.r0   = disp->d.udisp;
         resume_area.named.r1   = fault_address;
-        resume_area.named.r2   = 0;
+        resume_area.named.r2   = dfsr;
         resume_area.named.r3   = saved_pc;
         resume_area.named.r9   = disp->got_base;
 
@@ -862,6 +862,28 @@ static struct sysret dispatcher_dump_capabilities(struct capability *cap,
     return SYSRET(err);
 }
 
+static struct sysret dispatcher_get_stats(struct capability *cap,
+        arch_registers_state_t* context, int argc)
+{
+    assert(cap->type == ObjType_Dispatcher);
+    assert(3 == argc);
+
+    struct registers_arm_syscall_args* sa = &context->syscall_args;
+    struct dcb *dispatcher = cap->u.dispatcher.dcb;
+    struct dispatcher_stats *stats = (struct dispatcher_stats *)sa->arg2;
+
+    if(!access_ok(ACCESS_WRITE, (lvaddr_t)stats, sizeof(struct dispatcher_stats))) {
+        return SYSRET(SYS_ERR_INVALID_USER_BUFFER);
+    }
+
+    /* The running dispatcher has not been charged for its current slice */
+    stats->cpu_time = dispatcher->cpu_time;
+    stats->cpu_freq = timestamp_freq();
+    stats->dispatches = dispatcher->dispatches;
+
+    return SYSRET(SYS_ERR_OK);
+}
+
 static struct sysret handle_idcap_identify(struct capability *to,
                                            arch_registers_state_t *context,
                                            int argc)
@@ -965,7 +987,8 @@ static invocation_t invocations[ObjType_Num][CAP_MAX_CMD] = {
         [DispatcherCmd_Properties]  = handle_dispatcher_properties,
         [DispatcherCmd_PerfMon]     = handle_dispatcher_perfmon,
         [DispatcherCmd_DumpPTables]  = dispatcher_dump_ptables,
-        [DispatcherCmd_DumpCapabilities] = dispatcher_dump_capabilities
+        [DispatcherCmd_DumpCapabilities] = dispatcher_dump_capabilities,
+        [DispatcherCmd_GetStats] = dispatcher_get_stats
     },
     [ObjType_KernelControlBlock] = {
         [FrameCmd_Identify] = handle_kcb_identify,
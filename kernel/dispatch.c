@@ -139,6 +139,7 @@ void __attribute__ ((noreturn)) dispatch(struct dcb *dcb)
     // XXX FIXME: Why is this null pointer check on the fast path ?
     // If we have nothing to do we should call something other than dispatch
     if (dcb == NULL) {
+        dispatch_account(NULL);
         dcb_current = NULL;
 #if defined(__x86_64__) || defined(__i386__) || defined(__k1om__)
         // Can this be moved into wait_for_interrupt?
@@ -152,6 +153,7 @@ void __attribute__ ((noreturn)) dispatch(struct dcb *dcb)
 
     // Don't context switch if we are current already
     if (dcb_current != dcb) {
+        dispatch_account(dcb);
         context_switch(dcb);
         dcb_current = dcb;
     }
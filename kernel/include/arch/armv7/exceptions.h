@@ -29,12 +29,14 @@ extern uint32_t exception_vectors[8];
 
 /**
  * Handle page fault in user-mode process.
+ * dfsr is the data fault status of a data abort, 0 for a prefetch abort.
  *
  * This function should be called in SVC mode with interrupts disabled.
  */
 void handle_user_page_fault(lvaddr_t                fault_address,
                             arch_registers_state_t* saved_context,
-			    struct dispatcher_shared_arm *disp)
+			    struct dispatcher_shared_arm *disp,
+                            uint32_t                dfsr)
     __attribute__((noreturn));
 
 /**
@@ -43,12 +43,15 @@ struct dcb {
     lpaddr_t            vspace;         ///< Address of VSpace root
     struct cte          disp_cte;
     unsigned int        faults_taken;   ///< # of disabled faults or traps taken
+    lvaddr_t            last_disabled_fault; ///< Address of the last disabled fault
     /// Indicates whether this domain shall be executed in VM guest mode
     bool                is_vm_guest;
     struct guest        guest_desc;     ///< Descriptor of the VM Guest
     uint64_t            domain_id;      ///< ID of dispatcher's domain
     systime_t           wakeup_time;    ///< Time to wakeup this dispatcher
     struct dcb          *wakeup_prev, *wakeup_next; ///< Next/prev in timeout queue
+    uint64_t            cpu_time;       ///< Timestamp ticks spent running
+    uint32_t            dispatches;     ///< # of times switched to
 
     struct dcb          *next;          ///< Next DCB in schedule
     struct dcb          *prev;          ///< Previous DCB in schedule
@@ -74,6 +77,7 @@ void fpu_lazy_bottom(struct dcb *dcb);
 #endif
 
 void context_switch(struct dcb *dcb);
+void dispatch_account(struct dcb *next);
 
 /// The currently running dispatcher and FPU dispatcher
 extern struct dcb *dcb_current, *fpu_dcb;
@@ -28,50 +28,148 @@
 
 const size_t LMP_MAX_BUFF_SIZE=8*sizeof(uintptr_t);
 
+/*
+ * Appends the chunk the client just wrote to the bulk request being
+ * received. The buffer keeps a byte for a terminating NUL.
+ */
 static
-void cb_accept_loop(void* args)
+errval_t bulk_receive(struct aos_rpc_session* cs, size_t chunk)
 {
-    struct aos_rpc_session* cs=(struct aos_rpc_session*)args;
-    errval_t err;
+    if (!cs->shared_buffer_size)
+        return RPC_ERR_SHARED_BUF_EMPTY;
 
-    struct lmp_recv_msg message = LMP_RECV_MSG_INIT;
-    struct capref received_cap=NULL_CAP;
+    if (cs->bulk_in_len + chunk + 1 > cs->bulk_in_size)
+    {
+        size_t size = MAX(2 * cs->bulk_in_size, cs->bulk_in_len + chunk + 1);
+        char* grown = realloc(cs->bulk_in, size);
+        if (!grown)
+            return LIB_ERR_MALLOC_FAIL;
+        cs->bulk_in = grown;
+        cs->bulk_in_size = size;
+    }
+    size_t read;
+    ERROR_RET1(rpc_bulk_read(&cs->bulk.rx, cs->bulk_in + cs->bulk_in_len, chunk, &read));
+    ASSERT_PROTOCOL(read == chunk);
+    cs->bulk_in_len += chunk;
+    cs->bulk_in[cs->bulk_in_len] = 0;
+    return SYS_ERR_OK;
+}
 
-    lmp_chan_recv(&cs->lc, &message, &received_cap);
+/*
+ * Writes the next chunk of the pending bulk answer into *$chunk bytes.
+ * *$flags gets RPC_FLAG_INCOMPLETE if more remain. On failure the answer
+ * is dropped.
+ */
+static
+errval_t bulk_send_answer(struct aos_rpc_session* cs, uint32_t* flags, size_t* chunk)
+{
+    errval_t err = rpc_bulk_write(&cs->bulk.tx, cs->bulk_out + cs->bulk_out_sent,
+        cs->bulk_out_len - cs->bulk_out_sent, chunk);
+    if (err_is_fail(err))
+    {
+        free(cs->bulk_out);
+        cs->bulk_out = NULL;
+        return err;
+    }
+    cs->bulk_out_sent += *chunk;
+    *flags |= RPC_FLAG_BULK;
+    if (cs->bulk_out_sent < cs->bulk_out_len)
+        *flags |= RPC_FLAG_INCOMPLETE;
+    else
+    {
+        free(cs->bulk_out);
+        cs->bulk_out = NULL;
+    }
+    return SYS_ERR_OK;
+}
+
+/*
+ * Runs the handler of a received message and sends the ack
+ */
+static
+void handle_message(struct aos_rpc_session* cs, struct lmp_recv_msg* msg, struct capref received_cap)
+{
+    errval_t err;
+    struct lmp_recv_msg message = *msg;
 
     uint32_t return_opcode = RPC_NULL_OPCODE;
     uint32_t return_flags = RPC_FLAG_ACK;
     bool send_ack = true;
 
     uint32_t message_opcode=RPC_HEADER_OPCODE(message.words[0]);
+    uint32_t message_flags=RPC_HEADER_FLAGS(message.words[0]);
 
     struct aos_rpc_message_handler_closure closure=cs->rpc->aos_rpc_message_handler_closure[message_opcode];
     struct capref ret_cap=NULL_CAP;
 
-    if(closure.message_handler!=NULL){
+    bool call_handler = true;
+    if (message_opcode == RPC_BULK_CONTINUE)
+    {
+        // The client wants the next chunk of the answer
+        call_handler = false;
+        return_opcode = RPC_BULK_CONTINUE;
+        err = cs->bulk_out ? SYS_ERR_OK : RPC_ERR_INVALID_PROTOCOL;
+    }
+    else if (message_flags & RPC_FLAG_BULK)
+    {
+        // Chunks of a longer request are only acked
+        err = bulk_receive(cs, message.words[1]);
+        if (err_is_fail(err) || (message_flags & RPC_FLAG_INCOMPLETE))
+        {
+            call_handler = false;
+            return_opcode = message_opcode;
+        }
+    }
+
+    if (!call_handler){
+        if (err_is_fail(err))
+        {
+            cs->bulk_in_len = 0;
+            return_flags = RPC_FLAG_ERROR;
+        }
+    }else if(closure.message_handler!=NULL){
         err=closure.message_handler(cs, &message, received_cap, closure.args, &ret_cap, &return_opcode, &return_flags);
         if (!closure.send_ack && !err_is_fail(err))
             send_ack = false;
 
         if(err_is_fail(err))
             return_flags = RPC_FLAG_ERROR;
+        cs->bulk_in_len = 0;
     }else{
         debug_printf("Callback not registered, sending error\n");
 
         err = RPC_ERR_SERVICE_NOT_FOUND;
         return_flags = RPC_FLAG_ERROR;
+        cs->bulk_in_len = 0;
 
         //TODO: if someone sent cap, we have to free it
     }
 
+    if (err_is_fail(err) && cs->bulk_out)
+    {
+        free(cs->bulk_out);
+        cs->bulk_out = NULL;
+    }
+
     if (send_ack)
     {
         return_flags |= RPC_FLAG_ACK;
-        err = lmp_chan_send2(&cs->lc,
+        size_t chunk = 0;
+        if (cs->bulk_out)
+        {
+            errval_t bulk_err = bulk_send_answer(cs, &return_flags, &chunk);
+            if (err_is_fail(bulk_err))
+            {
+                err = bulk_err;
+                return_flags = RPC_FLAG_ACK | RPC_FLAG_ERROR;
+                chunk = 0;
+            }
+        }
+        err = lmp_chan_send3(&cs->lc,
             LMP_FLAG_SYNC,
             ret_cap,
             MAKE_RPC_MSG_HEADER(return_opcode, return_flags),
-            err);
+            err, chunk);
 
         if (err_is_fail(err))
             debug_printf("Response message not sent\n");
@@ -81,9 +179,114 @@ void cb_accept_loop(void* args)
         debug_printf("Capabilities changed, allocating new slot\n");
         lmp_chan_alloc_recv_slot(&cs->lc);
     }
+}
+
+static void cb_accept_loop(void* args);
+
+static
+void cb_worker_job(void* args)
+{
+    struct aos_rpc_session* cs=(struct aos_rpc_session*)args;
+    handle_message(cs, &cs->job_msg, cs->job_cap);
+    cs->worker->jobs++;
+    // Only now may the accept loop take the session's next request
+    lmp_chan_register_recv(&cs->lc, cs->rpc->ws, MKCLOSURE(cb_accept_loop, args));
+}
+
+static
+void cb_accept_loop(void* args)
+{
+    struct aos_rpc_session* cs=(struct aos_rpc_session*)args;
+
+    struct lmp_recv_msg message = LMP_RECV_MSG_INIT;
+    struct capref received_cap=NULL_CAP;
+
+    lmp_chan_recv(&cs->lc, &message, &received_cap);
+
+    // Bulk continuations and partial chunks are cheap, they stay inline
+    uint32_t message_opcode=RPC_HEADER_OPCODE(message.words[0]);
+    uint32_t message_flags=RPC_HEADER_FLAGS(message.words[0]);
+    if (cs->worker && cs->rpc->aos_rpc_message_handler_closure[message_opcode].slow &&
+        !(message_flags & RPC_FLAG_INCOMPLETE))
+    {
+        cs->job_msg = message;
+        cs->job_cap = received_cap;
+        errval_t err = waitset_chan_trigger_closure(&cs->worker->ws, &cs->job_chan,
+            MKCLOSURE(cb_worker_job, args));
+        if (err_is_ok(err))
+            return;
+        DEBUG_ERR(err, "handing request to worker, running it inline");
+    }
+
+    handle_message(cs, &message, received_cap);
     lmp_chan_register_recv(&cs->lc, cs->rpc->ws, MKCLOSURE(cb_accept_loop, args));
 }
 
+static
+int worker_loop(void* args)
+{
+    struct aos_rpc_worker* worker = args;
+    while (true)
+    {
+        errval_t err = event_dispatch(&worker->ws);
+        if (err_is_fail(err))
+        {
+            DEBUG_ERR(err, "in worker event_dispatch");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+errval_t aos_rpc_start_workers(struct aos_rpc* rpc, size_t count)
+{
+    if (rpc->workers || !count)
+        return RPC_ERR_INVALID_ARGUMENTS;
+
+    rpc->workers = calloc(count, sizeof(struct aos_rpc_worker));
+    if (!rpc->workers)
+        return LIB_ERR_MALLOC_FAIL;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        struct aos_rpc_worker* worker = &rpc->workers[i];
+        worker->rpc = rpc;
+        waitset_init(&worker->ws);
+        worker->thread = thread_create(worker_loop, worker);
+        if (!worker->thread)
+            return LIB_ERR_THREAD_CREATE;
+        rpc->num_workers++;
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t aos_rpc_set_handler_slow(struct aos_rpc* rpc, enum message_opcodes opcode, bool slow)
+{
+    rpc->aos_rpc_message_handler_closure[opcode].slow=slow;
+    return SYS_ERR_OK;
+}
+
+void aos_rpc_bulk_request(struct aos_rpc_session* sess, char** data, size_t* len)
+{
+    *data = sess->bulk_in_len ? sess->bulk_in : "";
+    *len = sess->bulk_in_len;
+}
+
+errval_t aos_rpc_bulk_reply(struct aos_rpc_session* sess, const void* data, size_t len)
+{
+    if (!sess->shared_buffer_size)
+        return RPC_ERR_SHARED_BUF_EMPTY;
+
+    free(sess->bulk_out);
+    sess->bulk_out = malloc(len);
+    if (!sess->bulk_out && len)
+        return LIB_ERR_MALLOC_FAIL;
+    memcpy(sess->bulk_out, data, len);
+    sess->bulk_out_len = len;
+    sess->bulk_out_sent = 0;
+    return SYS_ERR_OK;
+}
+
 static
 void cb_send_ready(void* args){
     struct aos_rpc_session *sess = args;
@@ -104,6 +307,28 @@ errval_t wait_for_send(struct aos_rpc_session* sess)
     return SYS_ERR_OK;
 }
 
+/*
+ * Sends right away and only goes through the waitset if the channel is
+ * busy (transient error): no send closure, no dispatch loop in the common
+ * case. Without sess->fast_path it waits for the channel first, as all
+ * calls used to. Evaluates to the error of the last attempt.
+ */
+#define RPC_SEND(sess, call) \
+    ({ \
+        errval_t _send_err = (sess)->fast_path ? (call) : wait_for_send(sess); \
+        if (!(sess)->fast_path && err_is_ok(_send_err)) \
+            _send_err = (call); \
+        while (err_is_fail(_send_err) && lmp_err_is_transient(_send_err)) { \
+            _send_err = wait_for_send(sess); \
+            if (err_is_ok(_send_err)) \
+                _send_err = (call); \
+        } \
+        _send_err; \
+    })
+
+/// Directed yields to the server before recv_block falls back to the waitset
+#define RPC_FAST_RECV_YIELDS 8
+
 struct recv_block_helper_struct
 {
     bool received;
@@ -144,9 +369,24 @@ errval_t recv_block(struct aos_rpc_session* sess,
     rb.sess = sess;
     rb.cap = cap;
 
-    ERROR_RET1(lmp_chan_register_recv(&sess->lc,
-            sess->rpc->ws,
-            MKCLOSURE(cb_recv_first, (void*)&rb)));
+    // Fast path: the answer is usually there once a LMP_FLAG_SYNC send
+    // returns. If not, give our timeslice to the server rather than
+    // registering a closure and spinning on the waitset.
+    for (int i = 0; sess->fast_path && i < RPC_FAST_RECV_YIELDS && !rb.received; ++i)
+    {
+        rb.err = lmp_chan_recv(&sess->lc, message, cap);
+        if (err_no(rb.err) == LIB_ERR_NO_LMP_MSG)
+            thread_yield_dispatcher(sess->lc.remote_cap);
+        else if (err_is_ok(rb.err) || !lmp_err_is_transient(rb.err))
+            rb.received = true;
+        else
+            break;
+    }
+
+    if (!rb.received)
+        ERROR_RET1(lmp_chan_register_recv(&sess->lc,
+                sess->rpc->ws,
+                MKCLOSURE(cb_recv_first, (void*)&rb)));
 
     while (!rb.received)
         ERROR_RET1(event_dispatch(sess->rpc->ws));
@@ -181,13 +421,11 @@ errval_t wait_for_ack(struct aos_rpc_session* sess)
     return wait_for_ack_with_message(sess, &message, &dummy_capref);
 }
 
-// Waits for send, sends and waits for ack
+// Sends and waits for ack
 #define RPC_CHAN_WRAPPER_SEND(rpc, call) \
     { \
-        reset_cycle_counter(); \
         assert(rpc->server_sess); \
-        ERROR_RET1(wait_for_send(rpc->server_sess)); \
-        errval_t _err = call; \
+        errval_t _err = RPC_SEND(rpc->server_sess, call); \
         if (err_is_fail(_err)) \
             DEBUG_ERR(_err, "Send failed in " __FILE__ ":%d", __LINE__); \
         ERROR_RET1(wait_for_ack(rpc->server_sess)); \
@@ -195,15 +433,98 @@ errval_t wait_for_ack(struct aos_rpc_session* sess)
 
 #define RPC_CHAN_WRAPPER_SEND_WITH_MESSAGE_RESPONSE(rpc, call, message, retcap) \
     { \
-        reset_cycle_counter(); \
         assert(rpc->server_sess); \
-        ERROR_RET1(wait_for_send(rpc->server_sess)); \
-        errval_t _err = call; \
+        errval_t _err = RPC_SEND(rpc->server_sess, call); \
         if (err_is_fail(_err)) \
             DEBUG_ERR(_err, "Send failed in " __FILE__ ":%d", __LINE__); \
         ERROR_RET1(wait_for_ack_with_message(rpc->server_sess, message, retcap)); \
     }
 
+/*
+ * Sends $len bytes of $data as the payload of $opcode, in chunks as large
+ * as the bulk ring. The server acks every chunk but the last one: its
+ * answer is left to the caller. $cap and $arg go with the last chunk.
+ */
+static
+errval_t bulk_call(struct aos_rpc_session* sess, uint32_t opcode, struct capref cap,
+        const char* data, size_t len, uintptr_t arg)
+{
+    if (!sess->shared_buffer_size)
+        return RPC_ERR_SHARED_BUF_EMPTY;
+
+    while (true)
+    {
+        // The server drains every chunk before its ack, so the ring is empty
+        size_t chunk;
+        ERROR_RET1(rpc_bulk_write(&sess->bulk.tx, data, len, &chunk));
+        data += chunk;
+        len -= chunk;
+
+        uint32_t flags = RPC_FLAG_BULK | (len ? RPC_FLAG_INCOMPLETE : 0);
+        ERROR_RET1(RPC_SEND(sess, lmp_chan_send3(&sess->lc,
+                LMP_FLAG_SYNC,
+                len ? NULL_CAP : cap,
+                MAKE_RPC_MSG_HEADER(opcode, flags),
+                chunk, arg)));
+        if (!len)
+            return SYS_ERR_OK;
+        ERROR_RET1(wait_for_ack(sess));
+    }
+}
+
+/*
+ * Reads the bulk answer that came with $message into a malloc'ed,
+ * NUL-terminated buffer, asking the server for the next chunk as long
+ * as the answer is incomplete. An answer without payload gives NULL.
+ */
+static
+errval_t bulk_collect(struct aos_rpc_session* sess, struct lmp_recv_msg* message,
+        char** data, size_t* len)
+{
+    *data = NULL;
+    *len = 0;
+
+    while (RPC_HEADER_FLAGS(message->words[0]) & RPC_FLAG_BULK)
+    {
+        size_t chunk = message->words[2];
+        char* grown = realloc(*data, *len + chunk + 1);
+        if (!grown)
+        {
+            free(*data);
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        *data = grown;
+        size_t read;
+        errval_t err = rpc_bulk_read(&sess->bulk.rx, *data + *len, chunk, &read);
+        if (err_is_ok(err) && read != chunk)
+            err = RPC_ERR_INVALID_PROTOCOL;
+        if (err_is_fail(err))
+        {
+            free(*data);
+            return err;
+        }
+        *len += chunk;
+        (*data)[*len] = 0;
+
+        if (!(RPC_HEADER_FLAGS(message->words[0]) & RPC_FLAG_INCOMPLETE))
+            break;
+
+        struct capref tmp_cap;
+        err = RPC_SEND(sess, lmp_chan_send1(&sess->lc,
+                LMP_FLAG_SYNC,
+                NULL_CAP,
+                RPC_BULK_CONTINUE));
+        if (err_is_ok(err))
+            err = recv_block(sess, message, &tmp_cap);
+        if (err_is_fail(err))
+        {
+            free(*data);
+            return err;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
 /*
  * sends a number over the channel
  */
@@ -221,19 +542,9 @@ errval_t aos_rpc_send_number(struct aos_rpc *rpc, uintptr_t val)
 errval_t aos_rpc_send_string(struct aos_rpc *rpc, const char *string)
 {
     assert(rpc->server_sess);
-    size_t size = strlen(string);
-    if (size > rpc->server_sess->shared_buffer_size)
-        return RPC_ERR_BUF_TOO_SMALL;
-
-    memcpy(rpc->server_sess->shared_buffer, string, size);
-
-    RPC_CHAN_WRAPPER_SEND(rpc,
-        lmp_chan_send2(&rpc->server_sess->lc,
-            LMP_FLAG_SYNC,
-            NULL_CAP,
-            RPC_STRING,
-            size));
-    return SYS_ERR_OK;
+    ERROR_RET1(bulk_call(rpc->server_sess, RPC_STRING, NULL_CAP,
+        string, strlen(string), 0));
+    return wait_for_ack(rpc->server_sess);
 }
 
 errval_t aos_rpc_create_server_socket(struct aos_rpc *rpc, struct capref shared_buffer, size_t port){
@@ -254,15 +565,16 @@ errval_t aos_connect_to_port(struct aos_rpc *rpc,
     uint32_t port,
     struct capref *retcap)
 {
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send2(&rpc->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send2(&rpc->server_sess->lc,
             LMP_FLAG_SYNC,
             NULL_CAP,
             RPC_CONNECT_TO_SOCKET,
-            port));
+            port)));
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
     ERROR_RET1(recv_block(rpc->server_sess, &message, retcap));
     ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_CONNECT_TO_SOCKET);
+    if (RPC_HEADER_FLAGS(message.words[0]) & RPC_FLAG_ERROR)
+        return message.words[1];
 
     return SYS_ERR_OK;
 }
@@ -270,12 +582,11 @@ errval_t aos_connect_to_port(struct aos_rpc *rpc,
 errval_t aos_rpc_get_special_capability(struct aos_rpc *rpc, enum aos_rpc_cap_type cap_type,
         struct capref *retcap){
 
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send2(&rpc->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send2(&rpc->server_sess->lc,
             LMP_FLAG_SYNC,
             NULL_CAP,
             RPC_SPECIAL_CAP_QUERY,
-            (uint32_t)cap_type));
+            (uint32_t)cap_type)));
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
     ERROR_RET1(recv_block(rpc->server_sess, &message, retcap));
     ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_SPECIAL_CAP_RESPONSE);
@@ -288,12 +599,11 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *rpc,
     struct capref *retcap,
     size_t *ret_bits)
 {
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send3(&rpc->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send3(&rpc->server_sess->lc,
             LMP_FLAG_SYNC,
             NULL_CAP,
             RPC_RAM_CAP_QUERY,
-            request_bits, alignment));
+            request_bits, alignment)));
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
     ERROR_RET1(recv_block(rpc->server_sess, &message, retcap));
     ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_RAM_CAP_RESPONSE);
@@ -301,15 +611,86 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *rpc,
     return SYS_ERR_OK;
 }
 
+errval_t aos_rpc_get_ram_cap_batch(struct aos_rpc *rpc,
+    size_t count,
+    size_t bytes,
+    size_t alignment,
+    struct capref *retcaps)
+{
+    if (!count || count > RPC_RAM_CAP_BATCH_MAX)
+        return RPC_ERR_INVALID_ARGUMENTS;
+
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send4(&rpc->server_sess->lc,
+            LMP_FLAG_SYNC,
+            NULL_CAP,
+            RPC_RAM_CAP_BATCH_QUERY,
+            count, bytes, alignment)));
+    // recv_block() allocates a fresh receive slot after every cap,
+    // the server retries until it is there.
+    for (size_t i = 0; i < count; ++i)
+    {
+        struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
+        retcaps[i] = NULL_CAP;
+        errval_t err = recv_block(rpc->server_sess, &message, &retcaps[i]);
+        if (err_is_ok(err) &&
+            (RPC_HEADER_OPCODE(message.words[0]) != RPC_RAM_CAP_BATCH_RESPONSE ||
+             message.words[2] != i))
+        {
+            debug_printf("RPC: Protocol error in RAM cap batch\n");
+            err = RPC_ERR_INVALID_PROTOCOL;
+        }
+        if (err_is_fail(err))
+        {
+            // Don't leave the caller with part of a batch
+            for (size_t j = 0; j <= i; ++j)
+                if (!capref_is_null(retcaps[j]))
+                    cap_destroy(retcaps[j]);
+            return err;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t aos_rpc_free_ram_cap(struct aos_rpc *rpc, struct capref cap, size_t bytes)
+{
+    RPC_CHAN_WRAPPER_SEND(rpc,
+        lmp_chan_send2(&rpc->server_sess->lc,
+            LMP_FLAG_SYNC,
+            cap,
+            RPC_RAM_CAP_FREE,
+            bytes));
+    return SYS_ERR_OK;
+}
+
+errval_t aos_rpc_get_ram_cache_stats(struct aos_rpc *rpc, struct aos_ram_cache_stats *stats)
+{
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send1(&rpc->server_sess->lc,
+            LMP_FLAG_SYNC,
+            NULL_CAP,
+            RPC_RAM_CACHE_STATS)));
+    struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
+    struct capref tmp_cap;
+    ERROR_RET1(recv_block(rpc->server_sess, &message, &tmp_cap));
+    ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_RAM_CACHE_STATS);
+    stats->hits = message.words[1];
+    stats->misses = message.words[2];
+    stats->refills = message.words[3];
+    stats->refilled_caps = message.words[4];
+    stats->frees_cached = message.words[5];
+    stats->frees_returned = message.words[6];
+    stats->cached_small = message.words[7];
+    stats->cached_large = message.words[8];
+    return SYS_ERR_OK;
+}
+
 errval_t aos_rpc_serial_getchar(struct aos_rpc *rpc, char *retc)
 {
     // TODO implement functionality to request a character from
     // the serial driver.
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send1(&rpc->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send1(&rpc->server_sess->lc,
             LMP_FLAG_SYNC,
             NULL_CAP,
-            RPC_GET_CHAR));
+            RPC_GET_CHAR)));
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
     struct capref tmp_cap;
     ERROR_RET1(recv_block(rpc->server_sess, &message, &tmp_cap));
@@ -345,15 +726,19 @@ errval_t aos_rpc_process_spawn_with_args(struct aos_rpc *rpc,
         domainid_t *newpid)
 {
     assert(rpc->server_sess);
-    if (!serialize_array_of_strings(rpc->server_sess->shared_buffer, rpc->server_sess->shared_buffer_size, argv, argc))
+    size_t size = serialize_array_of_strings_size(argv, argc);
+    char* args = malloc(size);
+    if (!args)
+        return LIB_ERR_MALLOC_FAIL;
+    if (!serialize_array_of_strings(args, size, argv, argc))
+    {
+        free(args);
         return AOS_ERR_SERIALIZE;
+    }
 
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send2(&rpc->server_sess->lc,
-            LMP_FLAG_SYNC,
-            NULL_CAP,
-            RPC_SPAWN,
-            core));
+    errval_t err = bulk_call(rpc->server_sess, RPC_SPAWN, NULL_CAP, args, size, core);
+    free(args);
+    ERROR_RET1(err);
 
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
     struct capref tmp_cap;
@@ -369,16 +754,57 @@ errval_t aos_rpc_process_spawn_with_args(struct aos_rpc *rpc,
     return SYS_ERR_OK;
 }
 
+errval_t aos_rpc_process_spawn_batch(struct aos_rpc *rpc,
+        char* const argv[], int argc, size_t count, uint32_t core_mask,
+        domainid_t **pids, size_t *spawned)
+{
+    assert(rpc->server_sess);
+    if (!count || count > RPC_SPAWN_BATCH_MAX || !core_mask)
+        return RPC_ERR_INVALID_ARGUMENTS;
+
+    size_t size = serialize_array_of_strings_size(argv, argc);
+    size_t request_size = sizeof(struct aos_rpc_spawn_batch) + size;
+    struct aos_rpc_spawn_batch* request = malloc(request_size);
+    if (!request)
+        return LIB_ERR_MALLOC_FAIL;
+    request->count = count;
+    request->core_mask = core_mask;
+    if (!serialize_array_of_strings(request->args, size, argv, argc))
+    {
+        free(request);
+        return AOS_ERR_SERIALIZE;
+    }
+
+    errval_t err = bulk_call(rpc->server_sess, RPC_SPAWN_BATCH, NULL_CAP,
+        (char*)request, request_size, 0);
+    free(request);
+    ERROR_RET1(err);
+
+    struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
+    struct capref tmp_cap;
+    ERROR_RET1(recv_block(rpc->server_sess, &message, &tmp_cap));
+    ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_SPAWN_BATCH);
+
+    *pids = NULL;
+    *spawned = 0;
+    if (RPC_HEADER_FLAGS(message.words[0]) & RPC_FLAG_ERROR)
+        return err_push(message.words[1], PROCMGR_ERR_RPC_SPAWN_FAILED);
+
+    size_t len;
+    ERROR_RET1(bulk_collect(rpc->server_sess, &message, (char**)pids, &len));
+    *spawned = len / sizeof(domainid_t);
+    return SYS_ERR_OK;
+}
+
 errval_t aos_rpc_process_exit(struct aos_rpc *rpc) {
     assert(rpc->server_sess);
 
     debug_printf("Sending exit message\n");
 
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send1(&rpc->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send1(&rpc->server_sess->lc,
             LMP_FLAG_SYNC,
             NULL_CAP,
-            RPC_EXIT));
+            RPC_EXIT)));
 
     return SYS_ERR_OK;
 }
@@ -387,12 +813,11 @@ errval_t aos_rpc_process_get_name(struct aos_rpc *rpc, domainid_t pid,
                                   char **name)
 {
     // send RPC_GET_NAME message to server containing PID
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send2(&rpc->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send2(&rpc->server_sess->lc,
             LMP_FLAG_SYNC,
             NULL_CAP,
             RPC_GET_NAME,
-            pid));
+            pid)));
 
     // expect a response with header RPC_GET_NAME
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
@@ -406,45 +831,114 @@ errval_t aos_rpc_process_get_name(struct aos_rpc *rpc, domainid_t pid,
         return SPAWN_ERR_DOMAIN_NOTFOUND;
     }
 
-    // read the name from the shared buffer into the return argument
-    if (!rpc->server_sess->shared_buffer_size) {
-        return RPC_ERR_SHARED_BUF_EMPTY;
-    }
-
-    size_t string_size = message.words[1];
-    ASSERT_PROTOCOL(string_size <= rpc->server_sess->shared_buffer_size);
-
-    *name = malloc(string_size+1);
-    memcpy(*name, rpc->server_sess->shared_buffer, string_size);
-    (*name)[string_size] = 0;
-
+    size_t string_size;
+    ERROR_RET1(bulk_collect(rpc->server_sess, &message, name, &string_size));
+    ASSERT_PROTOCOL(*name);
     return SYS_ERR_OK;
 }
 
 errval_t aos_rpc_process_get_all_pids(struct aos_rpc *rpc,
         domainid_t **pids, size_t *pid_count)
 {
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send1(&rpc->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send1(&rpc->server_sess->lc,
             LMP_FLAG_SYNC,
             NULL_CAP,
-            RPC_GET_PID));
+            RPC_GET_PID)));
 
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
     struct capref tmp_cap;
     ERROR_RET1(recv_block(rpc->server_sess, &message, &tmp_cap));
     ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_GET_PID);
 
-    // read the array of pids from the shared buffer into the return argument
-    if (!rpc->server_sess->shared_buffer_size)
-        return RPC_ERR_SHARED_BUF_EMPTY;
+    size_t size;
+    ERROR_RET1(bulk_collect(rpc->server_sess, &message, (char**)pids, &size));
+    *pid_count = size / sizeof(domainid_t);
+    return SYS_ERR_OK;
+}
 
-    *pid_count = message.words[1];
-    ASSERT_PROTOCOL(*pid_count <= rpc->server_sess->shared_buffer_size);
+errval_t aos_rpc_process_snapshot(struct aos_rpc *rpc,
+        struct aos_process_info **procs, size_t *count)
+{
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send1(&rpc->server_sess->lc,
+            LMP_FLAG_SYNC,
+            NULL_CAP,
+            RPC_PROCESS_SNAPSHOT)));
 
-    *pids = malloc(sizeof(domainid_t) * (*pid_count));
-    memcpy(*pids, rpc->server_sess->shared_buffer, *pid_count * sizeof(domainid_t));
+    struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
+    struct capref tmp_cap;
+    ERROR_RET1(recv_block(rpc->server_sess, &message, &tmp_cap));
+    ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_PROCESS_SNAPSHOT);
+    if (RPC_HEADER_FLAGS(message.words[0]) & RPC_FLAG_ERROR)
+        return message.words[1];
+
+    char* records;
+    size_t size;
+    ERROR_RET1(bulk_collect(rpc->server_sess, &message, &records, &size));
+
+    // Count first, the names go right behind the array
+    size_t names_size = 0;
+    *count = 0;
+    for (size_t pos = 0; pos < size; ++*count)
+    {
+        struct aos_process_record* record = (struct aos_process_record*)(records + pos);
+        if (size - pos < sizeof(*record) || size - pos < AOS_PROCESS_RECORD_SIZE(record->name_size) ||
+                !record->name_size)
+        {
+            free(records);
+            return RPC_ERR_INVALID_PROTOCOL;
+        }
+        names_size += record->name_size;
+        pos += AOS_PROCESS_RECORD_SIZE(record->name_size);
+    }
 
+    size_t bytes = *count * sizeof(struct aos_process_info) + names_size;
+    *procs = malloc(bytes ? bytes : 1);
+    if (!*procs)
+    {
+        free(records);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    char* names = (char*)(*procs + *count);
+    char* pos = records;
+    for (size_t i = 0; i < *count; ++i)
+    {
+        struct aos_process_record* record = (struct aos_process_record*)pos;
+        (*procs)[i].pid = record->pid;
+        (*procs)[i].core_id = record->core_id;
+        (*procs)[i].state = record->state;
+        (*procs)[i].name = names;
+        memcpy(names, record->name, record->name_size);
+        names[record->name_size - 1] = 0;
+        names += record->name_size;
+        pos += AOS_PROCESS_RECORD_SIZE(record->name_size);
+    }
+    free(records);
+    return SYS_ERR_OK;
+}
+
+errval_t aos_rpc_process_usage(struct aos_rpc *rpc,
+        struct aos_process_usage **usage, size_t *count)
+{
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send1(&rpc->server_sess->lc,
+            LMP_FLAG_SYNC,
+            NULL_CAP,
+            RPC_PROCESS_USAGE)));
+
+    struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
+    struct capref tmp_cap;
+    ERROR_RET1(recv_block(rpc->server_sess, &message, &tmp_cap));
+    ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_PROCESS_USAGE);
+    if (RPC_HEADER_FLAGS(message.words[0]) & RPC_FLAG_ERROR)
+        return message.words[1];
+
+    size_t size;
+    ERROR_RET1(bulk_collect(rpc->server_sess, &message, (char**)usage, &size));
+    if (size % sizeof(struct aos_process_usage))
+    {
+        free(*usage);
+        return RPC_ERR_INVALID_PROTOCOL;
+    }
+    *count = size / sizeof(struct aos_process_usage);
     return SYS_ERR_OK;
 }
 
@@ -452,6 +946,7 @@ errval_t aos_rpc_register_handler(struct aos_rpc* rpc, enum message_opcodes opco
         aos_rpc_handler message_handler, bool send_ack){
 
     rpc->aos_rpc_message_handler_closure[opcode].send_ack=send_ack;
+    rpc->aos_rpc_message_handler_closure[opcode].slow=false;
     rpc->aos_rpc_message_handler_closure[opcode].message_handler=message_handler;
     rpc->aos_rpc_message_handler_closure[opcode].args=NULL;
 
@@ -462,6 +957,7 @@ errval_t aos_rpc_register_handler_with_context(struct aos_rpc* rpc, enum message
         aos_rpc_handler message_handler, bool send_ack, void* context){
 
     rpc->aos_rpc_message_handler_closure[opcode].send_ack=send_ack;
+    rpc->aos_rpc_message_handler_closure[opcode].slow=false;
     rpc->aos_rpc_message_handler_closure[opcode].message_handler=message_handler;
     rpc->aos_rpc_message_handler_closure[opcode].args=context;
 
@@ -499,14 +995,20 @@ errval_t aos_rpc_request_shared_buffer(struct aos_rpc* rpc, size_t size)
 
     size = ROUND_UP(size, BASE_PAGE_SIZE);
 
+    // The server replaces the frame: drop our mapping of the old one
+    if (rpc->server_sess->shared_buffer_size)
+    {
+        rpc->server_sess->shared_buffer_size = 0; // Disable buffer
+        ERROR_RET1(paging_unmap(get_current_paging_state(), rpc->server_sess->shared_buffer));
+        ERROR_RET1(cap_destroy(rpc->server_sess->shared_buffer_cap));
+    }
+
     // Request shared buffer
-    rpc->server_sess->shared_buffer_size = 0; // Disable buffer
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send2(&rpc->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc->server_sess, lmp_chan_send2(&rpc->server_sess->lc,
         LMP_FLAG_SYNC,
         NULL_CAP,
         RPC_SHARED_BUFFER_REQUEST,
-        size));
+        size)));
     struct lmp_recv_msg message;
     ERROR_RET1(recv_block(rpc->server_sess,
         &message,
@@ -546,6 +1048,9 @@ errval_t aos_rpc_map_shared_buffer(struct aos_rpc_session* sess, size_t size)
         sess->shared_buffer_cap,
         NULL, NULL));
 
+    // A fresh frame is zeroed: both rings start empty
+    ERROR_RET1(rpc_bulk_init(&sess->bulk, sess->shared_buffer, size,
+        sess->rpc->server_sess == sess));
     sess->shared_buffer_size = size;
     return SYS_ERR_OK;
 }
@@ -559,7 +1064,14 @@ errval_t aos_rpc_session_init(struct aos_rpc_session* sess,
 
     sess->ack_received=false;
     sess->can_send=false;
+    sess->fast_path=true;
     sess->shared_buffer_size = 0; // Disable buffer
+    sess->bulk_in = NULL;
+    sess->bulk_in_len = 0;
+    sess->bulk_in_size = 0;
+    sess->bulk_out = NULL;
+    sess->worker = NULL;
+    waitset_chanstate_init(&sess->job_chan, CHANTYPE_OTHER);
     ERROR_RET1(slot_alloc(&sess->shared_buffer_cap));
     ERROR_RET1(lmp_chan_alloc_recv_slot(&sess->lc));
     return SYS_ERR_OK;
@@ -571,6 +1083,10 @@ errval_t aos_rpc_init(struct aos_rpc *rpc, struct capref remote_endpoint, bool i
     rpc->ws = get_default_waitset();
     memset(rpc->aos_rpc_message_handler_closure,
         0, sizeof(rpc->aos_rpc_message_handler_closure));
+    rpc->workers = NULL;
+    rpc->num_workers = 0;
+    rpc->next_worker = 0;
+    thread_mutex_init(&rpc->workers_lock);
 
     if (is_client)
     {
@@ -646,46 +1162,42 @@ errval_t aos_rpc_get_device_cap(struct aos_rpc *rpc,
 
 errval_t aos_server_register_client(struct aos_rpc* rpc, struct aos_rpc_session* sess)
 {
+    // Clients register from several worker threads
+    thread_mutex_lock(&rpc->workers_lock);
+    if (rpc->num_workers)
+    {
+        sess->worker = &rpc->workers[rpc->next_worker++ % rpc->num_workers];
+        sess->worker->sessions++;
+    }
+    thread_mutex_unlock(&rpc->workers_lock);
     ERROR_RET1(lmp_chan_register_recv(&sess->lc,
         rpc->ws, MKCLOSURE(cb_accept_loop, sess)));
     return SYS_ERR_OK;
 }
 
-errval_t aos_rpc_nameserver_lookup(struct aos_rpc *rpc, char *name, struct capref *ret_ep)
+errval_t aos_rpc_nameserver_lookup(struct aos_rpc *rpc, char *name, uint32_t *generation,
+        uint32_t *registry_generation, struct capref *ret_ep)
 {
     assert(rpc->server_sess);
-    size_t size = strlen(name);
-    if (size > rpc->server_sess->shared_buffer_size)
-        return RPC_ERR_BUF_TOO_SMALL;
-
-    memcpy(rpc->server_sess->shared_buffer, name, size);
-
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    errval_t _err = lmp_chan_send2(&rpc->server_sess->lc,
-            LMP_FLAG_SYNC,
-            NULL_CAP,
-            RPC_NAMESERVER_LOOKUP,
-            size);
-    if (err_is_fail(_err))
-        DEBUG_ERR(_err, "Failed to send nameserver lookup request");
+    ERROR_RET1(bulk_call(rpc->server_sess, RPC_NAMESERVER_LOOKUP, NULL_CAP,
+        name, strlen(name) + 1, *generation));
 
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
+    *ret_ep = NULL_CAP;
     ERROR_RET1(recv_block(rpc->server_sess,
         &message,
         ret_ep));
+    ASSERT_PROTOCOL(RPC_HEADER_OPCODE(message.words[0]) == RPC_NAMESERVER_LOOKUP);
 
+    *generation = message.words[2];
+    *registry_generation = message.words[3];
     return SYS_ERR_OK;
 }
 
-errval_t aos_rpc_nameserver_enumerate(struct aos_rpc *rpc, size_t *num, char ***result)
+errval_t aos_rpc_nameserver_enumerate(struct aos_rpc *rpc, char *prefix, size_t *num, char ***result)
 {
-	ERROR_RET1(wait_for_send(rpc->server_sess));
-	errval_t _err = lmp_chan_send1(&rpc->server_sess->lc,
-			LMP_FLAG_SYNC,
-			NULL_CAP,
-			RPC_NAMESERVER_ENUMERATE);
-	if (err_is_fail(_err))
-		DEBUG_ERR(_err, "Failed to send nameserver lookup request");
+	ERROR_RET1(bulk_call(rpc->server_sess, RPC_NAMESERVER_ENUMERATE, NULL_CAP,
+			prefix, strlen(prefix) + 1, 0));
 
 	struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
 	struct capref cap;
@@ -693,18 +1205,27 @@ errval_t aos_rpc_nameserver_enumerate(struct aos_rpc *rpc, size_t *num, char ***
 			&message,
 			&cap));
 
-	*num = message.words[1];
+	// The answer is the NUL-terminated names, one after the other
+	char* names;
+	size_t len;
+	ERROR_RET1(bulk_collect(rpc->server_sess, &message, &names, &len));
+
+	*num = 0;
+	for (size_t i = 0; i < len; i++)
+		if (!names[i])
+			(*num)++;
 	*result = malloc(sizeof(char *) * (*num));
 
 	size_t size = 0;
 	size_t offset = 0;
 	for (int i = 0; i < *num; i++) {
-		size = strlen(rpc->server_sess->shared_buffer + offset) + 1;
+		size = strlen(names + offset) + 1;
 		char *service_name = malloc(sizeof(char) * size); // should be done statically instead, somehow
-		memcpy(service_name, rpc->server_sess->shared_buffer + offset, size);
+		memcpy(service_name, names + offset, size);
 		(*result)[i] = service_name;
 		offset += size;
 	}
+	free(names);
 
 	return SYS_ERR_OK;
 }
@@ -713,46 +1234,29 @@ errval_t aos_rpc_nameserver_enumerate(struct aos_rpc *rpc, size_t *num, char ***
 errval_t aos_rpc_nameserver_register(struct aos_rpc *rpc, struct capref ep_cap, char *name)
 {
     assert(rpc->server_sess);
-    size_t size = strlen(name);
-    if (size > rpc->server_sess->shared_buffer_size)
-        return RPC_ERR_BUF_TOO_SMALL;
-    memcpy(rpc->server_sess->shared_buffer, name, size);
-
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    ERROR_RET1(lmp_chan_send2(&rpc->server_sess->lc,
-            LMP_FLAG_SYNC,
-            ep_cap,
-            RPC_NAMESERVER_REGISTER,
-            size));
-
-    return SYS_ERR_OK;
+    ERROR_RET1(bulk_call(rpc->server_sess, RPC_NAMESERVER_REGISTER, ep_cap,
+        name, strlen(name) + 1, 0));
+    // The nameserver binds to ep_cap before it acks: our waitset serves
+    // its handshake while we wait.
+    return wait_for_ack(rpc->server_sess);
 }
 
 errval_t aos_rpc_nameserver_deregister(struct aos_rpc *rpc, char *name)
 {
 	assert(rpc->server_sess);
-	size_t size = strlen(name);
-	if (size > rpc->server_sess->shared_buffer_size)
-		return RPC_ERR_BUF_TOO_SMALL;
-	memcpy(rpc->server_sess->shared_buffer, name, size);
-
-	RPC_CHAN_WRAPPER_SEND(rpc,
-			lmp_chan_send1(&rpc->server_sess->lc,
-					LMP_FLAG_SYNC,
-					NULL_CAP,
-					RPC_NAMESERVER_DEREGISTER));
-	return SYS_ERR_OK;
+	ERROR_RET1(bulk_call(rpc->server_sess, RPC_NAMESERVER_DEREGISTER, NULL_CAP,
+			name, strlen(name) + 1, 0));
+	return wait_for_ack(rpc->server_sess);
 }
 
 // This is used to request an EP from any process
 errval_t aos_rpc_request_ep(struct aos_rpc *rpc, struct capref *ret_ep)
 {
     assert(rpc->server_sess);
-    ERROR_RET1(wait_for_send(rpc->server_sess));
-    errval_t err = lmp_chan_send1(&rpc->server_sess->lc,
+    errval_t err = RPC_SEND(rpc->server_sess, lmp_chan_send1(&rpc->server_sess->lc,
             LMP_FLAG_SYNC,
             NULL_CAP,
-            RPC_NAMESERVER_EP_REQUEST);
+            RPC_NAMESERVER_EP_REQUEST));
     if (err_is_fail(err))
         DEBUG_ERR(err, "Sending EP request failed");
 
@@ -771,11 +1275,10 @@ errval_t aos_rpc_bind_to_nameserver(struct aos_rpc *rpc_init, struct aos_rpc *re
         return RPC_ERR_INVALID_ARGUMENTS;
 
     // Request nameserver endpoint
-    ERROR_RET1(wait_for_send(rpc_init->server_sess));
-    ERROR_RET1(lmp_chan_send1(&rpc_init->server_sess->lc,
+    ERROR_RET1(RPC_SEND(rpc_init->server_sess, lmp_chan_send1(&rpc_init->server_sess->lc,
         LMP_FLAG_SYNC,
         NULL_CAP,
-        RPC_NAMESERVER_LOOKUP));
+        RPC_NAMESERVER_LOOKUP)));
 
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
     struct capref received_ep;
@@ -71,6 +71,22 @@ disp_resume_context(struct dispatcher_shared_generic *disp, uint32_t *regs)
                   );
 }
 
+/*
+ * Same as disp_resume_context, but the dispatcher stays disabled.
+ */
+static void __attribute__((naked)) __attribute__((noinline))
+disp_resume_context_disabled(uint32_t *regs)
+{
+    __asm volatile(
+        "    clrex\n\t"
+        "    mov     r1, r0                                             \n\t"
+        /* Restore cpsr condition bits  */
+        "    ldr     r0, [r1], #4                                       \n\t"
+        "    msr     cpsr, r0                                           \n\t"
+        /* Restore registers */
+        "    ldmia   r1, {r0-r15}                                       \n\t"
+                  );
+}
 
 static void __attribute__((naked))
 disp_save_context(uint32_t *regs)
@@ -127,6 +143,25 @@ disp_resume(dispatcher_handle_t handle,
     disp_resume_context(&disp->d, archregs->regs);
 }
 
+/**
+ * \brief Resume execution of a given register state, staying disabled
+ *
+ * \param disp Current dispatcher pointer
+ * \param regs Register state snapshot, usually the trap save area
+ */
+void
+disp_resume_disabled(dispatcher_handle_t handle,
+                     arch_registers_state_t *archregs)
+{
+    struct dispatcher_shared_arm *disp =
+        get_dispatcher_shared_arm(handle);
+
+    assert_disabled(curdispatcher() == handle);
+    assert_disabled(disp->d.disabled);
+
+    disp_resume_context_disabled(archregs->regs);
+}
+
 /**
  * \brief Switch execution between two register states
  *
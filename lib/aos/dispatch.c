@@ -295,6 +295,11 @@ uint8_t disp_xeon_phi_id(void)
 #endif
 
 
+#if defined(__arm__)
+/// Write-not-Read bit of the DFSR, which the kernel passes as error code
+#define ARM_DFSR_WNR (1 << 11)
+#endif
+
 /**
  * \brief Page fault entry point
  *
@@ -330,6 +335,15 @@ void disp_pagefault(dispatcher_handle_t handle, lvaddr_t fault_address,
     } else {
         fault_type = PAGEFLT_READ;
     }
+#elif defined(__arm__)
+    // error is the DFSR of a data abort, 0 for a prefetch abort
+    if (error == 0) {
+        fault_type = PAGEFLT_EXEC;
+    } else if ((error & ARM_DFSR_WNR) != 0) {
+        fault_type = PAGEFLT_WRITE;
+    } else {
+        fault_type = PAGEFLT_READ;
+    }
 #else
     //assert_print("Warning: don't know how to determine fault type on this arch!\n");
     fault_type = PAGEFLT_NULL;
@@ -341,6 +355,12 @@ void disp_pagefault(dispatcher_handle_t handle, lvaddr_t fault_address,
     // sanity-check that we were on a thread
     assert_disabled(disp_gen->current != NULL);
 
+    // Copy-on-write pages are copied right here, without a thread switch
+    if (fault_type == PAGEFLT_WRITE &&
+        paging_cow_fault_disabled(handle, fault_address, false)) {
+        disp_resume(handle, regs);
+    }
+
     // Save FPU context if used
 #ifdef FPU_LAZY_CONTEXT_SWITCH
     if (disp_gen->fpu_thread == disp_gen->current) {
@@ -402,6 +422,15 @@ void disp_pagefault_disabled(dispatcher_handle_t handle, lvaddr_t fault_address,
 {
     struct dispatcher_shared_generic *disp =
         get_dispatcher_shared_generic(handle);
+
+#if defined(__arm__)
+    // Domains write copy-on-write pages long before they can take faults
+    if ((error & ARM_DFSR_WNR) != 0 &&
+        paging_cow_fault_disabled(handle, fault_address, true)) {
+        disp_resume_disabled(handle, dispatcher_get_trap_save_area(handle));
+    }
+#endif
+
     static char str[256];
     snprintf(str, 256, "%.*s: page fault WHILE DISABLED"
              " (error code 0x%" PRIxPTR ") on %" PRIxPTR " at IP %" PRIxPTR "\n",
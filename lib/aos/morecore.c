@@ -103,13 +103,26 @@ static void *morecore_alloc(size_t bytes, size_t *retbytes)
         USER_PANIC("morecore_alloc: paging_alloc failed!");
     block->map_flags = VREGION_FLAGS_READ_WRITE;
     debug_printf("morecore_alloc: Returning buf @ 0x%08x [size 0x%x]\n", (int)buf, (int)*retbytes);
+
+    // lesscore() trims the free chunk ending at the top of the last region
+    struct morecore_state *state = get_morecore_state();
+    state->region.base_addr = (lvaddr_t)buf;
+    state->region.region_size = *retbytes;
+    state->region.current_addr = (lvaddr_t)buf + *retbytes;
     return buf;
 }
 
+/**
+ * \brief Give memory back that malloc does not need anymore
+ *
+ * The pages that were faulted in are unmapped and their RAM goes back to
+ * init, the virtual address space becomes free.
+ */
 static void morecore_free(void *base, size_t bytes)
 {
-    USER_PANIC("morecore_free: NotYetImplemented");
-    return;
+    errval_t err = paging_free_range(get_current_paging_state(), (lvaddr_t)base, bytes);
+    if (err_is_fail(err))
+        DEBUG_ERR(err, "morecore_free 0x%08x [size 0x%x]", (int)base, (int)bytes);
 }
 
 errval_t morecore_init(void)
@@ -12,16 +12,105 @@
 #include <aos/aos.h>
 #include <aos/aos_rpc.h>
 #include <aos/nameserver.h>
+#include <aos/deferred.h>
 
-errval_t nameserver_lookup(char *name, struct aos_rpc *ret_rpc) {
-    // TODO error handling
+/*
+ * Service endpoints from earlier lookups. A lookup binds a fresh session
+ * to the cached endpoint without asking the nameserver, for at most
+ * NS_CACHE_MAX_AGE after the entry was last checked. Older entries are
+ * checked again: the nameserver only hands out a new endpoint if the
+ * service was registered anew. An entry whose endpoint does not answer
+ * the handshake is dropped.
+ */
+#define NS_CACHE_MAX_AGE    (1*1000*1000)
+
+struct ns_cache_entry {
+    char *name;
+    struct capref endpoint;
+    uint32_t generation;        // Of the service
+    systime_t checked;          // When the nameserver last confirmed it
+    struct ns_cache_entry *next;
+};
+
+static struct ns_cache_entry *ns_cache = NULL;
+static struct thread_mutex ns_cache_lock = THREAD_MUTEX_INITIALIZER;
+
+static struct ns_cache_entry *ns_cache_find(char *name) {
+    struct ns_cache_entry *entry = ns_cache;
+    while (entry && strcmp(entry->name, name))
+        entry = entry->next;
+    return entry;
+}
+
+static void ns_cache_remove(struct ns_cache_entry *entry) {
+    struct ns_cache_entry **link = &ns_cache;
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    if (!capref_is_null(entry->endpoint))
+        ERR_CHECK("destroying a cached endpoint", cap_destroy(entry->endpoint));
+    free(entry->name);
+    free(entry);
+}
+
+static errval_t ns_cache_lookup(char *name, struct aos_rpc *ret_rpc) {
+    systime_t now = get_system_time();
+    struct ns_cache_entry *entry = ns_cache_find(name);
+    if (entry && now - entry->checked < NS_CACHE_MAX_AGE) {
+        if (err_is_ok(aos_rpc_init(ret_rpc, entry->endpoint, true)))
+            return SYS_ERR_OK;
+        // The service is gone, ask the nameserver
+        ns_cache_remove(entry);
+        entry = NULL;
+    }
+
+    uint32_t generation = entry ? entry->generation : 0;
+    uint32_t registry;
     struct capref rpc_cap;
-    ERROR_RET1(aos_rpc_nameserver_lookup(get_nameserver_rpc(), name, &rpc_cap));
-    return aos_rpc_init(ret_rpc, rpc_cap, true);
+    errval_t err = aos_rpc_nameserver_lookup(get_nameserver_rpc(), name,
+        &generation, &registry, &rpc_cap);
+    if (err_is_fail(err)) {
+        // Gone, or registered by someone else the next time
+        if (entry && err_no(err) == NAMESERVER_ERR_NOT_FOUND)
+            ns_cache_remove(entry);
+        return err;
+    }
+
+    if (!capref_is_null(rpc_cap)) {
+        if (!entry) {
+            entry = calloc(1, sizeof(struct ns_cache_entry));
+            if (!entry)
+                return LIB_ERR_MALLOC_FAIL;
+            entry->name = strdup(name);
+            entry->next = ns_cache;
+            ns_cache = entry;
+        }
+        else
+            ERR_CHECK("destroying a stale endpoint", cap_destroy(entry->endpoint));
+        entry->endpoint = rpc_cap;
+        entry->generation = generation;
+    }
+    assert(entry);
+    entry->checked = now;
+    err = aos_rpc_init(ret_rpc, entry->endpoint, true);
+    if (err_is_fail(err))
+        ns_cache_remove(entry);
+    return err;
+}
+
+errval_t nameserver_lookup(char *name, struct aos_rpc *ret_rpc) {
+    thread_mutex_lock(&ns_cache_lock);
+    errval_t err = ns_cache_lookup(name, ret_rpc);
+    thread_mutex_unlock(&ns_cache_lock);
+    return err;
 }
 
 errval_t nameserver_enumerate(size_t *num, char ***result) {
-    return aos_rpc_nameserver_enumerate(get_nameserver_rpc(), num, result);
+    return nameserver_enumerate_prefix("", num, result);
+}
+
+errval_t nameserver_enumerate_prefix(char *prefix, size_t *num, char ***result) {
+    return aos_rpc_nameserver_enumerate(get_nameserver_rpc(), prefix, num, result);
 }
 
 errval_t nameserver_register(char *name, struct aos_rpc *rpc) {
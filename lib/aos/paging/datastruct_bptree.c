@@ -60,6 +60,9 @@ void check_tree_correctness(struct bpt_node* root, bool verbose)
                     case VirtualBlock_Paged:
                         type = "PAGED";
                         break;
+                    case VirtualBlock_Unmapping:
+                        type = "UNMAPPING";
+                        break;
                 }
                 debug_printf("[0x%08x[%d]][Addr0x%08x][Block0x%08x] Size is 0x%08x [%s]\n",
                     (int)n, (int)i, (int)n->keys[i], (int)va, (int)va->size,
@@ -135,6 +138,7 @@ struct vm_block* add_block_after(struct paging_state* st,
 
     struct vm_block* original_block = original.node->pointers[original.index];
     struct vm_block* new_block = slab_alloc(&st->slabs);
+    new_block->mappings = NULL;
     size_t original_size = original_block->size;
     assert(original_size + ADDRESS_FROM_VM_BLOCK_KEY(original) > at_address);
     //original_block->size = at_address - ADDRESS_FROM_VM_BLOCK_KEY(original);
@@ -186,10 +190,21 @@ struct vm_block* create_root(struct paging_state* st, size_t start_address)
 
     struct vm_block* block = slab_alloc(&st->slabs);
     assert(block);
+    block->mappings = NULL;
     st->blocks.root = bpt_insert(&st->blocks.mem, NULL, start_address, block);
     return block;
 }
 
+void vm_block_set_type(struct paging_state* st, struct vm_block* block, enum virtual_block_type type)
+{
+    block->type = type;
+}
+
+void vm_block_set_size(struct paging_state* st, struct vm_block* block, size_t size)
+{
+    block->size = size;
+}
+
 static struct bpt_node* bpt_find_prev_leaf(struct bpt_node* n)
 {
     // Go up until we are no longer the leftmost leaf
@@ -20,21 +20,159 @@ static bool is_block_valid(struct vm_block* b)
     return true;
 }
 
+/*
+ * Both indices are intrusive AVL trees sharing the same code, the tree
+ * only decides which links are used and how blocks are ordered.
+ */
+enum vm_tree {
+    VM_TREE_ADDR,   // All blocks, by start_address
+    VM_TREE_FREE,   // Free blocks, by (size, start_address)
+};
+
+static inline struct vm_block_link* vm_link(struct vm_block* b, enum vm_tree t)
+{
+    return t == VM_TREE_ADDR ? &b->addr_link : &b->free_link;
+}
+
+static inline bool vm_tree_less(enum vm_tree t, struct vm_block* a, struct vm_block* b)
+{
+    if (t == VM_TREE_FREE && a->size != b->size)
+        return a->size < b->size;
+    return a->start_address < b->start_address;
+}
+
+static inline int vm_tree_height(struct vm_block* n, enum vm_tree t)
+{
+    return n ? vm_link(n, t)->height : 0;
+}
+
+static inline void vm_tree_update(struct vm_block* n, enum vm_tree t)
+{
+    int l = vm_tree_height(vm_link(n, t)->left, t);
+    int r = vm_tree_height(vm_link(n, t)->right, t);
+    vm_link(n, t)->height = (l > r ? l : r) + 1;
+}
+
+static struct vm_block* vm_tree_rotate_right(struct vm_block* n, enum vm_tree t)
+{
+    struct vm_block* l = vm_link(n, t)->left;
+    vm_link(n, t)->left = vm_link(l, t)->right;
+    vm_link(l, t)->right = n;
+    vm_tree_update(n, t);
+    vm_tree_update(l, t);
+    return l;
+}
+
+static struct vm_block* vm_tree_rotate_left(struct vm_block* n, enum vm_tree t)
+{
+    struct vm_block* r = vm_link(n, t)->right;
+    vm_link(n, t)->right = vm_link(r, t)->left;
+    vm_link(r, t)->left = n;
+    vm_tree_update(n, t);
+    vm_tree_update(r, t);
+    return r;
+}
+
+static struct vm_block* vm_tree_balance(struct vm_block* n, enum vm_tree t)
+{
+    struct vm_block_link* link = vm_link(n, t);
+    vm_tree_update(n, t);
+    int balance = vm_tree_height(link->left, t) - vm_tree_height(link->right, t);
+    if (balance > 1)
+    {
+        struct vm_block_link* l = vm_link(link->left, t);
+        if (vm_tree_height(l->left, t) < vm_tree_height(l->right, t))
+            link->left = vm_tree_rotate_left(link->left, t);
+        return vm_tree_rotate_right(n, t);
+    }
+    if (balance < -1)
+    {
+        struct vm_block_link* r = vm_link(link->right, t);
+        if (vm_tree_height(r->right, t) < vm_tree_height(r->left, t))
+            link->right = vm_tree_rotate_right(link->right, t);
+        return vm_tree_rotate_left(n, t);
+    }
+    return n;
+}
+
+static struct vm_block* vm_tree_insert_rec(struct vm_block* root, struct vm_block* b, enum vm_tree t)
+{
+    if (!root)
+        return b;
+    if (vm_tree_less(t, b, root))
+        vm_link(root, t)->left = vm_tree_insert_rec(vm_link(root, t)->left, b, t);
+    else
+        vm_link(root, t)->right = vm_tree_insert_rec(vm_link(root, t)->right, b, t);
+    return vm_tree_balance(root, t);
+}
+
+static struct vm_block* vm_tree_remove_min(struct vm_block* root, struct vm_block** min, enum vm_tree t)
+{
+    if (!vm_link(root, t)->left)
+    {
+        *min = root;
+        return vm_link(root, t)->right;
+    }
+    vm_link(root, t)->left = vm_tree_remove_min(vm_link(root, t)->left, min, t);
+    return vm_tree_balance(root, t);
+}
+
+static struct vm_block* vm_tree_remove_rec(struct vm_block* root, struct vm_block* b, enum vm_tree t)
+{
+    assert(root && "Block not in vspace index");
+    if (root != b)
+    {
+        if (vm_tree_less(t, b, root))
+            vm_link(root, t)->left = vm_tree_remove_rec(vm_link(root, t)->left, b, t);
+        else
+            vm_link(root, t)->right = vm_tree_remove_rec(vm_link(root, t)->right, b, t);
+        return vm_tree_balance(root, t);
+    }
+    if (!vm_link(root, t)->right)
+        return vm_link(root, t)->left;
+    struct vm_block* min;
+    struct vm_block* right = vm_tree_remove_min(vm_link(root, t)->right, &min, t);
+    vm_link(min, t)->left = vm_link(root, t)->left;
+    vm_link(min, t)->right = right;
+    return vm_tree_balance(min, t);
+}
+
+static void vm_tree_insert(struct vm_block** root, struct vm_block* b, enum vm_tree t)
+{
+    vm_link(b, t)->left = vm_link(b, t)->right = NULL;
+    vm_link(b, t)->height = 1;
+    *root = vm_tree_insert_rec(*root, b, t);
+}
+
+static void vm_tree_remove(struct vm_block** root, struct vm_block* b, enum vm_tree t)
+{
+    *root = vm_tree_remove_rec(*root, b, t);
+}
+
 /**
- * \brief Finds a free block with given size
+ * \brief Finds the smallest free block with at least given size.
+ * Ties are broken by the lowest address.
  */
 struct vm_block* find_free_block_with_size(struct paging_state *st, size_t min_size, vm_block_key_t* key)
 {
-    for (struct vm_block* va = st->blocks;va; va = va->next)
+    struct vm_block* best = NULL;
+    struct vm_block* va = st->blocks.free_root;
+    while (va)
     {
-        if (va->type != VirtualBlock_Free ||
-            va->size < min_size)
-            continue;
-        *key = va;
-        assert(is_block_valid(va));
-        return va;
+        if (va->size >= min_size)
+        {
+            best = va;
+            va = va->free_link.left;
+        }
+        else
+            va = va->free_link.right;
     }
-    return NULL;
+    if (!best)
+        return NULL;
+    assert(best->type == VirtualBlock_Free);
+    assert(is_block_valid(best));
+    *key = best;
+    return best;
 }
 
 /**
@@ -42,26 +180,38 @@ struct vm_block* find_free_block_with_size(struct paging_state *st, size_t min_s
  */
 struct vm_block* find_block_before(struct paging_state *st, lvaddr_t before_address, vm_block_key_t* key)
 {
-    struct vm_block* va = st->blocks;
-    if (!va)
-        return NULL;
-
-    for(;va->next && va->next->start_address <= before_address; va = va->next);
-    assert(va);
-    assert(is_block_valid(va));
-    if (va->start_address > before_address)
+    struct vm_block* best = NULL;
+    struct vm_block* va = st->blocks.addr_root;
+    while (va)
+    {
+        if (va->start_address <= before_address)
+        {
+            best = va;
+            va = va->addr_link.right;
+        }
+        else
+            va = va->addr_link.left;
+    }
+    if (!best)
         return NULL;
-
-    *key = va;
-    return va;
+    assert(is_block_valid(best));
+    *key = best;
+    return best;
 }
 
+/**
+ * \brief Creates a new block at given address, right after `original`.
+ * The new block is Allocated and empty: size it and type it with
+ * vm_block_set_size/vm_block_set_type.
+ */
 struct vm_block* add_block_after(struct paging_state* st,
     vm_block_key_t original, lvaddr_t at_address, vm_block_key_t* new_key)
 {
     assert(slab_has_freecount(&st->slabs, 1));
     struct vm_block* new_block = slab_alloc(&st->slabs);
     assert(is_block_valid(original));
+    assert(original->start_address < at_address);
+    assert(!original->next || at_address < original->next->start_address);
     new_block->next = original->next;
     new_block->prev = original;
     if (new_block->next)
@@ -70,19 +220,60 @@ struct vm_block* add_block_after(struct paging_state* st,
     assert(is_block_valid(original));
     assert(is_block_valid(new_block));
 
+    new_block->type = VirtualBlock_Allocated;
+    new_block->size = 0;
+    new_block->map_flags = 0;
+    new_block->mappings = NULL;
     new_block->start_address = at_address;
+    vm_tree_insert(&st->blocks.addr_root, new_block, VM_TREE_ADDR);
+    ++st->blocks.num_blocks;
+
     *new_key = new_block;
     return new_block;
 }
 
+void vm_block_set_type(struct paging_state* st, struct vm_block* block, enum virtual_block_type type)
+{
+    if (block->type == type)
+        return;
+    if (block->type == VirtualBlock_Free)
+    {
+        vm_tree_remove(&st->blocks.free_root, block, VM_TREE_FREE);
+        --st->blocks.num_free;
+    }
+    block->type = type;
+    if (type == VirtualBlock_Free)
+    {
+        vm_tree_insert(&st->blocks.free_root, block, VM_TREE_FREE);
+        ++st->blocks.num_free;
+    }
+}
+
+void vm_block_set_size(struct paging_state* st, struct vm_block* block, size_t size)
+{
+    if (block->type != VirtualBlock_Free)
+    {
+        block->size = size;
+        return;
+    }
+    vm_tree_remove(&st->blocks.free_root, block, VM_TREE_FREE);
+    block->size = size;
+    vm_tree_insert(&st->blocks.free_root, block, VM_TREE_FREE);
+}
+
 /**
  * \brief Merges next node to current node, and update list links accordingly.
  *          The next node is deleted with the slab allocator.
+ *          The caller is responsible for the size of the current node.
  */
 static void vm_block_merge_next_into_me(struct paging_state *st, struct vm_block* virtual_addr)
 {
     assert(virtual_addr->next);
     struct vm_block* node_to_free = virtual_addr->next;
+    // Indices
+    vm_block_set_type(st, node_to_free, VirtualBlock_Allocated);
+    vm_tree_remove(&st->blocks.addr_root, node_to_free, VM_TREE_ADDR);
+    --st->blocks.num_blocks;
     // Linked list
     virtual_addr->next = virtual_addr->next->next;
     if (virtual_addr->next)
@@ -98,8 +289,16 @@ struct vm_block* create_root(struct paging_state* st, size_t start_address)
     struct vm_block* new_block = slab_alloc(&st->slabs);
     new_block->next = NULL;
     new_block->prev = NULL;
+    new_block->type = VirtualBlock_Allocated;
+    new_block->size = 0;
+    new_block->map_flags = 0;
+    new_block->mappings = NULL;
     new_block->start_address = start_address;
-    st->blocks = new_block;
+
+    memset(&st->blocks, 0, sizeof(st->blocks));
+    st->blocks.head = new_block;
+    vm_tree_insert(&st->blocks.addr_root, new_block, VM_TREE_ADDR);
+    st->blocks.num_blocks = 1;
     return new_block;
 }
 
@@ -108,16 +307,103 @@ void vm_block_merge_free_neighbors(struct paging_state* st, vm_block_key_t virtu
     // Merge with previous <- me
     if (virtual_addr->prev && virtual_addr->prev->type == VirtualBlock_Free)
     {
-        virtual_addr->prev->size += virtual_addr->size;
+        vm_block_set_size(st, virtual_addr->prev,
+            virtual_addr->prev->size + virtual_addr->size);
         virtual_addr = virtual_addr->prev;
         vm_block_merge_next_into_me(st, virtual_addr);
     }
     // Merge with me <- next
     if (virtual_addr->next && virtual_addr->next->type == VirtualBlock_Free)
     {
-        virtual_addr->size += virtual_addr->next->size;
+        vm_block_set_size(st, virtual_addr,
+            virtual_addr->size + virtual_addr->next->size);
         vm_block_merge_next_into_me(st, virtual_addr);
     }
 }
 
+/*
+ * Self-check: the list must be contiguous, the address tree must visit
+ * exactly the list in order, the free tree exactly the free blocks, and
+ * both trees must be balanced with correct heights.
+ */
+#define VM_CHECK(cond) { if (!(cond)) \
+    USER_PANIC("vspace index corrupted: \"" #cond "\" not true!\n"); }
+
+static int vm_check_addr_tree(struct vm_block* n, struct vm_block** expected, size_t* count)
+{
+    if (!n)
+        return 0;
+    int l = vm_check_addr_tree(n->addr_link.left, expected, count);
+    VM_CHECK(n == *expected);
+    *expected = n->next;
+    ++*count;
+    int r = vm_check_addr_tree(n->addr_link.right, expected, count);
+    VM_CHECK(l - r <= 1 && r - l <= 1);
+    VM_CHECK(n->addr_link.height == (l > r ? l : r) + 1);
+    return n->addr_link.height;
+}
+
+static int vm_check_free_tree(struct vm_block* n, struct vm_block** prev, size_t* count)
+{
+    if (!n)
+        return 0;
+    int l = vm_check_free_tree(n->free_link.left, prev, count);
+    VM_CHECK(n->type == VirtualBlock_Free);
+    VM_CHECK(!*prev || vm_tree_less(VM_TREE_FREE, *prev, n));
+    *prev = n;
+    ++*count;
+    int r = vm_check_free_tree(n->free_link.right, prev, count);
+    VM_CHECK(l - r <= 1 && r - l <= 1);
+    VM_CHECK(n->free_link.height == (l > r ? l : r) + 1);
+    return n->free_link.height;
+}
+
+void vm_block_check_correctness(struct paging_state* st, bool verbose)
+{
+    static const char* type_names[] = { "FREE", "ALLOCATED", "PAGED", "UNMAPPING" };
+    if (verbose)
+        debug_printf("###### vm_block_check_correctness: %zu blocks, %zu free\n",
+            st->blocks.num_blocks, st->blocks.num_free);
+
+    size_t num_blocks = 0;
+    size_t num_free = 0;
+    VM_CHECK(st->blocks.head && !st->blocks.head->prev);
+    for (struct vm_block* va = st->blocks.head; va; va = va->next)
+    {
+        if (verbose)
+            debug_printf("[Addr0x%08x][Block0x%08x] Size is 0x%08x [%s]\n",
+                (int)va->start_address, (int)va, (int)va->size, type_names[va->type]);
+        VM_CHECK(is_block_valid(va));
+        VM_CHECK(!va->next || va->start_address + va->size == va->next->start_address);
+        ++num_blocks;
+        if (va->type == VirtualBlock_Free)
+            ++num_free;
+    }
+    VM_CHECK(num_blocks == st->blocks.num_blocks);
+    VM_CHECK(num_free == st->blocks.num_free);
+
+    size_t count = 0;
+    struct vm_block* cursor = st->blocks.head;
+    vm_check_addr_tree(st->blocks.addr_root, &cursor, &count);
+    VM_CHECK(!cursor && count == num_blocks);
+
+    count = 0;
+    cursor = NULL;
+    vm_check_free_tree(st->blocks.free_root, &cursor, &count);
+    VM_CHECK(count == num_free);
+}
+
+/**
+ * \brief Enables or disables the index self-check on every paging
+ * operation. This is O(n) per operation and meant for debugging only.
+ */
+void vm_block_set_self_check(struct paging_state* st, bool enable)
+{
+    DATA_STRUCT_LOCK(st);
+    st->blocks.self_check = enable;
+    if (enable)
+        vm_block_check_correctness(st, false);
+    DATA_STRUCT_UNLOCK(st);
+}
+
 #endif
@@ -23,6 +23,8 @@
 #include <string.h>
 
 errval_t paging_refill_own_allocator(struct paging_state *state);
+static errval_t paging_map_in_l2(struct paging_state *st, lvaddr_t vaddr,
+        struct capref frame, size_t bytes, size_t offset, int flags, struct vm_mapping* record);
 
 static struct paging_state current;
 /**
@@ -46,6 +48,50 @@ static errval_t arml2_alloc(struct paging_state * st, struct capref *ret)
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Allocates a mapping record, keeping a few spare for the refill
+ * itself (which maps a page).
+ */
+static struct vm_mapping* paging_alloc_mapping(struct paging_state *st)
+{
+    DATA_STRUCT_LOCK(st);
+    if (!slab_has_freecount(&st->mapping_slabs, 4))
+        st->mapping_slabs.refill_func(&st->mapping_slabs);
+    struct vm_mapping* record = slab_alloc(&st->mapping_slabs);
+    DATA_STRUCT_UNLOCK(st);
+    return record;
+}
+
+static void paging_init_mapping(struct vm_mapping* record, lvaddr_t vaddr, size_t bytes,
+        struct capref mapping, struct capref frame, bool section)
+{
+    record->next = NULL;
+    record->vaddr = vaddr;
+    record->bytes = bytes;
+    record->mapping = mapping;
+    record->frame = frame;
+    record->ram = NULL_CAP;
+    record->owned = false;
+    record->section = section;
+}
+
+/**
+ * \brief Links a mapping record to its block, or frees it if the mapping failed.
+ */
+static void paging_add_mapping(struct paging_state *st, struct vm_block* block,
+        struct vm_mapping* record, bool mapped)
+{
+    DATA_STRUCT_LOCK(st);
+    if (mapped)
+    {
+        record->next = block->mappings;
+        block->mappings = record;
+    }
+    else
+        slab_free(&st->mapping_slabs, record);
+    DATA_STRUCT_UNLOCK(st);
+}
+
 static errval_t slab_refill_no_lazy_alloc(struct slab_allocator *slabs){
         static int refill = 0;
 
@@ -79,18 +125,30 @@ errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
     st->l1_pagetable = pdir;
     st->slot_alloc = ca;
     st->cap_slot_in_own_space = NULL_CAP;
+    st->fault_ram_count = 0;
+    st->fault_around = PAGING_FAULT_AROUND_DEFAULT;
+    st->fault_sections = true;
+    memset(&st->fault_stats, 0, sizeof(st->fault_stats));
 
-    memset(st->l2nodes, 0, sizeof(st->l2nodes));
+    // l2nodes must be zero already (static, or a zeroed spawninfo). Not
+    // writing it keeps its 160 KiB copy-on-write shared in spawned domains.
     slab_init(&st->slabs, sizeof(struct vm_block), slab_refill_no_lazy_alloc);
     SLAB_SET_NAME(&st->slabs, "Paging");
     slab_grow(&st->slabs, st->slab_init_buffer, sizeof(st->slab_init_buffer));
+    slab_init(&st->mapping_slabs, sizeof(struct vm_mapping), slab_refill_no_lazy_alloc);
+    SLAB_SET_NAME(&st->mapping_slabs, "PagingMappings");
+    slab_grow(&st->mapping_slabs, st->mapping_init_buffer, sizeof(st->mapping_init_buffer));
 
     struct vm_block* initial_free_space = create_root(st, start_vaddr);
-    initial_free_space->type = VirtualBlock_Free;
-    initial_free_space->size = VADDR_OFFSET;
+    vm_block_set_size(st, initial_free_space, VADDR_OFFSET);
+    vm_block_set_type(st, initial_free_space, VirtualBlock_Free);
 
+    memset(st->fault_inflight, 0, sizeof(st->fault_inflight));
+    thread_cond_init(&st->fault_done);
     thread_mutex_init(&st->page_fault_lock);
     thread_mutex_init(&st->blocks_lock);
+    for (int i = 0; i < PAGING_L2_LOCK_STRIPES; ++i)
+        thread_mutex_init(&st->l2_locks[i]);
     return SYS_ERR_OK;
 }
 
@@ -181,7 +239,6 @@ errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes, struct
 {
     DEBUG_PAGING("paging_alloc: Alloc block for size 0x%x\n",
         bytes);
-    CHECK_DATA_CORRECTNESS(st, false);
     #ifdef PAGING_KEEP_GAPS
         bytes += PAGING_KEEP_GAPS * BASE_PAGE_SIZE;
     #endif
@@ -190,6 +247,7 @@ errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes, struct
 
     vm_block_key_t key;
     DATA_STRUCT_LOCK(st);
+    CHECK_DATA_CORRECTNESS(st, false);
 
     /* Upon refilling slab, we need to paging_alloc and mm_alloc.
     One alloc + paging:
@@ -216,7 +274,7 @@ errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes, struct
 
     // Mark this one as used - for calls to alloc from refill functions
     // indirectly called here.
-    virtual_addr->type = VirtualBlock_Allocated;
+    vm_block_set_type(st, virtual_addr, VirtualBlock_Allocated);
     virtual_addr->map_flags = 0;
 
     //if it is exact same size, just retype it
@@ -235,10 +293,9 @@ errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes, struct
     assert(remaining_free_space);
 
     // Create block for remaining free size
-    remaining_free_space->type = VirtualBlock_Free;
-    remaining_free_space->size = virtual_addr->size - bytes;
-    virtual_addr->size = bytes;
-    remaining_free_space->type = VirtualBlock_Free;
+    vm_block_set_size(st, remaining_free_space, virtual_addr->size - bytes);
+    vm_block_set_size(st, virtual_addr, bytes);
+    vm_block_set_type(st, remaining_free_space, VirtualBlock_Free);
     DATA_STRUCT_UNLOCK(st);
 
     *buf=(void*)ADDRESS_FROM_VM_BLOCK_KEY(key);
@@ -252,11 +309,11 @@ static
 errval_t paging_retype_block_at_address(struct paging_state *st, lvaddr_t desired_address, size_t bytes,
         enum virtual_block_type from_type, enum virtual_block_type to_type)
 {
-    CHECK_DATA_CORRECTNESS(st, false);
     lvaddr_t start_address = ROUND_DOWN((lvaddr_t) desired_address, BASE_PAGE_SIZE);
 
 
     DATA_STRUCT_LOCK(st);
+    CHECK_DATA_CORRECTNESS(st, false);
 
     if (!slab_has_freecount(&st->slabs, 6*3+2))
         st->slabs.refill_func(&st->slabs);
@@ -281,14 +338,15 @@ errval_t paging_retype_block_at_address(struct paging_state *st, lvaddr_t desire
 
         virtual_addr = add_block_after(st, key, start_address, &key);
         assert(virtual_addr);
-        previous_block->size = start_address - prev_start_addr;
-        virtual_addr->size = prev_size - previous_block->size;
+        vm_block_set_size(st, previous_block, start_address - prev_start_addr);
+        vm_block_set_size(st, virtual_addr, prev_size - previous_block->size);
+        vm_block_set_type(st, virtual_addr, from_type);
     }
 
     virtual_addr->map_flags = VREGION_FLAGS_READ_WRITE;
     if (virtual_addr->size == bytes)
     {
-        virtual_addr->type = to_type;
+        vm_block_set_type(st, virtual_addr, to_type);
         DATA_STRUCT_UNLOCK(st);
         return SYS_ERR_OK;
     }
@@ -299,10 +357,10 @@ errval_t paging_retype_block_at_address(struct paging_state *st, lvaddr_t desire
         ADDRESS_FROM_VM_BLOCK_KEY(key) + bytes, &remaining_free_space_key);
     assert(remaining_free_space);
     // Create block for remaining free size
-    remaining_free_space->type = from_type;
-    remaining_free_space->size = virtual_addr->size - bytes;
-    virtual_addr->size = bytes;
-    virtual_addr->type = to_type;
+    vm_block_set_size(st, remaining_free_space, virtual_addr->size - bytes);
+    vm_block_set_type(st, remaining_free_space, from_type);
+    vm_block_set_size(st, virtual_addr, bytes);
+    vm_block_set_type(st, virtual_addr, to_type);
     DATA_STRUCT_UNLOCK(st);
     return SYS_ERR_OK;
 }
@@ -316,7 +374,13 @@ errval_t paging_alloc_fixed_address(struct paging_state *st, lvaddr_t desired_ad
 errval_t paging_mark_as_paged_address(struct paging_state *st, lvaddr_t desired_address, size_t bytes)
 {
     return paging_retype_block_at_address(st, desired_address, bytes,
-            VirtualBlock_Allocated, VirtualBlock_Paged); //from free to allocated
+            VirtualBlock_Allocated, VirtualBlock_Paged); //from allocated to paged
+}
+
+errval_t paging_unmark_paged_address(struct paging_state *st, lvaddr_t desired_address, size_t bytes)
+{
+    return paging_retype_block_at_address(st, desired_address, bytes,
+            VirtualBlock_Paged, VirtualBlock_Allocated); //from paged to allocated
 }
 
 /**
@@ -331,13 +395,10 @@ errval_t paging_map_frame_attr(struct paging_state *st, void **buf,
     ERROR_RET1(paging_alloc(st, buf, bytes, &block));
     assert(block);
     errval_t err = paging_map_fixed_attr(st, (lvaddr_t)(*buf), frame, bytes, 0, flags, block);
-    if (err_is_fail(err))
-    {
-        block->type = VirtualBlock_Free;
-        return err;
-    }
-    block->type = VirtualBlock_Paged;
-    return SYS_ERR_OK;
+    DATA_STRUCT_LOCK(st);
+    vm_block_set_type(st, block, err_is_fail(err) ? VirtualBlock_Free : VirtualBlock_Paged);
+    DATA_STRUCT_UNLOCK(st);
+    return err;
 }
 
 errval_t
@@ -373,7 +434,6 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
 
     capaddr_t l1_slot = ARM_L1_OFFSET(vaddr);
     capaddr_t l1_slot_end = ARM_L1_OFFSET(vaddr + bytes - 1);
-    capaddr_t l2_slot = ARM_L2_OFFSET(vaddr);
     if (l1_slot != l1_slot_end)
     {
         DEBUG_PAGING("Several L2 map [%u - %u]\n",
@@ -394,22 +454,53 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
         return SYS_ERR_OK;
     }
 
+    // Allocated before taking the L2 lock: blocks_lock is never taken
+    // while holding an L2 lock.
+    struct vm_mapping* record = NULL;
+    if (block)
+    {
+        record = paging_alloc_mapping(st);
+        if (!record)
+            return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+
+    struct thread_mutex* l2_lock = PAGING_L2_LOCK(st, l1_slot);
+    thread_mutex_lock_nested(l2_lock);
+    errval_t err = paging_map_in_l2(st, vaddr, frame, bytes, offset, flags, record);
+    thread_mutex_unlock(l2_lock);
+
+    if (block)
+        paging_add_mapping(st, block, record, err_is_ok(err));
+    return err;
+}
+
+/**
+ * \brief map a frame into the L2 table of a single L1 slot, creating it if
+ * needed. Must be called with the L2 lock of that slot held.
+ */
+static errval_t paging_map_in_l2(struct paging_state *st, lvaddr_t vaddr,
+        struct capref frame, size_t bytes, size_t offset, int flags, struct vm_mapping* record)
+{
+    capaddr_t l1_slot = ARM_L1_OFFSET(vaddr);
+    capaddr_t l2_slot = ARM_L2_OFFSET(vaddr);
+    if (st->l2nodes[l1_slot].section)
+        return PAGE_ERR_SECTION_SLOT_USED;
+
     // 1. Find cap to L2 for mapping (possibly create it)
     struct capref l2_cap;
     if(!st->l2nodes[l1_slot].used){
         ERROR_RET2(arml2_alloc(st, &st->l2nodes[l1_slot].vnode_ref),
             PAGE_ERR_ALLOC_ARML2);
 
-        st->l2nodes[l1_slot].used=true;
-
-        struct capref mapping_l2_to_l1;
-        ERROR_RET2(st->slot_alloc->alloc(st->slot_alloc, &mapping_l2_to_l1),
+        ERROR_RET2(st->slot_alloc->alloc(st->slot_alloc, &st->l2nodes[l1_slot].l1_mapping),
             PAGE_ERR_ALLOC_SLOT);
 
         ERROR_RET2(vnode_map(st->l1_pagetable, st->l2nodes[l1_slot].vnode_ref,
                 l1_slot, VREGION_FLAGS_READ_WRITE,
-                0, 1, mapping_l2_to_l1),
+                0, 1, st->l2nodes[l1_slot].l1_mapping),
                 PAGE_ERR_VNODE_MAP_L2);
+        st->l2nodes[l1_slot].used=true;
+        st->l2nodes[l1_slot].mapped_pages = 0;
     }
 
     l2_cap = st->l2nodes[l1_slot].vnode_ref;
@@ -426,37 +517,263 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
         ERROR_RET1(slot_alloc(&l2_cap));
         ERROR_RET1(cap_copy(l2_cap, l2_cap_remote));
     }
+    size_t pages = ((bytes - 1) / BASE_PAGE_SIZE) + 1;
     ERROR_RET2(vnode_map(l2_cap, frame,
             l2_slot, flags,
-            offset, (((bytes- 1) / BASE_PAGE_SIZE) + 1), mapping_ref),
+            offset, pages, mapping_ref),
             PAGE_ERR_VNODE_MAP_FRAME);
     if (remote)
         ERROR_RET1(cap_destroy(l2_cap));
+    st->l2nodes[l1_slot].mapped_pages += pages;
+
+    if (record)
+        paging_init_mapping(record, vaddr, pages * BASE_PAGE_SIZE, mapping_ref, frame, false);
+    return SYS_ERR_OK;
+}
+
+static errval_t paging_map_section_unsafe(struct paging_state *st, lvaddr_t vaddr,
+        struct capref frame, int flags, struct vm_mapping* record)
+{
+    capaddr_t l1_slot = ARM_L1_OFFSET(vaddr);
+    if (st->l2nodes[l1_slot].used || st->l2nodes[l1_slot].section)
+        return PAGE_ERR_SECTION_SLOT_USED;
+
+    struct capref mapping_ref;
+    ERROR_RET2(st->slot_alloc->alloc(st->slot_alloc, &mapping_ref),
+        PAGE_ERR_ALLOC_SLOT);
+    ERROR_RET2(vnode_map(st->l1_pagetable, frame, l1_slot, flags,
+            0, 1, mapping_ref),
+            PAGE_ERR_VNODE_MAP_SECTION);
+    st->l2nodes[l1_slot].section = true;
+    if (record)
+        paging_init_mapping(record, vaddr, LARGE_PAGE_SIZE, mapping_ref, frame, true);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief map the first LARGE_PAGE_SIZE bytes of a frame as an ARMv7 section,
+ * straight into the L1 table. The L1 slot must not have an L2 table.
+ */
+errval_t paging_map_section_attr(struct paging_state *st, lvaddr_t vaddr,
+        struct capref frame, int flags, struct vm_block* block)
+{
+    DEBUG_PAGING("Paging: section 0x%08x\n", (int)vaddr);
+    if (LARGE_PAGE_OFFSET(vaddr))
+        return PAGE_ERR_VADDR_NOT_ALIGNED;
+
+    struct vm_mapping* record = NULL;
+    if (block)
+    {
+        record = paging_alloc_mapping(st);
+        if (!record)
+            return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+
+    struct thread_mutex* l2_lock = PAGING_L2_LOCK(st, ARM_L1_OFFSET(vaddr));
+    thread_mutex_lock_nested(l2_lock);
+    errval_t err = paging_map_section_unsafe(st, vaddr, frame, flags, record);
+    thread_mutex_unlock(l2_lock);
 
     if (block)
-        block->mapping = mapping_ref;
+        paging_add_mapping(st, block, record, err_is_ok(err));
+    return err;
+}
+
+/**
+ * \brief unmap a page table entry through a copy in our own cspace if the
+ * table lives in another domain's cspace, like paging_map_in_l2 does.
+ */
+static errval_t paging_vnode_unmap(struct capref vnode, struct capref mapping)
+{
+    if (get_croot_addr(vnode) == CPTR_ROOTCN)
+        return vnode_unmap(vnode, mapping);
+
+    struct capref local;
+    ERROR_RET1(slot_alloc(&local));
+    ERROR_RET1(cap_copy(local, vnode));
+    errval_t err = vnode_unmap(local, mapping);
+    cap_destroy(local);
+    return err;
+}
+
+/**
+ * \brief unmap an L2 table that does not map anything anymore, and free it.
+ * Must be called with the L2 lock of that slot held.
+ */
+static errval_t paging_free_l2(struct paging_state *st, capaddr_t l1_slot)
+{
+    struct l2_vnode_ref* l2 = &st->l2nodes[l1_slot];
+    DEBUG_PAGING("Freeing L2 table of slot %u\n", (int)l1_slot);
+    ERROR_RET2(paging_vnode_unmap(st->l1_pagetable, l2->l1_mapping),
+        PAGE_ERR_VNODE_UNMAP);
+    ERROR_RET1(cap_destroy(l2->l1_mapping));
+    ERROR_RET1(cap_destroy(l2->vnode_ref));
+    l2->used = false;
     return SYS_ERR_OK;
 }
 
 /**
- * \brief unmap a user provided frame, and return the VA of the mapped
- *        frame in `buf`.
+ * \brief unmap a single mapping. Frames allocated by the pagefault handler
+ * are destroyed and their RAM goes back to init.
  */
-errval_t paging_unmap(struct paging_state *st, const void *region)
+static errval_t paging_unmap_one(struct paging_state *st, struct vm_mapping* m)
 {
-    lvaddr_t address_to_free=(lvaddr_t)region;
+    capaddr_t l1_slot = ARM_L1_OFFSET(m->vaddr);
+    struct l2_vnode_ref* l2 = &st->l2nodes[l1_slot];
+    struct thread_mutex* l2_lock = PAGING_L2_LOCK(st, l1_slot);
+
+    thread_mutex_lock_nested(l2_lock);
+    errval_t err;
+    if (m->section)
+    {
+        err = paging_vnode_unmap(st->l1_pagetable, m->mapping);
+        if (err_is_ok(err))
+            l2->section = false;
+    }
+    else
+    {
+        err = paging_vnode_unmap(l2->vnode_ref, m->mapping);
+        if (err_is_ok(err))
+        {
+            l2->mapped_pages -= m->bytes / BASE_PAGE_SIZE;
+            if (!l2->mapped_pages)
+                err = paging_free_l2(st, l1_slot);
+        }
+    }
+    thread_mutex_unlock(l2_lock);
+    if (err_is_fail(err))
+        return err_push(err, PAGE_ERR_VNODE_UNMAP);
+
+    ERROR_RET1(cap_destroy(m->mapping));
+    if (m->owned)
+    {
+        ERROR_RET1(cap_destroy(m->frame));
+        ERROR_RET1(ram_free(m->ram, m->bytes));
+        thread_mutex_lock(&st->page_fault_lock);
+        st->fault_stats.freed += m->bytes / BASE_PAGE_SIZE;
+        thread_mutex_unlock(&st->page_fault_lock);
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief unmap a list of mappings detached from their block, and free the
+ * list. Runs without blocks_lock held, like the pagefault handler.
+ */
+static errval_t paging_unmap_list(struct paging_state *st, struct vm_mapping* list)
+{
+    errval_t err = SYS_ERR_OK;
+    while (list)
+    {
+        struct vm_mapping* m = list;
+        list = m->next;
+        errval_t unmap_err = paging_unmap_one(st, m);
+        if (err_is_fail(unmap_err))
+        {
+            DEBUG_ERR(unmap_err, "paging_unmap_one 0x%08x", (int)m->vaddr);
+            err = unmap_err;
+        }
+        DATA_STRUCT_LOCK(st);
+        slab_free(&st->mapping_slabs, m);
+        DATA_STRUCT_UNLOCK(st);
+    }
+    return err;
+}
+
+/**
+ * \brief unmap the Paged block at `start` and free it. Called with
+ * blocks_lock held, which is dropped while unmapping. Meanwhile the block
+ * is Unmapping: faults on it fail, and it is not handed out again.
+ */
+static errval_t paging_unmap_block(struct paging_state *st, lvaddr_t start, struct vm_block* block)
+{
+    struct vm_mapping* mappings = block->mappings;
+    block->mappings = NULL;
+    vm_block_set_type(st, block, VirtualBlock_Unmapping);
+    DATA_STRUCT_UNLOCK(st);
+
+    errval_t err = paging_unmap_list(st, mappings);
+
+    DATA_STRUCT_LOCK(st);
     vm_block_key_t key;
-    struct vm_block* virtual_addr = find_block_before(st, address_to_free, &key);
-    if (!virtual_addr || ADDRESS_FROM_VM_BLOCK_KEY(key) != address_to_free)
-        return PAGE_ERR_NOT_MAPPED;
-
-    // TODO: Need to store several mappings in that case.
-    // -> Linked list ie another slab etc...
-    assert(ARM_L1_OFFSET(address_to_free) == ARM_L1_OFFSET(address_to_free + virtual_addr->size - 1) &&
-        "Unmap for mappings spawning over different L2 VNodes not implemented yet.");
-    ERROR_RET1(vnode_unmap(st->l2nodes[ARM_L1_OFFSET(address_to_free)].vnode_ref,
-        virtual_addr->mapping));
-    virtual_addr->type = VirtualBlock_Free;
+    block = find_block_before(st, start, &key);
+    assert(block && ADDRESS_FROM_VM_BLOCK_KEY(key) == start);
+    vm_block_set_type(st, block, VirtualBlock_Free);
     vm_block_merge_free_neighbors(st, key);
-    return SYS_ERR_OK;
+    return err;
+}
+
+errval_t paging_unmap(struct paging_state *st, const void *region)
+{
+    lvaddr_t start = (lvaddr_t)region;
+    DEBUG_PAGING("paging_unmap: 0x%08x\n", (int)start);
+
+    DATA_STRUCT_LOCK(st);
+    CHECK_DATA_CORRECTNESS(st, false);
+    vm_block_key_t key;
+    struct vm_block* block = find_block_before(st, start, &key);
+    if (!block || ADDRESS_FROM_VM_BLOCK_KEY(key) != start ||
+        block->type == VirtualBlock_Free || block->type == VirtualBlock_Unmapping)
+    {
+        DATA_STRUCT_UNLOCK(st);
+        return PAGE_ERR_NOT_BLOCK_START;
+    }
+    errval_t err = paging_unmap_block(st, start, block);
+    DATA_STRUCT_UNLOCK(st);
+    return err;
+}
+
+/*
+ * Walks the range block by block, looking each one up again after the
+ * previous step, as unmapping drops blocks_lock and merges free blocks.
+ */
+errval_t paging_free_range(struct paging_state *st, lvaddr_t base, size_t bytes)
+{
+    lvaddr_t addr = ROUND_UP(base, BASE_PAGE_SIZE);
+    lvaddr_t end = ROUND_DOWN(base + bytes, BASE_PAGE_SIZE);
+    DEBUG_PAGING("paging_free_range: 0x%08x..0x%08x\n", (int)addr, (int)end);
+
+    errval_t err = SYS_ERR_OK;
+    DATA_STRUCT_LOCK(st);
+    CHECK_DATA_CORRECTNESS(st, false);
+    while (addr < end && err_is_ok(err))
+    {
+        if (!slab_has_freecount(&st->slabs, 6*3+2))
+            st->slabs.refill_func(&st->slabs);
+        PAGING_SLAB_REFILL(st);
+
+        vm_block_key_t key;
+        struct vm_block* block = find_block_before(st, addr, &key);
+        lvaddr_t block_start = block ? ADDRESS_FROM_VM_BLOCK_KEY(key) : 0;
+        if (!block || block_start + block->size <= addr)
+        {
+            err = PAGE_ERR_NOT_MAPPED;
+            break;
+        }
+        lvaddr_t block_end = block_start + block->size;
+
+        switch (block->type)
+        {
+            case VirtualBlock_Free:
+            case VirtualBlock_Unmapping:
+                break;
+            case VirtualBlock_Paged:
+                if (block_start >= addr && block_end <= end)
+                    err = paging_unmap_block(st, block_start, block);
+                break;
+            case VirtualBlock_Allocated:
+                block_end = MIN(block_end, end);
+                err = paging_retype_block_at_address(st, addr, block_end - addr,
+                    VirtualBlock_Allocated, VirtualBlock_Free);
+                if (err_is_ok(err))
+                {
+                    find_block_before(st, addr, &key);
+                    vm_block_merge_free_neighbors(st, key);
+                }
+                break;
+        }
+        addr = block_end;
+    }
+    DATA_STRUCT_UNLOCK(st);
+    return err;
 }
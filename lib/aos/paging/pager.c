@@ -2,6 +2,8 @@
 #include <aos/paging.h>
 #include <aos/except.h>
 #include <aos/slab.h>
+#include <aos/dispatcher_arch.h>
+#include <aos/curdispatcher_arch.h>
 #include "threads_priv.h"
 #include <mm/mm.h>
 
@@ -13,68 +15,467 @@
 
 static void paging_thread_exception_handler(enum exception_type type, int val1, void* data, union registers_arm* registers, void ** whatever);
 
-static errval_t handle_pagefault(void *_addr)
+/**
+ * \brief Allocates a page-sized frame for the pagefault handler.
+ * RAM is fetched from init PAGING_FAULT_RAM_BATCH caps at a time.
+ * The RAM cap is kept, to give it back when the page is unmapped.
+ */
+static errval_t pagefault_frame_alloc(struct paging_state* st, struct capref* frame,
+    struct capref* ram)
+{
+    thread_mutex_lock(&st->page_fault_lock);
+    if (!st->fault_ram_count)
+    {
+        errval_t err = ram_alloc_batch(st->fault_ram, PAGING_FAULT_RAM_BATCH, BASE_PAGE_SIZE);
+        if (err_is_fail(err))
+        {
+            thread_mutex_unlock(&st->page_fault_lock);
+            return err;
+        }
+        st->fault_ram_count = PAGING_FAULT_RAM_BATCH;
+    }
+    *ram = st->fault_ram[--st->fault_ram_count];
+    thread_mutex_unlock(&st->page_fault_lock);
+
+    ERROR_RET1(slot_alloc(frame));
+    return cap_retype(*frame, *ram, 0, ObjType_Frame, BASE_PAGE_SIZE, 1);
+}
+
+/**
+ * \brief Hands the frame of the mapping at vaddr over to the block, so
+ * that unmapping the block frees it.
+ */
+static void pagefault_own_mapping(struct paging_state* st, struct vm_block* block,
+    lvaddr_t vaddr, struct capref frame, struct capref ram)
+{
+    DATA_STRUCT_LOCK(st);
+    for (struct vm_mapping* m = block->mappings; m; m = m->next)
+    {
+        if (m->vaddr != vaddr)
+            continue;
+        m->frame = frame;
+        m->ram = ram;
+        m->owned = true;
+        break;
+    }
+    DATA_STRUCT_UNLOCK(st);
+}
+
+/**
+ * \brief Backs a whole 1 MiB aligned section with one section mapping.
+ */
+static errval_t pagefault_map_section(struct paging_state* st, lvaddr_t section,
+    struct vm_block* block)
+{
+    struct capref ram, frame;
+    ERROR_RET1(ram_alloc_aligned(&ram, LARGE_PAGE_SIZE, LARGE_PAGE_SIZE));
+    ERROR_RET1(slot_alloc(&frame));
+    ERROR_RET1(cap_retype(frame, ram, 0, ObjType_Frame, LARGE_PAGE_SIZE, 1));
+    errval_t err = paging_map_section_attr(st, section, frame,
+        VREGION_FLAGS_READ_WRITE, block);
+    if (err_is_fail(err))
+    {
+        cap_destroy(frame);
+        ram_free(ram, LARGE_PAGE_SIZE);
+        return err;
+    }
+    pagefault_own_mapping(st, block, section, frame, ram);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Maps [start, end) with a single frame.
+ */
+static errval_t pagefault_map_cluster(struct paging_state* st, lvaddr_t start, lvaddr_t end,
+    struct vm_block* block)
+{
+    struct capref frame, ram;
+    size_t bytes = end - start;
+    if (bytes == BASE_PAGE_SIZE)
+    {
+        ERROR_RET1(pagefault_frame_alloc(st, &frame, &ram));
+    }
+    else
+    {
+        ERROR_RET1(ram_alloc(&ram, bytes));
+        ERROR_RET1(slot_alloc(&frame));
+        ERROR_RET1(cap_retype(frame, ram, 0, ObjType_Frame, bytes, 1));
+    }
+    errval_t err = paging_map_fixed_attr(st, start, frame, bytes, 0,
+        VREGION_FLAGS_READ_WRITE, block);
+    if (err_is_fail(err))
+    {
+        cap_destroy(frame);
+        ram_free(ram, bytes);
+        return err;
+    }
+    pagefault_own_mapping(st, block, start, frame, ram);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Returns the in-flight fault covering addr, if any.
+ * Must be called with blocks_lock held.
+ */
+static struct paging_fault_inflight* pagefault_find_inflight(struct paging_state* st, lvaddr_t addr)
+{
+    for (int i = 0; i < PAGING_MAX_INFLIGHT_FAULTS; ++i)
+    {
+        struct paging_fault_inflight* f = &st->fault_inflight[i];
+        if (f->active && f->start <= addr && addr < f->end)
+            return f;
+    }
+    return NULL;
+}
+
+static struct paging_fault_inflight* pagefault_alloc_inflight(struct paging_state* st)
+{
+    for (int i = 0; i < PAGING_MAX_INFLIGHT_FAULTS; ++i)
+        if (!st->fault_inflight[i].active)
+            return &st->fault_inflight[i];
+    return NULL;
+}
+
+/**
+ * \brief Picks what to map for a fault at addr in the lazily allocated
+ * block [block_start, block_end): the whole section, or the fault-around
+ * cluster clamped to the block.
+ */
+static bool pagefault_range(struct paging_state* st, lvaddr_t addr,
+    lvaddr_t block_start, lvaddr_t block_end, lvaddr_t* start, lvaddr_t* end)
+{
+    lvaddr_t section = ROUND_DOWN(addr, LARGE_PAGE_SIZE);
+    if (st->fault_sections && block_start <= section &&
+        section + LARGE_PAGE_SIZE <= block_end &&
+        !st->l2nodes[ARM_L1_OFFSET(section)].used)
+    {
+        *start = section;
+        *end = section + LARGE_PAGE_SIZE;
+        return true;
+    }
+    size_t cluster = st->fault_around;
+    *start = MAX(ROUND_DOWN(addr, cluster), block_start);
+    *end = MIN(ROUND_DOWN(addr, cluster) + cluster, block_end);
+    return false;
+}
+
+/**
+ * \brief Maps the claimed range. Runs without blocks_lock held.
+ */
+static errval_t pagefault_map(struct paging_state* st, lvaddr_t addr,
+    lvaddr_t* start, lvaddr_t* end, bool section, struct vm_block* block)
+{
+    if (section)
+    {
+        errval_t err = pagefault_map_section(st, *start, block);
+        if (err_is_ok(err))
+        {
+            thread_mutex_lock(&st->page_fault_lock);
+            ++st->fault_stats.sections;
+            st->fault_stats.pages += LARGE_PAGE_SIZE / BASE_PAGE_SIZE;
+            thread_mutex_unlock(&st->page_fault_lock);
+            return SYS_ERR_OK;
+        }
+        // No aligned MiB left: fall back to a cluster inside the section.
+        // The rest of the section stays claimed as Paged, so give it back.
+        PF_DEBUG("[Pagefault@0x%08x] Section failed: %s\n", addr, err_getstring(err));
+        lvaddr_t section_start = *start;
+        lvaddr_t section_end = *end;
+        *start = ROUND_DOWN(addr, st->fault_around);
+        *end = *start + st->fault_around;
+        if (*start > section_start)
+            ERROR_RET1(paging_unmark_paged_address(st, section_start, *start - section_start));
+        if (*end < section_end)
+            ERROR_RET1(paging_unmark_paged_address(st, *end, section_end - *end));
+        // Unmarking split the claimed block
+        vm_block_key_t key;
+        DATA_STRUCT_LOCK(st);
+        block = find_block_before(st, *start, &key);
+        DATA_STRUCT_UNLOCK(st);
+    }
+
+    ERROR_RET1(pagefault_map_cluster(st, *start, *end, block));
+    thread_mutex_lock(&st->page_fault_lock);
+    if (*end - *start > BASE_PAGE_SIZE)
+        ++st->fault_stats.clusters;
+    st->fault_stats.pages += (*end - *start) / BASE_PAGE_SIZE;
+    thread_mutex_unlock(&st->page_fault_lock);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Returns the copy-on-write page at the page aligned addr, if any.
+ */
+static struct paging_cow_page* cow_find_page(struct paging_cow_table* table, lvaddr_t addr)
+{
+    size_t low = 0;
+    size_t high = table->num_pages;
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (table->pages[mid].vaddr < addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low < table->num_pages && table->pages[low].vaddr == addr)
+        return &table->pages[low];
+    return NULL;
+}
+
+/*
+ * Runs disabled, on the dispatcher stack: it may only touch the table, its
+ * pages and its reserve, all of them private to this domain, so it works
+ * from the first instruction of the domain on.
+ */
+bool paging_cow_fault_disabled(dispatcher_handle_t handle, lvaddr_t addr, bool disabled)
+{
+    struct dispatcher_generic* disp_gen = get_dispatcher_generic(handle);
+    struct paging_cow_table* table = disp_gen->cow_table;
+    if (!table)
+        return false;
+    struct paging_cow_page* page = cow_find_page(table, ROUND_DOWN(addr, BASE_PAGE_SIZE));
+    if (!page || !page->shared)
+        return false;
+
+    // Threads that can take a fault have the pager refill the reserve
+    // before it runs out
+    struct thread* thread = disp_gen->current;
+    bool can_refill = !disabled && thread && thread->exception_handler &&
+        !thread->in_exception;
+    if (!table->num_reserve ||
+        (can_refill && table->num_reserve <= PAGING_COW_RESERVE_LOW))
+        return false;
+
+    struct paging_cow_frame* copy = &table->reserve[table->num_reserve - 1];
+    memcpy((void*)copy->vaddr, (void*)page->vaddr, BASE_PAGE_SIZE);
+
+    // The mapping's slot is reused for the copy. Once the template page is
+    // unmapped there is no way back, the table does not hold its frame.
+    if (err_is_fail(vnode_unmap(page->l2, page->mapping)))
+        return false;
+    if (err_is_fail(cap_delete(page->mapping)) ||
+        err_is_fail(vnode_map(page->l2, copy->frame, ARM_L2_OFFSET(page->vaddr),
+            VREGION_FLAGS_READ_WRITE, copy->offset, 1, page->mapping)))
+        disp_assert_fail("copy-on-write page left unmapped", __FILE__, __func__, "");
+
+    table->num_reserve--;
+    page->shared = false;
+    page->copy = *copy;
+    if (!capref_is_null(copy->ram) && table->num_aliases < PAGING_COW_RESERVE)
+        table->aliases[table->num_aliases++] = page - table->pages;
+    table->breaks++;
+    return true;
+}
+
+/**
+ * \brief Tops the copy-on-write reserve up with pages of our own. Faults
+ * this takes are served from what is left of the reserve. First unmaps
+ * the aliases of our pages that copies went to since the last refill;
+ * their frame and RAM stay with the copy-on-write page.
+ */
+static errval_t pagefault_cow_refill(struct paging_state* st, struct paging_cow_table* table)
 {
-    // TODO: MT environment: handle 2 pagefault at same addr, same time, diff threads
-    // TODO: Handle unmap
+    uint32_t aliases[PAGING_COW_RESERVE];
+    dispatcher_handle_t handle = disp_disable();
+    size_t num_aliases = table->num_aliases;
+    memcpy(aliases, table->aliases, num_aliases * sizeof(uint32_t));
+    table->num_aliases = 0;
+    disp_enable(handle);
+    for (size_t i = 0; i < num_aliases; ++i)
+        ERR_CHECK("unmapping a copy-on-write alias",
+            paging_unmap(st, (void*)table->pages[aliases[i]].copy.vaddr));
+
+    while (table->num_reserve < PAGING_COW_RESERVE)
+    {
+        struct capref frame, ram;
+        void* vaddr;
+        ERROR_RET1(pagefault_frame_alloc(st, &frame, &ram));
+        errval_t err = paging_map_frame(st, &vaddr, BASE_PAGE_SIZE, frame, NULL, NULL);
+        if (err_is_fail(err))
+        {
+            cap_destroy(frame);
+            ram_free(ram, BASE_PAGE_SIZE);
+            return err;
+        }
+
+        handle = disp_disable();
+        bool room = table->num_reserve < PAGING_COW_RESERVE;
+        if (room)
+        {
+            struct paging_cow_frame* copy = &table->reserve[table->num_reserve];
+            copy->frame = frame;
+            copy->ram = ram;
+            copy->offset = 0;
+            copy->vaddr = (lvaddr_t)vaddr;
+            table->num_reserve++;
+        }
+        disp_enable(handle);
+
+        // Another thread filled it up meanwhile
+        if (!room)
+        {
+            ERROR_RET1(paging_unmap(st, vaddr));
+            ERROR_RET1(cap_destroy(frame));
+            return ram_free(ram, BASE_PAGE_SIZE);
+        }
+    }
+    PF_DEBUG("[Pagefault] Copy-on-write reserve refilled\n");
+    return SYS_ERR_OK;
+}
 
+/*
+ * Locking: blocks_lock is only held to look up the faulting block and to
+ * claim the range to map, which is marked Paged right away and recorded
+ * as in flight. Frame allocation and mapping run unlocked, so faults on
+ * other ranges proceed in parallel; a thread faulting on an in-flight
+ * range waits on fault_done instead of mapping it twice. page_fault_lock
+ * only guards the prefetched RAM and the statistics.
+ * A fault from inside a paging call, with blocks_lock already held, can
+ * not wait: the wait would only drop the inner level of the lock. It maps
+ * inline instead, and other threads stay out until the outer call is done.
+ */
+static errval_t handle_pagefault(void *_addr, enum pagefault_exception_type type)
+{
     lvaddr_t addr = ROUND_DOWN((lvaddr_t)_addr, BASE_PAGE_SIZE);
     PF_DEBUG("[Pagefault@0x%08x] Entering callback\n", addr);
     struct paging_state* st = get_current_paging_state();
 
-    thread_mutex_lock(&st->page_fault_lock);
+    // Copy-on-write pages are copied by the dispatcher, which sends write
+    // faults here when its reserve runs low. Once refilled, the write is
+    // retried and copies the page.
+    struct paging_cow_table* cow = get_dispatcher_generic(curdispatcher())->cow_table;
+    if (type == PAGEFLT_WRITE && cow && cow_find_page(cow, addr))
+    {
+        errval_t err = pagefault_cow_refill(st, cow);
+        if (err_is_fail(err))
+            return err_push(err, LIB_ERR_VSPACE_PAGEFAULT_HANDER);
+        return SYS_ERR_OK;
+    }
+
+    bool nested = st->blocks_lock.holder == thread_self();
     DATA_STRUCT_LOCK(st);
 
     // 1. Ensure we are on an allocated vmem block
     // ie block_base <= addr < block_base + block_size
     vm_block_key_t key;
-    struct vm_block* block = find_block_before(st, addr, &key);
-    if (!block || ADDRESS_FROM_VM_BLOCK_KEY(key) + block->size < addr){
-        debug_printf("Address not in any block! This is SEGFAULT!\n");
-        thread_mutex_unlock(&st->page_fault_lock);
-        DATA_STRUCT_UNLOCK(st);
-        return LIB_ERR_VSPACE_PAGEFAULT_ADDR_NOT_FOUND;
-    }
-    assert(ADDRESS_FROM_VM_BLOCK_KEY(key) <= addr);
+    struct vm_block* block;
+    while (true)
+    {
+        block = find_block_before(st, addr, &key);
+        if (!block || ADDRESS_FROM_VM_BLOCK_KEY(key) + block->size <= addr){
+            debug_printf("Address not in any block! This is SEGFAULT!\n");
+            DATA_STRUCT_UNLOCK(st);
+            return LIB_ERR_VSPACE_PAGEFAULT_ADDR_NOT_FOUND;
+        }
+        assert(ADDRESS_FROM_VM_BLOCK_KEY(key) <= addr);
 
-    PF_DEBUG("Found block type: %d\n", block->type);
+        PF_DEBUG("Found block type: %d\n", block->type);
 
-    if (block->type == VirtualBlock_Free){
-        debug_printf("Address not allocated! This is SEGFAULT!\n");
-        thread_mutex_unlock(&st->page_fault_lock);
-        DATA_STRUCT_UNLOCK(st);
-        return LIB_ERR_VSPACE_PAGEFAULT_ADDR_NOT_FOUND;
-    }
+        if (block->type == VirtualBlock_Free || block->type == VirtualBlock_Unmapping){
+            debug_printf("Address not allocated! This is SEGFAULT!\n");
+            DATA_STRUCT_UNLOCK(st);
+            return LIB_ERR_VSPACE_PAGEFAULT_ADDR_NOT_FOUND;
+        }
 
-    if (block->type == VirtualBlock_Paged){
-        debug_printf("Address already paged, returning!\n");
-        thread_mutex_unlock(&st->page_fault_lock);
-        DATA_STRUCT_UNLOCK(st);
-        return SYS_ERR_OK;
+        // Another thread is mapping this page, or we are out of
+        // in-flight slots: wait and look again
+        if (block->type == VirtualBlock_Paged && pagefault_find_inflight(st, addr))
+        {
+            if (nested){
+                debug_printf("Nested fault on a range being mapped!\n");
+                DATA_STRUCT_UNLOCK(st);
+                return PAGE_ERR_FAULT_NESTED;
+            }
+            thread_cond_wait(&st->fault_done, &st->blocks_lock);
+            continue;
+        }
+        if (block->type == VirtualBlock_Allocated && !nested && !pagefault_alloc_inflight(st))
+        {
+            thread_cond_wait(&st->fault_done, &st->blocks_lock);
+            continue;
+        }
+
+        if (block->type == VirtualBlock_Paged){
+            PF_DEBUG("Address already paged, returning!\n");
+            DATA_STRUCT_UNLOCK(st);
+            return SYS_ERR_OK;
+        }
+        break;
     }
 
     PF_DEBUG("[Pagefault@0x%08x] Block found @ 0x%08x [size 0x%08x]\n",
         addr, (int)ADDRESS_FROM_VM_BLOCK_KEY(key), block->size);
 
-    // 2. It is the case: map a new frame here then
-    struct capref frame;
-    size_t actualsize;
-    ERROR_RET2(frame_alloc(&frame, BASE_PAGE_SIZE, &actualsize),
-        LIB_ERR_VSPACE_PAGEFAULT_HANDER);
-    PF_DEBUG("[Pagefault@0x%08x] Frame allocated\n", addr);
-    ERROR_RET2(paging_map_fixed_attr(st, addr,
-        frame, BASE_PAGE_SIZE, 0,
-        VREGION_FLAGS_READ_WRITE, NULL),
-        LIB_ERR_VSPACE_PAGEFAULT_HANDER);
+    // 2. Claim the range and map it without holding blocks_lock
+    lvaddr_t start, end;
+    bool section = pagefault_range(st, addr, ADDRESS_FROM_VM_BLOCK_KEY(key),
+        ADDRESS_FROM_VM_BLOCK_KEY(key) + block->size, &start, &end);
+    errval_t err = paging_mark_as_paged_address(st, start, end - start);
+    if (err_is_fail(err))
+    {
+        DATA_STRUCT_UNLOCK(st);
+        return err_push(err, LIB_ERR_VSPACE_PAGEFAULT_HANDER);
+    }
+    // The mappings are recorded in the claimed block, for unmapping
+    block = find_block_before(st, start, &key);
+    assert(block && ADDRESS_FROM_VM_BLOCK_KEY(key) == start);
+    // Only a nested fault goes without a slot, holding the lock throughout
+    struct paging_fault_inflight* inflight = pagefault_alloc_inflight(st);
+    assert(inflight || nested);
+    if (inflight)
+    {
+        inflight->start = start;
+        inflight->end = end;
+        inflight->active = true;
+    }
+    DATA_STRUCT_UNLOCK(st);
+
+    thread_mutex_lock(&st->page_fault_lock);
+    ++st->fault_stats.faults;
+    thread_mutex_unlock(&st->page_fault_lock);
+
+    err = pagefault_map(st, addr, &start, &end, section, block);
+    PF_DEBUG("[Pagefault@0x%08x] Mapped 0x%08x..0x%08x\n", addr, start, end);
 
-    paging_mark_as_paged_address(st, addr, BASE_PAGE_SIZE);
+    // 3. Release the claim and wake up threads waiting for it
+    DATA_STRUCT_LOCK(st);
+    if (err_is_fail(err))
+        paging_unmark_paged_address(st, start, end - start);
+    if (inflight)
+        inflight->active = false;
+    thread_cond_broadcast(&st->fault_done);
+    DATA_STRUCT_UNLOCK(st);
 
     PF_DEBUG("[Pagefault@0x%08x] Finished\n", addr);
+    if (err_is_fail(err))
+        return err_push(err, LIB_ERR_VSPACE_PAGEFAULT_HANDER);
+    return SYS_ERR_OK;
+}
+
+errval_t paging_set_fault_around(struct paging_state *st, size_t bytes, bool sections)
+{
+    if (bytes < BASE_PAGE_SIZE || bytes > PAGING_FAULT_AROUND_MAX ||
+        (bytes & (bytes - 1)))
+        return PAGE_ERR_FAULT_AROUND_SIZE;
+
+    thread_mutex_lock(&st->page_fault_lock);
+    st->fault_around = bytes;
+    st->fault_sections = sections;
     thread_mutex_unlock(&st->page_fault_lock);
-    DATA_STRUCT_UNLOCK(st);
     return SYS_ERR_OK;
 }
 
+void paging_get_fault_stats(struct paging_state *st, struct paging_fault_stats *stats)
+{
+    thread_mutex_lock(&st->page_fault_lock);
+    *stats = st->fault_stats;
+    thread_mutex_unlock(&st->page_fault_lock);
+
+    struct paging_cow_table* cow = get_dispatcher_generic(curdispatcher())->cow_table;
+    stats->cow_breaks = cow ? cow->breaks : 0;
+}
+
 static void paging_thread_exception_handler(enum exception_type type,
     int subtype,
     void *addr, union registers_arm *regs,
@@ -84,12 +485,13 @@ static void paging_thread_exception_handler(enum exception_type type,
     {
         case EXCEPT_PAGEFAULT:
         {
-            errval_t err = handle_pagefault(addr);
+            errval_t err = handle_pagefault(addr, subtype);
             if (err_is_fail(err))
             {
-                DEBUG_ERR(err, "handle_pagefault");
+                // Fatal, nested faults included: don't leave the thread
+                // spinning in its exception handler
                 backtrace_from_fp(regs->named.r11);
-                while(true);
+                USER_PANIC_ERR(err, "unhandled page fault at 0x%08x", (int)addr);
             }
             break;
         }
@@ -101,23 +503,49 @@ static void paging_thread_exception_handler(enum exception_type type,
 
 
 #define INTERNAL_STACK_SIZE (1<<14)
-static char internal_ex_stack[INTERNAL_STACK_SIZE];
+// Exception stack of the initial thread, before the heap is usable
+static char internal_ex_stack[INTERNAL_STACK_SIZE]
+__attribute__((aligned(BASE_PAGE_SIZE)));
 
 
 /**
  * \brief Initialize per-thread paging state
+ * Every thread gets its own exception stack, so that concurrent faults do
+ * not share one. The stack is touched up front: the fault handler can not
+ * take a fault on its own stack. This includes copy-on-write faults on the
+ * internal stack, which is part of .bss. A malloc'd stack is not page
+ * aligned and spans one more page, which holds its last bytes.
  */
-void paging_init_onthread(struct thread *t)
+errval_t paging_init_onthread(struct thread *t)
 {
     char* ex_stack = internal_ex_stack;
-    char* ex_stack_top = ex_stack + INTERNAL_STACK_SIZE;
 
     if (!t)
         t = thread_self();
+    else
+    {
+        ex_stack = malloc(INTERNAL_STACK_SIZE);
+        if (!ex_stack)
+            return LIB_ERR_MALLOC_FAIL;
+    }
+    for (size_t off = 0; off < INTERNAL_STACK_SIZE; off += BASE_PAGE_SIZE)
+        ex_stack[off] = 0;
+    ex_stack[INTERNAL_STACK_SIZE - 1] = 0;
 
     t->exception_handler = paging_thread_exception_handler;
     t->exception_stack = ex_stack;
-    t->exception_stack_top = ex_stack_top;
+    t->exception_stack_top = ex_stack + INTERNAL_STACK_SIZE;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Releases the per-thread paging state of a thread being freed
+ */
+void paging_destroy_onthread(struct thread *t)
+{
+    if (t->exception_stack != internal_ex_stack)
+        free(t->exception_stack);
+    t->exception_stack = t->exception_stack_top = NULL;
 }
 
 /**
@@ -24,6 +24,14 @@ static errval_t ram_alloc_remote(struct capref *ret, size_t size, size_t alignme
     return aos_rpc_get_ram_cap(rpc, size, alignment, ret, &actual_size);
 }
 
+/* remote version of ram_free: init revokes the cap, which also deletes our copy */
+static errval_t ram_free_remote(struct capref cap, size_t size)
+{
+    struct aos_rpc* rpc = get_init_rpc();
+    ERROR_RET1(aos_rpc_free_ram_cap(rpc, cap, size));
+    return slot_free(cap);
+}
+
 void ram_set_affinity(uint64_t minbase, uint64_t maxlimit)
 {
     struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
@@ -97,6 +105,50 @@ errval_t ram_alloc(struct capref *ret, size_t size)
     return ram_alloc_aligned(ret, size, BASE_PAGE_SIZE);
 }
 
+/**
+ * \brief Allocates `count` RAM caps of `size` bytes each.
+ * Remote allocations are fetched in batches of up to RPC_RAM_CAP_BATCH_MAX
+ * caps per round-trip. Local allocators (init) are simply called in a loop.
+ */
+errval_t ram_alloc_batch(struct capref *retcaps, size_t count, size_t size)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    assert(ram_alloc_state->ram_alloc_func != NULL);
+
+    if (ram_alloc_state->ram_alloc_func != ram_alloc_remote)
+    {
+        for (size_t i = 0; i < count; ++i)
+            ERROR_RET1(ram_alloc_state->ram_alloc_func(&retcaps[i], size, BASE_PAGE_SIZE));
+        return SYS_ERR_OK;
+    }
+
+    struct aos_rpc* rpc = get_init_rpc();
+    while (count)
+    {
+        size_t chunk = MIN(count, RPC_RAM_CAP_BATCH_MAX);
+        ERROR_RET1(aos_rpc_get_ram_cap_batch(rpc, chunk, size, BASE_PAGE_SIZE, retcaps));
+        retcaps += chunk;
+        count -= chunk;
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Gives a RAM capability back to the memory server.
+ * Every copy and descendant of the cap is revoked.
+ *
+ * \param cap  RAM capability as returned by ram_alloc
+ * \param size Size of the capability, in bytes
+ */
+errval_t ram_free(struct capref cap, size_t size)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    // Before the memory server is connected, the memory is simply leaked
+    if (ram_alloc_state->ram_free_func == NULL)
+        return cap_destroy(cap);
+    return ram_alloc_state->ram_free_func(cap, size);
+}
+
 errval_t ram_available(genpaddr_t *available, genpaddr_t *total)
 {
     // TODO: Implement protocol to check amount of ram available with memserv
@@ -114,6 +166,7 @@ void ram_alloc_init(void)
     ram_alloc_state->mem_connect_err  = 0;
     thread_mutex_init(&ram_alloc_state->ram_alloc_lock);
     ram_alloc_state->ram_alloc_func   = NULL;
+    ram_alloc_state->ram_free_func    = NULL;
     ram_alloc_state->default_minbase  = 0;
     ram_alloc_state->default_maxlimit = 0;
     ram_alloc_state->base_capnum      = 0;
@@ -136,6 +189,17 @@ errval_t ram_alloc_set(ram_alloc_func_t local_allocator)
     }
 
     ram_alloc_state->ram_alloc_func = ram_alloc_remote;
+    ram_alloc_state->ram_free_func = ram_free_remote;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Set ram_free to the function freeing RAM of a local allocator
+ */
+errval_t ram_free_set(ram_free_func_t local_free)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    ram_alloc_state->ram_free_func = local_free;
     return SYS_ERR_OK;
 }
 
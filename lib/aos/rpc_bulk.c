@@ -0,0 +1,75 @@
+/**
+ * \file
+ * \brief Byte rings on an aos_rpc session's shared buffer
+ */
+
+#include <aos/rpc_bulk.h>
+#include <arch/arm/barrelfish_kpi/asm_inlines_arch.h>
+
+static void ring_init(struct rpc_bulk_ring* ring, void* memory, size_t bytes)
+{
+    ring->shared = memory;
+    ring->size = bytes > sizeof(struct rpc_bulk_shared) ? bytes - sizeof(struct rpc_bulk_shared) : 0;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+errval_t rpc_bulk_init(struct rpc_bulk* bulk, void* buffer, size_t bytes, bool is_client)
+{
+    size_t half = ROUND_DOWN(bytes / 2, RPC_BULK_CACHE_LINE);
+    struct rpc_bulk_ring* to_server = is_client ? &bulk->tx : &bulk->rx;
+    struct rpc_bulk_ring* to_client = is_client ? &bulk->rx : &bulk->tx;
+    ring_init(to_server, buffer, half);
+    ring_init(to_client, buffer + half, half);
+    if (!bulk->tx.size)
+        return RPC_ERR_BUF_TOO_SMALL;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Copies as much of $data as fits, wrapping around the ring end.
+ * Fails if the consumer published an index outside the ring.
+ */
+errval_t rpc_bulk_write(struct rpc_bulk_ring* ring, const void* data, size_t len, size_t* written)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = ring->shared->tail;
+    if (tail >= ring->size)
+        return RPC_ERR_INVALID_PROTOCOL;
+    // The consumer must be done with the bytes before we overwrite them
+    dmb();
+    // One byte stays free to tell a full ring from an empty one
+    len = MIN(len, (tail + ring->size - head - 1) % ring->size);
+    size_t first = MIN(len, ring->size - head);
+    memcpy(ring->shared->data + head, data, first);
+    memcpy(ring->shared->data, data + first, len - first);
+    // Publish the bytes before the index
+    dmb();
+    ring->head = (head + len) % ring->size;
+    ring->shared->head = ring->head;
+    *written = len;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Copies up to $len available bytes out of the ring.
+ * Fails if the producer published an index outside the ring.
+ */
+errval_t rpc_bulk_read(struct rpc_bulk_ring* ring, void* data, size_t len, size_t* read)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = ring->shared->head;
+    if (head >= ring->size)
+        return RPC_ERR_INVALID_PROTOCOL;
+    // Don't read the bytes before the producer's index
+    dmb();
+    len = MIN(len, (head + ring->size - tail) % ring->size);
+    size_t first = MIN(len, ring->size - tail);
+    memcpy(data, ring->shared->data + tail, first);
+    memcpy(data + first, ring->shared->data, len - first);
+    dmb();
+    ring->tail = (tail + len) % ring->size;
+    ring->shared->tail = ring->tail;
+    *read = len;
+    return SYS_ERR_OK;
+}
@@ -354,6 +354,7 @@ static void free_thread(struct thread *thread)
 #endif
 
     free(thread->stack);
+    paging_destroy_onthread(thread);
     if (thread->tls_dtv != NULL) {
         free(thread->tls_dtv);
     }
@@ -406,6 +407,7 @@ struct thread *thread_create_unrunnable(thread_func_t start_func, void *arg,
     // init thread
     thread_init(curdispatcher(), newthread);
     newthread->slab = space;
+    newthread->exception_stack = NULL;
 
     if (tls_block_total_len > 0) {
         // populate initial TLS data from pristine copy
@@ -444,7 +446,10 @@ struct thread *thread_create_unrunnable(thread_func_t start_func, void *arg,
     newthread->stack_top = (char *)newthread->stack_top
         - (lvaddr_t)newthread->stack_top % STACK_ALIGNMENT;
 
-    paging_init_onthread(newthread);
+    if (err_is_fail(paging_init_onthread(newthread))) {
+        free_thread(newthread);
+        return NULL;
+    }
     newthread->id = ++last_thread_id;
 
     // init registers
@@ -1,6 +1,6 @@
 #include <aos/urpc/server.h>
 
-#define URPC_SERV_DEBUG(...) debug_printf(__VA_ARGS__)
+#define URPC_SERV_DEBUG(...) //debug_printf(__VA_ARGS__);
 
 errval_t urpc_server_register_handler(struct urpc_channel* channel, uint32_t opcode, urpc_callback_func_t message_handler,
         void* context){
@@ -21,7 +21,7 @@ errval_t urpc_channel_init(struct urpc_channel* channel, void* fullbuffer, size_
 
     channel->callbacks_table=malloc(sizeof(struct urpc_message_closure)*callback_number);
 
-    memset(channel->callbacks_table, 0, sizeof(channel->callbacks_table));
+    memset(channel->callbacks_table, 0, sizeof(struct urpc_message_closure)*callback_number);
 
     if(channel_type==URPC_CHAN_MASTER){
         URPC_SERV_DEBUG("Initializing urpc channel as master\n");
@@ -33,8 +33,8 @@ errval_t urpc_channel_init(struct urpc_channel* channel, void* fullbuffer, size_
         send_buffer=fullbuffer;
     }
 
-    urpc_server_init(&channel->buffer_rcv, rcv_buffer, buffer_size);
-    urpc_client_init(&channel->buffer_send, send_buffer, buffer_size);
+    ERROR_RET1(urpc_server_init(&channel->buffer_rcv, rcv_buffer, buffer_size));
+    ERROR_RET1(urpc_client_init(&channel->buffer_send, send_buffer, buffer_size));
 
     channel->server_thread=NULL;
     channel->server_stop_now=false;
@@ -42,6 +42,23 @@ errval_t urpc_channel_init(struct urpc_channel* channel, void* fullbuffer, size_
     return SYS_ERR_OK;
 }
 
+errval_t urpc_channel_attach_pool(struct urpc_channel* channel, void* pool, size_t length,
+        enum urpc_channel_type channel_type){
+
+    size_t pool_size=ROUND_DOWN(length/2, BASE_PAGE_SIZE);
+    void* rcv_pool=channel_type==URPC_CHAN_MASTER ? pool : pool+pool_size;
+    void* send_pool=channel_type==URPC_CHAN_MASTER ? pool+pool_size : pool;
+
+    ERROR_RET1(urpc_buffer_attach_pool(&channel->buffer_rcv, rcv_pool, pool_size));
+    ERROR_RET1(urpc_buffer_attach_pool(&channel->buffer_send, send_pool, pool_size));
+    return SYS_ERR_OK;
+}
+
+void urpc_channel_set_wait(struct urpc_channel* channel, enum urpc_wait_mode mode, uint32_t spin_cycles){
+    urpc_buffer_set_wait(&channel->buffer_rcv, mode, spin_cycles);
+    urpc_buffer_set_wait(&channel->buffer_send, mode, spin_cycles);
+}
+
 errval_t urpc_server_start_listen(struct urpc_channel* channel, bool new_thread)
 {
     if (new_thread)
@@ -76,25 +93,29 @@ int urpc_server_event_loop(void* _buf_void)
     struct urpc_channel* channel=_buf_void;
     struct urpc_buffer* buf = &channel->buffer_rcv;
     errval_t err;
-    size_t len = 1024;
     struct urpc_message message;
-    message.data = malloc(len);
-    assert(message.data);
     debug_printf("URPC server started!\n");
     do {
         if (channel->server_stop_now)
         {
             URPC_SERV_DEBUG("[URPC_SERVER] Server exited without errors :)\n");
-            free(message.data);
             return SYS_ERR_OK;
         }
         bool has_data = false;
-        err = urpc_server_receive_try(buf, message.data, len, &message.length, &message.opcode, &has_data);
+        size_t length;
+        err = urpc_server_peek(buf, &message.data, &length, &message.opcode, &message.in_pool, &has_data);
         if (err_is_fail(err))
             break;
-        if (has_data)
+        if (!has_data)
+            urpc_buffer_wait(buf, &channel->server_stop_now);
+        else
         {
-            URPC_SERV_DEBUG("SERVER: Received data length %d opcode %d\n", message.length, message.opcode);
+            URPC_SERV_DEBUG("SERVER: Received data length %d opcode %d\n", length, message.opcode);
+            // Handlers may change $message, keep what the pool needs back
+            void* data = message.data;
+            bool in_pool = message.in_pool;
+            message.length = length;
+            message.keep = false;
             if (channel->callbacks_table[message.opcode].message_handler)
             {
                 errval_t cb_error = (channel->callbacks_table[message.opcode].message_handler)(buf, &message,
@@ -106,12 +127,12 @@ int urpc_server_event_loop(void* _buf_void)
                 URPC_SERV_DEBUG("[URPC_SERVER] Packet without handler!\n");
                 urpc_server_answer_error(buf, URPC_ERR_NO_HANDLER_FOR_OPCODE);
             }
-            // TODO: Check if we have replied!
+            if (in_pool && !message.keep)
+                urpc_pool_return(buf, data, length);
         }
     } while (!err_is_fail(err));
 
     URPC_SERV_DEBUG("[URPC_SERVER] Exited with error.\n");
     assert (err_is_fail(err));
-    free(message.data);
     return 0;
 }
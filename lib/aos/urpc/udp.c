@@ -12,6 +12,8 @@ errval_t handle_data_received(struct urpc_buffer* buf, struct urpc_message* msg,
         .socket_id=command->header.socket_id
     };
 
+    // Points into the ring or, for datagrams from the wire, into the pool
+    // page the network controller decoded it into
     struct udp_packet* packet=(struct udp_packet*)command->data;
     if(udp_state->data_received_handler!=NULL){
         udp_state->data_received_handler(socket, 0, packet, data_length);
@@ -46,11 +48,13 @@ errval_t get_network_rpc(struct aos_rpc* network_rpc){
 static
 errval_t init_urpc(struct udp_state* udp_state){
     size_t urpc_buff_size;
-    ERROR_RET1(frame_alloc(&udp_state->urpc_cap, BASE_PAGE_SIZE, &urpc_buff_size));
+    ERROR_RET1(frame_alloc(&udp_state->urpc_cap, UDP_URPC_FRAME_SIZE, &urpc_buff_size));
     ERROR_RET1(paging_map_frame(get_current_paging_state(), &udp_state->urpc_buffer, urpc_buff_size, udp_state->urpc_cap, NULL, NULL));
 
     debug_printf("Registring all necessery urpc message handlers\n");
-    ERROR_RET1(urpc_channel_init(&udp_state->urpc_chan, udp_state->urpc_buffer, urpc_buff_size, URPC_CHAN_MASTER, UDP_COMMADN_COUNT));
+    ERROR_RET1(urpc_channel_init(&udp_state->urpc_chan, udp_state->urpc_buffer, URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_MASTER, UDP_COMMADN_COUNT));
+    ERROR_RET1(urpc_channel_attach_pool(&udp_state->urpc_chan, udp_state->urpc_buffer + URPC_DEFAULT_FRAME_SIZE,
+            urpc_buff_size - URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_MASTER));
     ERROR_RET1(urpc_server_register_handler(&udp_state->urpc_chan, UDP_DATAGRAM_RECEIVED, handle_data_received, udp_state));
     ERROR_RET1(urpc_server_register_handler(&udp_state->urpc_chan, UDP_SOCKET_CREATED, handle_connection_established, udp_state));
     ERROR_RET1(urpc_server_register_handler(&udp_state->urpc_chan, UDP_CONNECTION_TERMINATED, handle_connection_terminated, udp_state));
@@ -100,7 +104,8 @@ errval_t udp_send_data(struct udp_socket* socket, void* data, size_t len){
     struct udp_command_payload_header command_header={
             .socket_id=socket->socket_id
     };
-    ERROR_RET1(urpc_client_send_chunck(&socket->state->urpc_chan.buffer_send, &command_header, sizeof(struct udp_command_payload_header), true));
+    // A failed chunk is reported by the final one
+    urpc_client_send_chunck(&socket->state->urpc_chan.buffer_send, &command_header, sizeof(struct udp_command_payload_header), true);
     ERROR_RET1(urpc_client_send_final_chunck_receive_fixed_size(&socket->state->urpc_chan.buffer_send, UDP_SEND_DATAGRAM,
                 data, len,
                 &response, sizeof(struct udp_command_payload), &return_size));
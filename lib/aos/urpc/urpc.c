@@ -1,259 +1,710 @@
 
 #include <aos/aos.h>
 #include <arch/arm/barrelfish_kpi/asm_inlines_arch.h>
+#include <aos/waitset_chan.h>
 #include <aos/urpc/urpc.h>
 
-errval_t urpc_server_init(struct urpc_buffer* urpc, void* buffer, size_t length)
+static errval_t ring_init(struct urpc_ring* ring, void* memory, size_t bytes)
 {
-    urpc->is_server = true;
-    urpc->buffer_len = length;
-    urpc->buffer = buffer;
-    thread_mutex_init(&urpc->buff_lock);
-    if (urpc->buffer_len < URPC_BUF_HEADER_LENGTH)
+    ring->shared = memory;
+    ring->num_slots = 0;
+    if (bytes > sizeof(struct urpc_ring_shared))
+        ring->num_slots = (bytes - sizeof(struct urpc_ring_shared)) / URPC_SLOT_SIZE;
+    if (!ring->num_slots)
         return URPC_ERR_BUFFER_TOO_SMALL;
+    // Pick up where the other side is, a zeroed buffer starts at 0
+    ring->head = ring->shared->head.value;
+    ring->tail = ring->shared->tail.value;
     return SYS_ERR_OK;
 }
 
-errval_t urpc_client_init(struct urpc_buffer* urpc, void* buffer, size_t length)
+static inline struct urpc_slot_header* ring_slot(struct urpc_ring* ring, uint32_t index)
+{
+    return (struct urpc_slot_header*)&ring->shared->slots[(index % ring->num_slots) * URPC_SLOT_SIZE];
+}
+
+static inline uint32_t ring_free_slots(struct urpc_ring* ring)
+{
+    uint32_t tail = ring->shared->tail.value;
+    // The consumer must be done reading the slots before we overwrite them
+    dmb();
+    return ring->num_slots - (ring->head - tail);
+}
+
+static inline void ring_commit(struct urpc_ring* ring, struct urpc_slot_header* hdr)
+{
+    ring->head += hdr->num_slots;
+    dmb();
+    ring->shared->head.value = ring->head;
+}
+
+/**
+ * \brief Free slots ring_reserve needs for $len bytes, padding included.
+ */
+static inline uint32_t ring_slots_needed(struct urpc_ring* ring, size_t len)
+{
+    uint32_t needed = DIVIDE_ROUND_UP(URPC_BUF_HEADER_LENGTH + len, URPC_SLOT_SIZE);
+    uint32_t to_end = ring->num_slots - ring->head % ring->num_slots;
+    return needed > to_end ? needed + to_end : needed;
+}
+
+/**
+ * \brief Reserves consecutive slots for a message of $len bytes.
+ * Messages never wrap around: if the message doesn't fit before the end of
+ * the ring, the rest of the ring is first published as padding.
+ * Returns NULL if there is not enough room yet.
+ */
+static struct urpc_slot_header* ring_reserve(struct urpc_ring* ring, size_t len)
 {
-    urpc->is_server = false;
+    uint32_t needed = DIVIDE_ROUND_UP(URPC_BUF_HEADER_LENGTH + len, URPC_SLOT_SIZE);
+    uint32_t to_end = ring->num_slots - ring->head % ring->num_slots;
+    if (needed > to_end)
+    {
+        if (ring_free_slots(ring) < to_end)
+            return NULL;
+        struct urpc_slot_header* padding = ring_slot(ring, ring->head);
+        padding->status = URPC_NO_DATA;
+        padding->num_slots = to_end;
+        ring_commit(ring, padding);
+    }
+    if (ring_free_slots(ring) < needed)
+        return NULL;
+    struct urpc_slot_header* hdr = ring_slot(ring, ring->head);
+    hdr->num_slots = needed;
+    return hdr;
+}
+
+static inline void ring_release(struct urpc_ring* ring, struct urpc_slot_header* hdr)
+{
+    ring->tail += hdr->num_slots;
+    dmb();
+    ring->shared->tail.value = ring->tail;
+}
+
+/**
+ * \brief Returns the oldest message of the ring without consuming it,
+ * or NULL if the ring is empty.
+ */
+static struct urpc_slot_header* ring_peek(struct urpc_ring* ring)
+{
+    while (ring->tail != ring->shared->head.value)
+    {
+        // Don't read the slot before the producer's index
+        dmb();
+        struct urpc_slot_header* hdr = ring_slot(ring, ring->tail);
+        if (hdr->status != URPC_NO_DATA)
+            return hdr;
+        ring_release(ring, hdr);
+    }
+    return NULL;
+}
+
+static errval_t urpc_buffer_init(struct urpc_buffer* urpc, void* buffer, size_t length, bool is_server)
+{
+    urpc->is_server = is_server;
     urpc->buffer_len = length;
-    urpc->buffer = buffer;
+    urpc->current = NULL;
+    urpc->next_tag = 0;
+    urpc->pending = NULL;
+    urpc->pump_thread = NULL;
+    urpc->pump_stop = false;
+    urpc->chunk_data = NULL;
+    urpc->chunk_len = 0;
+    urpc->chunk_err = SYS_ERR_OK;
+    memset(&urpc->request_pool, 0, sizeof(struct urpc_pool));
+    memset(&urpc->reply_pool, 0, sizeof(struct urpc_pool));
+    urpc->wait_mode = URPC_WAIT_ADAPTIVE;
+    urpc->spin_cycles = URPC_DEFAULT_SPIN_CYCLES;
+    urpc->parks = 0;
     thread_mutex_init(&urpc->buff_lock);
-    if (urpc->buffer_len < URPC_BUF_HEADER_LENGTH)
-        return URPC_ERR_BUFFER_TOO_SMALL;
+    thread_mutex_init(&urpc->chunk_lock);
+    size_t ring_bytes = ROUND_DOWN(length / 2, URPC_CACHE_LINE);
+    ERROR_RET1(ring_init(&urpc->requests, buffer, ring_bytes));
+    ERROR_RET1(ring_init(&urpc->replies, buffer + ring_bytes, ring_bytes));
     return SYS_ERR_OK;
 }
 
-static errval_t read_from_buffer(struct urpc_buffer_data* data, void* cpyto, size_t destlen, size_t* datalen, uint32_t* opcode)
+errval_t urpc_server_init(struct urpc_buffer* urpc, void* buffer, size_t length)
 {
-    *datalen = data->data_len;
-    *opcode = data->opcode;
-//  We will remove this
-//    if (data->opcode >= URPC_OP_COUNT)
-//        return URPC_ERR_INVALID_OPCODE;
-    if (*datalen > destlen)
+    return urpc_buffer_init(urpc, buffer, length, true);
+}
+
+errval_t urpc_client_init(struct urpc_buffer* urpc, void* buffer, size_t length)
+{
+    return urpc_buffer_init(urpc, buffer, length, false);
+}
+
+/// A parked thread, registered as a polled channel on its own waitset
+struct urpc_doorbell
+{
+    struct waitset_chanstate chan;      // First, see urpc_doorbell_poll
+    struct urpc_ring* ring;
+    uint32_t room;                      // Free slots to wait for, 0 to wait for data
+    volatile bool* done;
+};
+
+/**
+ * \brief Whether a thread waiting on $ring can go on: the ring has data,
+ * or $room free slots if $room is set.
+ */
+static inline bool ring_ready(struct urpc_ring* ring, uint32_t room)
+{
+    if (room)
+        return ring->num_slots - (ring->head - ring->shared->tail.value) >= room;
+    return ring->tail != ring->shared->head.value;
+}
+
+/**
+ * \brief Called from poll_channels_disabled for CHANTYPE_UMP_IN channels.
+ * \return true if the parked thread should be woken up
+ */
+bool urpc_doorbell_poll(struct waitset_chanstate* chan)
+{
+    struct urpc_doorbell* bell = (struct urpc_doorbell*)chan;
+    return ring_ready(bell->ring, bell->room) || (bell->done && *bell->done);
+}
+
+static void buffer_park(struct urpc_buffer* urpc, struct urpc_ring* ring, uint32_t room, volatile bool* done)
+{
+    struct waitset ws;
+    struct urpc_doorbell bell = { .ring = ring, .room = room, .done = done };
+    waitset_init(&ws);
+    waitset_chanstate_init(&bell.chan, CHANTYPE_UMP_IN);
+    errval_t err = waitset_chan_register_polled(&ws, &bell.chan, NOP_CLOSURE);
+    assert(err_is_ok(err));
+    ++urpc->parks;
+    // Polls once more, in case the data came in before we registered
+    check_for_event(&ws);
+    err = event_dispatch(&ws);
+    assert(err_is_ok(err));
+    waitset_destroy(&ws);
+}
+
+void urpc_buffer_set_wait(struct urpc_buffer* urpc, enum urpc_wait_mode mode, uint32_t spin_cycles)
+{
+    urpc->wait_mode = mode;
+    urpc->spin_cycles = spin_cycles;
+}
+
+static void buffer_wait(struct urpc_buffer* urpc, struct urpc_ring* ring, uint32_t room, volatile bool* done)
+{
+    if (urpc->wait_mode != URPC_WAIT_PARK)
     {
-        debug_printf("read_from_buffer: destlen=%d datalen=%d\n", destlen, *datalen);
-        return URPC_ERR_BUFFER_TOO_SMALL;
+        uint32_t start = get_cycle_count();
+        do {
+            if (ring_ready(ring, room) || (done && *done))
+                return;
+            thread_yield();
+        } while (urpc->wait_mode == URPC_WAIT_SPIN || get_cycle_count() - start < urpc->spin_cycles);
+    }
+    buffer_park(urpc, ring, room, done);
+}
+
+void urpc_buffer_wait(struct urpc_buffer* urpc, volatile bool* done)
+{
+    buffer_wait(urpc, urpc->is_server ? &urpc->requests : &urpc->replies, 0, done);
+}
+
+static void pool_init(struct urpc_pool* pool, void* memory, size_t bytes)
+{
+    // One state byte per page, the pages themselves stay page aligned
+    size_t state_bytes = ROUND_UP(bytes / BASE_PAGE_SIZE, BASE_PAGE_SIZE);
+    pool->used = memory;
+    pool->pages = memory + state_bytes;
+    pool->num_pages = bytes > state_bytes ? (bytes - state_bytes) / BASE_PAGE_SIZE : 0;
+    pool->next = 0;
+}
+
+static inline uint32_t pool_pages_for(size_t bytes)
+{
+    return bytes ? DIVIDE_ROUND_UP(bytes, BASE_PAGE_SIZE) : 1;
+}
+
+static inline bool pool_contains(struct urpc_pool* pool, void* buf, size_t bytes)
+{
+    char* p = buf;
+    char* end = pool->pages + pool->num_pages * BASE_PAGE_SIZE;
+    return pool->num_pages && p >= pool->pages && p < end && bytes <= end - p;
+}
+
+/**
+ * \brief Next-fit search for $bytes of consecutive free pages.
+ * Runs don't wrap around the end of the pool. Call with buff_lock held.
+ */
+static errval_t pool_alloc(struct urpc_pool* pool, size_t bytes, void** buf)
+{
+    if (!pool->num_pages)
+        return URPC_ERR_NO_POOL;
+    uint32_t needed = pool_pages_for(bytes);
+    if (needed > pool->num_pages)
+        return URPC_ERR_POOL_FULL;
+
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < pool->num_pages + needed; ++i)
+    {
+        uint32_t page = (pool->next + i) % pool->num_pages;
+        if (!page)
+            run = 0;
+        if (pool->used[page])
+        {
+            run = 0;
+            continue;
+        }
+        if (++run < needed)
+            continue;
+
+        uint32_t first = page + 1 - needed;
+        // The consumer must be done reading the pages before we reuse them
+        dmb();
+        for (uint32_t j = 0; j < needed; ++j)
+            pool->used[first + j] = 1;
+        pool->next = (page + 1) % pool->num_pages;
+        *buf = pool->pages + first * BASE_PAGE_SIZE;
+        return SYS_ERR_OK;
     }
-    memcpy(cpyto, (void*)data->data, *datalen);
+    return URPC_ERR_POOL_FULL;
+}
+
+static void pool_free(struct urpc_pool* pool, void* buf, size_t bytes)
+{
+    uint32_t first = ((char*)buf - pool->pages) / BASE_PAGE_SIZE;
+    uint32_t count = pool_pages_for(bytes);
+    // Finish reading the payload before the producer may reuse it
+    dmb();
+    for (uint32_t i = 0; i < count; ++i)
+        pool->used[first + i] = 0;
+}
+
+static errval_t pool_resolve(struct urpc_pool* pool, struct urpc_slot_header* hdr, void** data, size_t* len)
+{
+    if (hdr->data_len != sizeof(struct urpc_desc))
+        return URPC_ERR_PROTOCOL_ERROR;
+    struct urpc_desc* desc = (struct urpc_desc*)hdr->data;
+    void* p = pool->pages + desc->offset;
+    if (desc->offset >= pool->num_pages * BASE_PAGE_SIZE || !pool_contains(pool, p, desc->length))
+        return URPC_ERR_NOT_IN_POOL;
+    *data = p;
+    *len = desc->length;
     return SYS_ERR_OK;
 }
 
-errval_t urpc_server_receive_try(struct urpc_buffer* urpc, void* buf, size_t len, size_t* datalen, uint32_t* opcode, bool* has_data)
+static errval_t pool_make_desc(struct urpc_pool* pool, void* buf, size_t len, struct urpc_desc* desc)
+{
+    if (!pool_contains(pool, buf, len))
+        return URPC_ERR_NOT_IN_POOL;
+    desc->offset = (char*)buf - pool->pages;
+    desc->length = len;
+    return SYS_ERR_OK;
+}
+
+errval_t urpc_buffer_attach_pool(struct urpc_buffer* urpc, void* pool, size_t length)
+{
+    size_t half = ROUND_DOWN(length / 2, BASE_PAGE_SIZE);
+    pool_init(&urpc->request_pool, pool, half);
+    pool_init(&urpc->reply_pool, pool + half, half);
+    if (!urpc->request_pool.num_pages)
+        return URPC_ERR_BUFFER_TOO_SMALL;
+    return SYS_ERR_OK;
+}
+
+static errval_t buffer_pool_alloc(struct urpc_buffer* urpc, struct urpc_pool* pool, size_t bytes, void** buf)
+{
+    thread_mutex_lock(&urpc->buff_lock);
+    errval_t err = pool_alloc(pool, bytes, buf);
+    thread_mutex_unlock(&urpc->buff_lock);
+    return err;
+}
+
+errval_t urpc_client_alloc(struct urpc_buffer* urpc, size_t bytes, void** buf)
+{
+    if (urpc->is_server)
+        return URPC_ERR_IS_NOT_CLIENT_BUFFER;
+    return buffer_pool_alloc(urpc, &urpc->request_pool, bytes, buf);
+}
+
+errval_t urpc_server_alloc(struct urpc_buffer* urpc, size_t bytes, void** buf)
+{
+    if (!urpc->is_server)
+        return URPC_ERR_IS_NOT_SERVER_BUFFER;
+    return buffer_pool_alloc(urpc, &urpc->reply_pool, bytes, buf);
+}
+
+void urpc_pool_return(struct urpc_buffer* urpc, void* buf, size_t bytes)
+{
+    if (pool_contains(&urpc->request_pool, buf, bytes))
+        pool_free(&urpc->request_pool, buf, bytes);
+    else if (pool_contains(&urpc->reply_pool, buf, bytes))
+        pool_free(&urpc->reply_pool, buf, bytes);
+    else
+        USER_PANIC("urpc_pool_return: %p is not in the pool\n", buf);
+}
+
+errval_t urpc_server_peek(struct urpc_buffer* urpc, void** data, size_t* datalen, uint32_t* opcode,
+        bool* in_pool, bool* has_data)
 {
     if (!urpc->is_server)
         return URPC_ERR_IS_NOT_SERVER_BUFFER;
 
-    if (urpc->buffer->status == URPC_CLIENT_SENT_DATA)
+    // The request stays in the ring until it is answered
+    if (!urpc->current)
+        urpc->current = ring_peek(&urpc->requests);
+    if (!urpc->current)
+        return SYS_ERR_OK;
+
+    *opcode = urpc->current->opcode;
+    *in_pool = urpc->current->flags & URPC_FLAG_DESC;
+    if (*in_pool)
     {
+        errval_t err = pool_resolve(&urpc->request_pool, urpc->current, data, datalen);
+        // A bad descriptor fails this request only, not the whole server
+        if (err_is_fail(err))
+            return urpc_server_answer_error(urpc, err);
         *has_data = true;
-        return read_from_buffer(urpc->buffer, buf, len, datalen, opcode);
+        return SYS_ERR_OK;
     }
+    *has_data = true;
+    *data = urpc->current->data;
+    *datalen = urpc->current->data_len;
+    return SYS_ERR_OK;
+}
 
+errval_t urpc_server_receive_try(struct urpc_buffer* urpc, void* buf, size_t len, size_t* datalen, uint32_t* opcode, bool* has_data)
+{
+    void* data;
+    bool in_pool;
+    ERROR_RET1(urpc_server_peek(urpc, &data, datalen, opcode, &in_pool, has_data));
+    if (!*has_data)
+        return SYS_ERR_OK;
+    if (*datalen > len)
+    {
+        debug_printf("urpc_server_receive_try: destlen=%d datalen=%d\n", len, *datalen);
+        return URPC_ERR_BUFFER_TOO_SMALL;
+    }
+    memcpy(buf, data, *datalen);
+    if (in_pool)
+    {
+        // The copy is all the caller gets, the pool pages go back right away
+        urpc_pool_return(urpc, data, *datalen);
+        urpc->current->flags &= ~URPC_FLAG_DESC;
+        urpc->current->data_len = 0;
+    }
     return SYS_ERR_OK;
 }
 
 errval_t urpc_server_receive_block(struct urpc_buffer* urpc, void* buf, size_t len, size_t* datalen, uint32_t* opcode)
 {
-    if (!urpc->is_server)
-        return URPC_ERR_IS_NOT_SERVER_BUFFER;
-    while (urpc->buffer->status != URPC_CLIENT_SENT_DATA){
-        thread_yield();
+    bool has_data = false;
+    for (;;)
+    {
+        ERROR_RET1(urpc_server_receive_try(urpc, buf, len, datalen, opcode, &has_data));
+        if (has_data)
+            return SYS_ERR_OK;
+        urpc_buffer_wait(urpc, NULL);
     }
-    return read_from_buffer(urpc->buffer, buf, len, datalen, opcode);
 }
 
-static errval_t client_send_and_wait(struct urpc_buffer* urpc, uint32_t opcode, void* data, size_t len)
+static struct urpc_future* client_take_pending(struct urpc_buffer* urpc, uint32_t tag)
 {
-    if (urpc->is_server)
-        return URPC_ERR_IS_NOT_CLIENT_BUFFER;
-    if (urpc->buffer->status != URPC_NO_DATA)
-        return URPC_ERR_WRONG_BUFFER_STATUS;
-    if (URPC_MAX_DATA_SIZE(urpc) < len)
-        return URPC_ERR_URPC_BUFFER_TOO_SMALL_FOR_SEND;
-    //  We will remove this
-    //    if (data->opcode >= URPC_OP_COUNT)
-    //        return URPC_ERR_INVALID_OPCODE;
-
-    // 1. Send data
-    thread_mutex_lock(&urpc->buff_lock);
-    memcpy(urpc->buffer->data, data, len);
-    urpc->buffer->data_len = len;
-    urpc->buffer->opcode = opcode;
-    dmb();
-    urpc->buffer->status = URPC_CLIENT_SENT_DATA;
-    dmb();
-
-    // 2. Wait for answer
-    while (urpc->buffer->status == URPC_CLIENT_SENT_DATA){
-        thread_yield();
+    for (struct urpc_future** prev = &urpc->pending; *prev; prev = &(*prev)->next)
+    {
+        struct urpc_future* future = *prev;
+        if (future->tag == tag)
+        {
+            *prev = future->next;
+            return future;
+        }
     }
+    return NULL;
+}
 
-    if (urpc->buffer->status == URPC_SERVER_REPLIED_ERROR)
+static void client_complete(struct urpc_buffer* urpc, struct urpc_future* future, struct urpc_slot_header* hdr)
+{
+    void* data = hdr->data;
+    size_t len = hdr->data_len;
+    bool in_pool = hdr->flags & URPC_FLAG_DESC;
+    if (in_pool)
+        future->err = pool_resolve(&urpc->reply_pool, hdr, &data, &len);
+    else if (hdr->status == URPC_SERVER_REPLIED_ERROR)
+        future->err = *((errval_t*)hdr->data);
+    future->answer_len = len;
+    if (err_is_fail(future->err))
     {
-        // VoooodoooOOooo
-        void* pbuf = (void*)&urpc->buffer->data[0];
-        errval_t err = *((errval_t*)pbuf);
-        if (err_is_fail(err))
+        future->answer_len = 0;
+        in_pool = false;
+    }
+    else if (!in_pool && URPC_MAX_DATA_SIZE(urpc) < len)
+        future->err = URPC_ERR_PROTOCOL_FATAL_ERROR;
+    else if (!future->answer && !future->answer_size)
+    {
+        if (in_pool)
         {
-            urpc->buffer->status = URPC_NO_DATA;
-            thread_mutex_unlock(&urpc->buff_lock);
-            return err;
+            // Hand out the pool buffer itself
+            future->answer = data;
+            future->answer_in_pool = true;
+            in_pool = false;
+        }
+        else
+        {
+            future->answer = malloc(len);
+            if (future->answer)
+                memcpy(future->answer, data, len);
+            else if (len)
+                future->err = LIB_ERR_MALLOC_FAIL;
         }
     }
-    // TODO: Invalidate cache? Or not needed?
-    //assert(false && "TODO: Clear cache here??");
+    else if (len > future->answer_size)
+        future->err = URPC_ERR_ANSWER_BUFFER_TOO_SMALL;
+    else
+        memcpy(future->answer, data, len);
+    if (in_pool)
+        urpc_pool_return(urpc, data, len);
+
+    // Once triggered, the closure may free the future
+    future->done = true;
+    if (waitset_chan_is_registered(&future->chan))
+        waitset_chan_trigger(&future->chan);
+}
+
+/**
+ * \brief Completes the futures of all answers that arrived so far.
+ */
+static void client_pump(struct urpc_buffer* urpc)
+{
+    thread_mutex_lock(&urpc->buff_lock);
+    struct urpc_slot_header* hdr;
+    while ((hdr = ring_peek(&urpc->replies)))
+    {
+        struct urpc_future* future = client_take_pending(urpc, hdr->tag);
+        if (future)
+            client_complete(urpc, future, hdr);
+        else
+            debug_printf("urpc: dropped answer with unknown tag %u\n", hdr->tag);
+        ring_release(&urpc->replies, hdr);
+    }
     thread_mutex_unlock(&urpc->buff_lock);
-    return SYS_ERR_OK;
 }
 
-static errval_t client_send_chunk_and_wait(struct urpc_buffer* urpc, uint32_t opcode, void* data, size_t len,
-        bool first_message, bool final_message)
+static int client_pump_thread(void* arg)
+{
+    struct urpc_buffer* urpc = arg;
+    while (!urpc->pump_stop)
+    {
+        client_pump(urpc);
+        urpc_buffer_wait(urpc, &urpc->pump_stop);
+    }
+    return 0;
+}
+
+errval_t urpc_client_stop_pump(struct urpc_buffer* urpc)
+{
+    thread_mutex_lock(&urpc->buff_lock);
+    struct thread* pump = urpc->pump_thread;
+    urpc->pump_thread = NULL;
+    thread_mutex_unlock(&urpc->buff_lock);
+    if (!pump)
+        return SYS_ERR_OK;
+
+    int retval;
+    urpc->pump_stop = true;
+    errval_t err = thread_join(pump, &retval);
+    urpc->pump_stop = false;
+    return err;
+}
+
+static errval_t client_send(struct urpc_buffer* urpc, uint32_t opcode, uint32_t flags, void* data, size_t len,
+        void* answer, size_t answer_size, struct urpc_future* future,
+        struct waitset* ws, struct event_closure closure)
 {
     if (urpc->is_server)
         return URPC_ERR_IS_NOT_CLIENT_BUFFER;
-    if ((urpc->buffer->status != URPC_NO_DATA) && (urpc->buffer->status != URPC_CLIENT_SENT_DATA))
-        return URPC_ERR_WRONG_BUFFER_STATUS;
     if (URPC_MAX_DATA_SIZE(urpc) < len)
         return URPC_ERR_URPC_BUFFER_TOO_SMALL_FOR_SEND;
-    //  We will remove this
-    //    if (data->opcode >= URPC_OP_COUNT)
-    //        return URPC_ERR_INVALID_OPCODE;
 
-    if(first_message){
+    future->urpc = urpc;
+    future->done = false;
+    future->err = SYS_ERR_OK;
+    future->answer = answer;
+    future->answer_size = answer_size;
+    future->answer_len = 0;
+    future->answer_in_pool = false;
+    waitset_chanstate_init(&future->chan, CHANTYPE_OTHER);
+    if (ws)
+    {
+        ERROR_RET1(waitset_chan_register(ws, &future->chan, closure));
         thread_mutex_lock(&urpc->buff_lock);
-        urpc->buffer->data_len=0;
-    }
-
-    // 1. Send data
-    memcpy(urpc->buffer->data+urpc->buffer->data_len, data, len);
-    urpc->buffer->data_len += len;
-
-    // This is not a final message, there will be more
-    if(!final_message){
-        return SYS_ERR_OK;
-    }
-
-    urpc->buffer->opcode = opcode;
-    dmb();
-    urpc->buffer->status = URPC_CLIENT_SENT_DATA;
-    dmb();
-
-    // 2. Wait for answer
-    while (urpc->buffer->status == URPC_CLIENT_SENT_DATA){
-        thread_yield();
+        if (!urpc->pump_thread)
+            urpc->pump_thread = thread_create(client_pump_thread, urpc);
+        thread_mutex_unlock(&urpc->buff_lock);
+        if (!urpc->pump_thread)
+        {
+            waitset_chan_deregister(&future->chan);
+            return LIB_ERR_THREAD_CREATE;
+        }
     }
 
-    if (urpc->buffer->status == URPC_SERVER_REPLIED_ERROR)
+    for (;;)
     {
-        // VoooodoooOOooo
-        void* pbuf = (void*)&urpc->buffer->data[0];
-        errval_t err = *((errval_t*)pbuf);
-        if (err_is_fail(err))
+        thread_mutex_lock(&urpc->buff_lock);
+        struct urpc_slot_header* hdr = ring_reserve(&urpc->requests, len);
+        if (hdr)
         {
-            dmb();
-            urpc->buffer->status = URPC_NO_DATA;
+            if (len)
+                memcpy(hdr->data, data, len);
+            hdr->data_len = len;
+            hdr->opcode = opcode;
+            hdr->tag = future->tag = urpc->next_tag++;
+            hdr->flags = flags;
+            hdr->status = URPC_CLIENT_SENT_DATA;
+            future->next = urpc->pending;
+            urpc->pending = future;
+            ring_commit(&urpc->requests, hdr);
             thread_mutex_unlock(&urpc->buff_lock);
-            return err;
+            return SYS_ERR_OK;
         }
+        thread_mutex_unlock(&urpc->buff_lock);
+        // The server may be waiting for room in the reply ring
+        client_pump(urpc);
+        thread_yield();
     }
-    // TODO: Invalidate cache? Or not needed?
-    //assert(false && "TODO: Clear cache here??");
-    thread_mutex_unlock(&urpc->buff_lock);
-    return SYS_ERR_OK;
 }
 
-errval_t urpc_client_send_chunck(struct urpc_buffer* urpc, void* data, size_t len, bool first_chunck){
-    ERROR_RET1(client_send_chunk_and_wait(urpc, 0, data, len, first_chunck, false));
+errval_t urpc_client_send_async(struct urpc_buffer* urpc, uint32_t opcode, void* data, size_t len,
+        void* answer, size_t answer_size, struct urpc_future* future,
+        struct waitset* ws, struct event_closure closure)
+{
+    return client_send(urpc, opcode, 0, data, len, answer, answer_size, future, ws, closure);
+}
 
-    return SYS_ERR_OK;
+errval_t urpc_client_send_desc_async(struct urpc_buffer* urpc, uint32_t opcode, void* buf, size_t len,
+        void* answer, size_t answer_size, struct urpc_future* future,
+        struct waitset* ws, struct event_closure closure)
+{
+    struct urpc_desc desc;
+    ERROR_RET1(pool_make_desc(&urpc->request_pool, buf, len, &desc));
+    return client_send(urpc, opcode, URPC_FLAG_DESC, &desc, sizeof(desc),
+        answer, answer_size, future, ws, closure);
 }
 
-errval_t urpc_client_send_final_chunck_receive_fixed_size(struct urpc_buffer* urpc, uint32_t opcode,
-        void* data, size_t len, void* answer, size_t answer_size, size_t* actual_answer_size){
+errval_t urpc_future_wait(struct urpc_future* future)
+{
+    while (!future->done)
+    {
+        client_pump(future->urpc);
+        // Another thread may drain the ring and complete us, so watch $done too
+        if (!future->done)
+            urpc_buffer_wait(future->urpc, &future->done);
+    }
+    return future->err;
+}
 
-    ERROR_RET1(client_send_chunk_and_wait(urpc, opcode, data, len, false, true));
+static errval_t client_call(struct urpc_buffer* urpc, uint32_t opcode, void* data, size_t len,
+        void* answer, size_t answer_size, size_t* actual_answer_size)
+{
+    struct urpc_future future;
+    ERROR_RET1(urpc_client_send_async(urpc, opcode, data, len, answer, answer_size,
+        &future, NULL, NOP_CLOSURE));
+    errval_t err = urpc_future_wait(&future);
+    if (actual_answer_size)
+        *actual_answer_size = future.answer_len;
+    return err;
+}
 
-    // 3. Copy answer
-    size_t data_len = urpc->buffer->data_len;
+errval_t urpc_client_send_desc_receive_fixed_size(struct urpc_buffer* urpc, uint32_t opcode, void* buf, size_t len,
+        void* answer, size_t answer_size, size_t* actual_answer_size)
+{
+    struct urpc_future future;
+    ERROR_RET1(urpc_client_send_desc_async(urpc, opcode, buf, len, answer, answer_size,
+        &future, NULL, NOP_CLOSURE));
+    errval_t err = urpc_future_wait(&future);
     if (actual_answer_size)
-        *actual_answer_size = data_len;
-    if (data_len > answer_size)
-    {
-        urpc->buffer->status = URPC_NO_DATA;
-        return URPC_ERR_ANSWER_BUFFER_TOO_SMALL;
-    }
-    if (URPC_MAX_DATA_SIZE(urpc) < data_len)
+        *actual_answer_size = future.answer_len;
+    return err;
+}
+
+static errval_t client_chunk_append(struct urpc_buffer* urpc, void* data, size_t len)
+{
+    if (!urpc->chunk_data)
+        return LIB_ERR_MALLOC_FAIL;
+    if (URPC_MAX_DATA_SIZE(urpc) < urpc->chunk_len + len)
+        return URPC_ERR_URPC_BUFFER_TOO_SMALL_FOR_SEND;
+    memcpy(urpc->chunk_data + urpc->chunk_len, data, len);
+    urpc->chunk_len += len;
+    return SYS_ERR_OK;
+}
+
+errval_t urpc_client_send_chunck(struct urpc_buffer* urpc, void* data, size_t len, bool first_chunck){
+    if (urpc->is_server)
+        return URPC_ERR_IS_NOT_CLIENT_BUFFER;
+
+    // The message is assembled locally and sent with the final chunk,
+    // which also reports a failed chunk and releases chunk_lock
+    if (first_chunck)
     {
-        urpc->buffer->status = URPC_NO_DATA;
-        return URPC_ERR_PROTOCOL_FATAL_ERROR;
+        thread_mutex_lock(&urpc->chunk_lock);
+        if (!urpc->chunk_data)
+            urpc->chunk_data = malloc(URPC_MAX_DATA_SIZE(urpc));
+        urpc->chunk_len = 0;
+        urpc->chunk_err = SYS_ERR_OK;
     }
-    memcpy(answer, urpc->buffer->data, data_len);
+    if (err_is_ok(urpc->chunk_err))
+        urpc->chunk_err = client_chunk_append(urpc, data, len);
+    return urpc->chunk_err;
+}
 
-    // 4. Once we have finished everything, we are ready to send new data
-    dmb();
-    urpc->buffer->status = URPC_NO_DATA;
-    return SYS_ERR_OK;
+errval_t urpc_client_send_final_chunck_receive_fixed_size(struct urpc_buffer* urpc, uint32_t opcode,
+        void* data, size_t len, void* answer, size_t answer_size, size_t* actual_answer_size){
+
+    // chunk_lock is held since the first chunk
+    errval_t err = urpc->chunk_err;
+    if (err_is_ok(err))
+        err = client_chunk_append(urpc, data, len);
+    if (err_is_ok(err))
+        err = client_call(urpc, opcode, urpc->chunk_data, urpc->chunk_len,
+                answer, answer_size, actual_answer_size);
+    urpc->chunk_len = 0;
+    thread_mutex_unlock(&urpc->chunk_lock);
+    return err;
 }
 
 errval_t urpc_client_send(struct urpc_buffer* urpc, uint32_t opcode, void* data, size_t len, void** answer, size_t* answer_len)
 {
+    *answer = NULL;
     *answer_len = 0;
 
-    ERROR_RET1(client_send_and_wait(urpc, opcode, data, len));
-
-    // 3. Copy answer
-    size_t data_len = urpc->buffer->data_len;
-    if (URPC_MAX_DATA_SIZE(urpc) < data_len)
+    struct urpc_future future;
+    ERROR_RET1(urpc_client_send_async(urpc, opcode, data, len, NULL, 0, &future, NULL, NOP_CLOSURE));
+    errval_t err = urpc_future_wait(&future);
+    *answer_len = future.answer_len;
+    if (!future.answer_in_pool)
     {
-        urpc->buffer->status = URPC_NO_DATA;
-        return URPC_ERR_PROTOCOL_FATAL_ERROR;
+        *answer = future.answer;
+        return err;
     }
-    *answer = malloc(data_len);
-    memcpy(*answer, urpc->buffer->data, data_len);
-    *answer_len=data_len;
-
-    // 4. Once we have finished everything, we are ready to send new data
-    dmb();
-    urpc->buffer->status = URPC_NO_DATA;
-    return SYS_ERR_OK;
+    // Callers free() the answer, so it can't stay in the pool
+    *answer = malloc(future.answer_len);
+    if (*answer)
+        memcpy(*answer, future.answer, future.answer_len);
+    else if (future.answer_len)
+        err = LIB_ERR_MALLOC_FAIL;
+    urpc_pool_return(urpc, future.answer, future.answer_len);
+    return err;
 }
 
 errval_t urpc_client_send_receive_fixed_size(struct urpc_buffer* urpc, uint32_t opcode,
         void* data, size_t len, void* answer, size_t answer_size, size_t* actual_answer_size)
 {
-    ERROR_RET1(client_send_and_wait(urpc, opcode, data, len));
-
-    // 3. Copy answer
-    size_t data_len = urpc->buffer->data_len;
-    if (actual_answer_size)
-        *actual_answer_size = data_len;
-    if (data_len > answer_size)
-    {
-        urpc->buffer->status = URPC_NO_DATA;
-        return URPC_ERR_ANSWER_BUFFER_TOO_SMALL;
-    }
-    if (URPC_MAX_DATA_SIZE(urpc) < data_len)
-    {
-        urpc->buffer->status = URPC_NO_DATA;
-        return URPC_ERR_PROTOCOL_FATAL_ERROR;
-    }
-    memcpy(answer, urpc->buffer->data, data_len);
-
-    // 4. Once we have finished everything, we are ready to send new data
-    dmb();
-    urpc->buffer->status = URPC_NO_DATA;
-    return SYS_ERR_OK;
+    return client_call(urpc, opcode, data, len, answer, answer_size, actual_answer_size);
 }
 
-errval_t urpc_server_answer(struct urpc_buffer* urpc, void* data, size_t len)
+/**
+ * \brief Pushes an answer into the reply ring. Waits for room if the
+ * client is behind collecting. Answers may come from several threads.
+ */
+static errval_t server_reply(struct urpc_buffer* urpc, uint32_t tag, enum urpc_buffer_status status,
+        uint32_t flags, void* data, size_t len)
 {
     if (!urpc->is_server)
         return URPC_ERR_IS_NOT_SERVER_BUFFER;
-    if (urpc->buffer->status != URPC_CLIENT_SENT_DATA)
-        return URPC_ERR_WRONG_BUFFER_STATUS;
     if (URPC_MAX_DATA_SIZE(urpc) < len)
     {
         debug_printf("urpc_server_answer[URPC_ERR_BUFFER_TOO_SMALL_FOR_ANSWER]\n");
@@ -261,35 +712,87 @@ errval_t urpc_server_answer(struct urpc_buffer* urpc, void* data, size_t len)
         return URPC_ERR_BUFFER_TOO_SMALL_FOR_ANSWER;
     }
 
+    struct urpc_slot_header* hdr;
+    for (;;)
+    {
+        thread_mutex_lock(&urpc->buff_lock);
+        hdr = ring_reserve(&urpc->replies, len);
+        if (hdr)
+            break;
+        uint32_t room = ring_slots_needed(&urpc->replies, len);
+        thread_mutex_unlock(&urpc->buff_lock);
+        buffer_wait(urpc, &urpc->replies, room, NULL);
+    }
     if (len)
-        memcpy(urpc->buffer->data, data, len);
-    urpc->buffer->data_len = len;
-
-    dmb();
-    urpc->buffer->status = URPC_SERVER_REPLIED_DATA;
+        memcpy(hdr->data, data, len);
+    hdr->data_len = len;
+    hdr->opcode = 0;
+    hdr->tag = tag;
+    hdr->flags = flags;
+    hdr->status = status;
+    ring_commit(&urpc->replies, hdr);
+    thread_mutex_unlock(&urpc->buff_lock);
     return SYS_ERR_OK;
 }
 
-errval_t urpc_server_answer_error(struct urpc_buffer* urpc, errval_t error)
+/**
+ * \brief Answers the current request and frees its slots.
+ */
+static errval_t server_reply_current(struct urpc_buffer* urpc, enum urpc_buffer_status status,
+        uint32_t flags, void* data, size_t len)
 {
     if (!urpc->is_server)
         return URPC_ERR_IS_NOT_SERVER_BUFFER;
-    if (urpc->buffer->status != URPC_CLIENT_SENT_DATA)
+    if (!urpc->current)
         return URPC_ERR_WRONG_BUFFER_STATUS;
+    ERROR_RET1(server_reply(urpc, urpc->current->tag, status, flags, data, len));
+    ring_release(&urpc->requests, urpc->current);
+    urpc->current = NULL;
+    return SYS_ERR_OK;
+}
 
-    memcpy(urpc->buffer->data, &error, sizeof(error));
-    urpc->buffer->data_len = sizeof(error);
+errval_t urpc_server_answer(struct urpc_buffer* urpc, void* data, size_t len)
+{
+    return server_reply_current(urpc, URPC_SERVER_REPLIED_DATA, 0, data, len);
+}
 
-    dmb();
-    urpc->buffer->status = URPC_SERVER_REPLIED_ERROR;
+errval_t urpc_server_answer_desc(struct urpc_buffer* urpc, void* buf, size_t len)
+{
+    struct urpc_desc desc;
+    ERROR_RET1(pool_make_desc(&urpc->reply_pool, buf, len, &desc));
+    return server_reply_current(urpc, URPC_SERVER_REPLIED_DATA, URPC_FLAG_DESC, &desc, sizeof(desc));
+}
 
-    debug_printf("Server replied with data\n");
-    return SYS_ERR_OK;
+errval_t urpc_server_answer_error(struct urpc_buffer* urpc, errval_t error)
+{
+    return server_reply_current(urpc, URPC_SERVER_REPLIED_ERROR, 0, &error, sizeof(error));
 }
 
 errval_t urpc_server_dummy_answer_if_need(struct urpc_buffer* urpc)
 {
-    if (urpc->buffer->status == URPC_CLIENT_SENT_DATA)
+    if (urpc->current)
         return urpc_server_answer(urpc, NULL, 0);
     return SYS_ERR_OK;
 }
+
+errval_t urpc_server_defer(struct urpc_buffer* urpc, uint32_t* tag)
+{
+    if (!urpc->is_server)
+        return URPC_ERR_IS_NOT_SERVER_BUFFER;
+    if (!urpc->current)
+        return URPC_ERR_WRONG_BUFFER_STATUS;
+    *tag = urpc->current->tag;
+    ring_release(&urpc->requests, urpc->current);
+    urpc->current = NULL;
+    return SYS_ERR_OK;
+}
+
+errval_t urpc_server_answer_tag(struct urpc_buffer* urpc, uint32_t tag, void* data, size_t len)
+{
+    return server_reply(urpc, tag, URPC_SERVER_REPLIED_DATA, 0, data, len);
+}
+
+errval_t urpc_server_answer_error_tag(struct urpc_buffer* urpc, uint32_t tag, errval_t error)
+{
+    return server_reply(urpc, tag, URPC_SERVER_REPLIED_ERROR, 0, &error, sizeof(error));
+}
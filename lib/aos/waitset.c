@@ -23,6 +23,7 @@
 #include <aos/waitset_chan.h>
 #include <aos/threads.h>
 #include <aos/dispatch.h>
+#include <aos/urpc/urpc.h>
 #include "threads_priv.h"
 #include "waitset_chan_priv.h"
 #include <stdio.h>
@@ -221,9 +222,24 @@ void poll_channels_disabled(dispatcher_handle_t handle) {
 
     if (!dp->polled_channels)
         return;
+    // Triggering a channel takes it off the list, and may move the head:
+    // count the channels rather than stopping at the head
+    size_t count = 0;
     chan = dp->polled_channels;
     do {
+        ++count;
+        chan = chan->polled_next;
+    } while (chan != dp->polled_channels);
+
+    for (; count > 0; --count) {
+        struct waitset_chanstate *next = chan->polled_next;
         switch (chan->chantype) {
+        case CHANTYPE_UMP_IN:
+            if (urpc_doorbell_poll(chan)) {
+                errval_t err = waitset_chan_trigger_disabled(chan, handle);
+                assert_disabled(err_is_ok(err)); // should not be able to fail
+            }
+            break;
         case CHANTYPE_LWIP_SOCKET:
             arranet_polling_loop_proxy();
             break;
@@ -233,7 +249,10 @@ void poll_channels_disabled(dispatcher_handle_t handle) {
         default:
             assert(!"invalid channel type to poll!");
         }
-    } while (chan != dp->polled_channels);
+        if (!dp->polled_channels)
+            return;
+        chan = next;
+    }
 }
 
 /// Re-register a channel (if persistent)
@@ -36,6 +36,10 @@ errval_t mm_init(struct mm *mm, enum objtype objtype,
     mm->slot_alloc_inst = slot_alloc_inst;
     mm->objtype = objtype;
     mm->head = NULL;
+    mm->policy = MM_SEARCH_INDEXED;
+    memset(mm->bins, 0, sizeof(mm->bins));
+    mm->bins_map = 0;
+    mm->tree_root = NULL;
 
     slab_init(&(mm->slabs), sizeof(struct mmnode), slab_refill_func);
     SLAB_SET_NAME(&mm->slabs, "mm");
@@ -43,6 +47,172 @@ errval_t mm_init(struct mm *mm, enum objtype objtype,
     return SYS_ERR_OK;
 }
 
+/**
+ * Changes the strategy used to look up nodes. Both strategies operate on
+ * the same node list, so this can be switched at any time.
+ */
+void mm_set_search_policy(struct mm *mm, enum mm_search_policy policy)
+{
+    LIBMM_STRUCT_LOCK(mm);
+    mm->policy = policy;
+    LIBMM_STRUCT_UNLOCK(mm);
+}
+
+/*
+ * Segregated free bins.
+ * Every free node lives in exactly one bin, selected by floor(log2(size)).
+ */
+static inline int mm_bin_index(gensize_t size)
+{
+    if (size < BASE_PAGE_SIZE)
+        return 0;
+    int bin = (63 - __builtin_clzll(size)) - BASE_PAGE_BITS;
+    return bin < MM_NUM_BINS ? bin : MM_NUM_BINS - 1;
+}
+
+static void mm_bin_insert_unsafe(struct mm* mm, struct mmnode* node)
+{
+    int bin = mm_bin_index(node->size);
+    node->bin_prev = NULL;
+    node->bin_next = mm->bins[bin];
+    if (node->bin_next)
+        node->bin_next->bin_prev = node;
+    mm->bins[bin] = node;
+    mm->bins_map |= (1u << bin);
+}
+
+static void mm_bin_remove_unsafe(struct mm* mm, struct mmnode* node)
+{
+    int bin = mm_bin_index(node->size);
+    if (node->bin_prev)
+        node->bin_prev->bin_next = node->bin_next;
+    else
+        mm->bins[bin] = node->bin_next;
+    if (node->bin_next)
+        node->bin_next->bin_prev = node->bin_prev;
+    node->bin_prev = node->bin_next = NULL;
+    if (!mm->bins[bin])
+        mm->bins_map &= ~(1u << bin);
+}
+
+/*
+ * Address index: AVL tree over all nodes (free and allocated), keyed by base.
+ * Nodes are intrusive, so the index never allocates.
+ */
+static inline int mm_tree_height(struct mmnode* n)
+{
+    return n ? n->tree_height : 0;
+}
+
+static inline void mm_tree_update(struct mmnode* n)
+{
+    int l = mm_tree_height(n->tree_left);
+    int r = mm_tree_height(n->tree_right);
+    n->tree_height = (l > r ? l : r) + 1;
+}
+
+static struct mmnode* mm_tree_rotate_right(struct mmnode* n)
+{
+    struct mmnode* l = n->tree_left;
+    n->tree_left = l->tree_right;
+    l->tree_right = n;
+    mm_tree_update(n);
+    mm_tree_update(l);
+    return l;
+}
+
+static struct mmnode* mm_tree_rotate_left(struct mmnode* n)
+{
+    struct mmnode* r = n->tree_right;
+    n->tree_right = r->tree_left;
+    r->tree_left = n;
+    mm_tree_update(n);
+    mm_tree_update(r);
+    return r;
+}
+
+static struct mmnode* mm_tree_balance(struct mmnode* n)
+{
+    mm_tree_update(n);
+    int balance = mm_tree_height(n->tree_left) - mm_tree_height(n->tree_right);
+    if (balance > 1)
+    {
+        if (mm_tree_height(n->tree_left->tree_left) < mm_tree_height(n->tree_left->tree_right))
+            n->tree_left = mm_tree_rotate_left(n->tree_left);
+        return mm_tree_rotate_right(n);
+    }
+    if (balance < -1)
+    {
+        if (mm_tree_height(n->tree_right->tree_right) < mm_tree_height(n->tree_right->tree_left))
+            n->tree_right = mm_tree_rotate_right(n->tree_right);
+        return mm_tree_rotate_left(n);
+    }
+    return n;
+}
+
+static struct mmnode* mm_tree_insert_rec(struct mmnode* root, struct mmnode* node)
+{
+    if (!root)
+        return node;
+    if (node->base < root->base)
+        root->tree_left = mm_tree_insert_rec(root->tree_left, node);
+    else
+        root->tree_right = mm_tree_insert_rec(root->tree_right, node);
+    return mm_tree_balance(root);
+}
+
+static struct mmnode* mm_tree_remove_min(struct mmnode* root, struct mmnode** min)
+{
+    if (!root->tree_left)
+    {
+        *min = root;
+        return root->tree_right;
+    }
+    root->tree_left = mm_tree_remove_min(root->tree_left, min);
+    return mm_tree_balance(root);
+}
+
+static struct mmnode* mm_tree_remove_rec(struct mmnode* root, struct mmnode* node)
+{
+    if (!root)
+        return NULL;
+    if (root != node)
+    {
+        if (node->base < root->base)
+            root->tree_left = mm_tree_remove_rec(root->tree_left, node);
+        else
+            root->tree_right = mm_tree_remove_rec(root->tree_right, node);
+        return mm_tree_balance(root);
+    }
+    if (!root->tree_right)
+        return root->tree_left;
+    struct mmnode* min;
+    struct mmnode* right = mm_tree_remove_min(root->tree_right, &min);
+    min->tree_left = root->tree_left;
+    min->tree_right = right;
+    return mm_tree_balance(min);
+}
+
+static void mm_tree_insert_unsafe(struct mm* mm, struct mmnode* node)
+{
+    node->tree_left = node->tree_right = NULL;
+    node->tree_height = 1;
+    mm->tree_root = mm_tree_insert_rec(mm->tree_root, node);
+}
+
+static void mm_tree_remove_unsafe(struct mm* mm, struct mmnode* node)
+{
+    mm->tree_root = mm_tree_remove_rec(mm->tree_root, node);
+}
+
+static struct mmnode* mm_tree_find_unsafe(struct mm* mm, genpaddr_t base)
+{
+    struct mmnode* n = mm->tree_root;
+    while (n && n->base != base)
+        n = base < n->base ? n->tree_left : n->tree_right;
+    return n;
+}
+
 /**
  * Destroys the memory allocator.
  */
@@ -72,6 +242,8 @@ errval_t mm_add(struct mm *mm, struct capref cap, genpaddr_t base, size_t size)
     if (mm->head)
         mm->head->prev = newnode;
     mm->head = newnode;
+    mm_bin_insert_unsafe(mm, newnode);
+    mm_tree_insert_unsafe(mm, newnode);
     LIBMM_STRUCT_UNLOCK(mm);
 
     debug_printf("mm_add received %lu MB\n", size / 1024 / 1024);
@@ -80,7 +252,7 @@ errval_t mm_add(struct mm *mm, struct capref cap, genpaddr_t base, size_t size)
 }
 
 /**
- * Splits a memory node. $node is shrinked to $size, and
+ * Splits a free memory node. $node is shrinked to $size, and
  * a second node is insert after $node.
  *
  * \param       mm        The memory manager.
@@ -96,8 +268,12 @@ static void mm_split_mem_node_unsafe(struct mm* mm, struct mmnode* node, size_t
     remaining_free->base = node->base + size;
     remaining_free->size = node->size - size;
 
-    // Shrink initial node
+    // Shrink initial node (its bin depends on its size)
+    mm_bin_remove_unsafe(mm, node);
     node->size = size;
+    mm_bin_insert_unsafe(mm, node);
+    mm_bin_insert_unsafe(mm, remaining_free);
+    mm_tree_insert_unsafe(mm, remaining_free);
 
     // Link the list
     remaining_free->prev = node;
@@ -132,6 +308,47 @@ errval_t mm_alloc_cap(struct mm* mm, struct capref* ref)
  * \param       alignment The alignment requirement of the base address for your memory.
  * \param[out]  retcap    Capability for the allocated region.
  */
+static inline bool mm_node_fits(struct mmnode* node, size_t size, size_t alignment)
+{
+    size_t align_pad = (alignment - node->base % alignment) % alignment;
+    return node->size >= (size + align_pad);
+}
+
+/**
+ * First-fit walk of the whole node list.
+ */
+static struct mmnode* mm_find_free_linear_unsafe(struct mm* mm, size_t size, size_t alignment)
+{
+    for (struct mmnode* node = mm->head; node != NULL; node = node->next)
+        if (node->type == NodeType_Free && mm_node_fits(node, size, alignment))
+            return node;
+    return NULL;
+}
+
+/**
+ * Segregated fit: every node in a bin above the request's own bin is big
+ * enough, so for page-aligned requests the first non-empty bin answers in
+ * O(1). Larger alignments may have to skip a few nodes per bin. As a last
+ * resort the request's own bin, whose nodes may be too small, is scanned.
+ */
+static struct mmnode* mm_find_free_indexed_unsafe(struct mm* mm, size_t size, size_t alignment)
+{
+    int first = mm_bin_index(size);
+    uint32_t candidates = (first + 1 < MM_NUM_BINS) ? mm->bins_map & ~((2u << first) - 1) : 0;
+    while (candidates)
+    {
+        int bin = __builtin_ctz(candidates);
+        for (struct mmnode* node = mm->bins[bin]; node != NULL; node = node->bin_next)
+            if (mm_node_fits(node, size, alignment))
+                return node;
+        candidates &= ~(1u << bin);
+    }
+    for (struct mmnode* node = mm->bins[first]; node != NULL; node = node->bin_next)
+        if (mm_node_fits(node, size, alignment))
+            return node;
+    return NULL;
+}
+
 errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct capref *retcap)
 {
     if (alignment % BASE_PAGE_SIZE)
@@ -145,59 +362,59 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct c
     if (!slab_has_freecount(&mm->slabs, 6*3+2))
         mm->slabs.refill_func(&mm->slabs);
 
+    if (!mm->head)
+    {
+        LIBMM_STRUCT_UNLOCK(mm);
+        return MM_ERR_NO_NODE;
+    }
+
+    struct mmnode* node;
+    if (mm->policy == MM_SEARCH_LINEAR)
+        node = mm_find_free_linear_unsafe(mm, aligned_size, alignment);
+    else
+        node = mm_find_free_indexed_unsafe(mm, aligned_size, alignment);
 
-    struct mmnode* node = mm->head;
     if (!node)
     {
         LIBMM_STRUCT_UNLOCK(mm);
-        return MM_ERR_NO_NODE;
+        return MM_ERR_OUT_OF_MEMORY;
     }
-    while (node != NULL)
+
+    size_t align_pad = (alignment - node->base % alignment) % alignment;
+    genpaddr_t base = node->base + align_pad;
+    // 1. Split to align
+    if (align_pad)
     {
-        if (node->type == NodeType_Free)
-        {
-            size_t align_pad = (alignment - node->base % alignment) % alignment;
-            if (node->size >= (aligned_size + align_pad))
-            {
-                genpaddr_t base = node->base + align_pad;
-                // 1. Split to align
-                if (align_pad)
-                {
-                    mm_split_mem_node_unsafe(mm, node, align_pad);
-                    node = node->next;
-                    assert(node);
-                }
-                // 2. split the mem we need
-                if (node->size > size)
-                    mm_split_mem_node_unsafe(mm, node, aligned_size);
-                assert(node->type == NodeType_Free && "mm: After splitting node, node used?!");
-
-                // 3. Alloc cap for returned value
-                errval_t err = mm_alloc_cap(mm, retcap);
-                if (err_is_fail(err))
-                {
-                    LIBMM_STRUCT_UNLOCK(mm);
-                    return err;
-                }
-
-                assert(node->type == NodeType_Free && "mm: After alloc_cap, node used?!");
-                err = cap_retype(*retcap, node->cap.cap, base - node->cap.base,
-                        mm->objtype, size, 1);
-                if (err_is_fail(err))
-                {
-                    LIBMM_STRUCT_UNLOCK(mm);
-                    return err;
-                }
-
-                node->type = NodeType_Allocated;
-                LIBMM_STRUCT_UNLOCK(mm);
-                return err;
-            }
-        }
+        mm_split_mem_node_unsafe(mm, node, align_pad);
         node = node->next;
+        assert(node);
     }
+    // 2. split the mem we need
+    if (node->size > aligned_size)
+        mm_split_mem_node_unsafe(mm, node, aligned_size);
+    assert(node->type == NodeType_Free && "mm: After splitting node, node used?!");
+
+    // 3. Alloc cap for returned value
+    errval_t err = mm_alloc_cap(mm, retcap);
+    if (err_is_fail(err))
+    {
+        LIBMM_STRUCT_UNLOCK(mm);
+        return err;
+    }
+
+    assert(node->type == NodeType_Free && "mm: After alloc_cap, node used?!");
+    err = cap_retype(*retcap, node->cap.cap, base - node->cap.base,
+            mm->objtype, size, 1);
+    if (err_is_fail(err))
+    {
+        LIBMM_STRUCT_UNLOCK(mm);
+        return err;
+    }
+
+    mm_bin_remove_unsafe(mm, node);
+    node->type = NodeType_Allocated;
     LIBMM_STRUCT_UNLOCK(mm);
-    return MM_ERR_OUT_OF_MEMORY;
+    return err;
 }
 
 /**
@@ -214,7 +431,7 @@ errval_t mm_alloc(struct mm *mm, size_t size, struct capref *retcap)
 
 /**
  * Merges a given memory node with the following one.
- * if both of them are of type 'NodeType_Free'.
+ * if both of them are of type 'NodeType_Free' and carved out of the same cap.
  * $node_first and $node_first->next should be valid pointers.
  * $node_first remains valid, and $node_first->next is possibly deleted.
  *
@@ -226,11 +443,19 @@ static void mm_merge_mem_node_if_free_unsafe(struct mm* mm, struct mmnode* node_
     if (node_first->type != NodeType_Free || node_first->next->type != NodeType_Free)
         return;
     struct mmnode* node_next = node_first->next;
+    // Neighbours in the list may come from different mm_add() regions
+    if (node_first->cap.base != node_next->cap.base
+            || node_first->base + node_first->size != node_next->base)
+        return;
 
+    mm_bin_remove_unsafe(mm, node_first);
+    mm_bin_remove_unsafe(mm, node_next);
+    mm_tree_remove_unsafe(mm, node_next);
     node_first->size += node_first->next->size;
     node_first->next = node_next->next;
     if (node_first->next)
     	node_first->next->prev = node_first;
+    mm_bin_insert_unsafe(mm, node_first);
 
     slab_free(&mm->slabs, node_next);
 }
@@ -262,11 +487,22 @@ void mm_print_nodes(struct mm* mm)
  */
 errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t size)
 {
+    // Nobody may keep access to memory that we hand out again
+    errval_t err = cap_revoke(cap);
+    if (err_is_fail(err))
+        return err_push(err, MM_ERR_MM_FREE);
+
     LIBMM_STRUCT_LOCK(mm);
-    struct mmnode* node = mm->head;
+    struct mmnode* node;
     // Find node
-    while (node != NULL && node->base != base)
-        node = node->next;
+    if (mm->policy == MM_SEARCH_LINEAR)
+    {
+        node = mm->head;
+        while (node != NULL && node->base != base)
+            node = node->next;
+    }
+    else
+        node = mm_tree_find_unsafe(mm, base);
 
     // This node does not exist!
     if (!node)
@@ -283,14 +519,13 @@ errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t si
     // Merge with previous if the previous one is free
     // (We may need to merge with previous AND next node - see aligned alloc)
     node->type = NodeType_Free;
+    mm_bin_insert_unsafe(mm, node);
     if (node->next)
         mm_merge_mem_node_if_free_unsafe(mm, node);
     if (node->prev)
         mm_merge_mem_node_if_free_unsafe(mm, node->prev);
     LIBMM_STRUCT_UNLOCK(mm);
     //! $node may be invalid now!
-    // Revoke the cap.
-    //cap_revoke(cap) // NOT YET IMPLEMENTED!
     // Destroy the capability (and frees the slot)
     return cap_destroy(cap);
 }
@@ -1,48 +1,156 @@
+#include <stddef.h>
+#include <string.h>
 #include <netutil/checksum.h>
-#include <netutil/htons.h>
 
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
+/*
+ * The ones' complement sum doesn't care about byte order (RFC 1071, 2.B):
+ * summing 16 bit words as they are in memory gives the checksum in network
+ * order. So the data is summed in the widest chunks available and folded
+ * at the end, instead of assembling big endian words byte by byte.
+ */
+
+static inline uint16_t
+chksum_fold(uint64_t sum)
+{
+  sum = (sum >> 32) + (sum & 0xffffffffULL);
+  sum = (sum >> 32) + (sum & 0xffffffffULL);
+  sum = (sum >> 16) + (sum & 0xffffULL);
+  sum = (sum >> 16) + (sum & 0xffffULL);
+  return (uint16_t)sum;
+}
+
+static inline uint16_t
+chksum_swap(uint16_t x)
+{
+  return (uint16_t)((x << 8) | (x >> 8));
+}
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+/* Sums 32 bytes per iteration; $p is 4 byte aligned. A 16 bit lane adds at
+   most 2 * 0xffff per iteration to its 32 bit accumulator, so even 64 KiB
+   of data can't overflow them. */
+static uint64_t
+chksum_words(const uint8_t *p, size_t len)
+{
+  uint32x4_t acc0 = vdupq_n_u32(0);
+  uint32x4_t acc1 = vdupq_n_u32(0);
+  uint64_t sum = 0;
+
+  while (len >= 32) {
+    acc0 = vpadalq_u16(acc0, vld1q_u16((const uint16_t *)p));
+    acc1 = vpadalq_u16(acc1, vld1q_u16((const uint16_t *)(p + 16)));
+    p += 32;
+    len -= 32;
+  }
+  uint64x2_t acc = vaddq_u64(vpaddlq_u32(acc0), vpaddlq_u32(acc1));
+  sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+
+  while (len >= 4) {
+    uint32_t w;
+    memcpy(&w, p, 4);
+    sum += w;
+    p += 4;
+    len -= 4;
+  }
+  return sum;
+}
+#else
+/* The data is of any type, read it as words without breaking aliasing rules */
+typedef uint32_t __attribute__((may_alias)) chksum_word_t;
+
+/* Sums aligned 32 bit words into a 64 bit accumulator, which takes the
+   carries; $p is 4 byte aligned. */
+static uint64_t
+chksum_words(const uint8_t *p, size_t len)
+{
+  const chksum_word_t *w = (const chksum_word_t *)p;
+  uint64_t sum0 = 0, sum1 = 0;
+
+  while (len >= 16) {
+    sum0 += (uint64_t)w[0] + w[1];
+    sum1 += (uint64_t)w[2] + w[3];
+    w += 4;
+    len -= 16;
+  }
+  while (len >= 4) {
+    sum0 += *w++;
+    len -= 4;
+  }
+  return sum0 + sum1;
+}
+#endif
+
+/**
+ * Ones' complement sum of $len bytes, in network order; any alignment
+ */
 static uint16_t
-lwip_standard_chksum(void *dataptr, uint16_t len)
-{
-  uint32_t acc;
-  uint16_t src;
-  uint8_t *octetptr;
-
-  acc = 0;
-  /* dataptr may be at odd or even addresses */
-  octetptr = (uint8_t*)dataptr;
-  while (len > 1) {
-    /* declare first octet as most significant
-       thus assume network order, ignoring host order */
-    src = (*octetptr) << 8;
-    octetptr++;
-    /* declare second octet as least significant */
-    src |= (*octetptr);
-    octetptr++;
-    acc += src;
+chksum_partial(const void *dataptr, size_t len)
+{
+  const uint8_t *p = dataptr;
+  uint64_t sum = 0;
+  uint16_t t = 0;
+  /* From an odd address every word is summed with its bytes swapped,
+     the result is swapped back at the end */
+  int odd = (uintptr_t)p & 1;
+
+  if (odd && len > 0) {
+    ((uint8_t *)&t)[1] = *p++;
+    len--;
+    sum += t;
+  }
+  if (((uintptr_t)p & 2) && len >= 2) {
+    memcpy(&t, p, 2);
+    sum += t;
+    p += 2;
     len -= 2;
   }
-  if (len > 0) {
-    /* accumulate remaining octet */
-    src = (*octetptr) << 8;
-    acc += src;
+
+  size_t words = len & ~(size_t)3;
+  sum += chksum_words(p, words);
+  p += words;
+  len -= words;
+
+  if (len >= 2) {
+    memcpy(&t, p, 2);
+    sum += t;
+    p += 2;
+    len -= 2;
   }
-  /* add deferred carry bits */
-  acc = (acc >> 16) + (acc & 0x0000ffffUL);
-  if ((acc & 0xffff0000UL) != 0) {
-    acc = (acc >> 16) + (acc & 0x0000ffffUL);
+  if (len > 0) {
+    t = 0;
+    ((uint8_t *)&t)[0] = *p;
+    sum += t;
   }
-  /* This maybe a little confusing: reorder sum using htons()
-     instead of ntohs() since it has a little less call overhead.
-     The caller must invert bits for Internet sum ! */
-  return htons((uint16_t)acc);
-};
+
+  uint16_t folded = chksum_fold(sum);
+  return odd ? chksum_swap(folded) : folded;
+}
 
 /**
  * Calculate a short such that ret + dataptr[..] becomes 0
  */
 uint16_t inet_checksum(void *dataptr, uint16_t len)
 {
-  return ~lwip_standard_chksum(dataptr, len);
-};
+  return ~chksum_partial(dataptr, len);
+}
+
+/*
+ * RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m'). Works in network order like
+ * the rest, as long as $old_value and $new_value are as they are in memory.
+ */
+uint16_t inet_checksum_update16(uint16_t checksum, uint16_t old_value, uint16_t new_value)
+{
+  uint32_t sum = (uint16_t)~checksum + (uint32_t)(uint16_t)~old_value + new_value;
+  return ~chksum_fold(sum);
+}
+
+uint16_t inet_checksum_update32(uint16_t checksum, uint32_t old_value, uint32_t new_value)
+{
+  uint64_t sum = (uint16_t)~checksum + (uint64_t)(uint16_t)~(uint16_t)old_value
+      + (uint16_t)~(uint16_t)(old_value >> 16) + (uint16_t)new_value + (new_value >> 16);
+  return ~chksum_fold(sum);
+}
@@ -6,39 +6,117 @@
 #include <dev/omap/omap44xx_uart3_dev.h>
 #include <omap44xx_map.h>
 
+#include <arch/arm/barrelfish_kpi/asm_inlines_arch.h>
+
 #include <netutil/user_serial.h>
 
+#define UART_FIFO_SIZE      64
+
+// Filled by serial_write, drained by the THR interrupt. Power of two, the
+// indices run freely and wrap on their own.
+#define SERIAL_TX_RING_SIZE 4096
 
 static omap44xx_uart3_t port;
 
+static struct {
+    uint8_t data[SERIAL_TX_RING_SIZE];
+    volatile uint32_t head;     // Written by serial_write only
+    volatile uint32_t tail;     // Written by the interrupt handler only
+} tx_ring;
+
+static struct serial_stats stats;
+
+/*
+ * IER is only ever written as a whole: RHR and timeout interrupts stay on,
+ * the THR interrupt is on while the TX ring holds data.
+ */
+static void serial_set_tx_interrupt(bool enabled)
+{
+    omap44xx_uart3_ier_t ier = omap44xx_uart3_ier_default;
+    ier = omap44xx_uart3_ier_rhr_it_insert(ier, 1);
+    ier = omap44xx_uart3_ier_thr_it_insert(ier, enabled);
+    omap44xx_uart3_ier_wr(&port, ier);
+}
+
 static void serial_poll(omap44xx_uart3_t *uart)
 {
-    // Read while we can
-    while(omap44xx_uart3_lsr_rx_fifo_e_rdf(uart)) {
-        uint8_t c = omap44xx_uart3_rhr_rhr_rdf(uart);
-        serial_input(&c, 1);
+    // Hand the FIFO over in batches instead of byte by byte
+    uint8_t batch[UART_FIFO_SIZE];
+    size_t len = 0;
+    while (true) {
+        omap44xx_uart3_lsr_t lsr = omap44xx_uart3_lsr_rd(uart);
+        if (omap44xx_uart3_lsr_rx_oe_extract(lsr)) {
+            stats.rx_fifo_overruns++;
+        }
+        if (!omap44xx_uart3_lsr_rx_fifo_e_extract(lsr)) {
+            break;
+        }
+        batch[len++] = omap44xx_uart3_rhr_rhr_rdf(uart);
+        if (len == sizeof(batch)) {
+            serial_input(batch, len);
+            stats.rx_bytes += len;
+            stats.rx_batches++;
+            len = 0;
+        }
+    }
+    if (len) {
+        serial_input(batch, len);
+        stats.rx_bytes += len;
+        stats.rx_batches++;
     }
 }
 
-static void serial_interrupt(void *arg)
+static void serial_transmit(omap44xx_uart3_t *uart)
 {
-    // get type
-    omap44xx_uart3_iir_t iir= omap44xx_uart3_iir_rd(&port);
+    uint32_t tail = tx_ring.tail;
+    uint32_t head = tx_ring.head;
+    // Don't read the bytes before the writer's index
+    dmb();
+    size_t room = UART_FIFO_SIZE - omap44xx_uart3_txfifo_lvl_txfifo_lvl_rdf(uart);
+    while (tail != head && room--) {
+        omap44xx_uart3_thr_thr_wrf(uart, tx_ring.data[tail % SERIAL_TX_RING_SIZE]);
+        tail++;
+    }
+    // The writer must not reuse the slots before we are done reading them
+    dmb();
+    tx_ring.tail = tail;
 
-    if (omap44xx_uart3_iir_it_pending_extract(iir) == 0) {
-        omap44xx_uart3_it_type_status_t it_type=
+    if (tail == tx_ring.head) {
+        serial_set_tx_interrupt(false);
+        // serial_write may have queued more and enabled the interrupt just
+        // before we disabled it
+        dmb();
+        if (tail != tx_ring.head) {
+            serial_set_tx_interrupt(true);
+        }
+    }
+}
+
+static void serial_interrupt(void *arg)
+{
+    // Serve every pending source, RX first
+    while (true) {
+        omap44xx_uart3_iir_t iir = omap44xx_uart3_iir_rd(&port);
+        if (omap44xx_uart3_iir_it_pending_extract(iir) != 0) {
+            break;
+        }
+        omap44xx_uart3_it_type_status_t it_type =
             omap44xx_uart3_iir_it_type_extract(iir);
         switch(it_type) {
             case omap44xx_uart3_it_modem:
                 omap44xx_uart3_msr_rd(&port);
                 break;
+            case omap44xx_uart3_it_rlse:
             case omap44xx_uart3_it_rxtimeout:
             case omap44xx_uart3_it_rhr:
                 serial_poll(&port);
                 break;
+            case omap44xx_uart3_it_thr:
+                serial_transmit(&port);
+                break;
             default:
                 debug_printf("serial_interrupt: unhandled irq: %d\n", it_type);
-                break;
+                return;
         }
     }
 }
@@ -91,8 +169,12 @@ static void omap44xx_uart3_init(omap44xx_uart3_t *uart, lvaddr_t base)
 {
     // XXX: test this with other values
     // rx and tx FIFO threshold values (1 -- 63)
-    uint8_t rx_trig = 1; // amount of characters in fifo
-    uint8_t tx_trig = 63; // amount of free spaces in fifo
+    // Interrupt with a quarter of the FIFO filled and drain it in one go;
+    // the RX timeout interrupt picks up the tail of a burst
+    uint8_t rx_trig = 16; // amount of characters in fifo
+    // Refill with half the FIFO still queued, so the line never idles while
+    // the THR interrupt waits to be dispatched
+    uint8_t tx_trig = 32; // amount of free spaces in fifo
     // LH: Why not keep these always at 0??
     bool need_rx_1b = convert_rx_simple(&rx_trig);
     bool need_tx_1b = convert_tx_simple(&tx_trig);
@@ -221,24 +303,36 @@ errval_t serial_init(lvaddr_t vbase, uint32_t irq) {
     return SYS_ERR_OK;
 }
 
-/** output a single character */
-static void serial_putchar(uint8_t c)
+void serial_write(uint8_t *c, size_t len)
 {
-    // Wait until FIFO can hold more characters
-    int maxit = 100000;
-    while (!omap44xx_uart3_lsr_tx_fifo_e_rdf(&port) && maxit-- > 0);
-    if(maxit == 0){
-        printf("TX does not get ready.\n");
-    } else {
-        // Write character
-        omap44xx_uart3_thr_thr_wrf(&port, c);
+    while (len) {
+        uint32_t head = tx_ring.head;
+        uint32_t tail = tx_ring.tail;
+        // The interrupt handler must be done reading the slots
+        dmb();
+        size_t space = SERIAL_TX_RING_SIZE - (head - tail);
+        if (!space) {
+            // Back-pressure: wait for the THR interrupt to make room
+            stats.tx_ring_full++;
+            thread_yield();
+            continue;
+        }
+        size_t n = MIN(len, space);
+        for (size_t i = 0; i < n; ++i) {
+            tx_ring.data[(head + i) % SERIAL_TX_RING_SIZE] = c[i];
+        }
+        // Publish the bytes before the index
+        dmb();
+        tx_ring.head = head + n;
+        stats.tx_bytes += n;
+        c += n;
+        len -= n;
+        // Raises an interrupt right away if the FIFO has room
+        serial_set_tx_interrupt(true);
     }
-
 }
 
-void serial_write(uint8_t *c, size_t len)
+void serial_get_stats(struct serial_stats *ret)
 {
-    for (int i = 0; i < len; i++) {
-        serial_putchar(c[i]);
-    }
+    *ret = stats;
 }
@@ -56,11 +56,21 @@ malloc(size_t nbytes)
 		if (p->s.size >= nunits) {	/* big enough */
 			if (p->s.size == nunits)	/* exactly */
 				prevp->s.ptr = p->s.ptr;
+#if defined(__arm__) || defined(__aarch64__)
+			else {	/* allocate head end, keeps the heap top free for lesscore */
+				Header *rest = p + nunits;
+				rest->s.size = p->s.size - nunits;
+				rest->s.ptr = p->s.ptr;
+				prevp->s.ptr = rest;
+				p->s.size = nunits;
+			}
+#else
 			else {	/* allocate tail end */
 				p->s.size -= nunits;
 				p += p->s.size;
 				p->s.size = nunits;
 			}
+#endif
             p->s.magic = 0xdeadbeef;
 			state->header_freep = prevp;
 #ifdef CONFIG_MALLOC_DEBUG
@@ -180,10 +190,15 @@ void free(void *ap)
         return;
     }
     ((Header *)ap)[-1].s.magic = 0;
+    size_t trim_bytes;
     MALLOC_LOCK;
     __free_locked(ap);
-    lesscore();
+    void *trim = lesscore(&trim_bytes);
     MALLOC_UNLOCK;
+    // Giving memory back takes RPCs, which may allocate
+    if (trim != NULL) {
+        lesscore_release(trim, trim_bytes);
+    }
 }
 
 #ifdef CONFIG_MALLOC_DEBUG_INTERNAL
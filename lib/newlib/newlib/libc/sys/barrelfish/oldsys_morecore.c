@@ -26,6 +26,13 @@ typedef void (*morecore_free_func_t)(void *base, size_t bytes);
 morecore_alloc_func_t sys_morecore_alloc;
 morecore_free_func_t sys_morecore_free;
 
+#if defined(__arm__) || defined(__aarch64__)
+/// Free space lesscore() leaves at the top of the heap
+#define LESSCORE_PAD        (64 * 1024)
+/// Smallest amount lesscore() gives back
+#define LESSCORE_THRESHOLD  LARGE_PAGE_SIZE
+#endif
+
 /**
  * \brief sbrk() equivalent.
  *
@@ -63,12 +70,41 @@ Header *morecore(unsigned nu)
  * \brief sbrk() garbage collector.
  *
  * Tries to free up pages at the end of the segment, so to shorten the
- * segment and return memory to the operating system.
+ * segment. Called with the malloc lock held, it only detaches them from
+ * the heap: they go back to the operating system with lesscore_release()
+ * once the lock is dropped, as that takes RPCs which may need malloc.
+ *
+ * \return Base of the detached memory, *bytes long, or NULL.
  */
-void lesscore(void)
+void *lesscore(size_t *bytes)
 {
 #if defined(__arm__) || defined(__aarch64__)
-    // Not implemented
+    struct morecore_state *state = get_morecore_state();
+    Header *top = (Header *)state->region.current_addr;
+    Header *p = state->header_freep;
+    if (p == NULL || top == NULL) {
+        return NULL;
+    }
+
+    // free() leaves header_freep on the chunk it freed, or right below it
+    if (p + p->s.size != top) {
+        p = p->s.ptr;
+    }
+    if (p + p->s.size != top) {
+        return NULL;
+    }
+
+    // Cut at a section boundary: no mapping of the pagefault handler
+    // crosses it, so everything above can be unmapped.
+    lvaddr_t cut = ROUND_UP((lvaddr_t)(p + 1) + LESSCORE_PAD, LARGE_PAGE_SIZE);
+    if (cut + LESSCORE_THRESHOLD > (lvaddr_t)top) {
+        return NULL;
+    }
+
+    p->s.size = (Header *)cut - p;
+    state->region.current_addr = cut;
+    *bytes = (lvaddr_t)top - cut;
+    return (void *)cut;
 
 #else
     struct morecore_state *state = get_morecore_state();
@@ -77,8 +113,6 @@ void lesscore(void)
         + state->mmu_state.offset;
     void *eaddr = (void*)vspace_genvaddr_to_lvaddr(gvaddr);
 
-    assert(sys_morecore_free);
-
     // Deallocate from end of segment
     Header *prevp = state->header_freep, *p;
     for(p = prevp->s.ptr;; prevp = p, p = p->s.ptr) {
@@ -86,14 +120,23 @@ void lesscore(void)
             prevp->s.ptr = p->s.ptr;
             state->header_freep = prevp;
 
-            // Give back the memory
-            sys_morecore_free(p, p->s.size * sizeof(Header));
-            break;
+            *bytes = p->s.size * sizeof(Header);
+            return p;
         }
 
         if (p == state->header_freep) {	/* wrapped around free list */
-            break;
+            return NULL;
         }
     }
 #endif
 }
+
+/**
+ * \brief Gives memory detached by lesscore() back to the operating system.
+ * Must be called without the malloc lock held.
+ */
+void lesscore_release(void *base, size_t bytes)
+{
+    assert(sys_morecore_free);
+    sys_morecore_free(base, bytes);
+}
@@ -10,8 +10,39 @@
 // give every spawned process a copy of the kernel cap so we can identify caps for debugging
 #define KERNEL_CAP 0
 
+#define SPAWN_DEBUG(...) //debug_printf(__VA_ARGS__);
+
+/*
+ * Spawn image cache. The first spawn of a binary loads its ELF into frames
+ * of init, one per PT_LOAD segment, and keeps them. Later spawns map the
+ * read-only segments' frames straight into the child (shared) and
+ * map the writable ones (data, BSS) copy-on-write: no module mapping, no
+ * ELF parsing, and only the pages a child writes get copied.
+ * Relocations only depend on the link addresses, which are the same in
+ * every child.
+ */
+#define SPAWN_IMAGE_MAX_SEGMENTS 8
+
+struct spawn_image_segment {
+    genvaddr_t base;        // Page aligned, in the child
+    size_t size;            // Page aligned
+    uint32_t flags;         // PF_*
+    struct capref frame;
+    void* mapped;           // Writable segments: the pristine copy, in init
+};
+
+struct spawn_image {
+    char* name;
+    genvaddr_t entry;
+    lvaddr_t got;
+    size_t num_segments;
+    struct spawn_image_segment segments[SPAWN_IMAGE_MAX_SEGMENTS];
+    struct spawn_image* next;
+};
+
+static struct spawn_image* spawn_images = NULL;
+
 extern struct bootinfo *bi;
-errval_t elf_allocator(void *state, genvaddr_t base, size_t size, uint32_t flags, void **ret);
 
 errval_t spawn_map_multiboot(struct spawninfo* si, void** address);
 errval_t spawn_setup_cspace(struct spawninfo* si);
@@ -28,7 +59,8 @@ errval_t spawn_child_slot_free(struct slot_allocator *ca, struct capref cap);
 
 errval_t spawn_setup_dispatcher(struct spawninfo* si, struct lmp_chan* lc   );
 errval_t spawn_setup_arguments(struct spawninfo* si, char* const argv[], int argc);
-errval_t spawn_parse_elf(struct spawninfo* si, lvaddr_t address);
+errval_t spawn_get_image(struct spawninfo* si, struct spawn_image** image);
+errval_t spawn_map_image(struct spawninfo* si, struct spawn_image* image);
 
 //Util functions
 errval_t map_argument_to_child_vspace(char* const argv[], int argc, struct spawn_domain_params* child_args, lvaddr_t child_base_address);
@@ -36,24 +68,24 @@ errval_t map_argument_to_child_vspace(char* const argv[], int argc, struct spawn
 errval_t spawn_load_with_args(char* const argv[], int argc, struct spawninfo * si,
         struct lmp_chan* lc)
 {
-    debug_printf("spawn_load_with_args with %d arguments\n", argc);
+    SPAWN_DEBUG("spawn_load_with_args with %d arguments\n", argc);
     for (int i = 0; i < argc; ++i)
-        debug_printf("argv[%d] = '%s'\n", i, argv[i]);
+        SPAWN_DEBUG("argv[%d] = '%s'\n", i, argv[i]);
 
     const char* binary_name = argv[0];
-    debug_printf("spawn start_child: starting: %s, trying to load module\n", binary_name);
+    SPAWN_DEBUG("spawn start_child: starting: %s, trying to load module\n", binary_name);
     if (si->core_id >= 2) // We only have 2 cores
         return SPAWN_ERR_WRONG_CORE_ID;
+    si->ram_bytes = 0;
 
     // 1- Get the binary from multiboot image
     struct mem_region* process_mem_reg;
-    debug_printf("calling spawn_load_module with si [0x%08x], name %s, mem reg [0x%08x] \n", si, binary_name, &process_mem_reg);
     ERROR_RET1(spawn_load_module(si, (const char*)binary_name, &process_mem_reg));
-    debug_printf("----- spawn: mem region: [0x%08x] size: [0x%08x]\n", process_mem_reg, si->module_bytes);
+    SPAWN_DEBUG("----- spawn: mem region: [0x%08x] size: [0x%08x]\n", process_mem_reg, si->module_bytes);
 
-    // 2- Map multiboot module in your address space
-    void* address = NULL;
-    ERROR_RET1(spawn_map_multiboot(si, &address));
+    // 2- Load the binary's image, unless it is cached
+    struct spawn_image* image;
+    ERROR_RET1(spawn_get_image(si, &image));
 
     // 3- Setup childs cspace
     ERROR_RET1(spawn_setup_cspace(si));
@@ -62,20 +94,20 @@ errval_t spawn_load_with_args(char* const argv[], int argc, struct spawninfo * s
     ERROR_RET1(spawn_setup_vspace(si));
     ERROR_RET1(spawn_setup_minimal_child_paging(si));
 
-    // 5- Load the ELF binary
-    debug_printf("Load ELF...\n");
-    ERROR_RET1(spawn_parse_elf(si, (lvaddr_t)address));
+    // 5- Map the image's segments
+    ERROR_RET1(spawn_map_image(si, image));
+    SPAWN_DEBUG("%s image ready\n", binary_name);
 
     // 6- Setup dispatcher
-    debug_printf("Setup dispatcher...\n");
+    SPAWN_DEBUG("Setup dispatcher...\n");
     ERROR_RET1(spawn_setup_dispatcher(si, lc));
 
     // 7- Setup arguments
-    debug_printf("Setup arguments...\n");
+    SPAWN_DEBUG("Setup arguments...\n");
     ERROR_RET1(spawn_setup_arguments(si, argv, argc));
 
     // 8- Make dispatcher runnable0
-    debug_printf("And finally invoke dispatcher :)\n");
+    SPAWN_DEBUG("And finally invoke dispatcher :)\n");
 	struct capref slot_dispatcher={
 		.cnode=si->l2_cnodes[ROOTCN_SLOT_TASKCN],
 		.slot=TASKCN_SLOT_DISPFRAME
@@ -116,8 +148,9 @@ errval_t spawn_setup_vspace(struct spawninfo* si)
     // Allocate L1 arm vnode
     ERROR_RET2(vnode_create(si->l1_pagetable_own_cap, ObjType_VNode_ARM_l1),
         SPAWN_ERR_L1_VNODE_CREATE);
+    si->ram_bytes += vnode_objsize(ObjType_VNode_ARM_l1);
     ERROR_RET1(cap_copy(si->l1_pagetable_child_cap, si->l1_pagetable_own_cap));
-    debug_printf("Created child L1 pagetable\n");
+    SPAWN_DEBUG("Created child L1 pagetable\n");
     return SYS_ERR_OK;
 }
 
@@ -158,17 +191,18 @@ errval_t spawn_child_slot_free(struct slot_allocator *ca, struct capref cap)
 
 errval_t spawn_setup_cspace(struct spawninfo* si)
 {
-	debug_printf("Setting up cspace for %s\n", si->binary_name);
+	SPAWN_DEBUG("Setting up cspace for %s\n", si->binary_name);
     struct cnoderef cnoderef;
     ERROR_RET2(cnode_create_l1(&si->l1_cnode_cap, &cnoderef), SPAWN_ERR_SETUP_CSPACE);
+    si->ram_bytes += OBJSIZE_L2CNODE * (1 + ROOTCN_SLOTS_USER);
 
     // FIXME we have a problem here
-    debug_printf("L1 cnode: 0x%x, croot: 0x%x, slot: %d\n", si->l1_cnode_cap.cnode.cnode, &si->l1_cnode_cap.cnode.croot, &si->l1_cnode_cap.slot);
+    SPAWN_DEBUG("L1 cnode: 0x%x, croot: 0x%x, slot: %d\n", si->l1_cnode_cap.cnode.cnode, &si->l1_cnode_cap.cnode.croot, &si->l1_cnode_cap.slot);
     for (int i = 0; i < ROOTCN_SLOTS_USER; ++i)
     {
         ERROR_RET2(cnode_create_foreign_l2(si->l1_cnode_cap,
                 i, &si->l2_cnodes[i]), SPAWN_ERR_SETUP_CSPACE);
-        debug_printf("L2 %d cnode: 0x%x, croot: 0x%x\n", i, si->l2_cnodes[i].cnode, si->l2_cnodes[i].croot);
+        SPAWN_DEBUG("L2 %d cnode: 0x%x, croot: 0x%x\n", i, si->l2_cnodes[i].cnode, si->l2_cnodes[i].croot);
     }
 
     // Fill capabilities
@@ -184,6 +218,7 @@ errval_t spawn_setup_cspace(struct spawninfo* si)
     child_frame_ref.slot = 0;
     struct capref page_ref;
     ERROR_RET2(ram_alloc(&page_ref, BASE_PAGE_SIZE * L2_CNODE_SLOTS), SPAWN_ERR_CREATE_SMALLCN);
+    si->ram_bytes += BASE_PAGE_SIZE * L2_CNODE_SLOTS;
     ERROR_RET2(cap_retype(child_frame_ref,
         page_ref,
         0,
@@ -201,6 +236,7 @@ errval_t spawn_setup_dispatcher(struct spawninfo* si, struct lmp_chan* lc)
     ERROR_RET1(slot_alloc(&si->child_dispatcher_own_cap));
     ERROR_RET1(slot_alloc(&dispatcher_endpoint));
     ERROR_RET1(dispatcher_create(si->child_dispatcher_own_cap));
+    si->ram_bytes += OBJSIZE_DISPATCHER;
     ERROR_RET1(cap_retype(dispatcher_endpoint, si->child_dispatcher_own_cap, 0,
         ObjType_EndPoint, 0, 1));
 
@@ -208,6 +244,7 @@ errval_t spawn_setup_dispatcher(struct spawninfo* si, struct lmp_chan* lc)
     struct capref ram_for_dispatcher;
     ERROR_RET1(slot_alloc(&si->child_dispatcher_frame_own_cap));
     ERROR_RET1(ram_alloc(&ram_for_dispatcher, DISPATCHER_SIZE));
+    si->ram_bytes += DISPATCHER_SIZE;
     ERROR_RET1(cap_retype(si->child_dispatcher_frame_own_cap,
         ram_for_dispatcher, 0,
         ObjType_Frame, DISPATCHER_SIZE, 1));
@@ -289,6 +326,7 @@ errval_t spawn_setup_dispatcher(struct spawninfo* si, struct lmp_chan* lc)
     disp_gen->eh_frame_size = 0;
     disp_gen->eh_frame_hdr = 0;
     disp_gen->eh_frame_hdr_size = 0;
+    disp_gen->cow_table = (struct paging_cow_table*)si->cow_table;
     return SYS_ERR_OK;
 }
 
@@ -330,6 +368,7 @@ errval_t spawn_setup_arguments(struct spawninfo* si, char* const argv[], int arg
     struct capref ram_cap;
     struct capref frame_cap;
     ERROR_RET1(ram_alloc(&ram_cap, domain_params_frame_size));
+    si->ram_bytes += domain_params_frame_size;
     ERROR_RET1(slot_alloc(&frame_cap));
     ERROR_RET1(cap_retype(frame_cap, ram_cap, 0,
         ObjType_Frame, domain_params_frame_size, 1));
@@ -369,59 +408,249 @@ errval_t spawn_setup_arguments(struct spawninfo* si, char* const argv[], int arg
     return SYS_ERR_OK;
 }
 
-errval_t spawn_parse_elf(struct spawninfo* si, lvaddr_t address)
+static errval_t image_allocator(void *state, genvaddr_t base, size_t size, uint32_t flags, void **ret)
+{
+    SPAWN_DEBUG("image_allocator: request for : %lu bytes at 0x%08x\n", size, (int) base);
+
+    struct spawn_image* image = (struct spawn_image*)state;
+    if (image->num_segments == SPAWN_IMAGE_MAX_SEGMENTS)
+        return SPAWN_ERR_LOAD;
+    struct spawn_image_segment* seg = &image->segments[image->num_segments];
+
+    // 1. Fix sizes / alignments etc...
+    size_t base_offset = BASE_PAGE_OFFSET(base);
+    seg->base = base - base_offset;
+    seg->size = ROUND_UP(size + base_offset, BASE_PAGE_SIZE);
+    seg->flags = flags;
+
+    // 2. Allocate frame and map it in my own space for elf_load to fill
+    struct capref ram_ref;
+    ERROR_RET1(ram_alloc(&ram_ref, seg->size));
+    ERROR_RET1(slot_alloc(&seg->frame));
+    ERROR_RET1(cap_retype(seg->frame, ram_ref, 0,
+                ObjType_Frame, seg->size, 1));
+    ERROR_RET1(paging_map_frame(get_current_paging_state(), &seg->mapped,
+        seg->size, seg->frame, NULL, NULL));
+
+    *ret = seg->mapped + base_offset;
+    image->num_segments++;
+    return SYS_ERR_OK;
+}
+
+// Undoes a partial spawn_load_image: unmaps and destroys the segments
+static void spawn_free_image(struct spawn_image* image, void* address)
 {
-    debug_printf("Loading ELF binary...\n");
-    ERROR_RET2(elf_load(EM_ARM, elf_allocator,
-        (void*)si, address,
-        si->module_bytes, &si->child_entry_point),
+    struct paging_state* ps = get_current_paging_state();
+    if (address)
+        ERR_CHECK("unmapping the module", paging_unmap(ps, address));
+    for (size_t i = 0; i < image->num_segments; ++i)
+    {
+        struct spawn_image_segment* seg = &image->segments[i];
+        if (seg->mapped)
+            ERR_CHECK("unmapping a segment", paging_unmap(ps, seg->mapped));
+        ERR_CHECK("destroying a segment", cap_destroy(seg->frame));
+    }
+    free(image);
+}
+
+// Loads the ELF of the module mapped at *$address into $image
+static errval_t spawn_load_image(struct spawninfo* si, struct spawn_image* image,
+    void** address)
+{
+    ERROR_RET2(elf_load(EM_ARM, image_allocator,
+        (void*)image, (lvaddr_t)*address,
+        si->module_bytes, &image->entry),
         SPAWN_ERR_LOAD);
-    debug_printf("elf32_find_section_header_name...\n");
-    struct Elf64_Ehdr *head = (struct Elf64_Ehdr *)address;
-    debug_printf("Ident: %u\n", head->e_ident[EI_CLASS]);
-    struct Elf32_Shdr *got = elf32_find_section_header_name((lvaddr_t)address,
+    struct Elf32_Shdr *got = elf32_find_section_header_name((lvaddr_t)*address,
         si->module_bytes, ".got");
     if (!got)
         return SPAWN_ERR_LOAD;
-    si->got = got->sh_addr;
+    image->got = got->sh_addr;
+
+    // Only the writable segments' pristine copies stay mapped in init
+    struct paging_state* ps = get_current_paging_state();
+    ERROR_RET1(paging_unmap(ps, *address));
+    *address = NULL;
+    for (size_t i = 0; i < image->num_segments; ++i)
+    {
+        struct spawn_image_segment* seg = &image->segments[i];
+        if (!(seg->flags & PF_W))
+        {
+            ERROR_RET1(paging_unmap(ps, seg->mapped));
+            seg->mapped = NULL;
+        }
+    }
+
+    image->name = strdup(si->binary_name);
+    if (!image->name)
+        return LIB_ERR_MALLOC_FAIL;
     return SYS_ERR_OK;
 }
 
-errval_t elf_allocator(void *state, genvaddr_t base, size_t size, uint32_t flags, void **ret)
+/**
+ * Finds the image of si->binary_name in the cache, or loads the ELF from
+ * the multiboot module and adds it.
+ */
+errval_t spawn_get_image(struct spawninfo* si, struct spawn_image** image)
 {
-    debug_printf("elf_allocator: invoked, request for : %lu bytes at 0x%08x\n", size, (int) base);
+    for (*image = spawn_images; *image; *image = (*image)->next)
+        if (!strcmp((*image)->name, si->binary_name))
+            return SYS_ERR_OK;
 
-    struct spawninfo* si = (struct spawninfo*)state;
+    SPAWN_DEBUG("Loading ELF binary...\n");
+    struct spawn_image* new_image = calloc(1, sizeof(struct spawn_image));
+    if (!new_image)
+        return LIB_ERR_MALLOC_FAIL;
 
-    // 1. Fix sizes / alignments etc...
-    size_t base_offset = BASE_PAGE_OFFSET(base);
-    size += base_offset;
-    base -= base_offset;
-    size = ROUND_UP(size, BASE_PAGE_SIZE);
+    void* address = NULL;
+    errval_t err = spawn_map_multiboot(si, &address);
+    if (err_is_ok(err))
+        err = spawn_load_image(si, new_image, &address);
+    if (err_is_fail(err))
+    {
+        spawn_free_image(new_image, address);
+        *image = NULL;
+        return err;
+    }
 
-    // 2. Allocate frame
-    struct capref ram_ref;
-	ERROR_RET1(ram_alloc(&ram_ref, size));
-	struct capref frame_cap;
-	slot_alloc(&frame_cap);
-	ERROR_RET1(cap_retype(frame_cap, ram_ref, 0,
-				ObjType_Frame, size, 1));
+    new_image->next = spawn_images;
+    spawn_images = new_image;
+    *image = new_image;
+    return SYS_ERR_OK;
+}
 
-    // 3. Map in my own space and fill return buffer
-	struct paging_state* ps= get_current_paging_state();
+// A cap of the child's page cnode, as the child addresses it
+static struct capref spawn_child_pagecn_cap(struct capref cap)
+{
+    struct capref child_cap = {
+        .cnode = cnode_page,
+        .slot = cap.slot
+    };
+    return child_cap;
+}
 
+/**
+ * Gives the child its copy-on-write table, mapped in both of us, and the
+ * reserve its dispatcher copies the first written pages into.
+ */
+static errval_t spawn_setup_cow(struct spawninfo* si, struct paging_cow_table** table)
+{
+    size_t bytes;
+    struct capref table_frame;
+    size_t table_bytes = ROUND_UP(sizeof(struct paging_cow_table), BASE_PAGE_SIZE);
+    ERROR_RET1(frame_alloc(&table_frame, table_bytes, &bytes));
+    si->ram_bytes += bytes;
+    ERROR_RET1(paging_map_frame(get_current_paging_state(), (void**)table,
+        table_bytes, table_frame, NULL, NULL));
+    ERROR_RET1(paging_map_frame(&si->child_paging_state, (void**)&si->cow_table,
+        table_bytes, table_frame, NULL, NULL));
+
+    struct capref reserve, reserve_child;
+    void* reserve_mapped_child;
+    size_t reserve_bytes = PAGING_COW_RESERVE * BASE_PAGE_SIZE;
+    ERROR_RET1(frame_alloc(&reserve, reserve_bytes, &bytes));
+    si->ram_bytes += bytes;
+    ERROR_RET1(paging_map_frame(&si->child_paging_state, &reserve_mapped_child,
+        reserve_bytes, reserve, NULL, NULL));
+    ERROR_RET1(si->slot_alloc.a.alloc(&si->slot_alloc.a, &reserve_child));
+    ERROR_RET1(cap_copy(reserve_child, reserve));
+
+    for (size_t i = 0; i < PAGING_COW_RESERVE; ++i)
+    {
+        struct paging_cow_frame* copy = &(*table)->reserve[i];
+        copy->frame = spawn_child_pagecn_cap(reserve_child);
+        copy->ram = NULL_CAP;
+        copy->offset = i * BASE_PAGE_SIZE;
+        copy->vaddr = (lvaddr_t)reserve_mapped_child + i * BASE_PAGE_SIZE;
+    }
+    (*table)->num_reserve = PAGING_COW_RESERVE;
+    return SYS_ERR_OK;
+}
 
-	ERROR_RET1(paging_map_frame(ps, ret, size, frame_cap, NULL, NULL));
+/**
+ * Maps a writable segment copy-on-write, one page per mapping so that the
+ * child can replace them one by one. Once $table is full, the rest of the
+ * segment gets a fresh copy.
+ */
+static errval_t spawn_map_writable(struct spawninfo* si, struct spawn_image_segment* seg,
+    struct paging_cow_table* table)
+{
+    struct paging_state* child = &si->child_paging_state;
+    size_t pages = seg->size / BASE_PAGE_SIZE;
+    size_t shared = MIN(pages, PAGING_COW_MAX_PAGES - table->num_pages);
+
+    ERROR_RET1(paging_alloc_fixed_address(child, seg->base, seg->size));
+    vm_block_key_t key;
+    struct vm_block* block = find_block_before(child, seg->base, &key);
+    assert(block && ADDRESS_FROM_VM_BLOCK_KEY(key) == seg->base);
+
+    struct capref frame;
+    ERROR_RET1(slot_alloc(&frame));
+    ERROR_RET1(cap_copy(frame, seg->frame));
+    // PT_LOAD segments come in address order, and so does the table
+    for (size_t i = 0; i < shared; ++i)
+    {
+        lvaddr_t vaddr = seg->base + i * BASE_PAGE_SIZE;
+        ERROR_RET1(paging_map_fixed_attr(child, vaddr, frame, BASE_PAGE_SIZE,
+            i * BASE_PAGE_SIZE, VREGION_FLAGS_READ, block));
+
+        struct paging_cow_page* page = &table->pages[table->num_pages++];
+        page->vaddr = vaddr;
+        page->l2 = spawn_child_pagecn_cap(child->l2nodes[ARM_L1_OFFSET(vaddr)].vnode_ref);
+        page->mapping = spawn_child_pagecn_cap(block->mappings->mapping);
+        page->shared = true;
+    }
+    if (shared == pages)
+        return SYS_ERR_OK;
+
+    size_t bytes;
+    size_t copy_bytes = (pages - shared) * BASE_PAGE_SIZE;
+    void* copy;
+    struct paging_state* ps = get_current_paging_state();
+    ERROR_RET1(frame_alloc(&frame, copy_bytes, &bytes));
+    si->ram_bytes += bytes;
+    ERROR_RET1(paging_map_frame(ps, &copy, copy_bytes, frame, NULL, NULL));
+    memcpy(copy, seg->mapped + shared * BASE_PAGE_SIZE, copy_bytes);
+    ERROR_RET1(paging_unmap(ps, copy));
+    return paging_map_fixed_attr(child, seg->base + shared * BASE_PAGE_SIZE,
+        frame, copy_bytes, 0, VREGION_FLAGS_READ_WRITE, NULL);
+}
 
-    *ret = (((void*)*ret) + (size_t)base_offset);
-    debug_printf("Allocated at 0x%08x\n", (int)*ret);
+/**
+ * Maps the segments of $image into the child: read-only ones share the
+ * image's frames, writable ones are copy-on-write.
+ */
+errval_t spawn_map_image(struct spawninfo* si, struct spawn_image* image)
+{
+    struct paging_cow_table* table;
+    ERROR_RET1(spawn_setup_cow(si, &table));
 
-    // 4. Map in child VSpace at given 'base' address
-    ERROR_RET1(paging_alloc_fixed_address(&si->child_paging_state,
-            base, size));
-    ERROR_RET1(paging_map_fixed(&si->child_paging_state,
-        base, frame_cap, size));
+    for (size_t i = 0; i < image->num_segments; ++i)
+    {
+        struct spawn_image_segment* seg = &image->segments[i];
+        if (seg->flags & PF_W)
+        {
+            ERROR_RET1(spawn_map_writable(si, seg, table));
+            continue;
+        }
+
+        // Each mapping needs a cap of its own
+        struct capref frame;
+        ERROR_RET1(slot_alloc(&frame));
+        ERROR_RET1(cap_copy(frame, seg->frame));
+        int flags = VREGION_FLAGS_READ;
+        if (seg->flags & PF_X)
+            flags |= VREGION_FLAGS_EXECUTE;
+
+        ERROR_RET1(paging_alloc_fixed_address(&si->child_paging_state,
+                seg->base, seg->size));
+        ERROR_RET1(paging_map_fixed_attr(&si->child_paging_state,
+            seg->base, frame, seg->size, 0, flags, NULL));
+    }
+    ERROR_RET1(paging_unmap(get_current_paging_state(), table));
 
+    si->child_entry_point = image->entry;
+    si->got = image->got;
     return SYS_ERR_OK;
 }
 
@@ -434,9 +663,8 @@ errval_t spawn_map_multiboot(struct spawninfo* si, void** address)
             NULL, NULL),
             SPAWN_ERR_MAP_MODULE);
 
-    char* elf = (char*)address;
-    debug_printf("Beginning at 0x%x: 0x%x 0x%x 0x%x 0x%x. Size=%u\n",
-        (int)address, elf[0], elf[1], elf[2], elf[3],
-        si->module_bytes);
+    SPAWN_DEBUG("Beginning at 0x%x: 0x%x 0x%x 0x%x 0x%x. Size=%u\n",
+        (int)*address, ((char*)*address)[0], ((char*)*address)[1],
+        ((char*)*address)[2], ((char*)*address)[3], si->module_bytes);
     return SYS_ERR_OK;
 }
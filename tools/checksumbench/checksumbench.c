@@ -0,0 +1,175 @@
+/*
+ * Checks lib/netutil's Internet checksum against the byte-at-a-time lwIP
+ * version it replaced, on every alignment and many lengths, checks the
+ * RFC 1624 incremental updates against full recomputation, and compares
+ * the speed of both checksums on the host.
+ *
+ * Usage: checksumbench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <netutil/checksum.h>
+
+#define DEFAULT_ITERATIONS  200000
+#define MAX_LENGTH          2048
+#define MAX_OFFSET          8
+
+static uint16_t swap16(uint16_t x)
+{
+    return (uint16_t)((x << 8) | (x >> 8));
+}
+
+static int little_endian(void)
+{
+    uint16_t x = 1;
+    return *(uint8_t*)&x;
+}
+
+// The old lwip_standard_chksum, followed by the inversion
+static uint16_t __attribute__((noinline)) scalar_checksum(void* dataptr, uint16_t len)
+{
+    uint32_t acc = 0;
+    uint8_t* octetptr = dataptr;
+    while (len > 1) {
+        uint16_t src = *octetptr++ << 8;
+        src |= *octetptr++;
+        acc += src;
+        len -= 2;
+    }
+    if (len > 0)
+        acc += *octetptr << 8;
+    acc = (acc >> 16) + (acc & 0xffff);
+    if (acc & 0xffff0000)
+        acc = (acc >> 16) + (acc & 0xffff);
+    uint16_t sum = little_endian() ? swap16(acc) : acc;
+    return ~sum;
+}
+
+static uint32_t xorshift(uint32_t* x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_full(uint8_t* buf, const char* profile)
+{
+    for (size_t offset = 0; offset < MAX_OFFSET; ++offset) {
+        for (size_t len = 0; len <= MAX_LENGTH; ++len) {
+            uint16_t expected = scalar_checksum(buf + offset, len);
+            uint16_t got = inet_checksum(buf + offset, len);
+            if (got != expected) {
+                fprintf(stderr, "checksumbench: %s data, offset %zu, %zu bytes: 0x%04x instead of 0x%04x\n",
+                        profile, offset, len, got, expected);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Patches random fields of a random 20 byte header, as ICMP and IP do
+static int check_incremental(uint32_t* x, size_t rounds)
+{
+    uint8_t header[20];
+    for (size_t i = 0; i < sizeof(header); ++i)
+        header[i] = xorshift(x);
+    memset(header + 10, 0, 2);
+    uint16_t checksum = inet_checksum(header, sizeof(header));
+
+    for (size_t i = 0; i < rounds; ++i) {
+        // Any field but the checksum itself
+        size_t offset;
+        int wide = xorshift(x) & 1;
+        do {
+            offset = (xorshift(x) % (wide ? 9 : 10)) * 2;
+        } while (offset <= 10 && offset + (wide ? 4 : 2) > 10);
+
+        if (wide) {
+            uint32_t old_value, new_value = xorshift(x);
+            memcpy(&old_value, header + offset, 4);
+            memcpy(header + offset, &new_value, 4);
+            checksum = inet_checksum_update32(checksum, old_value, new_value);
+        } else {
+            uint16_t old_value, new_value = xorshift(x);
+            memcpy(&old_value, header + offset, 2);
+            memcpy(header + offset, &new_value, 2);
+            checksum = inet_checksum_update16(checksum, old_value, new_value);
+        }
+
+        // Both zeros of ones' complement are fine, the receiver's sum is 0xffff either way
+        memcpy(header + 10, &checksum, 2);
+        uint16_t verify = inet_checksum(header, sizeof(header));
+        memset(header + 10, 0, 2);
+        if (verify != 0) {
+            fprintf(stderr, "checksumbench: incremental update %zu left a bad checksum 0x%04x\n", i, checksum);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static volatile uint16_t sink;
+
+static void bench(uint8_t* buf, size_t len, size_t offset, size_t iterations)
+{
+    double start = now();
+    for (size_t i = 0; i < iterations; ++i)
+        sink = scalar_checksum(buf + offset, len);
+    double scalar = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < iterations; ++i)
+        sink = inet_checksum(buf + offset, len);
+    double fast = now() - start;
+
+    printf("  %4zu bytes at offset %zu: %8.1f MB/s byte-wise, %8.1f MB/s word-wise\n", len, offset,
+            len * iterations / scalar / 1e6, len * iterations / fast / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    if (!iterations) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    static uint8_t buf[MAX_LENGTH + MAX_OFFSET] __attribute__((aligned(16)));
+    uint32_t x = 2463534242u;
+
+    for (size_t i = 0; i < sizeof(buf); ++i)
+        buf[i] = xorshift(&x);
+    if (check_full(buf, "random"))
+        return 1;
+    // Carries everywhere
+    memset(buf, 0xff, sizeof(buf));
+    if (check_full(buf, "all ones"))
+        return 1;
+    memset(buf, 0, sizeof(buf));
+    if (check_full(buf, "all zeros"))
+        return 1;
+    if (check_incremental(&x, 1000000))
+        return 1;
+    printf("Checksums match the byte-wise version, incremental updates verify\n");
+
+    for (size_t i = 0; i < sizeof(buf); ++i)
+        buf[i] = xorshift(&x);
+    bench(buf, 20, 0, iterations * 20);
+    bench(buf, 64, 0, iterations * 10);
+    bench(buf, 1500, 0, iterations);
+    bench(buf, 1500, 1, iterations);
+    return 0;
+}
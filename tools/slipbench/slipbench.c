@@ -0,0 +1,184 @@
+/*
+ * Host throughput of the network controller's SLIP codec, next to the
+ * byte-at-a-time encoder and decoder it replaced.
+ *
+ * Usage: slipbench [payload_bytes] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../usr/network_controller/slip_codec.h"
+
+#define DEFAULT_PAYLOAD     1500
+#define DEFAULT_ITERATIONS  20000
+
+static uint8_t* sink;
+static size_t sink_length;
+
+// Stands in for the serial write handler, which used to be called per byte
+static void __attribute__((noinline)) sink_write(uint8_t* buf, size_t len)
+{
+    memcpy(sink + sink_length, buf, len);
+    sink_length += len;
+}
+
+static void bytewise_encode(uint8_t* buf, size_t len)
+{
+    static uint8_t esc_end[2] = {SLIP_ESC, SLIP_ESC_END};
+    static uint8_t esc_esc[2] = {SLIP_ESC, SLIP_ESC_ESC};
+    static uint8_t esc_nul[2] = {SLIP_ESC, SLIP_ESC_NUL};
+    static uint8_t end[1] = {SLIP_END};
+
+    for (size_t i = 0; i < len; ++i) {
+        switch (buf[i]) {
+        case SLIP_END:
+            sink_write(esc_end, 2);
+            break;
+        case SLIP_ESC:
+            sink_write(esc_esc, 2);
+            break;
+        case 0x0:
+            sink_write(esc_nul, 2);
+            break;
+        default:
+            sink_write(buf + i, 1);
+        }
+    }
+    sink_write(end, 1);
+}
+
+static void block_encode(uint8_t* buf, size_t len)
+{
+    sink_length += slip_encode(sink + sink_length, buf, len);
+    sink[sink_length++] = SLIP_END;
+}
+
+static size_t received_bytes;
+
+static void frame_received(uint8_t* frame, size_t len, void* context)
+{
+    received_bytes += len;
+}
+
+struct bytewise_decoder {
+    uint8_t* frame;
+    size_t length;
+    int is_escape;
+};
+
+// One call per byte, as the receive thread used to make
+static void __attribute__((noinline)) bytewise_consume(struct bytewise_decoder* d, uint8_t byte)
+{
+    if (!d->is_escape && byte == SLIP_ESC) {
+        d->is_escape = 1;
+        return;
+    }
+    if (d->is_escape) {
+        byte = byte == SLIP_ESC_END ? SLIP_END : byte == SLIP_ESC_ESC ? SLIP_ESC : 0;
+        d->is_escape = 0;
+    } else if (byte == SLIP_END) {
+        frame_received(d->frame, d->length, NULL);
+        d->length = 0;
+        return;
+    }
+    d->frame[d->length++] = byte;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* label, size_t bytes, double seconds)
+{
+    printf("  %-20s %8.1f MB/s\n", label, bytes / seconds / 1e6);
+}
+
+static void run(const char* profile, uint8_t* payload, size_t len, size_t iterations)
+{
+    size_t total = len * iterations;
+    uint8_t* frame = malloc(len);
+    if (!frame) {
+        perror("malloc");
+        exit(1);
+    }
+    printf("%s payload, %zu bytes x %zu:\n", profile, len, iterations);
+
+    double start = now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink_length = 0;
+        bytewise_encode(payload, len);
+    }
+    report("encode, per byte", total, now() - start);
+
+    start = now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink_length = 0;
+        block_encode(payload, len);
+    }
+    report("encode, per block", total, now() - start);
+    size_t encoded = sink_length;
+
+    struct bytewise_decoder bytewise = { .frame = frame };
+    received_bytes = 0;
+    start = now();
+    for (size_t i = 0; i < iterations; ++i)
+        for (size_t j = 0; j < encoded; ++j)
+            bytewise_consume(&bytewise, sink[j]);
+    report("decode, per byte", total, now() - start);
+
+    struct slip_decoder decoder;
+    slip_decoder_init(&decoder, frame, len, frame_received, NULL);
+    received_bytes = 0;
+    start = now();
+    for (size_t i = 0; i < iterations; ++i)
+        slip_decode(&decoder, sink, encoded);
+    report("decode, per block", total, now() - start);
+
+    if (received_bytes != total || decoder.dropped || memcmp(frame, payload, len)) {
+        fprintf(stderr, "slipbench: decoded data does not match the payload\n");
+        exit(1);
+    }
+    free(frame);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t len = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_PAYLOAD;
+    size_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_ITERATIONS;
+    if (!len || !iterations) {
+        fprintf(stderr, "Usage: %s [payload_bytes] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t* payload = malloc(len);
+    sink = malloc(SLIP_ENCODED_MAX_SIZE(len) + 1);
+    if (!payload || !sink) {
+        perror("malloc");
+        return 1;
+    }
+
+    // Random bytes: one in 85 needs escaping
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < len; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        payload[i] = x;
+    }
+    run("random", payload, len, iterations);
+
+    // Every byte escaped
+    for (size_t i = 0; i < len; ++i)
+        payload[i] = i % 2 ? SLIP_END : SLIP_ESC;
+    run("all escaped", payload, len, iterations);
+
+    free(payload);
+    free(sink);
+    return 0;
+}
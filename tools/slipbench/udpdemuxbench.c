@@ -0,0 +1,282 @@
+/*
+ * Host cost of the network controller's UDP socket demultiplexing: replays
+ * a synthetic trace of datagrams from many distinct peers, echo server
+ * style (find the socket of each datagram, then find it again by id to send
+ * the answer), against the linked lists the UDP parser used to walk and
+ * against its hash tables.
+ *
+ * Usage: udpdemuxbench [peers] [datagrams] [local_ports] [idle_peers_per_mille]
+ *
+ * With idle peers, that share of the peers goes quiet halfway through the
+ * trace, and the table run expires them like the network controller does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../usr/network_controller/udp_table.h"
+
+#define DEFAULT_PEERS       500
+#define DEFAULT_DATAGRAMS   2000000
+#define DEFAULT_PORTS       4
+#define DEFAULT_IDLE        0
+
+// Trace time between datagrams and the network controller's timeouts (us)
+#define DATAGRAM_INTERVAL       100
+#define PEER_IDLE_TIMEOUT       (60*1000*1000)
+#define PEER_EXPIRY_PERIOD      (5*1000*1000)
+
+struct datagram {
+    uint32_t from;
+    uint16_t source_port;
+    uint16_t dest_port;
+};
+
+struct peer {
+    uint32_t address;
+    uint16_t port;
+    uint16_t local_port;
+    uint32_t socket_id;
+    uint64_t last_active;
+    struct peer* next;
+};
+
+struct local {
+    uint16_t port;
+    uint32_t last_socket_id;
+    struct peer* peers;
+    struct local* next;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t xorshift(uint32_t* x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static void* xmalloc(size_t bytes)
+{
+    void* p = calloc(1, bytes);
+    if (!p) {
+        perror("calloc");
+        exit(1);
+    }
+    return p;
+}
+
+static struct local* make_locals(size_t ports)
+{
+    struct local* head = NULL;
+    for (size_t i = 0; i < ports; ++i) {
+        struct local* local = xmalloc(sizeof(*local));
+        local->port = 7000 + i;
+        local->next = head;
+        head = local;
+    }
+    return head;
+}
+
+static void free_locals(struct local* local)
+{
+    while (local) {
+        struct local* next = local->next;
+        free(local);
+        local = next;
+    }
+}
+
+// What udp_parser.c did: walk the ports, then the port's peers
+static uint32_t list_receive(struct local* locals, struct datagram* d)
+{
+    struct local* local;
+    for (local = locals; local; local = local->next)
+        if (local->port == d->dest_port)
+            break;
+    struct peer* peer;
+    for (peer = local->peers; peer; peer = peer->next)
+        if (peer->port == d->source_port && peer->address == d->from)
+            return peer->socket_id;
+    peer = xmalloc(sizeof(*peer));
+    peer->address = d->from;
+    peer->port = d->source_port;
+    peer->socket_id = local->last_socket_id++;
+    peer->next = local->peers;
+    local->peers = peer;
+    return peer->socket_id;
+}
+
+static void list_send(struct local* locals, uint16_t local_port, uint32_t socket_id, struct datagram* d)
+{
+    struct local* local;
+    for (local = locals; local; local = local->next)
+        if (local->port == local_port)
+            break;
+    for (struct peer* peer = local->peers; peer; peer = peer->next)
+        if (peer->socket_id == socket_id) {
+            if (peer->address != d->from) {
+                fprintf(stderr, "udpdemuxbench: list found the wrong peer\n");
+                exit(1);
+            }
+            return;
+        }
+    fprintf(stderr, "udpdemuxbench: list lost a socket\n");
+    exit(1);
+}
+
+struct tables {
+    struct udp_table locals;
+    struct udp_table peers;
+    struct udp_table sockets;
+    uint64_t time;
+    uint64_t last_expiry;
+    size_t expired;
+};
+
+static uint32_t table_receive(struct tables* t, struct datagram* d)
+{
+    struct peer* peer = udp_table_find(&t->peers, UDP_TABLE_PEER_KEY(d->dest_port, d->from, d->source_port));
+    if (peer) {
+        peer->last_active = t->time;
+        return peer->socket_id;
+    }
+    struct local* local = udp_table_find(&t->locals, UDP_TABLE_PORT_KEY(d->dest_port));
+    peer = xmalloc(sizeof(*peer));
+    peer->address = d->from;
+    peer->port = d->source_port;
+    peer->local_port = local->port;
+    peer->socket_id = local->last_socket_id++;
+    peer->last_active = t->time;
+    if (!udp_table_insert(&t->peers, UDP_TABLE_PEER_KEY(local->port, peer->address, peer->port), peer) ||
+            !udp_table_insert(&t->sockets, UDP_TABLE_SOCKET_KEY(local->port, peer->socket_id), peer)) {
+        fprintf(stderr, "udpdemuxbench: out of memory\n");
+        exit(1);
+    }
+    return peer->socket_id;
+}
+
+static void table_send(struct tables* t, uint16_t local_port, uint32_t socket_id, struct datagram* d)
+{
+    struct peer* peer = udp_table_find(&t->sockets, UDP_TABLE_SOCKET_KEY(local_port, socket_id));
+    if (!peer || peer->address != d->from) {
+        fprintf(stderr, "udpdemuxbench: table found the wrong peer\n");
+        exit(1);
+    }
+    peer->last_active = t->time;
+}
+
+static bool peer_expired(void* value, void* context)
+{
+    struct peer* peer = value;
+    struct tables* t = context;
+    if (t->time - peer->last_active < PEER_IDLE_TIMEOUT)
+        return false;
+    udp_table_remove(&t->sockets, UDP_TABLE_SOCKET_KEY(peer->local_port, peer->socket_id));
+    free(peer);
+    return true;
+}
+
+static bool free_peer(void* value, void* context)
+{
+    free(value);
+    return true;
+}
+
+static void free_list_peers(struct local* local)
+{
+    for (; local; local = local->next) {
+        while (local->peers) {
+            struct peer* next = local->peers->next;
+            free(local->peers);
+            local->peers = next;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t peers = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_PEERS;
+    size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_DATAGRAMS;
+    size_t ports = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_PORTS;
+    size_t idle = argc > 4 ? strtoul(argv[4], NULL, 10) : DEFAULT_IDLE;
+    if (!peers || !count || !ports || ports > 1000 || idle > 1000) {
+        fprintf(stderr, "Usage: %s [peers] [datagrams] [local_ports 1-1000] [idle_peers_per_mille 0-1000]\n", argv[0]);
+        return 1;
+    }
+
+    // Peers talk to one port each, in random order
+    struct datagram* trace = xmalloc(count * sizeof(*trace));
+    size_t active = peers - peers * idle / 1000;
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < count; ++i) {
+        size_t pool = i < count / 2 || !active ? peers : active;
+        uint32_t peer = xorshift(&x) % pool;
+        trace[i].from = 0x0a000000 + peer / 4;
+        trace[i].source_port = 1024 + peer % 4;
+        trace[i].dest_port = 7000 + peer % ports;
+    }
+    uint32_t* socket_ids = xmalloc(count * sizeof(*socket_ids));
+
+    printf("%zu datagrams from %zu peers to %zu ports, %zu per mille go idle:\n", count, peers, ports, idle);
+
+    struct local* locals = make_locals(ports);
+    double start = now();
+    for (size_t i = 0; i < count; ++i) {
+        socket_ids[i] = list_receive(locals, &trace[i]);
+        list_send(locals, trace[i].dest_port, socket_ids[i], &trace[i]);
+    }
+    double elapsed = now() - start;
+    printf("  %-22s %8.1f ns/datagram\n", "lists", elapsed / count * 1e9);
+    free_list_peers(locals);
+
+    struct tables t;
+    if (!udp_table_init(&t.locals, ports) || !udp_table_init(&t.peers, 64) || !udp_table_init(&t.sockets, 64)) {
+        fprintf(stderr, "udpdemuxbench: out of memory\n");
+        return 1;
+    }
+    for (struct local* local = locals; local; local = local->next) {
+        local->last_socket_id = 0;
+        udp_table_insert(&t.locals, UDP_TABLE_PORT_KEY(local->port), local);
+    }
+    t.time = 0;
+    t.last_expiry = 0;
+    t.expired = 0;
+    start = now();
+    for (size_t i = 0; i < count; ++i) {
+        t.time += DATAGRAM_INTERVAL;
+        if (t.time - t.last_expiry >= PEER_EXPIRY_PERIOD) {
+            t.last_expiry = t.time;
+            t.expired += udp_table_remove_if(&t.peers, peer_expired, &t);
+        }
+        uint32_t socket_id = table_receive(&t, &trace[i]);
+        // Expired peers come back with new ids, the lists never expire
+        if (socket_id != socket_ids[i] && !t.expired) {
+            fprintf(stderr, "udpdemuxbench: table and lists disagree on datagram %zu\n", i);
+            return 1;
+        }
+        table_send(&t, trace[i].dest_port, socket_id, &trace[i]);
+    }
+    elapsed = now() - start;
+    printf("  %-22s %8.1f ns/datagram\n", "hash tables", elapsed / count * 1e9);
+    printf("  %zu peers left, %zu expired after %.0f s of trace time\n",
+            (size_t)t.peers.count, t.expired, t.time / 1e6);
+
+    udp_table_remove_if(&t.peers, free_peer, NULL);
+    udp_table_destroy(&t.peers);
+    udp_table_destroy(&t.sockets);
+    udp_table_destroy(&t.locals);
+    free_locals(locals);
+    free(socket_ids);
+    free(trace);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * End-to-end UDP echo throughput over SLIP: run udp_echo_server on the
+ * board, tunslip on the host, then
+ *
+ *   udpechobench [address] [port] [payload_bytes] [count] [window]
+ *
+ * Keeps up to $window datagrams in flight and reports echoed datagrams per
+ * second, payload throughput and round-trip times. The server copies the
+ * payload with strncpy behind its prefix into a 200 byte buffer, so the
+ * payload is printable and at most ECHO_MAX_PAYLOAD bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_ADDRESS     "10.0.2.1"
+#define DEFAULT_PORT        1234
+#define DEFAULT_PAYLOAD     64
+#define DEFAULT_COUNT       1000
+#define DEFAULT_WINDOW      4
+
+#define ECHO_MAX_PAYLOAD    180
+#define SEQ_DIGITS          8
+#define MAX_COUNT           99999999
+// A datagram not echoed by then is lost
+#define TIMEOUT_MS          1000
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* address = argc > 1 ? argv[1] : DEFAULT_ADDRESS;
+    int port = argc > 2 ? atoi(argv[2]) : DEFAULT_PORT;
+    size_t payload = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_PAYLOAD;
+    size_t count = argc > 4 ? strtoul(argv[4], NULL, 10) : DEFAULT_COUNT;
+    size_t window = argc > 5 ? strtoul(argv[5], NULL, 10) : DEFAULT_WINDOW;
+    if (payload < SEQ_DIGITS || payload > ECHO_MAX_PAYLOAD || !count || count > MAX_COUNT || !window) {
+        fprintf(stderr, "Usage: %s [address] [port] [payload_bytes %d-%d] [count] [window]\n",
+                argv[0], SEQ_DIGITS, ECHO_MAX_PAYLOAD);
+        return 1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    struct sockaddr_in server = { .sin_family = AF_INET, .sin_port = htons(port) };
+    if (!inet_aton(address, &server.sin_addr)) {
+        fprintf(stderr, "Invalid address %s\n", address);
+        return 1;
+    }
+    if (connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0) {
+        perror("connect");
+        return 1;
+    }
+
+    double* sent_at = calloc(count, sizeof(double));
+    if (!sent_at) {
+        perror("calloc");
+        return 1;
+    }
+    char request[ECHO_MAX_PAYLOAD + 1];
+    char answer[512];
+    memset(request, 'x', sizeof(request));
+
+    printf("UDP echo: %zu x %zu bytes to %s:%d, window %zu\n", count, payload, address, port, window);
+    size_t sent = 0, echoed = 0, in_flight = 0;
+    double rtt_sum = 0, rtt_min = 1e9, rtt_max = 0;
+    double start = now();
+    while (sent < count || in_flight) {
+        while (sent < count && in_flight < window) {
+            char seq[24];
+            snprintf(seq, sizeof(seq), "%0*zu", SEQ_DIGITS, sent);
+            memcpy(request, seq, SEQ_DIGITS);
+            sent_at[sent] = now();
+            if (send(fd, request, payload, 0) < 0) {
+                perror("send");
+                return 1;
+            }
+            sent++;
+            in_flight++;
+        }
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, TIMEOUT_MS);
+        if (ready < 0) {
+            perror("poll");
+            return 1;
+        }
+        if (!ready) {
+            // Whatever is in flight is gone
+            in_flight = 0;
+            continue;
+        }
+
+        ssize_t len = recv(fd, answer, sizeof(answer) - 1, 0);
+        if (len < (ssize_t)payload)
+            continue;
+        answer[len] = 0;
+        // The payload comes back behind the server's prefix
+        char* echo = answer + len - payload;
+        char* end;
+        size_t seq = strtoul(echo, &end, 10);
+        if (end != echo + SEQ_DIGITS || seq >= sent || !sent_at[seq])
+            continue;
+        double rtt = now() - sent_at[seq];
+        sent_at[seq] = 0;
+        rtt_sum += rtt;
+        rtt_min = rtt < rtt_min ? rtt : rtt_min;
+        rtt_max = rtt > rtt_max ? rtt : rtt_max;
+        echoed++;
+        if (in_flight)
+            in_flight--;
+    }
+    double elapsed = now() - start;
+
+    printf("  %zu echoed, %zu lost in %.2f s\n", echoed, count - echoed, elapsed);
+    if (echoed) {
+        printf("  %.1f datagrams/s, %.2f KB/s payload each way\n",
+                echoed / elapsed, echoed * payload / elapsed / 1e3);
+        printf("  rtt min %.2f ms, avg %.2f ms, max %.2f ms\n",
+                rtt_min * 1e3, rtt_sum / echoed * 1e3, rtt_max * 1e3);
+    }
+    free(sent_at);
+    close(fd);
+    return echoed == count ? 0 : 2;
+}
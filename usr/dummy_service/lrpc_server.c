@@ -64,14 +64,12 @@ errval_t handle_string(struct aos_rpc_session* sess,
         uint32_t* ret_type,
         uint32_t* ret_flags)
 {
-    if (!sess->shared_buffer_size)
-        return RPC_ERR_SHARED_BUF_EMPTY;
-
-    size_t string_size = msg->words[1];
-    ASSERT_PROTOCOL(string_size <= sess->shared_buffer_size);
+    char* string;
+    size_t string_size;
+    aos_rpc_bulk_request(sess, &string, &string_size);
 
     DEBUG_LRPC("Recv RPC_STRING [string size %d]\n", string_size);
-    sys_print(sess->shared_buffer, string_size);
+    sys_print(string, string_size);
     sys_print("\n", 1);
     return SYS_ERR_OK;
 }
@@ -80,6 +80,47 @@ errval_t handle_establish_connection(struct urpc_buffer* buf, struct urpc_messag
     return SYS_ERR_OK;
 }
 
+struct connect_to_socket_call
+{
+    struct urpc_future future;
+    struct aos_rpc_session* sess;
+    struct frame_identity frame;
+};
+
+static
+void connect_to_socket_done(void* arg)
+{
+    struct connect_to_socket_call* call = arg;
+    errval_t err = call->future.err;
+    if (err_is_ok(err) && call->future.answer_len != sizeof(struct frame_identity))
+        err = URPC_ERR_PROTOCOL_ERROR;
+
+    struct capref return_cap = NULL_CAP;
+    if (err_is_ok(err))
+    {
+        debug_printf("Received frame info: base: [0x%08x] and size: [0x%08x]\n", (int)call->frame.base, (int)call->frame.bytes);
+        err = slot_alloc(&return_cap);
+        if (err_is_ok(err))
+            err = frame_forge(return_cap, call->frame.base, call->frame.bytes, my_core_id);
+    }
+
+    uint32_t flags = RPC_FLAG_ACK;
+    if (err_is_fail(err))
+    {
+        DEBUG_ERR(err, "connect to socket");
+        return_cap = NULL_CAP;
+        flags |= RPC_FLAG_ERROR;
+    }
+    err = lmp_chan_send2(&call->sess->lc,
+        LMP_FLAG_SYNC,
+        return_cap,
+        MAKE_RPC_MSG_HEADER(RPC_CONNECT_TO_SOCKET, flags),
+        err);
+    if (err_is_fail(err))
+        DEBUG_ERR(err, "connect to socket: sending answer");
+    free(call);
+}
+
 static
 errval_t handle_connect_to_socket(struct aos_rpc_session* sess,
         struct lmp_recv_msg* msg,
@@ -94,29 +135,18 @@ errval_t handle_connect_to_socket(struct aos_rpc_session* sess,
     struct urpc_channel* channel=context;
     uint32_t pid=msg->words[1];
 
-    struct frame_identity received_frame={
-            .base=0,
-            .bytes=0
-    };
-    size_t received_size;
-    ERROR_RET1(urpc_client_send_receive_fixed_size(&channel->buffer_send, URPC_OP_CONNECT_TO_SOCKET, &pid, sizeof(pid),
-            &received_frame,sizeof(struct frame_identity),&received_size));
-
-    assert(received_size==sizeof(struct frame_identity));
-
-    debug_printf("Received frame info: base: [0x%08x] and size: [0x%08x]\n", (int)received_frame.base, (int)received_frame.bytes);
-
-    //TODO: Forge and return capability
-    struct capref return_cap;
-    slot_alloc(&return_cap);
-    ERROR_RET1(frame_forge(return_cap, received_frame.base, received_frame.bytes, my_core_id))
-    ERROR_RET1(lmp_chan_send1(&sess->lc,
-        LMP_FLAG_SYNC,
-        return_cap,
-        MAKE_RPC_MSG_HEADER(RPC_CONNECT_TO_SOCKET, RPC_FLAG_ACK)
-    ));
-
-    return SYS_ERR_OK;
+    // The answer is sent from connect_to_socket_done, so that this core's
+    // RPC server doesn't wait for the other core in the meantime
+    struct connect_to_socket_call* call = malloc(sizeof(struct connect_to_socket_call));
+    if (!call)
+        return LIB_ERR_MALLOC_FAIL;
+    call->sess = sess;
+    errval_t err = urpc_client_send_async(&channel->buffer_send, URPC_OP_CONNECT_TO_SOCKET, &pid, sizeof(pid),
+            &call->frame, sizeof(struct frame_identity), &call->future,
+            sess->rpc->ws, MKCLOSURE(connect_to_socket_done, call));
+    if (err_is_fail(err))
+        free(call);
+    return err;
 }
 
 errval_t binding_server_lmp_init(struct aos_rpc* _rpc, struct urpc_channel* channel){
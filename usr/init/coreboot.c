@@ -241,7 +241,7 @@ errval_t coreboot_init(struct bootinfo *binfo, void** urpc_buffer, size_t* urpc_
     core_data->memory_base_start=init_frame_id.base;
     core_data->memory_bytes=init_frame_id.bytes;
 
-    ERROR_RET1(frame_alloc(&cap_urpc, BASE_PAGE_SIZE, urpc_buffer_size));
+    ERROR_RET1(frame_alloc(&cap_urpc, URPC_DEFAULT_FRAME_SIZE + COREBOOT_URPC_POOL_SIZE, urpc_buffer_size));
     struct frame_identity urpc_frame_id;
     ERROR_RET1(frame_identify(cap_urpc, &urpc_frame_id));
 
@@ -276,11 +276,18 @@ errval_t coreboot_wait_for_core_to_boot(void* urpc_buf){
     return SYS_ERR_OK;
 }
 
-errval_t coreboot_finished_init(void* urpc_buf){
+errval_t coreboot_finished_init(void* urpc_buf, size_t urpc_buf_size){
     struct urpc_buffer_header* urpc_header=(struct urpc_buffer_header*)urpc_buf;
     debug_printf("Core %lu finished init\n", urpc_header->spawned_core_id);
+    assert(urpc_buf_size >= URPC_DEFAULT_FRAME_SIZE);
+    // The URPC rings start out as a zeroed frame: clear them before the parent
+    // sees the signal and starts sending requests. The pool behind the rings
+    // was never written, so it is still zero from the retype.
+    memset(urpc_buf+sizeof(struct urpc_buffer_header), 0, URPC_DEFAULT_FRAME_SIZE-sizeof(struct urpc_buffer_header));
+    urpc_header->ram_info.ram_base_address=0;
+    urpc_header->ram_info.ram_size=0;
+    dmb();
     urpc_header->spawned_core_id=0;
-    memset(urpc_buf,0,BASE_PAGE_SIZE);
     dmb();
     debug_printf("Signaled parent!\n");
 
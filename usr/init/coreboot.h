@@ -13,6 +13,9 @@ struct coreboot_available_ram_info{
     genpaddr_t ram_size;
 };
 
+/// Shared pages after the rings, for payloads sent as URPC descriptors
+#define COREBOOT_URPC_POOL_SIZE (2 * LARGE_PAGE_SIZE)
+
 struct urpc_buffer_header{
     struct coreboot_available_ram_info ram_info;
     volatile uint32_t spawned_core_id;
@@ -24,4 +27,4 @@ errval_t coreboot_write_bootinfo_to_urpc(void* urpc_buf, genpaddr_t base, gensiz
         coreid_t core_to_spawn_on, struct coreboot_available_ram_info available_ram);
 errval_t coreboot_urpc_read_bootinfo_modules(void* urpc_buf, struct bootinfo* bi);
 errval_t coreboot_wait_for_core_to_boot(void* urpc_buf);
-errval_t coreboot_finished_init(void* urpc_buf);
+errval_t coreboot_finished_init(void* urpc_buf, size_t urpc_buf_size);
@@ -90,8 +90,10 @@ errval_t os_core_initialize(int argc, char** argv)
             DEBUG_ERR(err, "read_modules");
             return err;
         }
-        coreboot_finished_init(urpc_buffer);
-        ERROR_RET1(urpc_channel_init(&urpc_chan, urpc_buffer, urpc_buffer_size, URPC_CHAN_SLAVE, URPC_OP_COUNT));
+        coreboot_finished_init(urpc_buffer, urpc_buffer_size);
+        ERROR_RET1(urpc_channel_init(&urpc_chan, urpc_buffer, URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_SLAVE, URPC_OP_COUNT));
+        ERROR_RET1(urpc_channel_attach_pool(&urpc_chan, urpc_buffer + URPC_DEFAULT_FRAME_SIZE,
+            urpc_buffer_size - URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_SLAVE));
     }
 
     // 5. Init RPC server
@@ -101,7 +103,9 @@ errval_t os_core_initialize(int argc, char** argv)
     // 6. Boot second core if needed
     if (my_core_id==0){
         coreboot_init(bi, &urpc_buffer, &urpc_buffer_size);
-        ERROR_RET1(urpc_channel_init(&urpc_chan, urpc_buffer, urpc_buffer_size, URPC_CHAN_MASTER, URPC_OP_COUNT));
+        ERROR_RET1(urpc_channel_init(&urpc_chan, urpc_buffer, URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_MASTER, URPC_OP_COUNT));
+        ERROR_RET1(urpc_channel_attach_pool(&urpc_chan, urpc_buffer + URPC_DEFAULT_FRAME_SIZE,
+            urpc_buffer_size - URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_MASTER));
     }
     ERROR_RET1(processmgr_init(my_core_id, argv[0]));
 
@@ -1,6 +1,7 @@
 #include "lrpc_server.h"
 #include "init.h"
 #include "nameserver.h"
+#include "process/processmgr.h"
 #include <arch/arm/barrelfish_kpi/asm_inlines_arch.h>
 #include <omap44xx_map.h>
 #include <aos/urpc/udp.h>
@@ -10,6 +11,9 @@
 
 struct lmp_chan* networking_lmp_chan;
 
+// Workers forward lookups to the nameserver one at a time
+static struct thread_mutex ns_forward_lock;
+
 static
 void cb_send_ready(void* args){
     struct aos_rpc_session *sess = args;
@@ -129,14 +133,12 @@ errval_t handle_string(struct aos_rpc_session* sess,
         uint32_t* ret_type,
         uint32_t* ret_flags)
 {
-    if (!sess->shared_buffer_size)
-        return RPC_ERR_SHARED_BUF_EMPTY;
-
-    size_t string_size = msg->words[1];
-    ASSERT_PROTOCOL(string_size <= sess->shared_buffer_size);
+    char* string;
+    size_t string_size;
+    aos_rpc_bulk_request(sess, &string, &string_size);
 
     DEBUG_LRPC("Recv RPC_STRING [string size %d]\n", string_size);
-    sys_print(sess->shared_buffer, string_size);
+    sys_print(string, string_size);
     sys_print("\n", 1);
     return SYS_ERR_OK;
 }
@@ -162,6 +164,134 @@ errval_t handle_ram_cap_opcode(struct aos_rpc_session* sess,
         return_cap,
         MAKE_RPC_MSG_HEADER(RPC_RAM_CAP_RESPONSE, RPC_FLAG_ACK),
         requested_bytes));
+    processmgr_charge_ram(sess->lc.endpoint, requested_bytes, 1);
+    // The client owns the memory now, it comes back with RPC_RAM_CAP_FREE.
+    // The reply is sent already: a failure here must not send another one.
+    errval_t err = cap_destroy(return_cap);
+    if (err_is_fail(err))
+        DEBUG_ERR(err, "destroying our copy of a RAM cap");
+    return SYS_ERR_OK;
+}
+
+static
+errval_t handle_ram_cap_batch(struct aos_rpc_session* sess,
+        struct lmp_recv_msg* msg,
+        struct capref received_capref,
+        void* context,
+        struct capref* ret_cap,
+        uint32_t* ret_type,
+        uint32_t* ret_flags)
+{
+    size_t count = msg->words[1];
+    size_t requested_bytes = msg->words[2];
+    size_t requested_aligment = msg->words[3];
+    DEBUG_LRPC("Recvd RPC_RAM_CAP_BATCH_QUERY [%d x %d bytes | aligned 0x%x]",
+        (int)count, (int)requested_bytes, (int)requested_aligment);
+    if (!count || count > RPC_RAM_CAP_BATCH_MAX)
+        return RPC_ERR_INVALID_ARGUMENTS;
+
+    // Allocate everything first, so that a failure can still be reported
+    // through the normal error ack.
+    struct capref caps[RPC_RAM_CAP_BATCH_MAX];
+    for (size_t i = 0; i < count; ++i)
+    {
+        errval_t err = ram_alloc_aligned(&caps[i], requested_bytes, requested_aligment);
+        if (err_is_fail(err))
+        {
+            while (i--)
+                aos_ram_free(caps[i], requested_bytes);
+            return err;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t flags = RPC_FLAG_ACK | (i + 1 < count ? RPC_FLAG_INCOMPLETE : 0);
+        errval_t err;
+        // The client re-arms its receive slot after every cap
+        do {
+            err = lmp_chan_send3(&sess->lc,
+                LMP_FLAG_SYNC,
+                caps[i],
+                MAKE_RPC_MSG_HEADER(RPC_RAM_CAP_BATCH_RESPONSE, flags),
+                requested_bytes, i);
+            if (err_is_fail(err) && lmp_err_is_transient(err))
+                thread_yield();
+        } while (err_is_fail(err) && lmp_err_is_transient(err));
+        if (err_is_fail(err))
+        {
+            // The client is still reading caps: give the rest back and
+            // end the batch with an error in place of the next cap
+            DEBUG_ERR(err, "sending RAM cap %d of a batch", (int)i);
+            for (size_t j = i; j < count; ++j)
+                aos_ram_free(caps[j], requested_bytes);
+            do {
+                err = lmp_chan_send3(&sess->lc,
+                    LMP_FLAG_SYNC,
+                    NULL_CAP,
+                    MAKE_RPC_MSG_HEADER(RPC_RAM_CAP_BATCH_RESPONSE, RPC_FLAG_ACK | RPC_FLAG_ERROR),
+                    err, i);
+                if (err_is_fail(err) && lmp_err_is_transient(err))
+                    thread_yield();
+            } while (err_is_fail(err) && lmp_err_is_transient(err));
+            if (err_is_fail(err))
+                DEBUG_ERR(err, "reporting a failed RAM cap batch");
+            return SYS_ERR_OK;
+        }
+        processmgr_charge_ram(sess->lc.endpoint, requested_bytes, 1);
+        err = cap_destroy(caps[i]);
+        if (err_is_fail(err))
+            DEBUG_ERR(err, "destroying our copy of a RAM cap");
+    }
+    return SYS_ERR_OK;
+}
+
+static
+errval_t handle_ram_cap_free(struct aos_rpc_session* sess,
+        struct lmp_recv_msg* msg,
+        struct capref received_capref,
+        void* context,
+        struct capref* ret_cap,
+        uint32_t* ret_type,
+        uint32_t* ret_flags)
+{
+    size_t bytes = msg->words[1];
+    DEBUG_LRPC("Recvd RPC_RAM_CAP_FREE [%d bytes]", (int)bytes);
+
+    struct capability cap;
+    ERROR_RET1(debug_cap_identify(received_capref, &cap));
+    if (cap.type != ObjType_RAM)
+    {
+        cap_destroy(received_capref);
+        return SYS_ERR_INVALID_SOURCE_TYPE;
+    }
+    // Takes away the client's copy, and every frame retyped from it,
+    // before the memory can be handed out again.
+    ERROR_RET1(cap_revoke(received_capref));
+    processmgr_credit_ram(sess->lc.endpoint, cap.u.ram.bytes);
+    return aos_ram_free(received_capref, bytes);
+}
+
+static
+errval_t handle_ram_cache_stats(struct aos_rpc_session* sess,
+        struct lmp_recv_msg* msg,
+        struct capref received_capref,
+        void* context,
+        struct capref* ret_cap,
+        uint32_t* ret_type,
+        uint32_t* ret_flags)
+{
+    DEBUG_LRPC("Recvd RPC_RAM_CACHE_STATS", 0);
+    struct aos_ram_cache_stats stats;
+    aos_ram_cache_get_stats(&stats);
+    ERROR_RET1(lmp_chan_send9(&sess->lc,
+        LMP_FLAG_SYNC,
+        NULL_CAP,
+        MAKE_RPC_MSG_HEADER(RPC_RAM_CACHE_STATS, RPC_FLAG_ACK),
+        stats.hits, stats.misses,
+        stats.refills, stats.refilled_caps,
+        stats.frees_cached, stats.frees_returned,
+        stats.cached_small, stats.cached_large));
     return SYS_ERR_OK;
 }
 
@@ -319,20 +449,25 @@ errval_t handle_bootstrap_nameserver(struct aos_rpc_session* sess,
     DEBUG_LRPC("Received bootstrapping request, forwarding to nameserver\n");
 
     // Forward lookup request to nameserver
-    ERROR_RET1(wait_for_send(&ns_rpc.server_sess->lc, ns_rpc.server_sess));
-    ERROR_RET1(lmp_chan_send1(&ns_rpc.server_sess->lc,
-        LMP_FLAG_SYNC,
-        NULL_CAP,
-        RPC_NAMESERVER_EP_REQUEST));
+    thread_mutex_lock(&ns_forward_lock);
+    errval_t err = wait_for_send(&ns_rpc.server_sess->lc, ns_rpc.server_sess);
+    if (err_is_ok(err))
+        err = lmp_chan_send1(&ns_rpc.server_sess->lc,
+            LMP_FLAG_SYNC,
+            NULL_CAP,
+            RPC_NAMESERVER_EP_REQUEST);
 
     DEBUG_LRPC("Sent, waiting for nameserver response\n");
 
     // Relay cap back to client
     struct lmp_recv_msg message=LMP_RECV_MSG_INIT;
     struct capref relay_cap;
-    ERROR_RET1(recv_block(ns_rpc.server_sess,
-        &message,
-        &relay_cap));
+    if (err_is_ok(err))
+        err = recv_block(ns_rpc.server_sess,
+            &message,
+            &relay_cap);
+    thread_mutex_unlock(&ns_forward_lock);
+    ERROR_RET1(err);
 
     DEBUG_LRPC("-------------------------------- Received and attempting to return the following endpoint:\n");
     struct capability cap;
@@ -359,11 +494,22 @@ errval_t lmp_server_init(struct aos_rpc* rpc)
     aos_rpc_register_handler(rpc, RPC_NUMBER, handle_number, true);
     aos_rpc_register_handler(rpc, RPC_STRING, handle_string, true);
     aos_rpc_register_handler(rpc, RPC_RAM_CAP_QUERY, handle_ram_cap_opcode, false);
+    aos_rpc_register_handler(rpc, RPC_RAM_CAP_BATCH_QUERY, handle_ram_cap_batch, false);
+    aos_rpc_register_handler(rpc, RPC_RAM_CACHE_STATS, handle_ram_cache_stats, false);
+    aos_rpc_register_handler(rpc, RPC_RAM_CAP_FREE, handle_ram_cap_free, true);
     aos_rpc_register_handler(rpc, RPC_GET_CHAR, handle_get_char_handle, false);
     aos_rpc_register_handler(rpc, RPC_PUT_CHAR, handle_put_char_handle, true);
     aos_rpc_register_handler(rpc, RPC_SPECIAL_CAP_QUERY, handle_get_special_cap, false);
     aos_rpc_register_handler(rpc, RPC_SET_LED, handle_set_led, true);
     aos_rpc_register_handler(rpc, RPC_MEMTEST, handle_memtest, true);
 
+    // Allocation, mapping and waiting for other domains: off the accept loop
+    thread_mutex_init(&ns_forward_lock);
+    aos_rpc_set_handler_slow(rpc, RPC_SHARED_BUFFER_REQUEST, true);
+    aos_rpc_set_handler_slow(rpc, RPC_NAMESERVER_LOOKUP, true);
+    aos_rpc_set_handler_slow(rpc, RPC_MEMTEST, true);
+    if (INIT_RPC_WORKERS)
+        ERROR_RET1(aos_rpc_start_workers(rpc, INIT_RPC_WORKERS));
+
     return SYS_ERR_OK;
 }
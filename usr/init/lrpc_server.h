@@ -6,6 +6,9 @@
 #include <spawn/spawn.h>
 #include <aos/aos_rpc.h>
 
+/// Worker threads for the slow handlers, 0 runs everything in the accept loop
+#define INIT_RPC_WORKERS 4
+
 errval_t lmp_server_init(struct aos_rpc* rpc);
 
 #endif /* _INIT_LRPC_SERVER_H_ */
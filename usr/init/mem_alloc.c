@@ -33,9 +33,91 @@ static errval_t aos_slab_refill(struct slab_allocator *slabs){
 	return SYS_ERR_OK;
 }
 
+/*
+ * RAM cap magazines.
+ * Every core runs its own init with its own aos_mm, so these are per-core.
+ * They keep ready RAM caps of the most requested sizes, so that most
+ * ram_alloc calls neither take the mm lock nor search the allocator.
+ * Each magazine refills in batches, under a single hold of the mm lock.
+ */
+struct ram_magazine {
+    size_t size;            ///< Size and alignment of every cached cap
+    size_t depth;           ///< Max number of cached caps
+    size_t refill;          ///< Number of caps fetched from aos_mm per refill
+    size_t count;           ///< Number of cached caps
+    struct capref caps[RAM_CACHE_MAX_DEPTH];
+};
+
+static struct ram_cache {
+    struct thread_mutex lock;
+    bool enabled;
+    bool refilling;
+    struct ram_magazine mags[RAM_CACHE_NUM_CLASSES];
+    struct aos_ram_cache_stats stats;
+} ram_cache = {
+    .mags = {
+        { .size = BASE_PAGE_SIZE,      .depth = 64, .refill = 32 },
+        { .size = 16 * BASE_PAGE_SIZE, .depth = 16, .refill = 8 },
+    },
+};
+
+static struct ram_magazine* ram_cache_find(size_t size, size_t alignment)
+{
+    for (int i = 0; i < RAM_CACHE_NUM_CLASSES; ++i)
+        if (ram_cache.mags[i].size == size && alignment <= size)
+            return &ram_cache.mags[i];
+    return NULL;
+}
+
+static errval_t ram_cache_refill(struct ram_magazine* mag)
+{
+    errval_t err = SYS_ERR_OK;
+    ram_cache.refilling = true;
+    LIBMM_STRUCT_LOCK(&aos_mm);
+    size_t target = MIN(mag->count + mag->refill, mag->depth);
+    while (mag->count < target)
+    {
+        err = mm_alloc_aligned(&aos_mm, mag->size, mag->size, &mag->caps[mag->count]);
+        if (err_is_fail(err))
+            break;
+        ++mag->count;
+        ++ram_cache.stats.refilled_caps;
+    }
+    LIBMM_STRUCT_UNLOCK(&aos_mm);
+    ram_cache.refilling = false;
+    ++ram_cache.stats.refills;
+    // A partial refill is still a success
+    return mag->count ? SYS_ERR_OK : err;
+}
+
 static errval_t aos_ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment)
 {
-	return mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    struct ram_magazine* mag = ram_cache_find(size, alignment);
+    if (!mag || !ram_cache.enabled)
+        return mm_alloc_aligned(&aos_mm, size, alignment, ret);
+
+    thread_mutex_lock_nested(&ram_cache.lock);
+    // Refilling may need RAM itself (slabs, slots): serve it directly
+    if (ram_cache.refilling)
+    {
+        thread_mutex_unlock(&ram_cache.lock);
+        return mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    }
+    if (mag->count)
+        ++ram_cache.stats.hits;
+    else
+    {
+        ++ram_cache.stats.misses;
+        errval_t err = ram_cache_refill(mag);
+        if (err_is_fail(err))
+        {
+            thread_mutex_unlock(&ram_cache.lock);
+            return err;
+        }
+    }
+    *ret = mag->caps[--mag->count];
+    thread_mutex_unlock(&ram_cache.lock);
+    return SYS_ERR_OK;
 }
 
 errval_t aos_ram_free(struct capref cap, size_t bytes)
@@ -43,12 +125,42 @@ errval_t aos_ram_free(struct capref cap, size_t bytes)
 	errval_t err;
 	struct frame_identity fi;
 	err = frame_identify(cap, &fi);
+	if (err_is_fail(err))
+		return err;
 	if (bytes > fi.bytes) {
 		bytes = fi.bytes;
 	}
+
+	struct ram_magazine* mag = ram_cache_find(fi.bytes, fi.bytes);
+	bool cacheable = mag && bytes == fi.bytes && fi.base % mag->size == 0;
+	// Like mm_free: nobody may keep access to memory we hand out again.
+	// If revoking fails, mm_free reports it.
+	if (cacheable && err_is_fail(cap_revoke(cap)))
+		cacheable = false;
+
+	thread_mutex_lock_nested(&ram_cache.lock);
+	if (cacheable && ram_cache.enabled &&
+		mag->count < mag->depth && !ram_cache.refilling)
+	{
+		mag->caps[mag->count++] = cap;
+		++ram_cache.stats.frees_cached;
+		thread_mutex_unlock(&ram_cache.lock);
+		return SYS_ERR_OK;
+	}
+	++ram_cache.stats.frees_returned;
+	thread_mutex_unlock(&ram_cache.lock);
 	return mm_free(&aos_mm, cap, fi.base, bytes);
 }
 
+void aos_ram_cache_get_stats(struct aos_ram_cache_stats* stats)
+{
+    thread_mutex_lock_nested(&ram_cache.lock);
+    *stats = ram_cache.stats;
+    stats->cached_small = ram_cache.mags[0].count;
+    stats->cached_large = ram_cache.mags[1].count;
+    thread_mutex_unlock(&ram_cache.lock);
+}
+
 /**
  * \brief Setups a local memory allocator for init to use till the memory server
  * is ready to be used.
@@ -61,12 +173,16 @@ errval_t initialize_ram_alloc(coreid_t core_id, genpaddr_t ram_base_address, gen
         return err;
     }
 
+    thread_mutex_init(&ram_cache.lock);
+    ram_cache.enabled = true;
+
     // Finally, we can initialize the generic RAM allocator to use our local allocator
     debug_printf("aos ram alloc\n");
     err = ram_alloc_set(aos_ram_alloc_aligned);
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_RAM_ALLOC_SET);
     }
+    ram_free_set(aos_ram_free);
     debug_printf("Done initialize ram alloc\n");
     return err;
 }
@@ -17,6 +17,11 @@
 
 #include <stdio.h>
 #include <aos/aos.h>
+#include <aos/aos_rpc.h>
+
+/// Number of RAM cap sizes cached per core (4 KiB and 64 KiB)
+#define RAM_CACHE_NUM_CLASSES 2
+#define RAM_CACHE_MAX_DEPTH 64
 
 extern struct mm aos_mm;
 extern struct bootinfo *bi;
@@ -24,5 +29,6 @@ extern struct bootinfo *bi;
 errval_t initialize_ram_alloc(coreid_t core_id, genpaddr_t ram_base_address, genpaddr_t ram_size);
 errval_t aos_init_mm(coreid_t core_id, genpaddr_t ram_base_address, genpaddr_t ram_size);
 errval_t aos_ram_free(struct capref cap, size_t bytes);
+void aos_ram_cache_get_stats(struct aos_ram_cache_stats* stats);
 
 #endif /* _INIT_MEM_ALLOC_H_ */
@@ -3,6 +3,8 @@
 
 #define DEBUG_NS(s, ...) debug_printf("[NS] " s "\n", ##__VA_ARGS__)
 
+static struct waitset ns_waitset;
+
 errval_t finish_nameserver(void) {
     errval_t err;
 
@@ -35,6 +37,11 @@ errval_t finish_nameserver(void) {
         return err_push(err, LIB_ERR_MORECORE_INIT); // TODO find a better error
     }
 
+    // Lookups are forwarded from init's RPC workers: the answers must not
+    // be dispatched by the accept loop on the default waitset
+    waitset_init(&ns_waitset);
+    ns_rpc.ws = &ns_waitset;
+
     DEBUG_NS("Testing RPC to nameserver");
     aos_rpc_send_string(&ns_rpc, "Sup buddy");
 
@@ -1,6 +1,10 @@
 #include "process/coreprocessmgr.h"
 #include "process/processmgr.h"
 
+#define PROCESS_DEBUG(...) //debug_printf(__VA_ARGS__);
+
+#define COREPROCESSMGR_BUCKETS 127
+
 // ProcessMgr functions
 errval_t coreprocessmgr_spawn_process(struct coreprocessmgr_state* pm_state,
         char* const argv[], int argc,
@@ -13,29 +17,39 @@ errval_t coreprocessmgr_spawn_process(struct coreprocessmgr_state* pm_state,
     ERROR_RET1(aos_server_add_client(rpc, &sess));
 
     struct spawninfo* process_info = malloc(sizeof(struct spawninfo));
+    if (!process_info)
+        return LIB_ERR_MALLOC_FAIL;
     process_info->core_id=core_id;
+    thread_mutex_lock(&pm_state->spawn_lock);
     err = spawn_load_with_args(argv, argc,
         process_info,
         &sess->lc);
+    thread_mutex_unlock(&pm_state->spawn_lock);
+    struct capref dispatcher = process_info->child_dispatcher_own_cap;
+    size_t spawn_bytes = process_info->ram_bytes;
     free(process_info);
     if (err_is_fail(err))
         return err;
 
     ERROR_RET1(aos_server_register_client(rpc, sess));
 
-    // add to running processes list
+    // add to running processes
     struct running_process *rp = malloc(sizeof(struct running_process));
-    rp->prev = NULL;
-    rp->next = pm_state->running_procs;
-    if (rp->next) {
-        rp->next->prev = rp;
-    }
+    if (!rp)
+        return LIB_ERR_MALLOC_FAIL;
     rp->pid = withpid;
     rp->endpoint = sess->lc.endpoint;
+    rp->dispatcher = dispatcher;
+    rp->spawn_bytes = spawn_bytes;
+    rp->ram_bytes = 0;
+    rp->ram_caps = 0;
 
-    debug_printf("Spawned process with endpoint 0x%x\n", rp->endpoint);
+    thread_mutex_lock(&pm_state->procs_lock);
+    collections_hash_insert(pm_state->procs_by_pid, rp->pid, rp);
+    collections_hash_insert(pm_state->procs_by_endpoint, (lvaddr_t)rp->endpoint, rp);
+    thread_mutex_unlock(&pm_state->procs_lock);
 
-    pm_state->running_procs = rp;
+    PROCESS_DEBUG("Spawned process with endpoint 0x%x\n", rp->endpoint);
     return SYS_ERR_OK;
 }
 
@@ -44,14 +58,10 @@ errval_t coreprocessmgr_init(struct coreprocessmgr_state* pm_state, coreid_t cor
         struct aos_rpc* rpc)
 {
     pm_state->core_id = core_id;
-
-    struct running_process *init_rp = malloc(sizeof(struct running_process));
-    init_rp->prev = NULL;
-    init_rp->next = NULL;
-    init_rp->pid = core_id;
-
-    init_rp->endpoint = NULL;
-    pm_state->running_procs=init_rp;
+    thread_mutex_init(&pm_state->spawn_lock);
+    thread_mutex_init(&pm_state->procs_lock);
+    collections_hash_create_with_buckets(&pm_state->procs_by_pid, COREPROCESSMGR_BUCKETS, NULL);
+    collections_hash_create_with_buckets(&pm_state->procs_by_endpoint, COREPROCESSMGR_BUCKETS, NULL);
     processmgr_register_rpc_handlers(rpc);
     return SYS_ERR_OK;
 }
@@ -59,35 +69,120 @@ errval_t coreprocessmgr_init(struct coreprocessmgr_state* pm_state, coreid_t cor
 
 errval_t coreprocessmgr_find_process_by_endpoint(struct coreprocessmgr_state* pm_state, struct lmp_endpoint* ep, domainid_t* pid)
 {
-    struct running_process *rp = pm_state->running_procs;
+    thread_mutex_lock(&pm_state->procs_lock);
+    struct running_process *rp = collections_hash_find(pm_state->procs_by_endpoint, (lvaddr_t)ep);
+    if (rp)
+        *pid = rp->pid;
+    thread_mutex_unlock(&pm_state->procs_lock);
+    return rp ? SYS_ERR_OK : PROCMGR_ERR_PROCESS_NOT_FOUND;
+}
 
-    while (rp)
-    {
-        if (rp->endpoint == ep)
-        {
-            *pid = rp->pid;
-            return SYS_ERR_OK;
-        }
-        rp = rp->next;
-    }
-    return PROCMGR_ERR_PROCESS_NOT_FOUND;
+errval_t coreprocessmgr_find_endpoint_by_pid(struct coreprocessmgr_state* pm_state, domainid_t pid, struct lmp_endpoint** ep)
+{
+    thread_mutex_lock(&pm_state->procs_lock);
+    struct running_process *rp = collections_hash_find(pm_state->procs_by_pid, pid);
+    if (rp)
+        *ep = rp->endpoint;
+    thread_mutex_unlock(&pm_state->procs_lock);
+    return rp ? SYS_ERR_OK : PROCMGR_ERR_PROCESS_NOT_FOUND;
 }
 
 errval_t coreprocessmgr_process_finished(struct coreprocessmgr_state* pm_state, domainid_t pid)
 {
-    struct running_process *rp = pm_state->running_procs;
-    while (rp && rp->pid != pid)
-        rp = rp->next;
+    thread_mutex_lock(&pm_state->procs_lock);
+    struct running_process *rp = collections_hash_find(pm_state->procs_by_pid, pid);
+    if (rp)
+    {
+        collections_hash_delete(pm_state->procs_by_pid, pid);
+        collections_hash_delete(pm_state->procs_by_endpoint, (lvaddr_t)rp->endpoint);
+    }
+    thread_mutex_unlock(&pm_state->procs_lock);
     if (!rp)
         return PROCMGR_ERR_PROCESS_NOT_FOUND;
 
-    if (rp->next)
-        rp->next->prev = rp->prev;
-    if (rp->prev)
-        rp->prev->next = rp->next;
-    if (rp == pm_state->running_procs)
-        pm_state->running_procs = rp->next;
-
     free(rp);
     return SYS_ERR_OK;
 }
+
+void coreprocessmgr_charge_ram(struct coreprocessmgr_state* pm_state, struct lmp_endpoint* ep, size_t bytes, size_t caps)
+{
+    thread_mutex_lock(&pm_state->procs_lock);
+    struct running_process *rp = collections_hash_find(pm_state->procs_by_endpoint, (lvaddr_t)ep);
+    if (rp)
+    {
+        rp->ram_bytes += bytes;
+        rp->ram_caps += caps;
+    }
+    thread_mutex_unlock(&pm_state->procs_lock);
+}
+
+void coreprocessmgr_credit_ram(struct coreprocessmgr_state* pm_state, struct lmp_endpoint* ep, size_t bytes)
+{
+    thread_mutex_lock(&pm_state->procs_lock);
+    struct running_process *rp = collections_hash_find(pm_state->procs_by_endpoint, (lvaddr_t)ep);
+    // A cap may come back split, or from a process it was passed on to
+    if (rp && rp->ram_caps)
+    {
+        rp->ram_bytes -= MIN(bytes, rp->ram_bytes);
+        rp->ram_caps--;
+    }
+    thread_mutex_unlock(&pm_state->procs_lock);
+}
+
+static void coreprocessmgr_cpu_usage(struct capref dispatcher, struct aos_process_usage* usage)
+{
+    struct dispatcher_stats stats;
+    errval_t err = invoke_dispatcher_get_stats(dispatcher, &stats);
+    if (err_is_fail(err) || !stats.cpu_freq)
+    {
+        PROCESS_DEBUG("No CPU stats for PID %d\n", usage->pid);
+        usage->cpu_us = 0;
+        usage->dispatches = 0;
+        return;
+    }
+    // In two steps, the product would overflow after a few hours
+    usage->cpu_us = stats.cpu_time / stats.cpu_freq * 1000000ULL +
+        stats.cpu_time % stats.cpu_freq * 1000000ULL / stats.cpu_freq;
+    usage->dispatches = stats.dispatches;
+}
+
+/*
+ * Init itself comes first. Its RAM does not come through the RPC server,
+ * so it only reports CPU time.
+ */
+errval_t coreprocessmgr_usage(struct coreprocessmgr_state* pm_state, struct aos_process_usage** usage, size_t* count)
+{
+    thread_mutex_lock(&pm_state->procs_lock);
+    *count = 1 + collections_hash_size(pm_state->procs_by_pid);
+    *usage = malloc(*count * sizeof(struct aos_process_usage));
+    if (!*usage)
+    {
+        thread_mutex_unlock(&pm_state->procs_lock);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    struct aos_process_usage* init = &(*usage)[0];
+    memset(init, 0, sizeof(*init));
+    init->pid = pm_state->init_pid;
+    init->core_id = pm_state->core_id;
+    coreprocessmgr_cpu_usage(cap_dispatcher, init);
+
+    size_t i = 1;
+    uint64_t pid;
+    struct running_process *rp;
+    collections_hash_traverse_start(pm_state->procs_by_pid);
+    while ((rp = collections_hash_traverse_next(pm_state->procs_by_pid, &pid)))
+    {
+        struct aos_process_usage* entry = &(*usage)[i++];
+        entry->pid = rp->pid;
+        entry->core_id = pm_state->core_id;
+        entry->ram_caps = rp->ram_caps;
+        entry->ram_bytes = rp->ram_bytes;
+        entry->spawn_bytes = rp->spawn_bytes;
+        coreprocessmgr_cpu_usage(rp->dispatcher, entry);
+    }
+    collections_hash_traverse_end(pm_state->procs_by_pid);
+    thread_mutex_unlock(&pm_state->procs_lock);
+    assert(i == *count);
+    return SYS_ERR_OK;
+}
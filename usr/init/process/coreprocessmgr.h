@@ -4,16 +4,32 @@
 #include <aos/aos.h>
 #include <spawn/spawn.h>
 #include <aos/aos_rpc.h>
+#include <collections/hash_table.h>
 
 struct running_process{
-    struct running_process *next, *prev;
     domainid_t pid;
     struct lmp_endpoint *endpoint;
+    struct capref dispatcher;   // Our copy, for the kernel's CPU accounting
+    size_t spawn_bytes;         // RAM allocated to spawn it
+    size_t ram_bytes;           // RAM caps handed out and not returned
+    size_t ram_caps;
 };
 
+/*
+ * Spawns may be requested from several threads (RPC workers, the URPC
+ * spawn worker). They are serialized by spawn_lock, as the spawn library
+ * is not thread-safe; procs_lock only guards the running processes.
+ * Those are found by PID and by the endpoint of their session with us,
+ * which is all an exiting process is known by, and all a RAM request
+ * carries. RAM caps are charged to the process that requested them.
+ */
 struct coreprocessmgr_state{
-    struct running_process *running_procs;
+    struct thread_mutex spawn_lock;
+    struct thread_mutex procs_lock;
+    collections_hash_table *procs_by_pid;
+    collections_hash_table *procs_by_endpoint;
     coreid_t core_id;
+    domainid_t init_pid;
     struct processmgr_state* master_pm;
 };
 
@@ -21,6 +37,10 @@ errval_t coreprocessmgr_init(struct coreprocessmgr_state* pm_state, coreid_t cor
 errval_t coreprocessmgr_spawn_process(struct coreprocessmgr_state* pm_state, char* const argv[], int argc, struct aos_rpc* rpc,
         coreid_t core_id, domainid_t withpid);
 errval_t coreprocessmgr_find_process_by_endpoint(struct coreprocessmgr_state* pm_state, struct lmp_endpoint* ep, domainid_t* pid);
+errval_t coreprocessmgr_find_endpoint_by_pid(struct coreprocessmgr_state* pm_state, domainid_t pid, struct lmp_endpoint** ep);
 errval_t coreprocessmgr_process_finished(struct coreprocessmgr_state* pm_state, domainid_t pid);
+void coreprocessmgr_charge_ram(struct coreprocessmgr_state* pm_state, struct lmp_endpoint* ep, size_t bytes, size_t caps);
+void coreprocessmgr_credit_ram(struct coreprocessmgr_state* pm_state, struct lmp_endpoint* ep, size_t bytes);
+errval_t coreprocessmgr_usage(struct coreprocessmgr_state* pm_state, struct aos_process_usage** usage, size_t* count);
 
 #endif //_HEADER_INIT_PROCESSMGR
@@ -10,6 +10,53 @@ static bool use_sysmgr;
 
 #define PMGR_DEBUG(...) //debug_printf(__VA_ARGS__);
 
+/*
+ * PIDs come from the system process manager on core 0. The other cores
+ * reserve them PROCESSMGR_PID_BLOCK at a time and register their processes
+ * without waiting for the answer, so a spawn costs no round-trip to core 0.
+ */
+#define PROCESSMGR_PID_BLOCK 32
+
+static struct thread_mutex pid_block_lock;
+static domainid_t pid_block_next;
+static domainid_t pid_block_end;
+
+struct processmgr_async_call
+{
+    struct urpc_future future;
+    domainid_t pid;
+    errval_t answer;
+};
+
+static void processmgr_async_call_done(void* arg)
+{
+    struct processmgr_async_call* call = arg;
+    if (err_is_fail(call->future.err))
+        DEBUG_ERR(call->future.err, "updating PID %d on core 0", call->pid);
+    free(call);
+}
+
+// Sends a request to core 0 that nobody waits the answer of
+static errval_t processmgr_send_async(uint32_t opcode, domainid_t pid, void* data, size_t len)
+{
+    struct processmgr_async_call* call = malloc(sizeof(struct processmgr_async_call));
+    if (!call)
+        return LIB_ERR_MALLOC_FAIL;
+    call->pid = pid;
+    errval_t err = urpc_client_send_async(&urpc_chan.buffer_send,
+            opcode,
+            data,
+            len,
+            &call->answer,
+            sizeof(call->answer),
+            &call->future,
+            core_rpc.ws,
+            MKCLOSURE(processmgr_async_call_done, call));
+    if (err_is_fail(err))
+        free(call);
+    return err;
+}
+
 errval_t processmgr_init(coreid_t coreid, const char* init_process_name)
 {
     if (coreid == 0)
@@ -17,45 +64,86 @@ errval_t processmgr_init(coreid_t coreid, const char* init_process_name)
         ERROR_RET1(sysprocessmgr_init(&syspmgr_state, &urpc_chan, my_core_id));
         use_sysmgr = true;
     }
+    thread_mutex_init(&pid_block_lock);
     ERROR_RET1(coreprocessmgr_init(&core_pm_state, coreid, &core_rpc));
     processmgr_register_rpc_handlers(&core_rpc);
     processmgr_register_urpc_handlers(&urpc_chan);
 
-    domainid_t pid;
-    ERROR_RET1(processmgr_generate_pid(init_process_name, coreid, &pid));
+    ERROR_RET1(processmgr_generate_pid(init_process_name, coreid, &core_pm_state.init_pid));
 
     return SYS_ERR_OK;
 }
 
-errval_t processmgr_generate_pid(const char* name, coreid_t core_id, domainid_t* new_pid)
+errval_t processmgr_reserve_pids(size_t count, domainid_t* first_pid)
 {
     if (use_sysmgr)
-        return sysprocessmgr_register_process(&syspmgr_state, name, core_id, new_pid);
+        return sysprocessmgr_reserve_pids(&syspmgr_state, count, first_pid);
 
-    // URPC CALL: URPC_OP_PROCESSMGR_GEN_PID
+    // URPC CALL: URPC_OP_PROCESSMGR_RESERVE_PIDS
+    uint32_t request = count;
+    size_t answer_len;
+    ERROR_RET2(urpc_client_send_receive_fixed_size(&urpc_chan.buffer_send,
+        URPC_OP_PROCESSMGR_RESERVE_PIDS,
+        &request, sizeof(request), first_pid, sizeof(domainid_t), &answer_len),
+        PROCMGR_ERR_URPC_REMOTE_FAIL);
+    if (answer_len != sizeof(domainid_t))
+        return PROCMGR_ERR_URPC_REMOTE_FAIL;
+    return SYS_ERR_OK;
+}
+
+errval_t processmgr_register_pids(const char* name, coreid_t core_id, domainid_t first_pid, size_t count)
+{
+    if (use_sysmgr)
+        return sysprocessmgr_add_processes(&syspmgr_state, name, core_id, first_pid, count);
+
+    // URPC CALL: URPC_OP_PROCESSMGR_REGISTER_PIDS
     size_t size = strlen(name)+1;
-    size_t send_size = size + sizeof(struct urpc_msg_gen_pid);
-    struct urpc_msg_gen_pid* send = malloc(send_size);
-    send->name_size = size;
+    size_t send_size = size + sizeof(struct urpc_msg_register_pids);
+    struct urpc_msg_register_pids* send = malloc(send_size);
+    if (!send)
+        return LIB_ERR_MALLOC_FAIL;
+    send->first_pid = first_pid;
+    send->count = count;
     send->core_id = core_id;
+    send->name_size = size;
     memcpy(send->name, name, size);
-    domainid_t* answer_pid;
-    size_t answer_len;
 
-    ERROR_RET2(urpc_client_send(&urpc_chan.buffer_send, URPC_OP_PROCESSMGR_GEN_PID,
-        send, send_size, (void**)&answer_pid, &answer_len),
-        PROCMGR_ERR_URPC_REMOTE_FAIL);
+    // The request is copied into the ring, an unregistered PID can't be
+    // asked about before it is in
+    errval_t err = processmgr_send_async(URPC_OP_PROCESSMGR_REGISTER_PIDS, first_pid, send, send_size);
     free(send);
-    if (answer_len != sizeof(domainid_t))
+    return err;
+}
+
+errval_t processmgr_set_running(domainid_t first_pid, size_t count)
+{
+    if (use_sysmgr)
+        return sysprocessmgr_set_running(&syspmgr_state, first_pid, count);
+
+    // URPC CALL: URPC_OP_PROCESSMGR_SET_RUNNING
+    struct urpc_msg_pid_range range = { .first_pid = first_pid, .count = count };
+    return processmgr_send_async(URPC_OP_PROCESSMGR_SET_RUNNING, first_pid, &range, sizeof(range));
+}
+
+errval_t processmgr_generate_pid(const char* name, coreid_t core_id, domainid_t* new_pid)
+{
+    if (use_sysmgr)
+        return sysprocessmgr_register_process(&syspmgr_state, name, core_id, new_pid);
+
+    thread_mutex_lock(&pid_block_lock);
+    errval_t err = SYS_ERR_OK;
+    if (pid_block_next == pid_block_end)
     {
-        free(answer_pid);
-        return PROCMGR_ERR_URPC_REMOTE_FAIL;
+        err = processmgr_reserve_pids(PROCESSMGR_PID_BLOCK, &pid_block_next);
+        pid_block_end = err_is_ok(err) ? pid_block_next + PROCESSMGR_PID_BLOCK : pid_block_next;
     }
+    *new_pid = pid_block_next;
+    if (err_is_ok(err))
+        pid_block_next++;
+    thread_mutex_unlock(&pid_block_lock);
+    ERROR_RET1(err);
 
-    *new_pid = (int)*answer_pid;
-    free(answer_pid);
-
-    return SYS_ERR_OK;
+    return processmgr_register_pids(name, core_id, *new_pid, 1);
 }
 
 errval_t processmgr_spawn_process(char* name, coreid_t core_id, domainid_t *pid)
@@ -68,9 +156,9 @@ errval_t processmgr_spawn_process_with_args(char* const argv[], int argc, coreid
 {
     assert(argc > 0 && "Spawning process with 0 arg?! Need at least process name in argv[0]");
 
-    debug_printf("[ProcessMgr] Spawn on core %d\n", core_id);
+    PMGR_DEBUG("[ProcessMgr] Spawn on core %d\n", core_id);
     ERROR_RET1(processmgr_generate_pid(argv[0], core_id, pid));
-    debug_printf("[ProcessMgr] Generated PID %d\n", *pid);
+    PMGR_DEBUG("[ProcessMgr] Generated PID %d\n", *pid);
     errval_t err;
     err=processmgr_spawn_process_with_args_and_pid(argv, argc, core_id, *pid);
     if(err_is_fail(err)){
@@ -84,17 +172,25 @@ errval_t processmgr_spawn_process_with_args(char* const argv[], int argc, coreid
 errval_t processmgr_spawn_process_with_args_and_pid(char* const argv[], int argc, coreid_t core_id, domainid_t pid)
 {
     if (core_id == my_core_id)
-        return coreprocessmgr_spawn_process(&core_pm_state, argv, argc, &core_rpc, core_id, pid);
+    {
+        ERROR_RET1(coreprocessmgr_spawn_process(&core_pm_state, argv, argc, &core_rpc, core_id, pid));
+        return processmgr_set_running(pid, 1);
+    }
 
     // URPC CALL: URPC_OP_PROCESSMGR_SPAWN
     size_t size = serialize_array_of_strings_size(argv, argc);
     size_t send_size = size + sizeof(coreid_t) + sizeof(domainid_t);
     void* send = malloc(send_size);
+    if (!send)
+        return LIB_ERR_MALLOC_FAIL;
     memcpy(send,                    &core_id,   sizeof(coreid_t));
     memcpy(send + sizeof(coreid_t), &pid,       sizeof(domainid_t));
     if (!serialize_array_of_strings(send + sizeof(coreid_t) + sizeof(domainid_t),
             size, argv, argc))
+    {
+        free(send);
         return AOS_ERR_SERIALIZE;
+    }
 
     errval_t* answer;
     size_t answer_len = 0;
@@ -102,6 +198,8 @@ errval_t processmgr_spawn_process_with_args_and_pid(char* const argv[], int argc
     errval_t err = urpc_client_send(&urpc_chan.buffer_send, URPC_OP_PROCESSMGR_SPAWN,
         send, send_size, (void**)&answer, &answer_len);
 
+    if (err_is_ok(err) && answer_len < sizeof(errval_t))
+        err = URPC_ERR_PROTOCOL_ERROR;
     if (err_is_fail(err))
         err = err_push(err, PROCMGR_ERR_URPC_REMOTE_FAIL);
     else
@@ -113,6 +211,132 @@ errval_t processmgr_spawn_process_with_args_and_pid(char* const argv[], int argc
     return err;
 }
 
+errval_t processmgr_spawn_local_batch(char* const argv[], int argc, domainid_t first_pid, size_t count,
+        size_t* spawned)
+{
+    errval_t err = SYS_ERR_OK;
+    for (*spawned = 0; *spawned < count; ++*spawned)
+    {
+        err = coreprocessmgr_spawn_process(&core_pm_state, argv, argc, &core_rpc, my_core_id,
+            first_pid + *spawned);
+        if (err_is_fail(err))
+            break;
+    }
+    if (*spawned)
+    {
+        errval_t set_err = processmgr_set_running(first_pid, *spawned);
+        if (err_is_fail(set_err))
+            DEBUG_ERR(set_err, "marking PIDs from %d running", first_pid);
+    }
+    return err;
+}
+
+// Part of a batch spawned on one core
+struct processmgr_batch_share
+{
+    coreid_t core_id;
+    domainid_t first_pid;
+    size_t count;
+    size_t spawned;
+    errval_t err;
+    struct urpc_future future;
+    struct urpc_msg_spawn_batch_answer answer;
+};
+
+static errval_t processmgr_batch_share_send(struct processmgr_batch_share* share, char* const argv[], int argc)
+{
+    // URPC CALL: URPC_OP_PROCESSMGR_SPAWN_BATCH
+    size_t size = serialize_array_of_strings_size(argv, argc);
+    size_t send_size = size + sizeof(struct urpc_msg_spawn_batch);
+    struct urpc_msg_spawn_batch* send = malloc(send_size);
+    if (!send)
+        return LIB_ERR_MALLOC_FAIL;
+    send->core_id = share->core_id;
+    send->first_pid = share->first_pid;
+    send->count = share->count;
+    errval_t err = AOS_ERR_SERIALIZE;
+    if (serialize_array_of_strings(send->args, size, argv, argc))
+        err = urpc_client_send_async(&urpc_chan.buffer_send, URPC_OP_PROCESSMGR_SPAWN_BATCH,
+            send, send_size, &share->answer, sizeof(share->answer), &share->future,
+            NULL, NOP_CLOSURE);
+    free(send);
+    return err;
+}
+
+static void processmgr_batch_share_wait(struct processmgr_batch_share* share)
+{
+    share->err = urpc_future_wait(&share->future);
+    if (err_is_fail(share->err))
+        share->err = err_push(share->err, PROCMGR_ERR_URPC_REMOTE_FAIL);
+    else if (share->future.answer_len != sizeof(share->answer))
+        share->err = PROCMGR_ERR_URPC_REMOTE_FAIL;
+    else
+    {
+        share->spawned = share->answer.spawned;
+        share->err = share->answer.err;
+    }
+}
+
+/*
+ * A batch takes one block of PIDs, split into a range per core. The remote
+ * ranges are sent off first, so that the other cores load their ELFs while
+ * we spawn the local range.
+ */
+errval_t processmgr_spawn_batch(char* const argv[], int argc, size_t count, uint32_t core_mask,
+        domainid_t* pids, size_t* spawned)
+{
+    assert(argc > 0 && "Spawning process with 0 arg?! Need at least process name in argv[0]");
+
+    *spawned = 0;
+    struct processmgr_batch_share shares[sizeof(core_mask) * 8];
+    size_t num_shares = 0;
+    for (coreid_t core = 0; core < sizeof(core_mask) * 8; ++core)
+        if (core_mask & (1u << core))
+            shares[num_shares++].core_id = core;
+    if (!num_shares || !count)
+        return RPC_ERR_INVALID_ARGUMENTS;
+
+    domainid_t first_pid;
+    ERROR_RET1(processmgr_reserve_pids(count, &first_pid));
+    PMGR_DEBUG("[ProcessMgr] Batch of %zu on %zu cores, PIDs from %d\n", count, num_shares, first_pid);
+
+    domainid_t next_pid = first_pid;
+    for (size_t i = 0; i < num_shares; ++i)
+    {
+        struct processmgr_batch_share* share = &shares[i];
+        share->first_pid = next_pid;
+        share->count = count / num_shares + (i < count % num_shares);
+        share->spawned = 0;
+        share->err = SYS_ERR_OK;
+        next_pid += share->count;
+        if (share->count)
+            share->err = processmgr_register_pids(argv[0], share->core_id, share->first_pid, share->count);
+        if (err_is_ok(share->err) && share->count && share->core_id != my_core_id)
+            share->err = processmgr_batch_share_send(share, argv, argc);
+    }
+
+    for (size_t i = 0; i < num_shares; ++i)
+        if (err_is_ok(shares[i].err) && shares[i].count && shares[i].core_id == my_core_id)
+            shares[i].err = processmgr_spawn_local_batch(argv, argc, shares[i].first_pid,
+                shares[i].count, &shares[i].spawned);
+
+    errval_t err = SYS_ERR_OK;
+    for (size_t i = 0; i < num_shares; ++i)
+    {
+        struct processmgr_batch_share* share = &shares[i];
+        if (share->core_id != my_core_id && share->count && err_is_ok(share->err))
+            processmgr_batch_share_wait(share);
+        if (err_is_fail(share->err) && err_is_ok(err))
+            err = share->err;
+
+        for (size_t j = 0; j < share->spawned; ++j)
+            pids[(*spawned)++] = share->first_pid + j;
+        for (size_t j = share->spawned; j < share->count; ++j)
+            processmgr_remove_pid(share->first_pid + j);
+    }
+    return err;
+}
+
 errval_t processmgr_get_process_name(domainid_t pid, char* name, size_t buffer_len)
 {
     PMGR_DEBUG("processmgr_get_process_name [pid = %d, buflen = %d]\n", pid, buffer_len);
@@ -145,18 +369,83 @@ errval_t processmgr_list_pids(domainid_t* pids, size_t* number)
     return SYS_ERR_OK;
 }
 
+errval_t processmgr_snapshot(char** records, size_t* size)
+{
+    if (use_sysmgr)
+        return sysprocessmgr_snapshot(&syspmgr_state, records, size);
+
+    // URPC CALL: URPC_OP_PROCESS_SNAPSHOT
+    ERROR_RET2(urpc_client_send(&urpc_chan.buffer_send, URPC_OP_PROCESS_SNAPSHOT,
+        NULL, 0, (void**)records, size),
+        PROCMGR_ERR_URPC_REMOTE_FAIL);
+    return SYS_ERR_OK;
+}
+
+errval_t processmgr_local_usage(struct aos_process_usage** usage, size_t* count)
+{
+    return coreprocessmgr_usage(&core_pm_state, usage, count);
+}
+
+static int processmgr_usage_cmp(const void* a, const void* b)
+{
+    domainid_t x = ((const struct aos_process_usage*)a)->pid;
+    domainid_t y = ((const struct aos_process_usage*)b)->pid;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Every core accounts for the processes it spawned, the other core's share
+ * comes in one URPC call.
+ */
+errval_t processmgr_usage(struct aos_process_usage** usage, size_t* count)
+{
+    // URPC CALL: URPC_OP_PROCESS_USAGE
+    struct aos_process_usage* remote;
+    size_t remote_size;
+    ERROR_RET2(urpc_client_send(&urpc_chan.buffer_send, URPC_OP_PROCESS_USAGE,
+        NULL, 0, (void**)&remote, &remote_size),
+        PROCMGR_ERR_URPC_REMOTE_FAIL);
+    size_t remote_count = remote_size / sizeof(struct aos_process_usage);
+
+    size_t local_count;
+    errval_t err = processmgr_local_usage(usage, &local_count);
+    if (err_is_ok(err))
+    {
+        struct aos_process_usage* all = realloc(*usage,
+            (local_count + remote_count) * sizeof(struct aos_process_usage));
+        if (!all)
+        {
+            free(*usage);
+            err = LIB_ERR_MALLOC_FAIL;
+        }
+        else
+        {
+            memcpy(all + local_count, remote, remote_count * sizeof(struct aos_process_usage));
+            *count = local_count + remote_count;
+            qsort(all, *count, sizeof(struct aos_process_usage), processmgr_usage_cmp);
+            *usage = all;
+        }
+    }
+    free(remote);
+    return err;
+}
+
+void processmgr_charge_ram(struct lmp_endpoint* ep, size_t bytes, size_t caps)
+{
+    coreprocessmgr_charge_ram(&core_pm_state, ep, bytes, caps);
+}
+
+void processmgr_credit_ram(struct lmp_endpoint* ep, size_t bytes)
+{
+    coreprocessmgr_credit_ram(&core_pm_state, ep, bytes);
+}
+
 errval_t processmgr_remove_pid(domainid_t pid){
     if(use_sysmgr)
         return sysprocessmgr_deregister_process(&syspmgr_state, pid);
 
-    char* answer;
-    size_t answer_len;
-    return urpc_client_send(&urpc_chan.buffer_send,
-            URPC_OP_GET_PROCESS_DEREGISTER,
-            (void*)&pid,
-            sizeof(pid),
-            (void**)&answer,
-            &answer_len);
+    // Nobody needs the answer: don't wait a round-trip for it
+    return processmgr_send_async(URPC_OP_GET_PROCESS_DEREGISTER, pid, &pid, sizeof(pid));
 }
 
 errval_t processmgr_process_exited(struct lmp_endpoint* ep)
@@ -173,16 +462,7 @@ errval_t processmgr_process_exited(struct lmp_endpoint* ep)
     return processmgr_remove_pid(pid);
 }
 
-errval_t processmgr_get_endpoint_by_pid(domainid_t pid, struct capref *ret_ep)
+errval_t processmgr_get_endpoint_by_pid(domainid_t pid, struct lmp_endpoint **ret_ep)
 {
-    struct running_process *rp = core_pm_state.running_procs;
-    ret_ep = NULL;
-
-    while (rp->next) {
-        if (rp->pid == pid) {
-
-        }
-    }
-
-    return SYS_ERR_OK;
+    return coreprocessmgr_find_endpoint_by_pid(&core_pm_state, pid, ret_ep);
 }
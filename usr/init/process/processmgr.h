@@ -9,15 +9,27 @@ struct urpc_channel;
 
 errval_t processmgr_init(coreid_t core_id, const char* init_process_name);
 
+errval_t processmgr_reserve_pids(size_t count, domainid_t* first_pid);
+errval_t processmgr_register_pids(const char* name, coreid_t core_id, domainid_t first_pid, size_t count);
+errval_t processmgr_set_running(domainid_t first_pid, size_t count);
 errval_t processmgr_generate_pid(const char* name, coreid_t core_id, domainid_t* new_pid);
 errval_t processmgr_spawn_process(char* process_name, coreid_t core_id, domainid_t *pid);
 errval_t processmgr_spawn_process_with_args(char* const argv[], int argc, coreid_t core_id, domainid_t *pid);
 errval_t processmgr_spawn_process_with_args_and_pid(char* const argv[], int argc, coreid_t core_id, domainid_t pid);
+errval_t processmgr_spawn_local_batch(char* const argv[], int argc, domainid_t first_pid, size_t count,
+        size_t* spawned);
+errval_t processmgr_spawn_batch(char* const argv[], int argc, size_t count, uint32_t core_mask,
+        domainid_t* pids, size_t* spawned);
 errval_t processmgr_get_process_name(domainid_t pid, char* name, size_t buffer_len);
 errval_t processmgr_list_pids(domainid_t* pids, size_t* number);
+errval_t processmgr_snapshot(char** records, size_t* size);
+errval_t processmgr_local_usage(struct aos_process_usage** usage, size_t* count);
+errval_t processmgr_usage(struct aos_process_usage** usage, size_t* count);
+void processmgr_charge_ram(struct lmp_endpoint* ep, size_t bytes, size_t caps);
+void processmgr_credit_ram(struct lmp_endpoint* ep, size_t bytes);
 errval_t processmgr_process_exited(struct lmp_endpoint* ep);
 errval_t processmgr_remove_pid(domainid_t pid);
-errval_t processmgr_get_endpoint_by_pid(domainid_t pid, struct capref *ret_ep);
+errval_t processmgr_get_endpoint_by_pid(domainid_t pid, struct lmp_endpoint **ret_ep);
 
 void processmgr_register_rpc_handlers(struct aos_rpc* rpc);
 errval_t processmgr_register_urpc_handlers(struct urpc_channel* channel);
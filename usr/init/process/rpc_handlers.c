@@ -6,6 +6,8 @@
 
 #define RPC_HANDLER_DEBUG(...) //debug_printf(__VA_ARGS__);
 
+#define MAX_NAME_LEN 256
+
 static
 errval_t handle_get_name(struct aos_rpc_session* sess,
         struct lmp_recv_msg* msg,
@@ -18,17 +20,12 @@ errval_t handle_get_name(struct aos_rpc_session* sess,
     assert(sess);
 
     domainid_t requested_pid = msg->words[1];
-    char* processname = sess->shared_buffer;
+    char processname[MAX_NAME_LEN];
     RPC_HANDLER_DEBUG("handle_get_name\t%d\n", requested_pid);
-    ERROR_RET1(processmgr_get_process_name(requested_pid, processname, sess->shared_buffer_size));
-
-    ERROR_RET1(lmp_chan_send2(&sess->lc,
-            LMP_FLAG_SYNC,
-            NULL_CAP,
-            MAKE_RPC_MSG_HEADER(RPC_GET_NAME, RPC_FLAG_ACK),
-            strlen(processname) + 1));
+    ERROR_RET1(processmgr_get_process_name(requested_pid, processname, sizeof(processname)));
 
-    return SYS_ERR_OK;
+    *ret_type = RPC_GET_NAME;
+    return aos_rpc_bulk_reply(sess, processname, strlen(processname) + 1);
 }
 
 #define MAX_PID 100
@@ -49,18 +46,50 @@ errval_t handle_get_pid(struct aos_rpc_session* sess,
     size_t numpid = MAX_PID;
     ERROR_RET1(processmgr_list_pids(pids, &numpid));
 
-    if (numpid * sizeof(domainid_t) > sess->shared_buffer_size)
-        return RPC_ERR_BUF_TOO_SMALL;
+    *ret_type = RPC_GET_PID;
+    return aos_rpc_bulk_reply(sess, pids, numpid * sizeof(domainid_t));
+}
+
+static
+errval_t handle_snapshot(struct aos_rpc_session* sess,
+        struct lmp_recv_msg* msg,
+        struct capref received_capref,
+        void* context,
+        struct capref* ret_cap,
+        uint32_t* ret_type,
+        uint32_t* ret_flags)
+{
+    assert(sess);
 
-    memcpy(sess->shared_buffer, pids, numpid * sizeof(domainid_t));
+    char* records;
+    size_t size;
+    ERROR_RET1(processmgr_snapshot(&records, &size));
 
-    ERROR_RET1(lmp_chan_send2(&sess->lc,
-            LMP_FLAG_SYNC,
-            NULL_CAP,
-            MAKE_RPC_MSG_HEADER(RPC_GET_PID, RPC_FLAG_ACK),
-            numpid));
+    *ret_type = RPC_PROCESS_SNAPSHOT;
+    errval_t err = aos_rpc_bulk_reply(sess, records, size);
+    free(records);
+    return err;
+}
 
-    return SYS_ERR_OK;
+static
+errval_t handle_usage(struct aos_rpc_session* sess,
+        struct lmp_recv_msg* msg,
+        struct capref received_capref,
+        void* context,
+        struct capref* ret_cap,
+        uint32_t* ret_type,
+        uint32_t* ret_flags)
+{
+    assert(sess);
+
+    struct aos_process_usage* usage;
+    size_t count;
+    ERROR_RET1(processmgr_usage(&usage, &count));
+
+    *ret_type = RPC_PROCESS_USAGE;
+    errval_t err = aos_rpc_bulk_reply(sess, usage, count * sizeof(struct aos_process_usage));
+    free(usage);
+    return err;
 }
 
 static
@@ -74,13 +103,14 @@ errval_t handle_spawn(struct aos_rpc_session* sess,
 {
     assert(sess);
 
-    if (sess->shared_buffer_size < sizeof(int))
-        return RPC_ERR_SHARED_BUF_EMPTY;
+    char* args;
+    size_t args_len;
+    aos_rpc_bulk_request(sess, &args, &args_len);
 
-    coreid_t core_id = msg->words[1];
+    coreid_t core_id = msg->words[2];
     char** argv;
     int argc;
-    if (!unserialize_array_of_strings(sess->shared_buffer, sess->shared_buffer_size, &argv, &argc))
+    if (!unserialize_array_of_strings(args, args_len, &argv, &argc))
         return AOS_ERR_UNSERIALIZE;
 
     domainid_t ret_pid;
@@ -103,6 +133,53 @@ errval_t handle_spawn(struct aos_rpc_session* sess,
     return SYS_ERR_OK;
 }
 
+static
+errval_t handle_spawn_batch(struct aos_rpc_session* sess,
+        struct lmp_recv_msg* msg,
+        struct capref received_capref,
+        void* context,
+        struct capref* ret_cap,
+        uint32_t* ret_type,
+        uint32_t* ret_flags)
+{
+    assert(sess);
+
+    char* data;
+    size_t data_len;
+    aos_rpc_bulk_request(sess, &data, &data_len);
+    if (data_len < sizeof(struct aos_rpc_spawn_batch))
+        return RPC_ERR_INVALID_ARGUMENTS;
+    struct aos_rpc_spawn_batch* request = (struct aos_rpc_spawn_batch*)data;
+    if (!request->count || request->count > RPC_SPAWN_BATCH_MAX)
+        return RPC_ERR_INVALID_ARGUMENTS;
+
+    char** argv;
+    int argc;
+    if (!unserialize_array_of_strings(request->args, data_len - sizeof(struct aos_rpc_spawn_batch),
+            &argv, &argc))
+        return AOS_ERR_UNSERIALIZE;
+
+    size_t spawned = 0;
+    domainid_t* pids = malloc(request->count * sizeof(domainid_t));
+    errval_t err = LIB_ERR_MALLOC_FAIL;
+    if (pids && argc > 0)
+        err = processmgr_spawn_batch(argv, argc, request->count, request->core_mask, pids, &spawned);
+    RPC_HANDLER_DEBUG("handle_spawn_batch: %zu of %u spawned\n", spawned, request->count);
+
+    for (int i = 0; i < argc; ++i)
+        free(argv[i]);
+    free(argv);
+
+    // Whatever got spawned is reported, the client sees the rest missing
+    if (spawned)
+    {
+        *ret_type = RPC_SPAWN_BATCH;
+        err = aos_rpc_bulk_reply(sess, pids, spawned * sizeof(domainid_t));
+    }
+    free(pids);
+    return err;
+}
+
 static
 errval_t handle_exit(struct aos_rpc_session* sess,
         struct lmp_recv_msg* msg,
@@ -120,8 +197,15 @@ errval_t handle_exit(struct aos_rpc_session* sess,
 
 void processmgr_register_rpc_handlers(struct aos_rpc* rpc)
 {
-    aos_rpc_register_handler(rpc, RPC_GET_NAME, handle_get_name, false);
-    aos_rpc_register_handler(rpc, RPC_GET_PID, handle_get_pid, false);
+    aos_rpc_register_handler(rpc, RPC_GET_NAME, handle_get_name, true);
+    aos_rpc_register_handler(rpc, RPC_GET_PID, handle_get_pid, true);
+    aos_rpc_register_handler(rpc, RPC_PROCESS_SNAPSHOT, handle_snapshot, true);
+    aos_rpc_register_handler(rpc, RPC_PROCESS_USAGE, handle_usage, true);
     aos_rpc_register_handler(rpc, RPC_SPAWN, handle_spawn, false);
+    aos_rpc_register_handler(rpc, RPC_SPAWN_BATCH, handle_spawn_batch, true);
     aos_rpc_register_handler(rpc, RPC_EXIT, handle_exit, false);
+
+    // Spawns wait for ELF loading and for other cores: off the accept loop
+    aos_rpc_set_handler_slow(rpc, RPC_SPAWN, true);
+    aos_rpc_set_handler_slow(rpc, RPC_SPAWN_BATCH, true);
 }
@@ -2,6 +2,72 @@
 
 #define SYSPMGR_DEBUG(...) //debug_printf(__VA_ARGS__);
 
+#define SYSPMGR_TABLE_MIN_SIZE 64
+
+// Marks a slot whose process was removed, probing continues past it
+#define SYSPMGR_TOMBSTONE ((struct sysprocessmgr_process*)1)
+
+static inline size_t table_slot(struct sysprocessmgr_state* pm_state, domainid_t pid)
+{
+    // Fibonacci hashing, consecutive PIDs spread over the table
+    return (pid * 2654435761u) & (pm_state->table_size - 1);
+}
+
+// Slot of $pid, or table_size if it's not in
+static size_t table_find_slot(struct sysprocessmgr_state* pm_state, domainid_t pid)
+{
+    for (size_t slot = table_slot(pm_state, pid); ; slot = (slot + 1) & (pm_state->table_size - 1))
+    {
+        struct sysprocessmgr_process* process = pm_state->table[slot];
+        if (!process)
+            return pm_state->table_size;
+        if (process != SYSPMGR_TOMBSTONE && process->pid == pid)
+            return slot;
+    }
+}
+
+static struct sysprocessmgr_process* table_find(struct sysprocessmgr_state* pm_state, domainid_t pid)
+{
+    size_t slot = table_find_slot(pm_state, pid);
+    return slot < pm_state->table_size ? pm_state->table[slot] : NULL;
+}
+
+// Puts $process into the first free slot, or over a tombstone
+static void table_put(struct sysprocessmgr_state* pm_state, struct sysprocessmgr_process* process)
+{
+    size_t slot = table_slot(pm_state, process->pid);
+    while (pm_state->table[slot] && pm_state->table[slot] != SYSPMGR_TOMBSTONE)
+        slot = (slot + 1) & (pm_state->table_size - 1);
+    if (!pm_state->table[slot])
+        pm_state->table_used++;
+    pm_state->table[slot] = process;
+}
+
+// Rehashes the live entries into a table sized for $live + 1 entries
+static errval_t table_rebuild(struct sysprocessmgr_state* pm_state, size_t live)
+{
+    size_t size = SYSPMGR_TABLE_MIN_SIZE;
+    while (size * 3 / 4 <= 2 * live)
+        size *= 2;
+
+    struct sysprocessmgr_process** old_table = pm_state->table;
+    size_t old_size = pm_state->table_size;
+    pm_state->table = calloc(size, sizeof(struct sysprocessmgr_process*));
+    if (!pm_state->table)
+    {
+        pm_state->table = old_table;
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    pm_state->table_size = size;
+    pm_state->table_used = 0;
+    for (size_t i = 0; i < old_size; ++i)
+        if (old_table[i] && old_table[i] != SYSPMGR_TOMBSTONE)
+            table_put(pm_state, old_table[i]);
+    free(old_table);
+    SYSPMGR_DEBUG("process table: %zu slots for %zu processes\n", size, live);
+    return SYS_ERR_OK;
+}
+
 errval_t sysprocessmgr_init(struct sysprocessmgr_state* pm_state, struct urpc_channel* urpc_channel, coreid_t my_coreid)
 {
     pm_state->running_count=0;
@@ -9,54 +75,113 @@ errval_t sysprocessmgr_init(struct sysprocessmgr_state* pm_state, struct urpc_ch
     pm_state->my_core_id=my_coreid;
     pm_state->next_pid=0;
 
-    pm_state->head=NULL;
+    pm_state->table=NULL;
+    pm_state->table_size=0;
+    pm_state->table_used=0;
+    thread_mutex_init(&pm_state->lock);
 
-    return SYS_ERR_OK;
+    return table_rebuild(pm_state, 0);
 }
 
 errval_t sysprocessmgr_register_process(struct sysprocessmgr_state* pm_state, const char* name, coreid_t core_id, domainid_t* new_pid)
 {
-    struct sysprocessmgr_process *new_process = malloc(sizeof(struct sysprocessmgr_process));
+    ERROR_RET1(sysprocessmgr_reserve_pids(pm_state, 1, new_pid));
+    SYSPMGR_DEBUG("coreprocessmgr_spawn_process:: PID generated: 0x%d\n", *new_pid);
+    return sysprocessmgr_add_processes(pm_state, name, core_id, *new_pid, 1);
+}
+
+errval_t sysprocessmgr_reserve_pids(struct sysprocessmgr_state* pm_state, size_t count, domainid_t* first_pid)
+{
+    thread_mutex_lock(&pm_state->lock);
+    *first_pid = pm_state->next_pid;
+    pm_state->next_pid += count;
+    thread_mutex_unlock(&pm_state->lock);
+    return SYS_ERR_OK;
+}
+
+/**
+ *  Registers the processes [first_pid, first_pid + count) under $name.
+    The PIDs must have been reserved. They are starting until
+    sysprocessmgr_set_running.
+*/
+errval_t sysprocessmgr_add_processes(struct sysprocessmgr_state* pm_state, const char* name, coreid_t core_id,
+        domainid_t first_pid, size_t count)
+{
     size_t namelen = strlen(name);
     namelen++;
 
-    new_process->core_id=core_id;
-    new_process->pid=pm_state->next_pid++;
-
-    new_process->name=malloc(namelen);
-    strncpy(new_process->name, name, namelen);
-    new_process->next=pm_state->head;
-    new_process->prev=NULL;
-    if(pm_state->head)
-        pm_state->head->prev=new_process;
-    pm_state->head=new_process;
-    pm_state->running_count++;
-    *new_pid = new_process->pid;
-    SYSPMGR_DEBUG("coreprocessmgr_spawn_process:: PID generated: 0x%d\n", new_process->pid);
+    for (size_t i = 0; i < count; ++i)
+    {
+        struct sysprocessmgr_process *new_process = malloc(sizeof(struct sysprocessmgr_process));
+        if (!new_process)
+            return LIB_ERR_MALLOC_FAIL;
+        new_process->name=malloc(namelen);
+        if (!new_process->name)
+        {
+            free(new_process);
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        strncpy(new_process->name, name, namelen);
+        new_process->core_id=core_id;
+        new_process->pid=first_pid + i;
+        new_process->state=AOS_PROCESS_STARTING;
 
+        errval_t err = SYS_ERR_OK;
+        thread_mutex_lock(&pm_state->lock);
+        if ((pm_state->table_used + 1) * 4 > pm_state->table_size * 3)
+            err = table_rebuild(pm_state, pm_state->running_count);
+        if (err_is_ok(err))
+        {
+            table_put(pm_state, new_process);
+            pm_state->running_count++;
+        }
+        thread_mutex_unlock(&pm_state->lock);
+        if (err_is_fail(err))
+        {
+            free(new_process->name);
+            free(new_process);
+            return err;
+        }
+    }
     return SYS_ERR_OK;
 }
 
-static struct sysprocessmgr_process* find_process_by_pid(struct sysprocessmgr_process* list, domainid_t pid)
+errval_t sysprocessmgr_set_running(struct sysprocessmgr_state* pm_state, domainid_t first_pid, size_t count)
 {
-    while (list && list->pid != pid)
-        list = list->next;
-    return list;
+    thread_mutex_lock(&pm_state->lock);
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Might have exited already
+        struct sysprocessmgr_process *process = table_find(pm_state, first_pid + i);
+        if (process)
+            process->state = AOS_PROCESS_RUNNING;
+    }
+    thread_mutex_unlock(&pm_state->lock);
+    return SYS_ERR_OK;
 }
 
 errval_t sysprocessmgr_deregister_process(struct sysprocessmgr_state* pm_state, domainid_t pid)
 {
-    struct sysprocessmgr_process *process = find_process_by_pid(pm_state->head, pid);
-    if (!process)
+    thread_mutex_lock(&pm_state->lock);
+    size_t slot = table_find_slot(pm_state, pid);
+    if (slot == pm_state->table_size)
+    {
+        thread_mutex_unlock(&pm_state->lock);
         return PROCMGR_ERR_PROCESS_NOT_FOUND;
+    }
+    struct sysprocessmgr_process *process = pm_state->table[slot];
 
-    if(process->next)
-        process->next->prev=process->prev;
-    if(process->prev)
-        process->prev->next=process->next;
-    if(process==pm_state->head)
-        pm_state->head=process->next;
+    // A tombstone followed by an empty slot ends no probe sequence
+    size_t next = (slot + 1) & (pm_state->table_size - 1);
+    if (pm_state->table[next])
+        pm_state->table[slot] = SYSPMGR_TOMBSTONE;
+    else
+    {
+        pm_state->table[slot] = NULL;
+        pm_state->table_used--;
+    }
     pm_state->running_count--;
+    thread_mutex_unlock(&pm_state->lock);
 
     SYSPMGR_DEBUG("DEREGISTER [PID=%d] %s\n", (int)pid, process->name);
     free(process->name);
@@ -67,13 +192,17 @@ errval_t sysprocessmgr_deregister_process(struct sysprocessmgr_state* pm_state,
 
 errval_t sysprocessmgr_get_process_name(struct sysprocessmgr_state* pm_state, domainid_t pid, char* name, size_t buffer_len)
 {
-    struct sysprocessmgr_process *process = find_process_by_pid(pm_state->head, pid);
+    errval_t err = SYS_ERR_OK;
+    thread_mutex_lock(&pm_state->lock);
+    struct sysprocessmgr_process *process = table_find(pm_state, pid);
     if (!process)
-        return PROCMGR_ERR_PROCESS_NOT_FOUND;
-    if (strlen(process->name)+1 > buffer_len)
-        return PROCMGR_ERR_OUT_BUFFER_TOO_SMALL;
-    strncpy(name, process->name, buffer_len);
-    return SYS_ERR_OK;
+        err = PROCMGR_ERR_PROCESS_NOT_FOUND;
+    else if (strlen(process->name)+1 > buffer_len)
+        err = PROCMGR_ERR_OUT_BUFFER_TOO_SMALL;
+    else
+        strncpy(name, process->name, buffer_len);
+    thread_mutex_unlock(&pm_state->lock);
+    return err;
 }
 
 /**
@@ -84,16 +213,68 @@ errval_t sysprocessmgr_get_process_name(struct sysprocessmgr_state* pm_state, do
 */
 errval_t sysprocessmgr_list_pids(struct sysprocessmgr_state* pm_state, domainid_t* pids, size_t* number)
 {
-    struct sysprocessmgr_process* list = pm_state->head;
-    int i = 0;
-    int max_count = *number;
-    while (list && i < max_count)
+    thread_mutex_lock(&pm_state->lock);
+    size_t count = 0;
+    for (size_t i = 0; i < pm_state->table_size && count < *number; ++i)
     {
-        pids[i] = list->pid;
-        list = list->next;
-        SYSPMGR_DEBUG("sysprocessmgr_list_pids: got %d\n", pids[i]);
-        ++i;
+        struct sysprocessmgr_process* process = pm_state->table[i];
+        if (!process || process == SYSPMGR_TOMBSTONE)
+            continue;
+        pids[count++] = process->pid;
+        SYSPMGR_DEBUG("sysprocessmgr_list_pids: got %d\n", process->pid);
     }
-    *number = i;
+    thread_mutex_unlock(&pm_state->lock);
+    *number = count;
     return SYS_ERR_OK;
 }
+
+static int compare_by_pid(const void* a, const void* b)
+{
+    domainid_t x = (*(struct sysprocessmgr_process* const*)a)->pid;
+    domainid_t y = (*(struct sysprocessmgr_process* const*)b)->pid;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ *  Serializes all processes into a malloc'ed buffer of aos_process_records,
+    in PID order.
+*/
+errval_t sysprocessmgr_snapshot(struct sysprocessmgr_state* pm_state, char** records, size_t* size)
+{
+    thread_mutex_lock(&pm_state->lock);
+    errval_t err = SYS_ERR_OK;
+    struct sysprocessmgr_process** sorted = malloc((pm_state->running_count + 1) * sizeof(*sorted));
+    size_t count = 0;
+    *size = 0;
+    if (!sorted)
+        err = LIB_ERR_MALLOC_FAIL;
+    for (size_t i = 0; err_is_ok(err) && i < pm_state->table_size; ++i)
+    {
+        struct sysprocessmgr_process* process = pm_state->table[i];
+        if (!process || process == SYSPMGR_TOMBSTONE)
+            continue;
+        sorted[count++] = process;
+        *size += AOS_PROCESS_RECORD_SIZE(strlen(process->name) + 1);
+    }
+    *records = err_is_ok(err) ? malloc(*size ? *size : 1) : NULL;
+    if (err_is_ok(err) && !*records)
+        err = LIB_ERR_MALLOC_FAIL;
+    if (err_is_ok(err))
+    {
+        qsort(sorted, count, sizeof(*sorted), compare_by_pid);
+        char* pos = *records;
+        for (size_t i = 0; i < count; ++i)
+        {
+            struct aos_process_record* record = (struct aos_process_record*)pos;
+            record->pid = sorted[i]->pid;
+            record->core_id = sorted[i]->core_id;
+            record->state = sorted[i]->state;
+            record->name_size = strlen(sorted[i]->name) + 1;
+            memcpy(record->name, sorted[i]->name, record->name_size);
+            pos += AOS_PROCESS_RECORD_SIZE(record->name_size);
+        }
+    }
+    thread_mutex_unlock(&pm_state->lock);
+    free(sorted);
+    return err;
+}
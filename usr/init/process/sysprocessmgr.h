@@ -2,17 +2,29 @@
 #define _HEADER_INIT_SYSPROCESSMGR
 
 #include <aos/aos.h>
+#include <aos/aos_rpc.h>
 #include <aos/urpc/server.h>
 
 struct sysprocessmgr_process{
-    struct sysprocessmgr_process *next, *prev;
     domainid_t pid;
     char *name;
     coreid_t core_id;
+    enum aos_process_state state;
 };
 
+/*
+ * PIDs are handed out in increasing order. Reserving a block of them and
+ * registering the processes are separate steps, so that other cores can
+ * allocate from a block of their own and register afterwards.
+ * Processes are indexed by PID in an open-addressing table with linear
+ * probing. PIDs are never reused, so a removed process leaves a tombstone
+ * behind; the table is rebuilt once live entries and tombstones fill 3/4.
+ */
 struct sysprocessmgr_state{
-    struct sysprocessmgr_process *head;
+    struct thread_mutex lock;
+    struct sysprocessmgr_process **table;
+    size_t table_size;          // Power of two
+    size_t table_used;          // Live entries and tombstones
     struct urpc_channel* urpc_channel;
     domainid_t next_pid;
     uint32_t running_count;
@@ -21,8 +33,13 @@ struct sysprocessmgr_state{
 
 errval_t sysprocessmgr_init(struct sysprocessmgr_state* pm_state, struct urpc_channel* urpc_channel, coreid_t my_coreid);
 errval_t sysprocessmgr_register_process(struct sysprocessmgr_state* pm_state, const char* name, coreid_t core_id, domainid_t* new_pid);
+errval_t sysprocessmgr_reserve_pids(struct sysprocessmgr_state* pm_state, size_t count, domainid_t* first_pid);
+errval_t sysprocessmgr_add_processes(struct sysprocessmgr_state* pm_state, const char* name, coreid_t core_id,
+        domainid_t first_pid, size_t count);
+errval_t sysprocessmgr_set_running(struct sysprocessmgr_state* pm_state, domainid_t first_pid, size_t count);
 errval_t sysprocessmgr_deregister_process(struct sysprocessmgr_state* pm_state, domainid_t pid);
 errval_t sysprocessmgr_get_process_name(struct sysprocessmgr_state* pm_state, domainid_t pid, char* name, size_t buffer_len);
 errval_t sysprocessmgr_list_pids(struct sysprocessmgr_state* pm_state, domainid_t* pids, size_t* number);
+errval_t sysprocessmgr_snapshot(struct sysprocessmgr_state* pm_state, char** records, size_t* size);
 
 #endif
@@ -1,19 +1,120 @@
 #include "init.h"
+#include <aos/threads.h>
 #include <aos/serializers.h>
 #include <aos/urpc/urpc.h>
 #include "urpc/handlers.h"
 #include "process/processmgr.h"
 
-static errval_t urpc_handle_gen_pid(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+static errval_t urpc_handle_reserve_pids(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
 {
-    URPC_CHECK_READ_SIZE(msg, sizeof(struct urpc_msg_gen_pid));
-    struct urpc_msg_gen_pid* data = msg->data;
+    URPC_CHECK_READ_SIZE(msg, sizeof(uint32_t));
+    uint32_t count;
+    memcpy(&count, msg->data, sizeof(count));
+
+    domainid_t first_pid;
+    ERROR_RET1(processmgr_reserve_pids(count, &first_pid));
+    ERROR_RET1(urpc_server_answer(buf, &first_pid, sizeof(first_pid)));
+    return SYS_ERR_OK;
+}
+
+static errval_t urpc_handle_register_pids(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    URPC_CHECK_READ_SIZE(msg, sizeof(struct urpc_msg_register_pids));
+    struct urpc_msg_register_pids* data = msg->data;
     URPC_CHECK_READ_SIZE(msg, data->name_size);
     data->name[data->name_size - 1] = 0;
 
+    ERROR_RET1(processmgr_register_pids(data->name, data->core_id, data->first_pid, data->count));
+    return SYS_ERR_OK;
+}
+
+static errval_t urpc_handle_set_running(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    URPC_CHECK_READ_SIZE(msg, sizeof(struct urpc_msg_pid_range));
+    struct urpc_msg_pid_range* range = msg->data;
+
+    ERROR_RET1(processmgr_set_running(range->first_pid, range->count));
+    return SYS_ERR_OK;
+}
+
+/*
+ * Spawning takes long, so URPC_OP_PROCESSMGR_SPAWN and _SPAWN_BATCH are
+ * answered by a worker thread. The event loop keeps serving other requests
+ * meanwhile and the answers complete out of order on the client side.
+ */
+struct urpc_spawn_job
+{
+    struct urpc_spawn_job* next;
+    struct urpc_buffer* buf;
+    uint32_t tag;
     domainid_t pid;
-    ERROR_RET1(processmgr_generate_pid(data->name, data->core_id, &pid));
-    ERROR_RET1(urpc_server_answer(buf, &pid, sizeof(pid)));
+    uint32_t count;
+    bool batch;             // Answer with a urpc_msg_spawn_batch_answer
+    char** argv;
+    int argc;
+};
+
+static struct thread_mutex spawn_jobs_lock;
+static struct thread_cond spawn_jobs_cond;
+static struct urpc_spawn_job* spawn_jobs_head;
+static struct urpc_spawn_job** spawn_jobs_tail = &spawn_jobs_head;
+
+static int urpc_spawn_worker(void* arg)
+{
+    for (;;)
+    {
+        thread_mutex_lock(&spawn_jobs_lock);
+        while (!spawn_jobs_head)
+            thread_cond_wait(&spawn_jobs_cond, &spawn_jobs_lock);
+        struct urpc_spawn_job* job = spawn_jobs_head;
+        spawn_jobs_head = job->next;
+        if (!spawn_jobs_head)
+            spawn_jobs_tail = &spawn_jobs_head;
+        thread_mutex_unlock(&spawn_jobs_lock);
+
+        errval_t err;
+        if (job->batch)
+        {
+            struct urpc_msg_spawn_batch_answer answer;
+            size_t spawned;
+            answer.err = processmgr_spawn_local_batch(job->argv, job->argc, job->pid, job->count, &spawned);
+            answer.spawned = spawned;
+            err = urpc_server_answer_tag(job->buf, job->tag, &answer, sizeof(answer));
+        }
+        else
+        {
+            err = processmgr_spawn_process_with_args_and_pid(job->argv, job->argc, my_core_id, job->pid);
+            err = urpc_server_answer_error_tag(job->buf, job->tag, err);
+        }
+        if (err_is_fail(err))
+            DEBUG_ERR(err, "answering spawn of PID %d", job->pid);
+
+        for (int i = 0; i < job->argc; ++i)
+            free(job->argv[i]);
+        free(job->argv);
+        free(job);
+    }
+    return 0;
+}
+
+static errval_t urpc_spawn_enqueue(struct urpc_buffer* buf, struct urpc_spawn_job* job)
+{
+    job->buf = buf;
+    errval_t err = urpc_server_defer(buf, &job->tag);
+    if (err_is_fail(err))
+    {
+        for (int i = 0; i < job->argc; ++i)
+            free(job->argv[i]);
+        free(job->argv);
+        free(job);
+        return err;
+    }
+    job->next = NULL;
+    thread_mutex_lock(&spawn_jobs_lock);
+    *spawn_jobs_tail = job;
+    spawn_jobs_tail = &job->next;
+    thread_cond_signal(&spawn_jobs_cond);
+    thread_mutex_unlock(&spawn_jobs_lock);
     return SYS_ERR_OK;
 }
 
@@ -21,20 +122,45 @@ static errval_t urpc_handle_spawn(struct urpc_buffer* buf, struct urpc_message*
 {
     URPC_CHECK_READ_SIZE(msg, sizeof(coreid_t)); // Decreases msg->lenght
     coreid_t core_id;
-    domainid_t pid;
     memcpy(&core_id, msg->data, sizeof(coreid_t));
-    memcpy(&pid, msg->data + sizeof(coreid_t), sizeof(domainid_t));
-    char** argv;
-    int argc;
+    if (core_id != my_core_id)
+        return PROCMGR_ERR_REMOTE_DIFFERENT_COREID;
+
+    struct urpc_spawn_job* job = malloc(sizeof(struct urpc_spawn_job));
+    if (!job)
+        return LIB_ERR_MALLOC_FAIL;
+    memcpy(&job->pid, msg->data + sizeof(coreid_t), sizeof(domainid_t));
     if (!unserialize_array_of_strings(msg->data + sizeof(coreid_t) + sizeof(domainid_t), msg->length,
-        &argv, &argc))
+        &job->argv, &job->argc))
+    {
+        free(job);
         return AOS_ERR_UNSERIALIZE;
+    }
 
-    if (core_id != my_core_id)
+    job->count = 1;
+    job->batch = false;
+    return urpc_spawn_enqueue(buf, job);
+}
+
+static errval_t urpc_handle_spawn_batch(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    URPC_CHECK_READ_SIZE(msg, sizeof(struct urpc_msg_spawn_batch));
+    struct urpc_msg_spawn_batch* data = msg->data;
+    if (data->core_id != my_core_id)
         return PROCMGR_ERR_REMOTE_DIFFERENT_COREID;
 
-    ERROR_RET1(processmgr_spawn_process_with_args_and_pid(argv, argc, core_id, pid));
-    return SYS_ERR_OK;
+    struct urpc_spawn_job* job = malloc(sizeof(struct urpc_spawn_job));
+    if (!job)
+        return LIB_ERR_MALLOC_FAIL;
+    if (!unserialize_array_of_strings(data->args, msg->length, &job->argv, &job->argc))
+    {
+        free(job);
+        return AOS_ERR_UNSERIALIZE;
+    }
+    job->pid = data->first_pid;
+    job->count = data->count;
+    job->batch = true;
+    return urpc_spawn_enqueue(buf, job);
 }
 
 static errval_t urpc_handle_get_name(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
@@ -73,6 +199,46 @@ static errval_t urpc_handle_list_pids(struct urpc_buffer* buf, struct urpc_messa
     return SYS_ERR_OK;
 }
 
+static errval_t urpc_handle_snapshot(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    char* records;
+    size_t size;
+    ERROR_RET1(processmgr_snapshot(&records, &size));
+
+    // Many processes don't fit the ring, those go through the pool
+    errval_t err;
+    void* pool_buf;
+    if (size <= URPC_MAX_DATA_SIZE(buf))
+        err = urpc_server_answer(buf, records, size);
+    else if (err_is_ok(err = urpc_server_alloc(buf, size, &pool_buf)))
+    {
+        memcpy(pool_buf, records, size);
+        err = urpc_server_answer_desc(buf, pool_buf, size);
+    }
+    free(records);
+    return err;
+}
+
+static errval_t urpc_handle_usage(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    struct aos_process_usage* usage;
+    size_t count;
+    ERROR_RET1(processmgr_local_usage(&usage, &count));
+
+    errval_t err;
+    void* pool_buf;
+    size_t size = count * sizeof(struct aos_process_usage);
+    if (size <= URPC_MAX_DATA_SIZE(buf))
+        err = urpc_server_answer(buf, usage, size);
+    else if (err_is_ok(err = urpc_server_alloc(buf, size, &pool_buf)))
+    {
+        memcpy(pool_buf, usage, size);
+        err = urpc_server_answer_desc(buf, pool_buf, size);
+    }
+    free(usage);
+    return err;
+}
+
 static errval_t urpc_handle_pid_deregister(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
 {
     URPC_CHECK_READ_SIZE(msg, sizeof(domainid_t));
@@ -87,10 +253,24 @@ static errval_t urpc_handle_pid_deregister(struct urpc_buffer* buf, struct urpc_
 
 errval_t processmgr_register_urpc_handlers(struct urpc_channel* channel)
 {
-    urpc_server_register_handler(channel, URPC_OP_PROCESSMGR_GEN_PID, urpc_handle_gen_pid, NULL);
+    static struct thread* spawn_worker;
+    if (!spawn_worker)
+    {
+        thread_mutex_init(&spawn_jobs_lock);
+        thread_cond_init(&spawn_jobs_cond);
+        spawn_worker = thread_create(urpc_spawn_worker, NULL);
+        if (!spawn_worker)
+            return LIB_ERR_THREAD_CREATE;
+    }
+    urpc_server_register_handler(channel, URPC_OP_PROCESSMGR_RESERVE_PIDS, urpc_handle_reserve_pids, NULL);
+    urpc_server_register_handler(channel, URPC_OP_PROCESSMGR_REGISTER_PIDS, urpc_handle_register_pids, NULL);
+    urpc_server_register_handler(channel, URPC_OP_PROCESSMGR_SET_RUNNING, urpc_handle_set_running, NULL);
     urpc_server_register_handler(channel, URPC_OP_PROCESSMGR_SPAWN, urpc_handle_spawn, NULL);
+    urpc_server_register_handler(channel, URPC_OP_PROCESSMGR_SPAWN_BATCH, urpc_handle_spawn_batch, NULL);
     urpc_server_register_handler(channel, URPC_OP_GET_PROCESS_DEREGISTER, urpc_handle_pid_deregister, NULL);
     urpc_server_register_handler(channel, URPC_OP_GET_PROCESS_NAME, urpc_handle_get_name, NULL);
     urpc_server_register_handler(channel, URPC_OP_LIST_PIDS, urpc_handle_list_pids, NULL);
+    urpc_server_register_handler(channel, URPC_OP_PROCESS_SNAPSHOT, urpc_handle_snapshot, NULL);
+    urpc_server_register_handler(channel, URPC_OP_PROCESS_USAGE, urpc_handle_usage, NULL);
     return SYS_ERR_OK;
 }
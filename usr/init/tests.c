@@ -20,6 +20,7 @@ void test_allocate_frame(size_t alloc_size, struct capref* cap_as_frame);
 void* test_alloc_and_map(size_t alloc_size);
 void runtests_mem_alloc(void);
 void test_paging(void);
+void test_concurrent_faults(void);
 
 #define TEST_NUM_THREADS 1
 
@@ -47,6 +48,7 @@ void run_all_tests(void)
     for (int i = 0; i < TEST_NUM_THREADS; ++i)
         thread_join(test_threads[i], &retval);
 
+    test_concurrent_faults();
     debug_printf("[TEST] Tests finished\n");
 }
 
@@ -98,6 +100,16 @@ void runtests_mem_alloc(void)
     alloc_size = BASE_PAGE_SIZE * 4;
     TEST_PRINTF("\tFreeing medium-sized alloc\n");
     TEST_ASSERT(aos_ram_free(mediumCap, alloc_size), "mm_free failed");
+
+    // Alignment larger than the size: the free bins must skip unaligned nodes
+    TEST_PRINTF("\tAllocate 1 page aligned to 1MB\n");
+    struct capref alignedCap;
+    struct frame_identity fi;
+    TEST_ASSERT(ram_alloc_aligned(&alignedCap, BASE_PAGE_SIZE, LARGE_PAGE_SIZE), "Aligned alloc failed");
+    TEST_ASSERT(frame_identify(alignedCap, &fi), "frame_identify");
+    if (fi.base % LARGE_PAGE_SIZE)
+        USER_PANIC("Aligned alloc returned base 0x%08x\n", (int)fi.base);
+    TEST_ASSERT(aos_ram_free(alignedCap, BASE_PAGE_SIZE), "mm_free failed");
 }
 
 void test_allocate_frame(size_t alloc_size, struct capref* cap_as_frame) {
@@ -133,6 +145,10 @@ void test_paging(void)
 
     int* number;
 
+#ifdef PAGING_STORE_AS_LIST
+    // Verify the vspace indices after every paging operation below
+    vm_block_set_self_check(get_current_paging_state(), true);
+#endif
 
     PRINT_TEST("Allocate and map one page");
     void* page = test_alloc_and_map(BASE_PAGE_SIZE);
@@ -177,4 +193,59 @@ void test_paging(void)
     // But kind of destructive test :p
     //TEST_PRINTF("Should crash now\n");
     //*number = 1;
+
+    struct paging_state* st = get_current_paging_state();
+    PRINT_TEST("Unmap over several L2");
+    void* big = test_alloc_and_map(3 * LARGE_PAGE_SIZE);
+    TEST_ASSERT(paging_unmap(st, big), "unmap several L2");
+    TEST_ASSERT(paging_alloc_fixed_address(st, (lvaddr_t)big, 3 * LARGE_PAGE_SIZE),
+        "vspace not free after unmap");
+    TEST_ASSERT(paging_unmap(st, big), "unmap lazily allocated block");
+
+    PRINT_TEST("Free a faulted range");
+    char* lazy;
+    TEST_ASSERT(paging_alloc(st, (void**)&lazy, 2 * LARGE_PAGE_SIZE, NULL), "paging_alloc");
+    for (i = 0; i < 2 * LARGE_PAGE_SIZE; i += BASE_PAGE_SIZE)
+        lazy[i] = 1;
+    TEST_ASSERT(paging_free_range(st, (lvaddr_t)lazy, 2 * LARGE_PAGE_SIZE), "paging_free_range");
+    TEST_ASSERT(paging_alloc_fixed_address(st, (lvaddr_t)lazy, 2 * LARGE_PAGE_SIZE),
+        "vspace not free after paging_free_range");
+    TEST_ASSERT(paging_unmap(st, lazy), "unmap lazily allocated block");
+
+#ifdef PAGING_STORE_AS_LIST
+    vm_block_set_self_check(get_current_paging_state(), false);
+#endif
+}
+
+#define TEST_FAULT_THREADS 4
+#define TEST_FAULT_PAGES 64
+
+static int* fault_test_region;
+
+static int test_fault_thread(void* data)
+{
+    int id = (int)data;
+    // All threads fault on the same pages at the same time
+    for (int i = 0; i < TEST_FAULT_PAGES; ++i)
+        fault_test_region[i * BASE_PAGE_SIZE / sizeof(int) + id] = i + id;
+    return 0;
+}
+
+void test_concurrent_faults(void)
+{
+    PRINT_TEST("Concurrent faults on the same pages");
+    TEST_ASSERT(paging_alloc(get_current_paging_state(), (void**)&fault_test_region,
+        TEST_FAULT_PAGES * BASE_PAGE_SIZE, NULL), "paging_alloc");
+
+    struct thread* threads[TEST_FAULT_THREADS];
+    int retval;
+    for (int i = 0; i < TEST_FAULT_THREADS; ++i)
+        threads[i] = thread_create(test_fault_thread, (void*)i);
+    for (int i = 0; i < TEST_FAULT_THREADS; ++i)
+        thread_join(threads[i], &retval);
+
+    for (int i = 0; i < TEST_FAULT_PAGES; ++i)
+        for (int id = 0; id < TEST_FAULT_THREADS; ++id)
+            if (fault_test_region[i * BASE_PAGE_SIZE / sizeof(int) + id] != i + id)
+                USER_PANIC("Page %d lost the write of thread %d\n", i, id);
 }
@@ -3,9 +3,8 @@
 
 static errval_t urpc_handle_print_op(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
 {
-    char* data_as_str = msg->data;
-    data_as_str[msg->length] = 0;
-    debug_printf("SERVER: urpc_handle_print_op: \"%s\"\n", data_as_str);
+    // The data is not NUL-terminated and may still be in the ring
+    debug_printf("SERVER: urpc_handle_print_op: \"%.*s\"\n", (int)msg->length, (char*)msg->data);
 
     urpc_server_answer(buf, "answer", sizeof("answer"));
 
@@ -5,20 +5,27 @@ enum urpc_opcodes
 {
     URPC_OP_NULL = 0,
     URPC_OP_PRINT,
-    URPC_OP_PROCESSMGR_GEN_PID,
+    URPC_OP_PROCESSMGR_RESERVE_PIDS,
+    URPC_OP_PROCESSMGR_REGISTER_PIDS,
+    URPC_OP_PROCESSMGR_SET_RUNNING,
     URPC_OP_PROCESSMGR_SPAWN,
+    URPC_OP_PROCESSMGR_SPAWN_BATCH,
     URPC_OP_GET_PROCESS_NAME,
     URPC_OP_GET_PROCESS_DEREGISTER,
     URPC_OP_LIST_PIDS,
+    URPC_OP_PROCESS_SNAPSHOT,
+    URPC_OP_PROCESS_USAGE,
     URPC_OP_CONNECT_TO_SOCKET,
     URPC_OP_COUNT,
 };
 
 // Message structures
-struct urpc_msg_gen_pid
+struct urpc_msg_register_pids
 {
-    size_t name_size;
+    domainid_t first_pid;
+    uint32_t count;
     coreid_t core_id;
+    size_t name_size;
     char name[0];
 };
 
@@ -30,6 +37,26 @@ struct urpc_msg_spawn
     char name[0];
 };
 
+struct urpc_msg_pid_range
+{
+    domainid_t first_pid;
+    uint32_t count;
+};
+
+struct urpc_msg_spawn_batch
+{
+    coreid_t core_id;
+    domainid_t first_pid;
+    uint32_t count;
+    char args[0];           // Serialized argv
+};
+
+struct urpc_msg_spawn_batch_answer
+{
+    errval_t err;           // Why the process after the spawned ones failed
+    uint32_t spawned;       // Processes spawned, from first_pid on
+};
+
 struct urpc_msg_get_process_name
 {
     domainid_t pid;
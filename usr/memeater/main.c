@@ -105,6 +105,29 @@ static errval_t request_and_map_memory(void)
     TEST_DEBUG("Performing memset\n");
     memset(buf2, 0x00, LARGE_PAGE_SIZE);
 
+    ++test_id;
+    TEST_DEBUG("Touching a lazily mapped heap buffer...\n");
+    struct paging_fault_stats before, after;
+    paging_get_fault_stats(pstate, &before);
+    size_t heap_bytes = 8 * LARGE_PAGE_SIZE;
+    char *heap = malloc(heap_bytes);
+    if (!heap)
+        return LIB_ERR_MALLOC_FAIL;
+    for (size_t off = 0; off < heap_bytes; off += BASE_PAGE_SIZE)
+        heap[off] = 0;
+    paging_get_fault_stats(pstate, &after);
+    debug_printf("%zu pages touched: %zu faults, %zu pages mapped, "
+        "%zu clusters, %zu sections\n", heap_bytes / BASE_PAGE_SIZE,
+        after.faults - before.faults, after.pages - before.pages,
+        after.clusters - before.clusters, after.sections - before.sections);
+    size_t resident = after.pages - after.freed;
+    free(heap);
+
+    // free() trims the heap top: the pages go back to init
+    paging_get_fault_stats(pstate, &after);
+    debug_printf("resident fault pages: %zu after the burst, %zu after free\n",
+        resident, after.pages - after.freed);
+
     return SYS_ERR_OK;
 
 }
@@ -163,6 +186,12 @@ int main(int argc, char *argv[])
         USER_PANIC_ERR(err, "could not request and map memory\n");
     }
 
+    struct aos_ram_cache_stats stats;
+    err = aos_rpc_get_ram_cache_stats(get_init_rpc(), &stats);
+    if (err_is_ok(err))
+        debug_printf("init RAM cache: %u hits, %u misses, %u refills\n",
+            stats.hits, stats.misses, stats.refills);
+
     /* test printf functionality */
     debug_printf("testing terminal printf function...\n");
 
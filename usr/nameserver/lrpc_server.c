@@ -65,14 +65,12 @@ errval_t handle_string(struct aos_rpc_session* sess,
         uint32_t* ret_type,
         uint32_t* ret_flags)
 {
-    if (!sess->shared_buffer_size)
-        return RPC_ERR_SHARED_BUF_EMPTY;
-
-    size_t string_size = msg->words[1];
-    ASSERT_PROTOCOL(string_size <= sess->shared_buffer_size);
+    char* string;
+    size_t string_size;
+    aos_rpc_bulk_request(sess, &string, &string_size);
 
 //    debug_printf("Recv RPC_STRING [string size %d]\n", string_size);
-    sys_print(sess->shared_buffer, string_size);
+    sys_print(string, string_size);
     sys_print("\n", 1);
     return SYS_ERR_OK;
 }
@@ -115,15 +113,39 @@ errval_t handle_nameserver_lookup(struct aos_rpc_session* sess,
         uint32_t* ret_type,
         uint32_t* ret_flags)
 {
-    struct aos_rpc *service_rpc;
-    // TODO: error handling if name does not match any nameserver
-    lookup(sess->shared_buffer, &service_rpc);
+    char* name;
+    size_t name_len;
+    aos_rpc_bulk_request(sess, &name, &name_len);
+    uint32_t cached_generation = msg->words[2];
+
+    struct registered_service *service;
+    ERROR_RET1(lookup(name, &service));
+
+    // The client's cached binding is still the registered service
+    struct capref ep = NULL_CAP;
+    if (service->generation != cached_generation)
+        ERROR_RET1(aos_rpc_request_ep(service->rpc, &ep));
 
-    aos_rpc_request_ep(service_rpc, ret_cap);
+    ERROR_RET1(lmp_chan_send4(&sess->lc,
+        LMP_FLAG_SYNC,
+        ep,
+        MAKE_RPC_MSG_HEADER(RPC_NAMESERVER_LOOKUP, RPC_FLAG_ACK),
+        SYS_ERR_OK, service->generation, registry_generation()));
 
     return SYS_ERR_OK;
 }
 
+// Drops the binding to a service that could not be registered
+static void free_service_rpc(struct aos_rpc *rpc)
+{
+    if (rpc->server_sess) {
+        if (rpc->server_sess->lc.connstate == LMP_CONNECTED)
+            lmp_chan_destroy(&rpc->server_sess->lc);
+        free(rpc->server_sess);
+    }
+    free(rpc);
+}
+
 static
 errval_t handle_nameserver_register(struct aos_rpc_session* sess,
         struct lmp_recv_msg* msg,
@@ -133,23 +155,36 @@ errval_t handle_nameserver_register(struct aos_rpc_session* sess,
         uint32_t* ret_type,
         uint32_t* ret_flags)
 {
-    // TODO: should not allow double registration
-
-    size_t string_size = msg->words[1];
-    ASSERT_PROTOCOL(string_size <= sess->shared_buffer_size);
-
-    char *name = malloc(string_size);
-    memcpy(name, sess->shared_buffer, string_size);
-
-    struct aos_rpc *new_service_rpc = malloc(sizeof(struct aos_rpc));
+    char* request;
+    size_t string_size;
+    aos_rpc_bulk_request(sess, &request, &string_size);
+
+    struct registered_service *existing;
+    if (err_is_ok(lookup(request, &existing)))
+        return NAMESERVER_ERR_ALREADY_REGISTERED;
+
+    char *name = strdup(request);
+    if (!name)
+        return LIB_ERR_MALLOC_FAIL;
+
+    struct aos_rpc *new_service_rpc = calloc(1, sizeof(struct aos_rpc));
+    if (!new_service_rpc) {
+        free(name);
+        return LIB_ERR_MALLOC_FAIL;
+    }
     errval_t err = aos_rpc_init(new_service_rpc, received_capref, true);
     if (err_is_fail(err)) {
+        free_service_rpc(new_service_rpc);
+        free(name);
         return err_push(err, LIB_ERR_MORECORE_INIT); // TODO find a better error
     }
 
-    register_service(name, new_service_rpc);
-
-    return SYS_ERR_OK;
+    err = register_service(name, new_service_rpc);
+    if (err_is_fail(err)) {
+        free_service_rpc(new_service_rpc);
+        free(name);
+    }
+    return err;
 }
 
 static
@@ -161,13 +196,11 @@ errval_t handle_nameserver_deregister(struct aos_rpc_session* sess,
         uint32_t* ret_type,
         uint32_t* ret_flags)
 {
-    size_t string_size = msg->words[1];
-    ASSERT_PROTOCOL(string_size <= sess->shared_buffer_size);
+    char* name;
+    size_t string_size;
+    aos_rpc_bulk_request(sess, &name, &string_size);
 
-    // TODO error handling
-    deregister_service(sess->shared_buffer);
-
-    return SYS_ERR_OK;
+    return deregister_service(name);
 }
 
 static
@@ -179,15 +212,16 @@ errval_t handle_nameserver_enumerate(struct aos_rpc_session* sess,
         uint32_t* ret_type,
         uint32_t* ret_flags)
 {
-	size_t size;
-	enumerate(&size, sess->shared_buffer);
-
-	ERROR_RET1(lmp_chan_send2(&sess->lc,
-	        LMP_FLAG_SYNC,
-	        NULL_CAP,
-	        MAKE_RPC_MSG_HEADER(RPC_NAMESERVER_ENUMERATE, RPC_FLAG_ACK),
-			size));
-    return SYS_ERR_OK;
+	char *prefix;
+	size_t prefix_len;
+	aos_rpc_bulk_request(sess, &prefix, &prefix_len);
+
+	size_t num, size;
+	char *names;
+	ERROR_RET1(enumerate(prefix, &num, &names, &size));
+
+	*ret_type = RPC_NAMESERVER_ENUMERATE;
+	return aos_rpc_bulk_reply(sess, names, size);
 }
 
 errval_t lmp_server_init(struct aos_rpc* rpc)
@@ -197,10 +231,10 @@ errval_t lmp_server_init(struct aos_rpc* rpc)
     aos_rpc_register_handler(rpc, RPC_STRING, handle_string, true);
 
     aos_rpc_register_handler(rpc, RPC_NAMESERVER_EP_REQUEST, handle_ep_request, false);
-    aos_rpc_register_handler(rpc, RPC_NAMESERVER_LOOKUP, handle_nameserver_lookup, true);
+    aos_rpc_register_handler(rpc, RPC_NAMESERVER_LOOKUP, handle_nameserver_lookup, false);
     aos_rpc_register_handler(rpc, RPC_NAMESERVER_REGISTER, handle_nameserver_register, true);
     aos_rpc_register_handler(rpc, RPC_NAMESERVER_DEREGISTER, handle_nameserver_deregister, true);
-    aos_rpc_register_handler(rpc, RPC_NAMESERVER_ENUMERATE, handle_nameserver_enumerate, false);
+    aos_rpc_register_handler(rpc, RPC_NAMESERVER_ENUMERATE, handle_nameserver_enumerate, true);
 
     return SYS_ERR_OK;
 }
@@ -9,75 +9,188 @@
  */
 
 #include <services.h>
+#include <collections/hash_table.h>
 
-struct registered_service *services = NULL;
+#define SERVICES_BUCKETS 61
+
+static collections_hash_table *services_by_hash = NULL;
+
+// Sorted by name
+static struct registered_service **services_index = NULL;
+static size_t services_count = 0;
+static size_t services_index_size = 0;
+
+static uint32_t generation = 0;
+
+// Listing of all names, rebuilt when the generation moved
+static char *all_names = NULL;
+static size_t all_names_size = 0;
+static uint32_t all_names_generation = 0;
+static char *prefix_names = NULL;
+
+// FNV-1a
+static uint64_t hash_name(const char *name) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// First position in the index whose name is not below $name
+static size_t index_lower_bound(const char *name) {
+	size_t low = 0;
+	size_t high = services_count;
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (strcmp(services_index[mid]->name, name) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static struct registered_service *find(const char *name, uint64_t hash) {
+	if (!services_by_hash)
+		return NULL;
+	struct registered_service *service = collections_hash_find(services_by_hash, hash);
+	while (service && strcmp(service->name, name))
+		service = service->hash_next;
+	return service;
+}
+
+uint32_t registry_generation(void) {
+	return generation;
+}
 
 errval_t register_service(char *name, struct aos_rpc *rpc) {
+	if (!services_by_hash) {
+		collections_hash_create_with_buckets(&services_by_hash, SERVICES_BUCKETS, NULL);
+		if (!services_by_hash)
+			return LIB_ERR_MALLOC_FAIL;
+	}
+
+	uint64_t hash = hash_name(name);
+	if (find(name, hash))
+		return NAMESERVER_ERR_ALREADY_REGISTERED;
+
+	if (services_count == services_index_size) {
+		size_t size = services_index_size ? 2 * services_index_size : 16;
+		struct registered_service **index = realloc(services_index, size * sizeof(*index));
+		if (!index)
+			return LIB_ERR_MALLOC_FAIL;
+		services_index = index;
+		services_index_size = size;
+	}
+
 	struct registered_service *new_service = malloc(sizeof(struct registered_service));
+	if (!new_service)
+		return LIB_ERR_MALLOC_FAIL;
 	new_service->name = name;
 	new_service->rpc = rpc;
-	new_service->prev = NULL;
+	new_service->hash = hash;
+	new_service->generation = ++generation;
 
-	if (services) {
-		services->prev = new_service;
-		new_service->next = services;
-		services = new_service;
+	struct registered_service *same_hash = collections_hash_find(services_by_hash, hash);
+	if (same_hash) {
+		new_service->hash_next = same_hash->hash_next;
+		same_hash->hash_next = new_service;
 	} else {
-		services = new_service;
-		new_service->next = NULL;
+		new_service->hash_next = NULL;
+		collections_hash_insert(services_by_hash, hash, new_service);
 	}
 
+	size_t pos = index_lower_bound(name);
+	memmove(&services_index[pos + 1], &services_index[pos],
+			(services_count - pos) * sizeof(*services_index));
+	services_index[pos] = new_service;
+	services_count++;
+
 	return SYS_ERR_OK;
 }
 
 errval_t deregister_service(char *name) {
-	struct registered_service *service = services;
-	while (service) {
-		if (!strcmp(service->name, name)) {
-			if (service->prev) {
-				service->prev->next = service->next;
-			}
-			if (service->next) {
-				service->next->prev = service->prev;
-			}
-			if (service == services) {
-				services = service->next;
-			}
-			free(service);
-			return SYS_ERR_OK;
-		} else {
-			service = service->next;
-		}
+	uint64_t hash = hash_name(name);
+	struct registered_service *service = find(name, hash);
+	if (!service)
+		return NAMESERVER_ERR_NOT_FOUND;
+
+	struct registered_service *head = collections_hash_find(services_by_hash, hash);
+	if (head == service) {
+		collections_hash_delete(services_by_hash, hash);
+		if (service->hash_next)
+			collections_hash_insert(services_by_hash, hash, service->hash_next);
+	} else {
+		while (head->hash_next != service)
+			head = head->hash_next;
+		head->hash_next = service->hash_next;
 	}
+
+	size_t pos = index_lower_bound(name);
+	assert(services_index[pos] == service);
+	memmove(&services_index[pos], &services_index[pos + 1],
+			(services_count - pos - 1) * sizeof(*services_index));
+	services_count--;
+	generation++;
+
+	free(service->name);
+	free(service);
 	return SYS_ERR_OK;
 }
 
-errval_t lookup(char *query, struct aos_rpc **ret_rpc) {
-	struct registered_service *service = services;
-	while (service) {
-		if (!strcmp(service->name, query)) {
-			*ret_rpc = service->rpc;
-			break;
-		} else {
-			service = service->next;
-		}
-	}
+errval_t lookup(char *query, struct registered_service **ret_service) {
+	*ret_service = find(query, hash_name(query));
+	if (!*ret_service)
+		return NAMESERVER_ERR_NOT_FOUND;
 	return SYS_ERR_OK;
 }
 
-errval_t enumerate(size_t *num, char *result) {
-	struct registered_service *service = services;
-	*num = 0;
-	size_t size = 0;
+// Copies the names of index[first, last) into a new buffer
+static errval_t serialize_names(size_t first, size_t last, char **result, size_t *size) {
+	*size = 0;
+	for (size_t i = first; i < last; i++)
+		*size += strlen(services_index[i]->name) + 1;
+
+	*result = malloc(*size ? *size : 1);
+	if (!*result)
+		return LIB_ERR_MALLOC_FAIL;
+
 	size_t offset = 0;
-	while (service) {
-		size = strlen(service->name) + 1;
-		memcpy(result + offset, service->name, size);
-		offset += size;
+	for (size_t i = first; i < last; i++) {
+		size_t len = strlen(services_index[i]->name) + 1;
+		memcpy(*result + offset, services_index[i]->name, len);
+		offset += len;
+	}
+	return SYS_ERR_OK;
+}
 
-		service = service->next;
-		(*num)++;
+errval_t enumerate(char *prefix, size_t *num, char **result, size_t *size) {
+	size_t prefix_len = strlen(prefix);
+	if (!prefix_len) {
+		if (!all_names || all_names_generation != generation) {
+			free(all_names);
+			all_names = NULL;
+			ERROR_RET1(serialize_names(0, services_count, &all_names, &all_names_size));
+			all_names_generation = generation;
+		}
+		*num = services_count;
+		*result = all_names;
+		*size = all_names_size;
+		return SYS_ERR_OK;
 	}
 
+	// Names with the prefix are consecutive in the index
+	size_t first = index_lower_bound(prefix);
+	size_t last = first;
+	while (last < services_count && !strncmp(services_index[last]->name, prefix, prefix_len))
+		last++;
+
+	free(prefix_names);
+	prefix_names = NULL;
+	ERROR_RET1(serialize_names(first, last, &prefix_names, size));
+	*num = last - first;
+	*result = prefix_names;
 	return SYS_ERR_OK;
 }
@@ -5,11 +5,20 @@
 #include <aos/aos.h>
 #include <aos/aos_rpc.h>
 
+/*
+ * Services are found by name through a hash table, keyed by a 64 bit hash
+ * of the name (names with the same hash are chained), and listed in name
+ * order from a sorted index. Every change bumps the registry generation;
+ * a service keeps the generation it was registered at, so clients can
+ * tell whether a binding they cached is still the registered one.
+ */
 struct registered_service {
     char* name;
     struct aos_rpc *rpc;
+    uint64_t hash;
+    uint32_t generation;
 
-    struct registered_service *next, *prev;
+    struct registered_service *hash_next;
 };
 
 /**
@@ -25,11 +34,12 @@ errval_t nameserver_rpc_init(struct aos_rpc *rpc);
 /**
 * @brief register a name binding
 *
-* @param name the name under which to register the service
+* @param name the name under which to register the service, owned by
+* the registry from now on
 * other parameters: the service endpoint itself
 *
 * @return SYS_ERR_OK on success
-* errval on failure
+* NAMESERVER_ERR_ALREADY_REGISTERED if the name is taken
 */
 errval_t register_service(char *name, struct aos_rpc *rpc);
 
@@ -39,7 +49,7 @@ errval_t register_service(char *name, struct aos_rpc *rpc);
 * @param name the name under which the service was registered
 *
 * @return SYS_ERR_OK on success
-* errval on failure
+* NAMESERVER_ERR_NOT_FOUND if no service has this name
 */
 errval_t deregister_service(char *name);
 
@@ -48,22 +58,30 @@ errval_t deregister_service(char *name);
 * @brief lookup a name binding
 *
 * @param query the query string to look up
-* other parameters: the returned service endpoint itself
+* @param ret_service the registered service
 *
 * @return SYS_ERR_OK on success
-* errval on failure
+* NAMESERVER_ERR_NOT_FOUND if no service has this name
 */
-errval_t lookup(char *query, struct aos_rpc **ret_rpc);
+errval_t lookup(char *query, struct registered_service **ret_service);
 
 /**
-* @brief lookup a name binding
+* @brief list the names starting with a prefix, in order
 *
+* @param prefix the prefix, "" for all names
 * @param num returns the number of names returned
-* @param result array of <num> names returned
+* @param result returns the names, NUL-terminated one after the other.
+* The buffer belongs to the registry and is valid until the next call.
+* @param size returns the size of the buffer
 *
 * @return SYS_ERR_OK on success
 * errval on failure
 */
-errval_t enumerate(size_t *num, char *result);
+errval_t enumerate(char *prefix, size_t *num, char **result, size_t *size);
+
+/**
+* @brief the registry generation, bumped by every change
+*/
+uint32_t registry_generation(void);
 
 #endif /* USR_NAMESERVER_SERVICES_H_ */
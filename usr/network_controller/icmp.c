@@ -6,9 +6,12 @@ void message_handler(uint32_t from, uint32_t to, uint8_t *buf, size_t len, void*
     debug_printf("Handling PING\n");
     struct icmp_packet* packet=(struct icmp_packet*)buf;
     if(packet->code==0 && packet->type==8){
+        // Only the type changes, patch the checksum instead of summing the payload again
+        uint16_t old_type_code, new_type_code;
+        memcpy(&old_type_code, packet, sizeof(old_type_code));
         packet->type=0;
-        packet->checksum=0;
-        packet->checksum=inet_checksum(packet, len);
+        memcpy(&new_type_code, packet, sizeof(new_type_code));
+        packet->checksum=inet_checksum_update16(packet->checksum, old_type_code, new_type_code);
         slip_send_datagram(icmp_state->slip_state, from, to, 0x01, buf, len);
     }
 }
@@ -6,6 +6,7 @@
 #include <omap44xx_map.h>
 #include <netutil/user_serial.h>
 #include <aos/inthandler.h>
+#include <arch/arm/barrelfish_kpi/asm_inlines_arch.h>
 #include "slip_parser.h"
 #include "icmp.h"
 #include "udp_parser.h"
@@ -17,63 +18,106 @@ struct slip_state slip_state;
 struct icmp_state icmp_state;
 struct udp_parser_state udp_state;
 
-//Data buffer variables
-#define UART_RCV_BUFFER_SIZE 2000
+//Receive ring: filled by the UART interrupt handler, drained by the
+//consumer thread. Single producer and consumer, no lock: each side only
+//writes its own index. Power of two, the indices run freely.
+#define UART_RCV_BUFFER_SIZE    16384
+#define UART_RCV_HIGH_WATER     (UART_RCV_BUFFER_SIZE/4*3)
 uint8_t uart_receive_buffer[UART_RCV_BUFFER_SIZE];
-volatile size_t buffer_start;
-volatile size_t buffer_end;
-volatile size_t buffer_write_offset;
+volatile uint32_t buffer_start;
+volatile uint32_t buffer_end;
 
-struct thread_mutex buffer_lock;
-struct thread_cond buffer_content_changed;
+struct thread_sem buffer_content_changed;
 
-#define DEBUG_BUFF_SIZE 3500
-#define OFFSET_BUFFER   1133
-size_t debug_buff_index;
-uint8_t debug_buffer[DEBUG_BUFF_SIZE];
+//Only written by the producer, read by the consumer for reporting
+volatile uint32_t rx_overruns;          // Bytes dropped on a full ring
+volatile uint32_t rx_high_water_hits;   // Times the ring filled past the mark
+static bool rx_resync;                  // Dropping until the next frame starts
+static bool rx_above_high_water;
 
 struct aos_rpc network_server_rpc;
 struct aos_rpc nameserver_rpc;
 
+// Makes the decoder drop the partial frame it holds, even if it is halfway
+// through an escape sequence: either ESC or NUL is an invalid escape
+static const uint8_t slip_abort[]={SLIP_ESC, 0x00, SLIP_END};
+
 void serial_input(uint8_t *buf, size_t len){
-    thread_mutex_lock(&buffer_lock);
+    // Called from the interrupt handler: never wait for the consumer. Bytes
+    // that don't fit are counted and the frame they belong to is lost, so
+    // skip to the next END and terminate the partial frame there.
+    uint32_t start=buffer_start;
+    uint32_t end=buffer_end;
+    dmb();
     for(size_t i=0; i<len; ++i){
-        size_t end=(buffer_end+buffer_write_offset+1)%UART_RCV_BUFFER_SIZE;
-
-        while(end==buffer_start){
-            debug_printf("------ CONSUMER IS TOOOOO SLOW\n");
-            thread_cond_wait(&buffer_content_changed, &buffer_lock);
+        size_t needed=rx_resync && buf[i]==SLIP_END ? sizeof(slip_abort) : 1;
+        if(UART_RCV_BUFFER_SIZE-(end-start)<needed){
+            start=buffer_start;
+            dmb();
+        }
+        if(UART_RCV_BUFFER_SIZE-(end-start)<needed){
+            rx_overruns++;
+            rx_resync=true;
+            continue;
         }
 
-        size_t tmp_end=(buffer_end+buffer_write_offset)%UART_RCV_BUFFER_SIZE;
-        uart_receive_buffer[tmp_end]=buf[i];
-        if(++buffer_write_offset==OFFSET_BUFFER || buf[i]==0xC0){
-            buffer_write_offset=0;
-            buffer_end=end;
-            thread_cond_signal(&buffer_content_changed);
+        if(!rx_resync){
+            uart_receive_buffer[end++%UART_RCV_BUFFER_SIZE]=buf[i];
+        }else if(buf[i]==SLIP_END){
+            for(size_t j=0; j<sizeof(slip_abort); ++j)
+                uart_receive_buffer[end++%UART_RCV_BUFFER_SIZE]=slip_abort[j];
+            rx_resync=false;
+        }else{
+            rx_overruns++;
         }
     }
-    thread_mutex_unlock(&buffer_lock);
+
+    bool above=end-start>=UART_RCV_HIGH_WATER;
+    if(above && !rx_above_high_water)
+        rx_high_water_hits++;
+    rx_above_high_water=above;
+
+    if(end!=buffer_end){
+        // Publish the bytes before the index
+        dmb();
+        buffer_end=end;
+        thread_sem_post(&buffer_content_changed);
+    }
 }
 
 int serial_buffer_consumer(void* args);
 int serial_buffer_consumer(void* args){
     debug_printf("Started consumer thread!\n");
+    uint32_t reported_overruns=0;
+    uint32_t reported_high_water_hits=0;
     while(1){
-        thread_mutex_lock(&buffer_lock);
-        while(buffer_start==buffer_end){
-            thread_cond_wait(&buffer_content_changed, &buffer_lock);
+        thread_sem_wait(&buffer_content_changed);
+
+        uint32_t start=buffer_start;
+        uint32_t end=buffer_end;
+        dmb();
+        while(start!=end){
+            //Do processing, of everything published so far up to the end of the buffer
+            size_t offset=start%UART_RCV_BUFFER_SIZE;
+            size_t len=MIN(end-start, UART_RCV_BUFFER_SIZE-offset);
+            ERR_CHECK("Receive chunk", slip_raw_rcv(&slip_state, uart_receive_buffer+offset, len));
+            start+=len;
+            // The producer must not overwrite the bytes before we are done
+            dmb();
+            buffer_start=start;
+            end=buffer_end;
+            dmb();
         }
-        thread_mutex_unlock(&buffer_lock);
 
-        //Do processing
-        ERR_CHECK("Consume byte", slip_consume_byte(&slip_state, uart_receive_buffer[buffer_start]));
-
-        thread_mutex_lock(&buffer_lock);
-        size_t start=(buffer_start+1)%UART_RCV_BUFFER_SIZE;
-        buffer_start=start;
-        thread_cond_signal(&buffer_content_changed);
-        thread_mutex_unlock(&buffer_lock);
+        if(rx_overruns!=reported_overruns || rx_high_water_hits!=reported_high_water_hits){
+            reported_overruns=rx_overruns;
+            reported_high_water_hits=rx_high_water_hits;
+            struct serial_stats stats;
+            serial_get_stats(&stats);
+            debug_printf("UART receive ring: %"PRIu32" bytes dropped, %"PRIu32" times past high water, "
+                    "%"PRIu32" lost in the FIFO\n",
+                    reported_overruns, reported_high_water_hits, stats.rx_fifo_overruns);
+        }
     }
 
     return 0;
@@ -162,9 +206,7 @@ int main(int argc, char *argv[])
 
     buffer_start=0;
     buffer_end=0;
-    buffer_write_offset=0;
-    thread_cond_init(&buffer_content_changed);
-    thread_mutex_init(&buffer_lock);
+    thread_sem_init(&buffer_content_changed, 0);
 
     // Starting thread
     struct thread* consumer_thread=thread_create(serial_buffer_consumer, NULL);
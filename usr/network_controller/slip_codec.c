@@ -0,0 +1,160 @@
+#include <string.h>
+#include "slip_codec.h"
+
+#define MIN_SIZE(a, b) ((a)<(b) ? (a) : (b))
+
+// Second byte of the escape sequence of a byte, 0 if it goes out as is
+static const uint8_t slip_escape_table[256]={
+    [0x00]=SLIP_ESC_NUL,
+    [SLIP_END]=SLIP_ESC_END,
+    [SLIP_ESC]=SLIP_ESC_ESC,
+};
+
+size_t slip_encode(uint8_t* out, const uint8_t* in, size_t len){
+    uint8_t* out_start=out;
+    const uint8_t* end=in+len;
+
+    while(in<end){
+        const uint8_t* run=in;
+        while(run<end && !slip_escape_table[*run])
+            ++run;
+        memcpy(out, in, run-in);
+        out+=run-in;
+        in=run;
+
+        // Consecutive special bytes don't go through memcpy
+        while(in<end && slip_escape_table[*in]){
+            *out++=SLIP_ESC;
+            *out++=slip_escape_table[*in++];
+        }
+    }
+    return out-out_start;
+}
+
+void slip_decoder_init(struct slip_decoder* decoder, uint8_t* frame, size_t capacity,
+        slip_frame_received frame_handler, void* context){
+    decoder->buffer=frame;
+    decoder->buffer_capacity=capacity;
+    decoder->frame=frame;
+    decoder->capacity=capacity;
+    decoder->length=0;
+    decoder->is_escape=false;
+    decoder->discard=false;
+    decoder->frame_handler=frame_handler;
+    decoder->context=context;
+    decoder->header_length=0;
+    decoder->header_wanted=0;
+    decoder->header_handler=NULL;
+    decoder->drop_handler=NULL;
+    decoder->frames=0;
+    decoder->dropped=0;
+}
+
+void slip_decoder_set_header_handler(struct slip_decoder* decoder, size_t header_length,
+        slip_header_received header_handler, slip_frame_received drop_handler){
+    decoder->header_length=header_length;
+    decoder->header_wanted=decoder->length<header_length ? header_length : 0;
+    decoder->header_handler=header_handler;
+    decoder->drop_handler=drop_handler;
+}
+
+void slip_decoder_redirect(struct slip_decoder* decoder, uint8_t* frame, size_t capacity){
+    decoder->frame=frame;
+    decoder->capacity=capacity;
+    decoder->length=0;
+}
+
+// The frame just reached header_wanted bytes
+static
+void slip_decoder_header(struct slip_decoder* decoder){
+    size_t more=decoder->header_handler(decoder->buffer, decoder->length, decoder->context);
+    decoder->header_wanted=more && decoder->frame==decoder->buffer ? decoder->length+more : 0;
+}
+
+static
+void slip_decoder_append(struct slip_decoder* decoder, const uint8_t* buf, size_t len){
+    while(len && !decoder->discard){
+        size_t chunk=len;
+        if(decoder->header_wanted)
+            chunk=MIN_SIZE(chunk, decoder->header_wanted-decoder->length);
+        if(decoder->capacity-decoder->length<chunk){
+            decoder->discard=true;
+            return;
+        }
+        memcpy(decoder->frame+decoder->length, buf, chunk);
+        decoder->length+=chunk;
+        buf+=chunk;
+        len-=chunk;
+        if(decoder->length==decoder->header_wanted)
+            slip_decoder_header(decoder);
+    }
+}
+
+// Unescaped byte of an escape sequence, 0 for invalid ones besides ESC_NUL
+static const uint8_t slip_unescape_table[256]={
+    [SLIP_ESC_END]=SLIP_END,
+    [SLIP_ESC_ESC]=SLIP_ESC,
+};
+
+static
+void slip_decoder_unescape(struct slip_decoder* decoder, uint8_t escaped){
+    uint8_t byte=slip_unescape_table[escaped];
+    if(!byte && escaped!=SLIP_ESC_NUL)
+        decoder->discard=true;
+    if(decoder->discard)
+        return;
+    if(decoder->length==decoder->capacity){
+        decoder->discard=true;
+        return;
+    }
+    decoder->frame[decoder->length++]=byte;
+    if(decoder->length==decoder->header_wanted)
+        slip_decoder_header(decoder);
+}
+
+static
+void slip_decoder_finish(struct slip_decoder* decoder){
+    bool redirected=decoder->frame!=decoder->buffer;
+    if(decoder->discard){
+        decoder->dropped++;
+        if(redirected)
+            decoder->drop_handler(decoder->frame, decoder->length, decoder->context);
+    }else if(decoder->length || redirected){
+        decoder->frames++;
+        decoder->frame_handler(decoder->frame, decoder->length, decoder->context);
+    }
+    decoder->frame=decoder->buffer;
+    decoder->capacity=decoder->buffer_capacity;
+    decoder->length=0;
+    decoder->header_wanted=decoder->header_length;
+    decoder->discard=false;
+}
+
+void slip_decode(struct slip_decoder* decoder, const uint8_t* in, size_t len){
+    const uint8_t* end=in+len;
+
+    // An ESC may have ended the last chunk
+    if(in<end && decoder->is_escape){
+        slip_decoder_unescape(decoder, *in++);
+        decoder->is_escape=false;
+    }
+
+    while(in<end){
+        const uint8_t* run=in;
+        while(run<end && *run!=SLIP_END && *run!=SLIP_ESC)
+            ++run;
+        if(run>in)
+            slip_decoder_append(decoder, in, run-in);
+        in=run;
+        if(in==end)
+            break;
+
+        if(*in++==SLIP_END){
+            slip_decoder_finish(decoder);
+        }else if(in<end){
+            slip_decoder_unescape(decoder, *in++);
+        }else{
+            decoder->is_escape=true;
+        }
+    }
+}
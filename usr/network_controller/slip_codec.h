@@ -0,0 +1,91 @@
+#ifndef _SLIP_CODEC_
+#define _SLIP_CODEC_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Block-oriented SLIP codec (RFC 1055, with NUL escaped as well). It works
+ * on whole buffers: runs of bytes that need no escaping are copied at once.
+ * It depends on nothing but libc, so that tools/slipbench can measure it
+ * on the host.
+ */
+
+//SLIP specific defines
+#define SLIP_END        0xC0
+#define SLIP_ESC        0xDB
+#define SLIP_ESC_END    0xDC
+#define SLIP_ESC_ESC    0xDD
+#define SLIP_ESC_NUL    0xDE
+
+// Worst case size of $len encoded bytes: all of them escaped
+#define SLIP_ENCODED_MAX_SIZE(len) (2*(len))
+
+/**
+ * \brief Escapes $len bytes of $in into $out
+ *
+ * \param out Must hold SLIP_ENCODED_MAX_SIZE(len) bytes
+ *
+ * \return number of bytes written to $out. No END is appended.
+ */
+size_t slip_encode(uint8_t* out, const uint8_t* in, size_t len);
+
+typedef void (*slip_frame_received)(uint8_t* frame, size_t len, void* context);
+
+/*
+ * Called once a frame holds $len bytes. Returns how many more bytes it
+ * needs to see before deciding, or 0. It may call slip_decoder_redirect to
+ * have the rest of the frame unescaped into another buffer.
+ */
+typedef size_t (*slip_header_received)(uint8_t* header, size_t len, void* context);
+
+struct slip_decoder{
+    uint8_t* buffer;        // Frames start here
+    size_t buffer_capacity;
+    uint8_t* frame;         // Where bytes go now: $buffer, or a redirect target
+    size_t capacity;
+    size_t length;
+    bool is_escape;
+    bool discard;           // Frame too large or badly escaped, dropped at the next END
+    slip_frame_received frame_handler;
+    void* context;
+
+    size_t header_length;   // First header_handler call, 0 for none
+    size_t header_wanted;   // Next call, 0 once the frame's fate is decided
+    slip_header_received header_handler;
+    slip_frame_received drop_handler;  // Gets back redirected frames that are dropped
+
+    uint32_t frames;
+    uint32_t dropped;
+};
+
+void slip_decoder_init(struct slip_decoder* decoder, uint8_t* frame, size_t capacity,
+        slip_frame_received frame_handler, void* context);
+
+/**
+ * \brief Has $header_handler look at the first $header_length bytes of
+ * every frame, so that the frame can be redirected before the rest of it
+ * arrives.
+ */
+void slip_decoder_set_header_handler(struct slip_decoder* decoder, size_t header_length,
+        slip_header_received header_handler, slip_frame_received drop_handler);
+
+/**
+ * \brief Unescapes the rest of the current frame into $frame
+ *
+ * Only valid from the header handler. The header stays in the decoder's
+ * buffer. The frame handler then gets $frame and the bytes written to it,
+ * or, if the frame is dropped, the drop handler does.
+ */
+void slip_decoder_redirect(struct slip_decoder* decoder, uint8_t* frame, size_t capacity);
+
+/**
+ * \brief Unescapes a chunk of received bytes in one pass
+ *
+ * Frames may span chunks. Every complete, non-empty frame is handed to the
+ * frame handler, which may only use the frame until it returns.
+ */
+void slip_decode(struct slip_decoder* decoder, const uint8_t* in, size_t len);
+
+#endif //_SLIP_CODEC_
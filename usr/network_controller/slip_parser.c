@@ -1,60 +1,37 @@
 #include <slip_parser.h>
 
+#define SLIP_DEBUG(...) //debug_printf(__VA_ARGS__);
+
+static void slip_datagram_received(uint8_t* frame, size_t len, void* context);
+static size_t slip_ip_header_received(uint8_t* header, size_t len, void* context);
+static void slip_datagram_dropped(uint8_t* frame, size_t len, void* context);
+
 errval_t slip_init(struct slip_state* slip_state, system_raw_write write_handler){
     slip_state->my_ip_address=htonl(MY_IP_ADDRESS);
-    slip_state->current_position=0;
     slip_state->struct_initialized=SLIP_STATE_MAGIC_NUMBER;
-    slip_state->current_state=SLIP_PARSE_STATE_READY;
-    slip_state->is_escape=false;
-    slip_state->active_handler=NULL;
     slip_state->write_handler=write_handler;
+    slip_state->tx_length=0;
     thread_mutex_init(&slip_state->serial_lock);
     memset(slip_state->available_protocol_handlers, 0, sizeof(slip_state->available_protocol_handlers));
+    slip_decoder_init(&slip_state->decoder, slip_state->rcv_buffer, sizeof(slip_state->rcv_buffer),
+            slip_datagram_received, slip_state);
+    slip_decoder_set_header_handler(&slip_state->decoder, IP_MIN_IHL*IP_WORD_SIZE,
+            slip_ip_header_received, slip_datagram_dropped);
+    slip_state->redirected=NULL;
+    slip_state->redirect_buffer=NULL;
 
     return SLIP_ERR_OK;
 }
 
-static
-uint8_t slip_unescape(uint8_t escaped){
-    switch(escaped){
-        case SLIP_ESC_END:
-            return SLIP_END;
-        case SLIP_ESC_ESC:
-            return SLIP_ESC;
-        case SLIP_ESC_NUL:
-        default:
-            return 0x00;
-    }
-}
-
-static
-uint16_t calculate_checksum(uint16_t* header_buffer, size_t length){
-    uint32_t sum=0x0;
-    for(size_t i=0; i<length; ++i){
-        sum+=header_buffer[i];
-    }
-
-    while (sum>>16)
-        sum = (sum & 0xFFFF)+(sum >> 16);
-
-    uint16_t calculated_checksum=~sum;
-
-    return calculated_checksum;
-}
-
 static
 bool slip_correct_ip_header_checksum(struct ip_header* header){
     uint32_t ihl= GET_IHL(header->version);
     if(ihl>IP_MAX_IHL)
         return false;   //If IHL is larger then maximum value, something is wrong
 
-    uint16_t header_checksum=header->header_checksum;
-    header->header_checksum=0x0;
-    size_t half_word_count=ihl*2;
-    uint16_t* header_buffer=(uint16_t*)header;
-    uint16_t calculated_checksum=calculate_checksum(header_buffer, half_word_count);
-
-    return (calculated_checksum==header_checksum);
+    // Summed up with its checksum, a correct header adds up to 0xFFFF. The
+    // header is checked before the datagram is complete, so leave it as is.
+    return inet_checksum(header, ihl*IP_WORD_SIZE)==0;
 }
 
 void slip_dump_ip_header(struct ip_header* ip_header){
@@ -74,150 +51,149 @@ void slip_dump_ip_header(struct ip_header* ip_header){
     printf("\n\n\n");
 }
 
+/*
+ * Checks the IP header of a datagram of which $len bytes are in, and
+ * returns its protocol handler, or NULL if it is to be dropped.
+ */
 static
-errval_t slip_parse_ip_data(struct slip_state* slip_state, uint8_t byte){
-    assert(slip_state->active_handler->data_handler!=NULL);
-    assert(slip_state->active_handler->buffer_capacity>slip_state->active_handler->data_length);
-
-    if(!slip_state->remaining_data_bytes){
-        debug_printf("Invalid state! Too much bytes for processing\n");
-        slip_state->current_state=SLIP_PARSE_STATE_INVALID;
-        return SLIP_ERR_OK;
+struct slip_protocol_handler* slip_check_ip_header(struct slip_state* slip_state, struct ip_header* ip_header,
+        size_t len, size_t* header_size, size_t* data_length){
+    uint8_t ihl=GET_IHL(ip_header->version);
+    if(len<IP_MIN_IHL*IP_WORD_SIZE || GET_IP_VERSION(ip_header->version)!=IP_VERSION_V4 || ihl<IP_MIN_IHL){
+        SLIP_DEBUG("Unsupported IP version!\n");
+        return NULL;
+    }
+    *header_size=ihl*IP_WORD_SIZE;
+    size_t total_datagram_size=lwip_ntohs(ip_header->total_length);
+    if(total_datagram_size<*header_size || total_datagram_size>SLIP_MTU){
+        SLIP_DEBUG("Datagram claims %zu bytes, dropping it\n", total_datagram_size);
+        return NULL;
     }
+    *data_length=total_datagram_size-*header_size;
+    SLIP_DEBUG("Received datagram of type: [0x%02x]\n", (int)ip_header->protocol);
 
-    slip_state->active_handler->buffer[slip_state->active_handler->data_length++]=byte;
-    if (--slip_state->remaining_data_bytes==0){
-        debug_printf("Finished parsing ip data\n");
-        slip_state->active_handler->data_handler(slip_state->current_ip_header->source_ip,
-                slip_state->current_ip_header->destination_ip,
-                slip_state->active_handler->buffer,
-                slip_state->active_handler->data_length,
-                slip_state->active_handler->context);
+    if(ip_header->protocol>=ARRAY_LENGTH(slip_state->available_protocol_handlers) ||
+            slip_state->available_protocol_handlers[ip_header->protocol].data_handler==NULL){
+        SLIP_DEBUG("Unsupported protocol!\n");
+        return NULL;
     }
 
-    return SLIP_ERR_OK;
+    if(!slip_correct_ip_header_checksum(ip_header)){
+        SLIP_DEBUG("Received IP packet doesn't have correct checksum, dropping it\n");
+        return NULL;
+    }
+    if(ip_header->destination_ip!=slip_state->my_ip_address){
+        SLIP_DEBUG("Destination IP address is not valid, dropping packet!\n");
+        return NULL;
+    }
+    return &slip_state->available_protocol_handlers[ip_header->protocol];
 }
 
+// Decides where the rest of a datagram goes, once its headers are in
 static
-errval_t slip_parse_ip_header(struct slip_state* slip_state, uint8_t byte){
-    assert(slip_state->current_state==SLIP_PARSE_STATE_IPV4_HEADER);
-    assert(slip_state->current_position<slip_state->ip_header_size);
-
-    slip_state->rcv_buffer[slip_state->current_position++]=byte;
-
-    if(slip_state->current_position>=slip_state->ip_header_size){
-        debug_printf("Received datagram of type: [0x%02x]\n", (int)slip_state->current_ip_header->protocol);
-
-        uint16_t total_datagram_size=lwip_ntohs(slip_state->current_ip_header->total_length);
-        slip_state->remaining_data_bytes=total_datagram_size-slip_state->ip_header_size;
-        if(slip_state->available_protocol_handlers[slip_state->current_ip_header->protocol].data_handler!=NULL){
-            struct slip_protocol_handler* protocol_handler=&slip_state->available_protocol_handlers[slip_state->current_ip_header->protocol];
-
-            if(slip_correct_ip_header_checksum(slip_state->current_ip_header)){
-                if(protocol_handler->buffer_capacity<slip_state->remaining_data_bytes){
-                    debug_printf("Data to be received is larger then provided buffer! Dropping packet\n");
-                    slip_state->current_state=SLIP_PARSE_STATE_INVALID;
-                    return SLIP_ERR_OK;
-                }
-                if(slip_state->current_ip_header->destination_ip!=slip_state->my_ip_address){
-                    debug_printf("Destination IP address is not valid, dropping packet!\n");
-                    slip_state->current_state=SLIP_PARSE_STATE_INVALID;
-                    return SLIP_ERR_OK;
-                }
-                debug_printf("IP headers seems to be OK, proceeding to user data parsing of length: %lu\n", slip_state->remaining_data_bytes);
-                slip_state->active_handler=protocol_handler;
-                protocol_handler->data_length=0;
-                slip_state->current_state=SLIP_PARSE_STATE_IP_USER_DATA;
-                return SLIP_ERR_OK;
-            }else{
-                debug_printf("Received IP packet doesn't have correct checksum, dropping it\n");
-                slip_state->current_state=SLIP_PARSE_STATE_INVALID;
-                return SLIP_ERR_OK;
-            }
-        }else{
-            debug_printf("Unsupported protocol!\n");
-            slip_state->current_state=SLIP_PARSE_STATE_INVALID;
-        }
-    }
-
-    return SLIP_ERR_OK;
+size_t slip_ip_header_received(uint8_t* header, size_t len, void* context){
+    struct slip_state* slip_state=context;
+    struct ip_header* ip_header=(struct ip_header*)header;
+
+    uint8_t ihl=GET_IHL(ip_header->version);
+    if(GET_IP_VERSION(ip_header->version)==IP_VERSION_V4 && ihl*IP_WORD_SIZE>len)
+        return ihl*IP_WORD_SIZE-len;    // Options first
+
+    size_t header_size, data_length;
+    struct slip_protocol_handler* protocol_handler=slip_check_ip_header(slip_state, ip_header, len,
+            &header_size, &data_length);
+    if(protocol_handler==NULL || protocol_handler->redirect_handler==NULL ||
+            data_length<protocol_handler->header_length)
+        return 0;
+    if(len<header_size+protocol_handler->header_length)
+        return header_size+protocol_handler->header_length-len;
+
+    size_t capacity=0;
+    uint8_t* buffer=protocol_handler->redirect_handler(ip_header->source_ip, ip_header->destination_ip,
+            header+header_size, data_length, &capacity, protocol_handler->context);
+    if(buffer==NULL)
+        return 0;
+    assert(capacity>=protocol_handler->header_length);
+
+    memcpy(buffer, header+header_size, protocol_handler->header_length);
+    slip_decoder_redirect(&slip_state->decoder, buffer+protocol_handler->header_length,
+            capacity-protocol_handler->header_length);
+    slip_state->redirected=protocol_handler;
+    slip_state->redirect_buffer=buffer;
+    return 0;
 }
 
 static
-errval_t slip_verify_datagram_ip_version(struct slip_state* slip_state, uint8_t byte){
-    uint8_t ihl=GET_IHL(byte);
-    if(GET_IP_VERSION(byte)==IP_VERSION_V4 && (ihl<=IP_MAX_IHL) && (ihl>=IP_MIN_IHL)){
-        debug_printf("Recognized IPV4 version!\n");
-        slip_state->rcv_buffer[0]=byte;
-        slip_state->current_position=1;
-        slip_state->ip_header_size=ihl*IP_WORD_SIZE;
-        slip_state->current_state=SLIP_PARSE_STATE_IPV4_HEADER;
-    }else{
-        debug_printf("Unsupported IP version!\n");
-        slip_state->current_state=SLIP_PARSE_STATE_INVALID;
+void slip_redirected_datagram_received(struct slip_state* slip_state, size_t len){
+    struct slip_protocol_handler* protocol_handler=slip_state->redirected;
+    uint8_t* buffer=slip_state->redirect_buffer;
+    slip_state->redirected=NULL;
+    slip_state->redirect_buffer=NULL;
+
+    // The headers were checked before the redirect
+    struct ip_header* ip_header=(struct ip_header*)slip_state->rcv_buffer;
+    size_t header_size=GET_IHL(ip_header->version)*IP_WORD_SIZE;
+    size_t data_length=lwip_ntohs(ip_header->total_length)-header_size;
+    if(protocol_handler->header_length+len<data_length){
+        SLIP_DEBUG("Datagram shorter than its header claims, dropping it\n");
+        protocol_handler->drop_handler(buffer, protocol_handler->context);
+        return;
     }
-
-    return SLIP_ERR_OK;
+    protocol_handler->data_handler(ip_header->source_ip,
+            ip_header->destination_ip,
+            buffer,
+            data_length,
+            protocol_handler->context);
 }
 
 static
-errval_t slip_datagram_process_byte(struct slip_state* slip_state, uint8_t byte){
-    //TODO: Check if we are in header or user data process data
-    switch(slip_state->current_state){
-    case SLIP_PARSE_STATE_READY:
-        return slip_verify_datagram_ip_version(slip_state, byte);
-    case SLIP_PARSE_STATE_IPV4_HEADER:
-        if(slip_state->current_position==MAX_IP_BUFF_SIZE){
-            debug_printf("IP header size exceeded, returning\n");
-            return SLIP_ERR_OK;
-        }
-        return slip_parse_ip_header(slip_state, byte);
-    case SLIP_PARSE_STATE_IP_USER_DATA:
-        return slip_parse_ip_data(slip_state, byte);
-    case SLIP_PARSE_STATE_INVALID:
-        return SLIP_ERR_OK;
-    }
-
-    return SLIP_ERR_OK;
+void slip_datagram_dropped(uint8_t* frame, size_t len, void* context){
+    struct slip_state* slip_state=context;
+    struct slip_protocol_handler* protocol_handler=slip_state->redirected;
+    uint8_t* buffer=slip_state->redirect_buffer;
+    slip_state->redirected=NULL;
+    slip_state->redirect_buffer=NULL;
+
+    SLIP_DEBUG("Redirected datagram dropped\n");
+    protocol_handler->drop_handler(buffer, protocol_handler->context);
 }
 
 static
-errval_t slip_datagram_finished(struct slip_state* slip_state){
-    if(slip_state->current_state==SLIP_PARSE_STATE_IP_USER_DATA){
-        if(slip_state->remaining_data_bytes){
-            debug_printf("Received end of frame, but there was still %lu bytes to be received\n", slip_state->remaining_data_bytes);
-        }
+void slip_datagram_received(uint8_t* frame, size_t len, void* context){
+    struct slip_state* slip_state=context;
+    if(slip_state->redirected){
+        slip_redirected_datagram_received(slip_state, len);
+        return;
     }
 
-    slip_state->current_position=0;
-    slip_state->is_escape=false;
-    slip_state->current_state=SLIP_PARSE_STATE_READY;
-    return SLIP_ERR_OK;
-}
-
-errval_t slip_consume_byte(struct slip_state* slip_state, uint8_t byte){
-    SLIP_STATE_INITIALIZED(slip_state);
-
-    if(!slip_state->is_escape && byte==SLIP_ESC){
-        slip_state->is_escape=true;
-        return SLIP_ERR_OK;
-    }else if(slip_state->is_escape){
-        byte=slip_unescape(byte);
-        slip_state->is_escape=false;
-    }else if(!slip_state->is_escape && byte==SLIP_END){
-
-        return slip_datagram_finished(slip_state);
+    struct ip_header* ip_header=(struct ip_header*)frame;
+    size_t header_size, data_length;
+    struct slip_protocol_handler* protocol_handler=slip_check_ip_header(slip_state, ip_header, len,
+            &header_size, &data_length);
+    if(protocol_handler==NULL)
+        return;
+    if(header_size+data_length>len){
+        SLIP_DEBUG("Datagram of %zu bytes claims %zu bytes, dropping it\n", len, header_size+data_length);
+        return;
+    }
+    if(protocol_handler->buffer_capacity<data_length){
+        SLIP_DEBUG("Data to be received is larger then provided buffer! Dropping packet\n");
+        return;
     }
-    return slip_datagram_process_byte(slip_state, byte);
+
+    memcpy(protocol_handler->buffer, frame+header_size, data_length);
+    protocol_handler->data_length=data_length;
+    protocol_handler->data_handler(ip_header->source_ip,
+            ip_header->destination_ip,
+            protocol_handler->buffer,
+            protocol_handler->data_length,
+            protocol_handler->context);
 }
 
 errval_t slip_raw_rcv(struct slip_state* slip_state, uint8_t *buf, size_t len){
     SLIP_STATE_INITIALIZED(slip_state);
 
-    for(size_t i=0;i<len;++i){
-        ERROR_RET1(slip_consume_byte(slip_state, buf[i]));
-    }
-
+    slip_decode(&slip_state->decoder, buf, len);
     return SLIP_ERR_OK;
 }
 
@@ -234,31 +210,45 @@ errval_t slip_register_protocol_handler(struct slip_state* slip_state, uint8_t p
     return SLIP_ERR_OK;
 }
 
+errval_t slip_register_redirect_handler(struct slip_state* slip_state, uint8_t protocol_id,
+        size_t header_length, slip_data_redirect redirect_handler, slip_data_dropped drop_handler){
+    SLIP_STATE_INITIALIZED(slip_state);
+    assert(IP_MAX_IHL*IP_WORD_SIZE+header_length<=SLIP_MTU);
+
+    slip_state->available_protocol_handlers[protocol_id].header_length=header_length;
+    slip_state->available_protocol_handlers[protocol_id].redirect_handler=redirect_handler;
+    slip_state->available_protocol_handlers[protocol_id].drop_handler=drop_handler;
+
+    return SLIP_ERR_OK;
+}
+
+static
+void slip_flush(struct slip_state* slip_state){
+    if(slip_state->tx_length){
+        slip_state->write_handler(slip_state->tx_buffer, slip_state->tx_length);
+        slip_state->tx_length=0;
+    }
+}
+
+// Escapes $buf into the TX buffer, only writing out when it is full
 static
 errval_t slip_write_raw_data(struct slip_state* slip_state, uint8_t *buf, size_t len, bool finished_datagram){
-    static uint8_t ESCAPED_ESC_SEQ[2]={SLIP_ESC, SLIP_ESC_ESC};
-    static uint8_t ESCAPED_END_SEQ[2]={SLIP_ESC, SLIP_ESC_END};
-    static uint8_t ESCAPED_NUL_SEQ[2]={SLIP_ESC, SLIP_ESC_NUL};
-    static uint8_t END_SEQ[1]={SLIP_END};
-
-    for(size_t i=0;i<len;++i){
-        switch(buf[i]){
-        case SLIP_END:
-            slip_state->write_handler(ESCAPED_END_SEQ, 2);
-            break;
-        case SLIP_ESC:
-            slip_state->write_handler(ESCAPED_ESC_SEQ, 2);
-            break;
-        case 0x0:
-            slip_state->write_handler(ESCAPED_NUL_SEQ, 2);
-            break;
-        default:
-            slip_state->write_handler(buf+i, 1);
+    while(len){
+        size_t chunk=MIN(len, (SLIP_TX_BUFFER_SIZE-slip_state->tx_length)/2);
+        if(!chunk){
+            slip_flush(slip_state);
+            continue;
         }
+        slip_state->tx_length+=slip_encode(slip_state->tx_buffer+slip_state->tx_length, buf, chunk);
+        buf+=chunk;
+        len-=chunk;
     }
 
     if(finished_datagram){
-        slip_state->write_handler(END_SEQ, 1);
+        if(slip_state->tx_length==SLIP_TX_BUFFER_SIZE)
+            slip_flush(slip_state);
+        slip_state->tx_buffer[slip_state->tx_length++]=SLIP_END;
+        slip_flush(slip_state);
     }
     return SLIP_ERR_OK;
 }
@@ -4,18 +4,16 @@
 #include <aos/aos.h>
 #include <netutil/checksum.h>
 #include <netutil/htons.h>
+#include "slip_codec.h"
 
 #define MY_IP_ADDRESS   0x0a000201
 
-//SLIP specific defines
-#define SLIP_END        0xC0
-#define SLIP_ESC        0xDB
-#define SLIP_ESC_END    0xDC
-#define SLIP_ESC_ESC    0xDD
-#define SLIP_ESC_NUL    0xDE
-
 #define IP_WORD_SIZE            4
-#define MAX_IP_BUFF_SIZE        60
+
+// Largest datagram we receive or send
+#define SLIP_MTU                1500
+// A whole datagram fits, so that it goes out in a single write
+#define SLIP_TX_BUFFER_SIZE     (SLIP_ENCODED_MAX_SIZE(SLIP_MTU)+1)
 
 #define SLIP_STATE_MAGIC_NUMBER    607495481
 #define SLIP_STATE_INITIALIZED(slp) assert(slp->struct_initialized==SLIP_STATE_MAGIC_NUMBER && "Slip state not initialized, or corrupted")
@@ -29,19 +27,28 @@
 typedef void (*system_raw_write)(uint8_t *buf, size_t len);
 typedef void (*slip_data_received)(uint32_t from, uint32_t to, uint8_t *buf, size_t len, void* context);
 
+/*
+ * Zero-copy receive: called once the first header_length bytes of the
+ * datagram's data are decoded, and $data_length is what the IP header
+ * announces. Returns the buffer the whole data is to be unescaped into
+ * (header included) and its capacity, or NULL to receive it as usual.
+ * The buffer comes back through the data handler, or the drop handler if
+ * the datagram turns out to be bad.
+ */
+typedef uint8_t* (*slip_data_redirect)(uint32_t from, uint32_t to, uint8_t *header, size_t data_length,
+        size_t* capacity, void* context);
+typedef void (*slip_data_dropped)(uint8_t *buf, void* context);
+
 struct slip_protocol_handler{
     slip_data_received data_handler;
     size_t buffer_capacity;
     void* context;
     size_t data_length;
     uint8_t* buffer;
-};
 
-enum slip_parsing_state{
-    SLIP_PARSE_STATE_INVALID,
-    SLIP_PARSE_STATE_READY,
-    SLIP_PARSE_STATE_IPV4_HEADER,
-    SLIP_PARSE_STATE_IP_USER_DATA
+    size_t header_length;
+    slip_data_redirect redirect_handler;
+    slip_data_dropped drop_handler;
 };
 
 struct __attribute__((packed)) ip_header{
@@ -58,22 +65,30 @@ struct __attribute__((packed)) ip_header{
     uint32_t options[4];
 };
 
+/*
+ * Received bytes are unescaped into rcv_buffer, chunk by chunk, and every
+ * complete datagram is checked and handed to its protocol handler. If the
+ * protocol redirects it, only the headers land in rcv_buffer and the rest
+ * goes straight to the protocol's buffer. Sent datagrams are escaped into
+ * tx_buffer, and written out at once.
+ */
 struct slip_state{
     uint32_t my_ip_address;
     struct thread_mutex serial_lock;
     uint32_t struct_initialized;
-    enum slip_parsing_state current_state;
-    uint32_t current_position;
-    bool is_escape;
     system_raw_write write_handler;
-    uint8_t ip_header_size;
 
     struct slip_protocol_handler available_protocol_handlers[20]; //TODO: Dynamically sized?
-    struct slip_protocol_handler* active_handler;
-    uint16_t remaining_data_bytes;
 
-    struct ip_header current_ip_header[0];
-    uint8_t rcv_buffer[MAX_IP_BUFF_SIZE];
+    struct slip_decoder decoder;
+    uint8_t rcv_buffer[SLIP_MTU] __attribute__((aligned(4)));
+    // Protocol the current datagram is redirected to, and where its data starts
+    struct slip_protocol_handler* redirected;
+    uint8_t* redirect_buffer;
+
+    // Guarded by serial_lock
+    size_t tx_length;
+    uint8_t tx_buffer[SLIP_TX_BUFFER_SIZE];
 };
 
 /**
@@ -87,13 +102,23 @@ struct slip_state{
  */
 errval_t slip_init(struct slip_state* slip_state, system_raw_write write_handler);
 
+/**
+ * \brief Processes a chunk of bytes received from the serial line
+ *
+ * Datagrams may span chunks, a chunk may hold many of them.
+ */
 errval_t slip_raw_rcv(struct slip_state* slip_state, uint8_t *buf, size_t len);
 
-errval_t slip_consume_byte(struct slip_state* slip_state, uint8_t byte);
-
 errval_t slip_register_protocol_handler(struct slip_state* slip_state, uint8_t protocol_id,
         uint8_t* buffer, size_t buff_size, slip_data_received data_handler, void* context);
 
+/**
+ * \brief Lets a protocol pick the buffer of each datagram from its first
+ * $header_length data bytes (see slip_data_redirect)
+ */
+errval_t slip_register_redirect_handler(struct slip_state* slip_state, uint8_t protocol_id,
+        size_t header_length, slip_data_redirect redirect_handler, slip_data_dropped drop_handler);
+
 errval_t slip_send_datagram(struct slip_state* slip_state, uint32_t to, uint32_t from,
         uint8_t protocol, uint8_t *buf, size_t len);
 
@@ -1,36 +1,63 @@
 #include "udp_parser.h"
 
+#define UDP_DEBUG(...) //debug_printf(__VA_ARGS__);
+
+#define UDP_TABLE_INITIAL_CAPACITY 64
+
+// Call with table_lock held
 static
-struct udp_remote_connection* find_remote_connection(struct udp_local_connection* local_connection, uint32_t remote_address, uint16_t remote_port){
-    struct udp_remote_connection* rc;
-    for(rc=local_connection->remote_connection_head;rc!=NULL;rc=rc->next){
-        if(rc->remote_port==remote_port && rc->remote_address==remote_address){
-            return rc;
-        }
+struct udp_local_connection* find_local_connection_by_port(struct udp_parser_state* state, uint16_t local_port){
+    return udp_table_find(&state->local_connections, UDP_TABLE_PORT_KEY(local_port));
+}
+
+// Call with table_lock held
+static
+errval_t add_socket(struct udp_parser_state* state, struct udp_remote_connection* remote_connection){
+    struct udp_local_connection* local_connection=remote_connection->local_connection;
+    uint64_t peer_key=UDP_TABLE_PEER_KEY(local_connection->local_port, remote_connection->remote_address,
+            remote_connection->remote_port);
+    uint64_t socket_key=UDP_TABLE_SOCKET_KEY(local_connection->local_port, remote_connection->socket.socket_id);
+    if(!udp_table_insert(&state->peers, peer_key, remote_connection)){
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    if(!udp_table_insert(&state->sockets, socket_key, remote_connection)){
+        udp_table_remove(&state->peers, peer_key);
+        return LIB_ERR_MALLOC_FAIL;
     }
-    return NULL;
+    return SYS_ERR_OK;
 }
 
 static
-struct udp_local_connection* find_local_connection_by_port(struct udp_parser_state* state, uint32_t local_port){
-    struct udp_local_connection* rc;
-    for(rc=state->local_connectoin_head;rc!=NULL;rc=rc->next){
-        if(rc->local_port==local_port){
-            return rc;
-        }
+bool peer_expired(void* value, void* context){
+    struct udp_remote_connection* remote_connection=value;
+    struct udp_parser_state* state=context;
+    struct udp_local_connection* local_connection=remote_connection->local_connection;
+    systime_t now=state->last_expiry;
+    if(local_connection->connection_type!=UDP_PARSER_CONNECTION_SERVER ||
+            now-remote_connection->last_active<UDP_PEER_IDLE_TIMEOUT){
+        return false;
     }
-    return NULL;
+
+    debug_printf("Closing socket %lu of port %d, idle for %llu ms\n", remote_connection->socket.socket_id,
+            lwip_ntohs(local_connection->local_port), (now-remote_connection->last_active)/1000);
+    udp_table_remove(&state->sockets, UDP_TABLE_SOCKET_KEY(local_connection->local_port, remote_connection->socket.socket_id));
+    free(remote_connection);
+    return true;
 }
 
+/*
+ * Closes server sockets of idle peers, every UDP_PEER_EXPIRY_PERIOD. Only
+ * the receive thread frees peers, so it may keep using the one it found.
+ */
 static
-struct udp_remote_connection* find_socket_by_id(struct udp_local_connection* local_connection, uint32_t socket_id){
-    struct udp_remote_connection* rc;
-    for(rc=local_connection->remote_connection_head;rc!=NULL;rc=rc->next){
-        if(rc->socket.socket_id==socket_id){
-            return rc;
-        }
+void expire_idle_peers(struct udp_parser_state* state, systime_t now){
+    if(now-state->last_expiry<UDP_PEER_EXPIRY_PERIOD){
+        return;
     }
-    return NULL;
+    thread_mutex_lock(&state->table_lock);
+    state->last_expiry=now;
+    udp_table_remove_if(&state->peers, peer_expired, state);
+    thread_mutex_unlock(&state->table_lock);
 }
 
 static
@@ -38,8 +65,8 @@ errval_t get_udp_socket_id(struct urpc_buffer* urpc, struct urpc_message* msg, v
     struct udp_local_connection* local_connection=(struct udp_local_connection*)context;
     assert(local_connection);
     uint32_t* socket_id= msg->data;
-    assert(local_connection->remote_connection_head);
-    *socket_id=local_connection->remote_connection_head->socket.socket_id;
+    assert(local_connection->server);
+    *socket_id=local_connection->server->socket.socket_id;
     urpc_server_answer(urpc, socket_id, sizeof(uint32_t));
 
     return SYS_ERR_OK;
@@ -50,22 +77,37 @@ errval_t send_udp_datagram(struct urpc_buffer* urpc, struct urpc_message* msg, v
     struct udp_local_connection* local_connection=(struct udp_local_connection*)context;
     debug_printf("##### Sending UDP datagram, packet size: %lu\n", msg->length);
 
+    struct udp_parser_state* udp_state=local_connection->udp_parser_state;
     struct udp_command_payload* cmd=(struct udp_command_payload*)msg->data;
     uint32_t socket_id=cmd->header.socket_id;
-    struct udp_remote_connection* remote_connection=find_socket_by_id(local_connection, socket_id);
-    assert(remote_connection && "Unknown socket id");
+
+    // The peer may expire as soon as the lock is dropped, keep its address
+    thread_mutex_lock(&udp_state->table_lock);
+    struct udp_remote_connection* remote_connection=udp_table_find(&udp_state->sockets,
+            UDP_TABLE_SOCKET_KEY(local_connection->local_port, socket_id));
+    if(remote_connection==NULL){
+        thread_mutex_unlock(&udp_state->table_lock);
+        return NETWORKING_ERR_UNKNOWN_SOCKET;
+    }
+    remote_connection->last_active=get_system_time();
+    uint32_t remote_address=remote_connection->remote_address;
+    uint16_t remote_port=remote_connection->remote_port;
+    thread_mutex_unlock(&udp_state->table_lock);
 
     size_t payload_size=msg->length-sizeof(struct udp_command_payload_header);
     struct udp_packet* send_packet=(struct udp_packet*)malloc(payload_size+sizeof(struct udp_packet));
+    if(send_packet==NULL){
+        return LIB_ERR_MALLOC_FAIL;
+    }
     send_packet->checksum=0;
     send_packet->length=lwip_htons(payload_size+sizeof(struct udp_packet));
     send_packet->source_port=local_connection->local_port;
-    send_packet->dest_port=remote_connection->remote_port;
-    assert(remote_connection->remote_address);
+    send_packet->dest_port=remote_port;
+    assert(remote_address);
     memcpy(send_packet->data, cmd->data, payload_size);
 
-    slip_send_datagram(local_connection->udp_parser_state->slip_state,
-            remote_connection->remote_address, local_connection->udp_parser_state->slip_state->my_ip_address,
+    slip_send_datagram(udp_state->slip_state,
+            remote_address, udp_state->slip_state->my_ip_address,
             UDP_PROTOCOL_NUMBER, (void*)send_packet, payload_size+sizeof(struct udp_packet));
 
     free(send_packet);
@@ -82,8 +124,9 @@ errval_t forward_datagram(struct udp_local_connection* local_open_connection, ui
         .socket_id=socket_id
     };
 
-    ERROR_RET1(urpc_client_send_chunck(&local_open_connection->udp_state.urpc_chan.buffer_send, &command_header,
-            sizeof(struct udp_command_payload_header), true));
+    // A failed chunk is reported by the final one
+    urpc_client_send_chunck(&local_open_connection->udp_state.urpc_chan.buffer_send, &command_header,
+            sizeof(struct udp_command_payload_header), true);
     ERROR_RET1(urpc_client_send_final_chunck_receive_fixed_size(&local_open_connection->udp_state.urpc_chan.buffer_send, UDP_DATAGRAM_RECEIVED,
                 buf, len,
                 &response, sizeof(struct udp_command_payload), &return_size));
@@ -91,115 +134,278 @@ errval_t forward_datagram(struct udp_local_connection* local_open_connection, ui
     return SYS_ERR_OK;
 }
 
+/*
+ * Returns the socket a datagram belongs to. Servers get a new socket for
+ * every new remote end, clients only accept datagrams from their server.
+ * Only called from the receive thread.
+ */
 static
-void udp_handle_connection_to_server(struct udp_parser_state* udp_state, struct udp_local_connection* local_open_connection,
-        uint32_t from, uint32_t to, void* buf, size_t len){
-    debug_printf("Handling connection to server, local_open_connection: 0x%04x\n", local_open_connection);
-    struct udp_packet* udp_packet=(struct udp_packet*)buf;
-    struct udp_remote_connection* remote_connection=find_remote_connection(local_open_connection, from, udp_packet->source_port);
-    if(remote_connection==NULL){
-        remote_connection=(struct udp_remote_connection*)malloc(sizeof(struct udp_remote_connection));
-        remote_connection->next=local_open_connection->remote_connection_head;
-        remote_connection->remote_address=from;
-        remote_connection->socket.socket_id=local_open_connection->last_socket_id++;
-        remote_connection->remote_port=udp_packet->source_port;
-        local_open_connection->remote_connection_head=remote_connection;
-        debug_printf("Created new remote connection address 0x%04x\n", remote_connection);
+struct udp_remote_connection* find_socket_by_packet(struct udp_parser_state* udp_state,
+        uint32_t from, struct udp_packet* udp_packet){
+    systime_t now=get_system_time();
+    expire_idle_peers(udp_state, now);
+
+    thread_mutex_lock(&udp_state->table_lock);
+    struct udp_remote_connection* remote_connection=udp_table_find(&udp_state->peers,
+            UDP_TABLE_PEER_KEY(udp_packet->dest_port, from, udp_packet->source_port));
+    if(remote_connection!=NULL){
+        remote_connection->last_active=now;
+        thread_mutex_unlock(&udp_state->table_lock);
+        return remote_connection;
+    }
+
+    struct udp_local_connection* local_open_connection=find_local_connection_by_port(udp_state, udp_packet->dest_port);
+    if(local_open_connection==NULL){
+        thread_mutex_unlock(&udp_state->table_lock);
+        debug_printf("Sending request to unknown port, ignoring datagram\n");
+        //TODO: Send ICMP error message, or don't send anything??
+        return NULL;
+    }
+    if(local_open_connection->connection_type!=UDP_PARSER_CONNECTION_SERVER){
+        thread_mutex_unlock(&udp_state->table_lock);
+        debug_printf("We don't have opened remote connection for client, ignoring packet!\n");
+        return NULL;
     }
 
-    forward_datagram(local_open_connection, remote_connection->socket.socket_id, buf, len);
+    remote_connection=(struct udp_remote_connection*)malloc(sizeof(struct udp_remote_connection));
+    if(remote_connection==NULL){
+        thread_mutex_unlock(&udp_state->table_lock);
+        return NULL;
+    }
+    remote_connection->remote_address=from;
+    remote_connection->socket.socket_id=local_open_connection->last_socket_id++;
+    remote_connection->remote_port=udp_packet->source_port;
+    remote_connection->local_connection=local_open_connection;
+    remote_connection->last_active=now;
+    errval_t err=add_socket(udp_state, remote_connection);
+    thread_mutex_unlock(&udp_state->table_lock);
+    if(err_is_fail(err)){
+        DEBUG_ERR(err, "adding UDP peer");
+        free(remote_connection);
+        return NULL;
+    }
+    UDP_DEBUG("Created new remote connection address 0x%04x\n", remote_connection);
+    return remote_connection;
 }
 
+/*
+ * Zero-copy receive: once the UDP header is in, the rest of the datagram is
+ * unescaped straight into a pool page of the socket's channel, behind the
+ * command header, and only a descriptor goes through the ring.
+ */
 static
-void udp_handle_connection_to_client(struct udp_parser_state* udp_state, struct udp_local_connection* local_open_connection,
-        uint32_t from, uint32_t to, void* buf, size_t len){
+uint8_t* udp_redirect_datagram(uint32_t from, uint32_t to, uint8_t* header, size_t data_length,
+        size_t* capacity, void* context){
+    struct udp_parser_state* udp_state=(struct udp_parser_state*)context;
+    struct udp_packet* udp_packet=(struct udp_packet*)header;
+    assert(udp_state->pending_slot==NULL);
 
-    debug_printf("Handling connection to client, local_open_connection: 0x%04x\n", local_open_connection);
-    struct udp_packet* udp_packet=(struct udp_packet*)buf;
-    struct udp_remote_connection* remote_connection=find_remote_connection(local_open_connection, from, udp_packet->source_port);
+    struct udp_remote_connection* remote_connection=find_socket_by_packet(udp_state, from, udp_packet);
     if(remote_connection==NULL){
-        debug_printf("We don't have opened remote connection for client, ignoring packet!\n");
-        return;
+        return NULL;
+    }
+    struct udp_local_connection* local_open_connection=remote_connection->local_connection;
+
+    // Sockets of older clients have no pool, they get a copy
+    size_t size=sizeof(struct udp_command_payload_header)+data_length;
+    void* slot;
+    errval_t err=urpc_client_alloc(&local_open_connection->udp_state.urpc_chan.buffer_send, size, &slot);
+    if(err_is_fail(err)){
+        return NULL;
     }
 
-    forward_datagram(local_open_connection, remote_connection->socket.socket_id, buf, len);
+    udp_state->pending_connection=local_open_connection;
+    udp_state->pending_slot=slot;
+    udp_state->pending_size=size;
+    udp_state->pending_slot->header.socket_id=remote_connection->socket.socket_id;
+    *capacity=data_length;
+    return udp_state->pending_slot->data;
+}
+
+static
+void udp_drop_datagram(uint8_t* buf, void* context){
+    struct udp_parser_state* udp_state=(struct udp_parser_state*)context;
+    assert(udp_state->pending_slot && buf==udp_state->pending_slot->data);
+
+    urpc_pool_return(&udp_state->pending_connection->udp_state.urpc_chan.buffer_send,
+            udp_state->pending_slot, udp_state->pending_size);
+    udp_state->pending_slot=NULL;
 }
 
 static
 void udp_data_handler(uint32_t from, uint32_t to, uint8_t *buf, size_t len, void* context){
 
     struct udp_parser_state* udp_state=(struct udp_parser_state*)context;
-    struct udp_local_connection* local_open_connection;
-    struct udp_packet* udp_packet=(struct udp_packet*)buf;
-    for(local_open_connection=udp_state->local_connectoin_head;local_open_connection!=NULL;local_open_connection=local_open_connection->next){
-        if(udp_packet->dest_port!=local_open_connection->local_port){
-            continue;
+    if(udp_state->pending_slot){
+        // Decoded in place, the client returns the pool page once it got
+        // the descriptor. If it never went out, the page is still ours.
+        assert(buf==udp_state->pending_slot->data);
+        struct urpc_buffer* urpc=&udp_state->pending_connection->udp_state.urpc_chan.buffer_send;
+        struct udp_command_payload response;
+        struct urpc_future future;
+        errval_t err=urpc_client_send_desc_async(urpc, UDP_DATAGRAM_RECEIVED, udp_state->pending_slot,
+                udp_state->pending_size, &response, sizeof(struct udp_command_payload), &future, NULL, NOP_CLOSURE);
+        if(err_is_fail(err)){
+            urpc_pool_return(urpc, udp_state->pending_slot, udp_state->pending_size);
+        }else{
+            err=urpc_future_wait(&future);
         }
-        if(local_open_connection->connection_type==UDP_PARSER_CONNECTION_SERVER){
-            udp_handle_connection_to_server(udp_state, local_open_connection, from, to, buf, len);
-        }else{  // We have a response to client connection
-            udp_handle_connection_to_client(udp_state, local_open_connection, from, to, buf, len);
+        if(err_is_fail(err)){
+            DEBUG_ERR(err, "forwarding UDP datagram");
         }
+        udp_state->pending_slot=NULL;
         return;
     }
-    debug_printf("Sending request to unknown port, ignoring datagram\n");
-    //TODO: Send ICMP error message, or don't send anything??
+
+    struct udp_packet* udp_packet=(struct udp_packet*)buf;
+    struct udp_remote_connection* remote_connection=find_socket_by_packet(udp_state, from, udp_packet);
+    if(remote_connection==NULL){
+        return;
+    }
+    forward_datagram(remote_connection->local_connection, remote_connection->socket.socket_id, buf, len);
 }
 
 static
-errval_t udp_create_local_connection(struct capref urpc_cap, struct udp_local_connection* local_connection){
-    ERROR_RET1(paging_map_frame(get_current_paging_state(), &local_connection->udp_state.urpc_buffer, BASE_PAGE_SIZE, urpc_cap,
-            NULL, NULL));
-
-    ERROR_RET1(urpc_channel_init(&local_connection->udp_state.urpc_chan, local_connection->udp_state.urpc_buffer, BASE_PAGE_SIZE,
+errval_t udp_init_local_channel(struct udp_local_connection* local_connection, size_t frame_bytes){
+    // Frames of older clients are all rings
+    size_t rings_size=MIN(frame_bytes, URPC_DEFAULT_FRAME_SIZE);
+    ERROR_RET1(urpc_channel_init(&local_connection->udp_state.urpc_chan, local_connection->udp_state.urpc_buffer, rings_size,
             URPC_CHAN_SLAVE, UDP_COMMADN_COUNT));
+    if(frame_bytes>rings_size){
+        ERROR_RET1(urpc_channel_attach_pool(&local_connection->udp_state.urpc_chan,
+                local_connection->udp_state.urpc_buffer+rings_size, frame_bytes-rings_size, URPC_CHAN_SLAVE));
+    }
     ERROR_RET1(urpc_server_register_handler(&local_connection->udp_state.urpc_chan, UDP_SEND_DATAGRAM, send_udp_datagram, local_connection));
     ERROR_RET1(urpc_server_register_handler(&local_connection->udp_state.urpc_chan, UDP_GET_CLIENT_SOCKET_ID, get_udp_socket_id, local_connection));
-    debug_printf("----- creating new thread to listen for messages ---\n");
-    ERROR_RET1(urpc_server_start_listen(&local_connection->udp_state.urpc_chan, true));
     return SYS_ERR_OK;
 }
 
+/*
+ * Maps the client's frame and sets its channel and pool up. The connection
+ * must be in the tables only after this, as the receive thread allocates
+ * from its pool; it starts listening once it is in.
+ */
+static
+errval_t udp_create_local_connection(struct capref urpc_cap, struct udp_local_connection* local_connection){
+    local_connection->udp_state.urpc_buffer=NULL;
+    local_connection->udp_state.urpc_chan.callbacks_table=NULL;
+
+    struct frame_identity urpc_frame_id;
+    ERROR_RET1(frame_identify(urpc_cap, &urpc_frame_id));
+    ERROR_RET1(paging_map_frame(get_current_paging_state(), &local_connection->udp_state.urpc_buffer, urpc_frame_id.bytes, urpc_cap,
+            NULL, NULL));
+    return udp_init_local_channel(local_connection, urpc_frame_id.bytes);
+}
+
+// Undoes udp_create_local_connection and frees the connection
+static
+void udp_free_local_connection(struct udp_local_connection* local_connection){
+    free(local_connection->udp_state.urpc_chan.callbacks_table);
+    if(local_connection->udp_state.urpc_buffer){
+        ERR_CHECK("unmapping UDP URPC frame", paging_unmap(get_current_paging_state(),
+                local_connection->udp_state.urpc_buffer));
+    }
+    free(local_connection);
+}
+
+static
+errval_t udp_start_local_connection(struct udp_local_connection* local_connection){
+    debug_printf("----- creating new thread to listen for messages ---\n");
+    return urpc_server_start_listen(&local_connection->udp_state.urpc_chan, true);
+}
+
 errval_t udp_create_server_connection(struct udp_parser_state* udp_state, struct capref urpc_cap, uint16_t port){
     debug_printf("Creating UDP server port: %d\n", port);
-    struct udp_local_connection* local_connection=find_local_connection_by_port(udp_state, port);
-    if(local_connection!=NULL){
-        return NETWORKING_ERR_PORT_IN_USE;
+    struct udp_local_connection* local_connection=(struct udp_local_connection*)malloc(sizeof(struct udp_local_connection));
+    if(local_connection==NULL){
+        return LIB_ERR_MALLOC_FAIL;
     }
 
-    local_connection=(struct udp_local_connection*)malloc(sizeof(struct udp_local_connection));
-
     local_connection->connection_type=UDP_PARSER_CONNECTION_SERVER;
     local_connection->last_socket_id=0;
     local_connection->local_port=port;
-    local_connection->next=udp_state->local_connectoin_head;
-    udp_state->local_connectoin_head=local_connection;
     local_connection->udp_parser_state=udp_state;
-    local_connection->remote_connection_head=NULL;
+    local_connection->server=NULL;
+    errval_t err=udp_create_local_connection(urpc_cap, local_connection);
+    if(err_is_fail(err)){
+        udp_free_local_connection(local_connection);
+        return err;
+    }
 
-    udp_create_local_connection(urpc_cap, local_connection);
+    thread_mutex_lock(&udp_state->table_lock);
+    if(find_local_connection_by_port(udp_state, port)!=NULL){
+        err=NETWORKING_ERR_PORT_IN_USE;
+    }else if(!udp_table_insert(&udp_state->local_connections, UDP_TABLE_PORT_KEY(port), local_connection)){
+        err=LIB_ERR_MALLOC_FAIL;
+    }
+    thread_mutex_unlock(&udp_state->table_lock);
+    if(err_is_ok(err)){
+        err=udp_start_local_connection(local_connection);
+        if(err_is_fail(err)){
+            thread_mutex_lock(&udp_state->table_lock);
+            udp_table_remove(&udp_state->local_connections, UDP_TABLE_PORT_KEY(port));
+            thread_mutex_unlock(&udp_state->table_lock);
+        }
+    }
+    if(err_is_fail(err)){
+        udp_free_local_connection(local_connection);
+        return err;
+    }
     return SYS_ERR_OK;
 }
 
 errval_t udp_create_client_connection(struct udp_parser_state* udp_state, struct capref urpc_cap, uint32_t address, uint16_t port, uint32_t* socket_id){
     debug_printf("Creating UDP client\n");
     struct udp_local_connection* local_connection=(struct udp_local_connection*)malloc(sizeof(struct udp_local_connection));
+    struct udp_remote_connection* remote_connection=(struct udp_remote_connection*)malloc(sizeof(struct udp_remote_connection));
+    if(local_connection==NULL || remote_connection==NULL){
+        free(local_connection);
+        free(remote_connection);
+        return LIB_ERR_MALLOC_FAIL;
+    }
     //Create local connection
     local_connection->connection_type=UDP_PARSER_CONNECTION_CLIENT;
     local_connection->last_socket_id=0;
-    local_connection->local_port=htons(udp_state->first_available_port++);
-    local_connection->next=udp_state->local_connectoin_head;
-    udp_state->local_connectoin_head=local_connection;
     local_connection->udp_parser_state=udp_state;
-    local_connection->remote_connection_head=NULL;
-    udp_create_local_connection(urpc_cap, local_connection);
+    local_connection->server=remote_connection;
     // Create remote connection
-    struct udp_remote_connection* remote_connection=(struct udp_remote_connection*)malloc(sizeof(struct udp_remote_connection));
-    remote_connection->next=local_connection->remote_connection_head;
     remote_connection->remote_address=address;
     remote_connection->socket.socket_id=local_connection->last_socket_id++;
     remote_connection->remote_port=port;
-    local_connection->remote_connection_head=remote_connection;
+    remote_connection->local_connection=local_connection;
+    remote_connection->last_active=get_system_time();
+    errval_t err=udp_create_local_connection(urpc_cap, local_connection);
+    if(err_is_fail(err)){
+        udp_free_local_connection(local_connection);
+        free(remote_connection);
+        return err;
+    }
+
+    thread_mutex_lock(&udp_state->table_lock);
+    local_connection->local_port=htons(udp_state->first_available_port++);
+    if(!udp_table_insert(&udp_state->local_connections, UDP_TABLE_PORT_KEY(local_connection->local_port), local_connection)){
+        err=LIB_ERR_MALLOC_FAIL;
+    }else if(err_is_fail(err=add_socket(udp_state, remote_connection))){
+        udp_table_remove(&udp_state->local_connections, UDP_TABLE_PORT_KEY(local_connection->local_port));
+    }
+    thread_mutex_unlock(&udp_state->table_lock);
+    if(err_is_ok(err)){
+        err=udp_start_local_connection(local_connection);
+        if(err_is_fail(err)){
+            thread_mutex_lock(&udp_state->table_lock);
+            udp_table_remove(&udp_state->peers, UDP_TABLE_PEER_KEY(local_connection->local_port,
+                    remote_connection->remote_address, remote_connection->remote_port));
+            udp_table_remove(&udp_state->sockets, UDP_TABLE_SOCKET_KEY(local_connection->local_port,
+                    remote_connection->socket.socket_id));
+            udp_table_remove(&udp_state->local_connections, UDP_TABLE_PORT_KEY(local_connection->local_port));
+            thread_mutex_unlock(&udp_state->table_lock);
+        }
+    }
+    if(err_is_fail(err)){
+        udp_free_local_connection(local_connection);
+        free(remote_connection);
+        return err;
+    }
     debug_printf("Created new remote connection address 0x%04x\n", remote_connection);
 
     *socket_id=remote_connection->socket.socket_id;
@@ -210,9 +416,20 @@ errval_t udp_create_client_connection(struct udp_parser_state* udp_state, struct
 errval_t udp_init(struct udp_parser_state* udp_state, struct slip_state* slip_state){
     udp_state->first_available_port=50000;  //TODO: Implement mechanism for tracking last used port
     udp_state->slip_state=slip_state;
-    udp_state->local_connectoin_head=NULL;
+    thread_mutex_init(&udp_state->table_lock);
+    if(!udp_table_init(&udp_state->local_connections, UDP_TABLE_INITIAL_CAPACITY) ||
+            !udp_table_init(&udp_state->peers, UDP_TABLE_INITIAL_CAPACITY) ||
+            !udp_table_init(&udp_state->sockets, UDP_TABLE_INITIAL_CAPACITY)){
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    udp_state->last_expiry=get_system_time();
+    udp_state->pending_connection=NULL;
+    udp_state->pending_slot=NULL;
+    udp_state->pending_size=0;
     ERROR_RET1(slip_register_protocol_handler(slip_state, UDP_PROTOCOL_NUMBER, udp_state->data,
             UDP_BUFF_SIZE, udp_data_handler, udp_state));
+    ERROR_RET1(slip_register_redirect_handler(slip_state, UDP_PROTOCOL_NUMBER, sizeof(struct udp_packet),
+            udp_redirect_datagram, udp_drop_datagram));
 
     return SYS_ERR_OK;
 }
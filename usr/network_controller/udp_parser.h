@@ -3,17 +3,26 @@
 
 #include "slip_parser.h"
 #include <aos/urpc/udp.h>
+#include <aos/deferred.h>
+#include "udp_table.h"
 
 #define UDP_PROTOCOL_NUMBER 0x11
 #define UDP_BUFF_SIZE 1024
 
+// Server sockets whose peer was silent that long are closed (us)
+#define UDP_PEER_IDLE_TIMEOUT   (60*1000*1000)
+// How often idle peers are looked for (us)
+#define UDP_PEER_EXPIRY_PERIOD  (5*1000*1000)
+
 struct udp_parser_state;
+struct udp_local_connection;
 
 struct udp_remote_connection {
     uint16_t remote_port;
     uint32_t remote_address;
     struct udp_socket socket;
-    struct udp_remote_connection* next;
+    struct udp_local_connection* local_connection;
+    systime_t last_active;
 };
 
 struct udp_local_connection {
@@ -22,15 +31,29 @@ struct udp_local_connection {
     enum udp_connection_type connection_type;
     struct udp_state udp_state;
     struct udp_parser_state* udp_parser_state;
-    struct udp_remote_connection* remote_connection_head;
-    struct udp_local_connection* next;
+    struct udp_remote_connection* server;   // Clients: the only peer
 };
 
+/*
+ * Sockets are found through hash tables (see udp_table.h): local
+ * connections by port, sockets by peer address and by id. The receive
+ * thread adds peers and expires idle ones, the sending threads look sockets
+ * up by id, so the tables are guarded by table_lock.
+ */
 struct udp_parser_state {
     struct slip_state* slip_state;
-    struct udp_local_connection* local_connectoin_head;
+    struct thread_mutex table_lock;
+    struct udp_table local_connections;    // UDP_TABLE_PORT_KEY
+    struct udp_table peers;                // UDP_TABLE_PEER_KEY
+    struct udp_table sockets;              // UDP_TABLE_SOCKET_KEY
+    systime_t last_expiry;
     uint16_t first_available_port;
     uint8_t data[UDP_BUFF_SIZE];
+
+    // Datagram being decoded straight into a socket's pool
+    struct udp_local_connection* pending_connection;
+    struct udp_command_payload* pending_slot;
+    size_t pending_size;
 };
 
 errval_t udp_init(struct udp_parser_state* udp_state, struct slip_state* slip_state);
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include "udp_table.h"
+
+#define UDP_TABLE_MIN_CAPACITY 16
+
+static inline
+uint32_t udp_table_slot(const struct udp_table* table, uint64_t key){
+    // Fibonacci hashing: the top bits of the product mix all key bits
+    return (key*0x9E3779B97F4A7C15ull)>>table->shift;
+}
+
+static
+bool udp_table_alloc(struct udp_table* table, uint32_t capacity){
+    uint32_t bits=0;
+    while((1u<<bits)<capacity)
+        ++bits;
+    table->entries=calloc(1u<<bits, sizeof(struct udp_table_entry));
+    if(!table->entries)
+        return false;
+    table->capacity=1u<<bits;
+    table->shift=64-bits;
+    table->count=0;
+    return true;
+}
+
+bool udp_table_init(struct udp_table* table, uint32_t capacity){
+    return udp_table_alloc(table, capacity<UDP_TABLE_MIN_CAPACITY ? UDP_TABLE_MIN_CAPACITY : capacity);
+}
+
+void udp_table_destroy(struct udp_table* table){
+    free(table->entries);
+    table->entries=NULL;
+    table->capacity=0;
+    table->count=0;
+}
+
+void* udp_table_find(const struct udp_table* table, uint64_t key){
+    uint32_t mask=table->capacity-1;
+    for(uint32_t i=udp_table_slot(table, key);; i=(i+1)&mask){
+        struct udp_table_entry* entry=&table->entries[i];
+        if(!entry->value)
+            return NULL;
+        if(entry->key==key)
+            return entry->value;
+    }
+}
+
+static
+void udp_table_place(struct udp_table* table, uint64_t key, void* value){
+    uint32_t mask=table->capacity-1;
+    uint32_t i=udp_table_slot(table, key);
+    while(table->entries[i].value)
+        i=(i+1)&mask;
+    table->entries[i].key=key;
+    table->entries[i].value=value;
+    table->count++;
+}
+
+static
+bool udp_table_grow(struct udp_table* table){
+    struct udp_table old=*table;
+    if(!udp_table_alloc(table, old.capacity*2)){
+        *table=old;
+        return false;
+    }
+    for(uint32_t i=0; i<old.capacity; ++i){
+        if(old.entries[i].value)
+            udp_table_place(table, old.entries[i].key, old.entries[i].value);
+    }
+    free(old.entries);
+    return true;
+}
+
+bool udp_table_insert(struct udp_table* table, uint64_t key, void* value){
+    if((table->count+1)*4>table->capacity*3 && !udp_table_grow(table))
+        return false;
+    udp_table_place(table, key, value);
+    return true;
+}
+
+// Empties slot $i and moves later entries of its cluster back into the gap
+static
+void udp_table_remove_slot(struct udp_table* table, uint32_t i){
+    uint32_t mask=table->capacity-1;
+    uint32_t gap=i;
+    for(uint32_t j=(i+1)&mask; table->entries[j].value; j=(j+1)&mask){
+        // An entry may fill the gap if its home slot is not between the gap and itself
+        uint32_t home=udp_table_slot(table, table->entries[j].key);
+        if(((j-home)&mask)>=((j-gap)&mask)){
+            table->entries[gap]=table->entries[j];
+            gap=j;
+        }
+    }
+    table->entries[gap].value=NULL;
+    table->count--;
+}
+
+void* udp_table_remove(struct udp_table* table, uint64_t key){
+    uint32_t mask=table->capacity-1;
+    for(uint32_t i=udp_table_slot(table, key);; i=(i+1)&mask){
+        struct udp_table_entry* entry=&table->entries[i];
+        if(!entry->value)
+            return NULL;
+        if(entry->key==key){
+            void* value=entry->value;
+            udp_table_remove_slot(table, i);
+            return value;
+        }
+    }
+}
+
+size_t udp_table_remove_if(struct udp_table* table, udp_table_predicate expired, void* context){
+    size_t removed=0;
+    for(uint32_t i=0; i<table->capacity;){
+        // A removal shifts the next entry into slot i, look at it again
+        if(table->entries[i].value && expired(table->entries[i].value, context)){
+            udp_table_remove_slot(table, i);
+            removed++;
+        }else{
+            ++i;
+        }
+    }
+    return removed;
+}
@@ -0,0 +1,68 @@
+#ifndef _UDP_TABLE_
+#define _UDP_TABLE_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Open-addressing hash table from 64 bit keys to non-NULL pointers, with
+ * linear probing and backward-shift deletion, so there are no tombstones
+ * and lookups stay short however many peers come and go. It grows at 3/4
+ * load. Like the SLIP codec it only depends on libc, so that
+ * tools/slipbench can replay traces against it on the host.
+ */
+
+struct udp_table_entry{
+    uint64_t key;
+    void* value;            // NULL for a free slot
+};
+
+struct udp_table{
+    struct udp_table_entry* entries;
+    uint32_t capacity;      // Power of two
+    uint32_t shift;         // 64 - log2(capacity)
+    uint32_t count;
+};
+
+// Keys of the UDP parser's tables, ports and addresses in network order
+#define UDP_TABLE_PORT_KEY(local_port) ((uint64_t)(local_port))
+#define UDP_TABLE_PEER_KEY(local_port, remote_address, remote_port) \
+    ((uint64_t)(local_port)<<48 | (uint64_t)(remote_address)<<16 | (remote_port))
+#define UDP_TABLE_SOCKET_KEY(local_port, socket_id) ((uint64_t)(local_port)<<32 | (socket_id))
+
+/**
+ * \brief Allocates room for $capacity entries, rounded up to a power of two
+ *
+ * \return false if out of memory
+ */
+bool udp_table_init(struct udp_table* table, uint32_t capacity);
+void udp_table_destroy(struct udp_table* table);
+
+void* udp_table_find(const struct udp_table* table, uint64_t key);
+
+/**
+ * \brief Adds $key, which must not be in the table yet
+ *
+ * \return false if the table had to grow and is out of memory
+ */
+bool udp_table_insert(struct udp_table* table, uint64_t key, void* value);
+
+/**
+ * \return the value of $key, or NULL if it wasn't in the table
+ */
+void* udp_table_remove(struct udp_table* table, uint64_t key);
+
+typedef bool (*udp_table_predicate)(void* value, void* context);
+
+/**
+ * \brief Removes every entry for which $expired returns true, in one pass
+ *
+ * $expired may free the value it accepts, but not touch the table. It may
+ * be called more than once for an entry it keeps.
+ *
+ * \return number of entries removed
+ */
+size_t udp_table_remove_if(struct udp_table* table, udp_table_predicate expired, void* context);
+
+#endif //_UDP_TABLE_
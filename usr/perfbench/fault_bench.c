@@ -0,0 +1,97 @@
+/**
+ * \file
+ * \brief Page-fault throughput with N threads faulting disjoint regions.
+ *
+ * All threads run on the dispatcher of this domain, so the numbers show
+ * how much the fault handler serialises (locks, shared exception stack),
+ * not multi-core speedup.
+ */
+
+#include <stdlib.h>
+#include <aos/threads.h>
+
+#include "perfbench.h"
+
+#define FAULT_BENCH_DEFAULT_THREADS 8
+#define FAULT_BENCH_DEFAULT_PAGES   256
+
+struct fault_bench_thread {
+    char* region;
+    size_t pages;
+    int id;
+};
+
+static int fault_bench_thread_func(void* arg)
+{
+    struct fault_bench_thread* t = arg;
+    for (size_t i = 0; i < t->pages; ++i)
+        t->region[i * BASE_PAGE_SIZE] = (char)(t->id + i);
+    for (size_t i = 0; i < t->pages; ++i)
+        if (t->region[i * BASE_PAGE_SIZE] != (char)(t->id + i))
+            return 1;
+    return 0;
+}
+
+static errval_t fault_bench_run(struct paging_state* st, int num_threads, size_t pages)
+{
+    struct fault_bench_thread args[num_threads];
+    struct thread* threads[num_threads];
+    for (int i = 0; i < num_threads; ++i)
+    {
+        args[i].pages = pages;
+        args[i].id = i;
+        ERROR_RET1(paging_alloc(st, (void**)&args[i].region, pages * BASE_PAGE_SIZE, NULL));
+    }
+
+    struct paging_fault_stats before, after;
+    paging_get_fault_stats(st, &before);
+    uint32_t start = get_cycle_count();
+    for (int i = 0; i < num_threads; ++i)
+    {
+        threads[i] = thread_create(fault_bench_thread_func, &args[i]);
+        if (!threads[i])
+            return LIB_ERR_THREAD_CREATE;
+    }
+    int failed = 0;
+    for (int i = 0; i < num_threads; ++i)
+    {
+        int retval;
+        ERROR_RET1(thread_join(threads[i], &retval));
+        failed += retval;
+    }
+    uint64_t cycles = get_cycle_count() - start;
+    paging_get_fault_stats(st, &after);
+
+    size_t faults = after.faults - before.faults;
+    uint64_t per_fault = faults ? cycles / faults : 0;
+    BENCH_PRINTF("  %2d threads: %6zu faults, %8llu cycles/fault, %7llu faults/s%s\n",
+        num_threads, faults, per_fault, per_fault ? BENCH_CPU_HZ / per_fault : 0,
+        failed ? " [DATA MISMATCH]" : "");
+    return SYS_ERR_OK;
+}
+
+errval_t fault_bench(int argc, char* argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : FAULT_BENCH_DEFAULT_THREADS;
+    size_t pages = argc > 2 ? strtoul(argv[2], NULL, 10) : FAULT_BENCH_DEFAULT_PAGES;
+    if (max_threads < 1 || !pages)
+        return LIB_ERR_THREAD_CREATE;
+
+    // One fault per page, so that the handler dominates the measurement
+    struct paging_state* st = get_current_paging_state();
+    size_t fault_around = st->fault_around;
+    bool fault_sections = st->fault_sections;
+    ERROR_RET1(paging_set_fault_around(st, BASE_PAGE_SIZE, false));
+
+    struct paging_fault_stats stats;
+    paging_get_fault_stats(st, &stats);
+    BENCH_PRINTF("copy-on-write: %zu pages of .data/.bss copied since spawn\n",
+        stats.cow_breaks);
+    BENCH_PRINTF("page faults: %zu pages per thread, disjoint regions\n", pages);
+    errval_t err = SYS_ERR_OK;
+    for (int n = 1; n <= max_threads && err_is_ok(err); n *= 2)
+        err = fault_bench_run(st, n, pages);
+
+    ERROR_RET1(paging_set_fault_around(st, fault_around, fault_sections));
+    return err;
+}
@@ -0,0 +1,100 @@
+/**
+ * \file
+ * \brief frame_alloc throughput: one RPC per page vs. batched RAM caps.
+ */
+
+#include <stdlib.h>
+
+#include "perfbench.h"
+
+#define FRAME_BENCH_DEFAULT_PAGES 1024
+
+static void frame_bench_report(const char* name, size_t pages, uint64_t cycles)
+{
+    uint64_t per_page = cycles / pages;
+    BENCH_PRINTF("  %-32s %5zu pages, %8llu cycles/page, %6llu pages/s\n",
+        name, pages, per_page, per_page ? BENCH_CPU_HZ / per_page : 0);
+}
+
+/**
+ * Like frame_alloc, one RAM cap RPC per page, but keeps the RAM caps so
+ * the memory can be given back.
+ */
+static errval_t frame_bench_single(struct capref* frames, struct capref* ram, size_t pages, uint64_t* cycles)
+{
+    *cycles = 0;
+    for (size_t i = 0; i < pages; ++i)
+    {
+        uint32_t start = get_cycle_count();
+        ERROR_RET1(ram_alloc(&ram[i], BASE_PAGE_SIZE));
+        ERROR_RET1(slot_alloc(&frames[i]));
+        ERROR_RET1(cap_retype(frames[i], ram[i], 0, ObjType_Frame, BASE_PAGE_SIZE, 1));
+        *cycles += get_cycle_count() - start;
+    }
+    return SYS_ERR_OK;
+}
+
+static errval_t frame_bench_batched(struct capref* frames, struct capref* ram, size_t pages, uint64_t* cycles)
+{
+    *cycles = 0;
+    for (size_t done = 0; done < pages; done += RPC_RAM_CAP_BATCH_MAX)
+    {
+        size_t chunk = MIN(pages - done, RPC_RAM_CAP_BATCH_MAX);
+        uint32_t start = get_cycle_count();
+        ERROR_RET1(ram_alloc_batch(&ram[done], chunk, BASE_PAGE_SIZE));
+        for (size_t i = done; i < done + chunk; ++i)
+        {
+            ERROR_RET1(slot_alloc(&frames[i]));
+            ERROR_RET1(cap_retype(frames[i], ram[i], 0, ObjType_Frame, BASE_PAGE_SIZE, 1));
+        }
+        *cycles += get_cycle_count() - start;
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * Gives the pages of a run back. Init revokes each RAM cap, which deletes
+ * the frame retyped from it, so only the frame slot is left to free.
+ */
+static errval_t frame_bench_free(struct capref* frames, struct capref* ram, size_t pages)
+{
+    for (size_t i = 0; i < pages; ++i)
+    {
+        ERROR_RET1(ram_free(ram[i], BASE_PAGE_SIZE));
+        ERROR_RET1(slot_free(frames[i]));
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t frame_bench(int argc, char* argv[])
+{
+    size_t pages = argc > 1 ? strtoul(argv[1], NULL, 10) : FRAME_BENCH_DEFAULT_PAGES;
+    if (!pages)
+        return LIB_ERR_RAM_ALLOC_WRONG_SIZE;
+
+    struct capref* frames = malloc(2 * sizeof(struct capref) * pages);
+    if (!frames)
+        return LIB_ERR_MALLOC_FAIL;
+    struct capref* ram = frames + pages;
+
+    // Both runs start from the same free memory: the first run's pages
+    // go back to init before the second one.
+    uint64_t cycles;
+    BENCH_PRINTF("frame_alloc throughput\n");
+    errval_t err = frame_bench_single(frames, ram, pages, &cycles);
+    if (err_is_ok(err))
+    {
+        frame_bench_report("ram_alloc + retype (1 RPC/page)", pages, cycles);
+        err = frame_bench_free(frames, ram, pages);
+    }
+    if (err_is_ok(err))
+        err = frame_bench_batched(frames, ram, pages, &cycles);
+    if (err_is_ok(err))
+    {
+        frame_bench_report("ram_alloc_batch + retype", pages, cycles);
+        err = frame_bench_free(frames, ram, pages);
+    }
+
+    free(frames);
+    return err;
+}
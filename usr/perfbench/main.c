@@ -0,0 +1,70 @@
+/**
+ * \file
+ * \brief Benchmark domain. Usage: perfbench <name> [args...]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <aos/aos.h>
+
+#include "perfbench.h"
+
+struct perfbench_entry {
+    const char* name;
+    perfbench_func_t run;
+    const char* help;
+};
+
+static struct perfbench_entry benchmarks[] = {
+    { "mm", mm_bench, "[max_live] - libmm alloc/free latency, linear vs indexed" },
+    { "frames", frame_bench, "[pages] - frame_alloc throughput, single vs batched RPC" },
+    { "vspace", vspace_bench, "[pages] [check] - page-fault rate and paging_alloc vs. block count" },
+    { "faults", fault_bench, "[threads] [pages] - page-fault throughput, 1..N threads" },
+    { "rpc", rpc_bench, "[calls] - null LMP RPC latency to init, waitset vs. fast path" },
+    { "rpc-clients", rpc_clients_bench, "[clients] [calls] [slow] - RAM cap tail latency, concurrent clients" },
+    { "rpc-client", rpc_client_bench, "[calls] [label] - one client of 'rpc-clients'" },
+    { "rpc-slow-client", rpc_slow_client_bench, "- shared buffer requests next to 'rpc-clients'" },
+    { "urpc", urpc_bench, "[msgs] [bytes] [bulk] - URPC ping-pong, streaming and bulk, core 1 -> core 0" },
+    { "urpc-peer", urpc_bench_peer, "[msgs] [bytes] [bulk] - client side of 'urpc', spawned on core 1" },
+    { "urpc-wait", urpc_wait_bench, "[msgs] [spin] - URPC latency vs. CPU left to others, per wait mode" },
+    { "urpc-wait-peer", urpc_wait_bench_peer, "[msgs] [spin] - client side of 'urpc-wait', spawned on core 1" },
+    { "urpc-burn", urpc_bench_burn, "[cycles] [label] - busy loop spawned by 'urpc-wait-peer'" },
+    { "spawn", spawn_bench, "[count] [binary] - spawn latency, cold (ELF load) vs. warm (cached image)" },
+    { "spawn-batch", spawn_batch_bench, "[count] [binary] - spawn count processes on cores 0+1, batched vs. one by one" },
+};
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static void usage(const char* self)
+{
+    printf("Usage: %s <benchmark> [args...]\n", self);
+    for (int i = 0; i < NUM_BENCHMARKS; ++i)
+        printf("  %-10s %s\n", benchmarks[i].name, benchmarks[i].help);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    reset_cycle_counter();
+    for (int i = 0; i < NUM_BENCHMARKS; ++i)
+    {
+        if (strcmp(argv[1], benchmarks[i].name))
+            continue;
+        BENCH_PRINTF("Running '%s'\n", benchmarks[i].name);
+        errval_t err = benchmarks[i].run(argc - 1, argv + 1);
+        if (err_is_fail(err))
+        {
+            DEBUG_ERR(err, "benchmark '%s' failed", benchmarks[i].name);
+            return EXIT_FAILURE;
+        }
+        BENCH_PRINTF("Done '%s'\n", benchmarks[i].name);
+        return EXIT_SUCCESS;
+    }
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+/**
+ * \file
+ * \brief libmm allocation latency against the number of live allocations.
+ *
+ * Runs a private `struct mm` over a RAM cap obtained from init, so init's
+ * allocator is not disturbed, and compares MM_SEARCH_LINEAR (list walk)
+ * with MM_SEARCH_INDEXED (free bins + address tree).
+ */
+
+#include <stdlib.h>
+#include <mm/mm.h>
+
+#include "perfbench.h"
+
+#define MM_BENCH_POOL_SIZE     (32 * 1024 * 1024)
+#define MM_BENCH_DEFAULT_LIVE  4096
+#define MM_BENCH_REPORT_EVERY  512
+
+static errval_t bench_slot_alloc(void *inst, uint64_t nslots, struct capref *ret)
+{
+    assert(nslots == 1);
+    return slot_alloc(ret);
+}
+
+static errval_t bench_slot_refill(void *inst)
+{
+    return SYS_ERR_OK;
+}
+
+struct mm_bench_alloc {
+    struct capref cap;
+    genpaddr_t base;
+    gensize_t size;
+};
+
+static errval_t mm_bench_alloc_one(struct mm* mm, size_t size, struct mm_bench_alloc* a,
+        uint32_t* cycles)
+{
+    uint32_t start = get_cycle_count();
+    ERROR_RET1(mm_alloc(mm, size, &a->cap));
+    *cycles = get_cycle_count() - start;
+
+    struct frame_identity fi;
+    ERROR_RET1(frame_identify(a->cap, &fi));
+    a->base = fi.base;
+    a->size = fi.bytes;
+    return SYS_ERR_OK;
+}
+
+static errval_t mm_bench_free_one(struct mm* mm, struct mm_bench_alloc* a, uint32_t* cycles)
+{
+    uint32_t start = get_cycle_count();
+    ERROR_RET1(mm_free(mm, a->cap, a->base, a->size));
+    *cycles = get_cycle_count() - start;
+    return SYS_ERR_OK;
+}
+
+/**
+ * 1. Allocate up to max_live pages, reporting the mean alloc latency for
+ *    every window of MM_BENCH_REPORT_EVERY allocations.
+ * 2. Free every other page, then allocate 2-page blocks: none of the holes
+ *    fit, which is the worst case for a first-fit list walk.
+ * 3. Free everything (latency of the node lookup by address).
+ */
+static errval_t mm_bench_run(struct mm* mm, struct mm_bench_alloc* allocs, size_t max_live)
+{
+    uint64_t window = 0;
+    uint64_t total_free = 0;
+    uint32_t cycles;
+
+    BENCH_PRINTF("  live   alloc(cycles)\n");
+    for (size_t i = 0; i < max_live; ++i)
+    {
+        ERROR_RET1(mm_bench_alloc_one(mm, BASE_PAGE_SIZE, &allocs[i], &cycles));
+        window += cycles;
+        if ((i + 1) % MM_BENCH_REPORT_EVERY == 0)
+        {
+            BENCH_PRINTF("  %5zu  %10llu\n", i + 1, window / MM_BENCH_REPORT_EVERY);
+            window = 0;
+        }
+    }
+
+    for (size_t i = 0; i < max_live; i += 2)
+        ERROR_RET1(mm_bench_free_one(mm, &allocs[i], &cycles));
+
+    size_t num_large = max_live / 8;
+    struct mm_bench_alloc* large = allocs + max_live;
+    uint64_t total_large = 0;
+    for (size_t i = 0; i < num_large; ++i)
+    {
+        ERROR_RET1(mm_bench_alloc_one(mm, 2 * BASE_PAGE_SIZE, &large[i], &cycles));
+        total_large += cycles;
+    }
+    BENCH_PRINTF("  fragmented: %zu x 8 KiB allocs, mean %llu cycles\n",
+        num_large, total_large / num_large);
+
+    for (size_t i = 0; i < num_large; ++i)
+    {
+        ERROR_RET1(mm_bench_free_one(mm, &large[i], &cycles));
+        total_free += cycles;
+    }
+    for (size_t i = 1; i < max_live; i += 2)
+    {
+        ERROR_RET1(mm_bench_free_one(mm, &allocs[i], &cycles));
+        total_free += cycles;
+    }
+    BENCH_PRINTF("  free: mean %llu cycles\n",
+        total_free / (num_large + max_live / 2));
+    return SYS_ERR_OK;
+}
+
+errval_t mm_bench(int argc, char* argv[])
+{
+    size_t max_live = argc > 1 ? strtoul(argv[1], NULL, 10) : MM_BENCH_DEFAULT_LIVE;
+    if (max_live < MM_BENCH_REPORT_EVERY || max_live * BASE_PAGE_SIZE * 2 > MM_BENCH_POOL_SIZE)
+        return LIB_ERR_RAM_ALLOC_WRONG_SIZE;
+
+    struct capref pool;
+    ERROR_RET1(ram_alloc(&pool, MM_BENCH_POOL_SIZE));
+    struct frame_identity pool_id;
+    ERROR_RET1(frame_identify(pool, &pool_id));
+
+    struct mm_bench_alloc* allocs = malloc(sizeof(struct mm_bench_alloc) * (max_live + max_live / 8));
+    if (!allocs)
+        return LIB_ERR_MALLOC_FAIL;
+
+    static const struct {
+        enum mm_search_policy policy;
+        const char* name;
+    } policies[] = {
+        { MM_SEARCH_LINEAR, "linear list walk" },
+        { MM_SEARCH_INDEXED, "segregated bins + address tree" },
+    };
+
+    errval_t err = SYS_ERR_OK;
+    for (int p = 0; p < 2 && err_is_ok(err); ++p)
+    {
+        struct mm mm;
+        static char nodebuf[sizeof(struct mmnode) * 64];
+        ERROR_RET1(mm_init(&mm, ObjType_RAM, slab_default_refill,
+            bench_slot_alloc, bench_slot_refill, NULL));
+        slab_grow(&mm.slabs, nodebuf, sizeof(nodebuf));
+        mm_set_search_policy(&mm, policies[p].policy);
+        ERROR_RET1(mm_add(&mm, pool, pool_id.base, pool_id.bytes));
+
+        BENCH_PRINTF("libmm: %s, up to %zu live allocations\n", policies[p].name, max_live);
+        err = mm_bench_run(&mm, allocs, max_live);
+        mm_destroy(&mm);
+    }
+
+    free(allocs);
+    return err;
+}
@@ -0,0 +1,37 @@
+/**
+ * \file
+ * \brief Micro benchmarks for the AOS system services
+ */
+
+#ifndef _PERFBENCH_H_
+#define _PERFBENCH_H_
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+#include <arch/arm/barrelfish_kpi/asm_inlines_arch.h>
+
+#define BENCH_PRINTF(...) debug_printf("[BENCH] " __VA_ARGS__)
+
+/// Core clock of the PandaBoard ES (OMAP4460), used to turn cycles into rates
+#define BENCH_CPU_HZ 1200000000ULL
+
+/// Runs a single benchmark, argv[0] is the benchmark name
+typedef errval_t (*perfbench_func_t)(int argc, char* argv[]);
+
+errval_t mm_bench(int argc, char* argv[]);
+errval_t frame_bench(int argc, char* argv[]);
+errval_t vspace_bench(int argc, char* argv[]);
+errval_t fault_bench(int argc, char* argv[]);
+errval_t rpc_bench(int argc, char* argv[]);
+errval_t rpc_clients_bench(int argc, char* argv[]);
+errval_t rpc_client_bench(int argc, char* argv[]);
+errval_t rpc_slow_client_bench(int argc, char* argv[]);
+errval_t urpc_bench(int argc, char* argv[]);
+errval_t urpc_bench_peer(int argc, char* argv[]);
+errval_t urpc_wait_bench(int argc, char* argv[]);
+errval_t urpc_wait_bench_peer(int argc, char* argv[]);
+errval_t urpc_bench_burn(int argc, char* argv[]);
+errval_t spawn_bench(int argc, char* argv[]);
+errval_t spawn_batch_bench(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ * \file
+ * \brief Null-RPC latency to init, with and without the LMP fast path.
+ * 'rpc-clients' spawns concurrent RAM cap clients, next to one that keeps
+ * init busy with shared buffer requests (a slow handler), and each client
+ * prints its RPC_RAM_CAP_QUERY latency distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "perfbench.h"
+
+#define RPC_BENCH_DEFAULT_CALLS 10000
+#define RPC_CLIENTS_DEFAULT_CLIENTS 8
+#define RPC_CLIENTS_DEFAULT_CALLS 2000
+#define RPC_CLIENTS_SLOW_CALLS 32
+#define RPC_CLIENTS_SLOW_BYTES (256 * 1024)
+
+static int rpc_bench_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static errval_t rpc_bench_run(const char* name, bool fast_path, uint32_t* latencies, size_t calls)
+{
+    struct aos_rpc* rpc = get_init_rpc();
+    bool saved = rpc->server_sess->fast_path;
+    rpc->server_sess->fast_path = fast_path;
+
+    errval_t err = SYS_ERR_OK;
+    uint64_t cycles = 0;
+    for (size_t i = 0; i < calls && err_is_ok(err); ++i)
+    {
+        uint32_t start = get_cycle_count();
+        err = aos_rpc_send_number(rpc, i);
+        latencies[i] = get_cycle_count() - start;
+        cycles += latencies[i];
+    }
+    rpc->server_sess->fast_path = saved;
+    ERROR_RET1(err);
+
+    qsort(latencies, calls, sizeof(uint32_t), rpc_bench_cmp);
+    BENCH_PRINTF("  %-10s %6zu calls, %7llu cycles/call, p50 %6lu p99 %6lu min %6lu\n",
+        name, calls, cycles / calls, latencies[calls / 2], latencies[calls * 99 / 100], latencies[0]);
+    return SYS_ERR_OK;
+}
+
+errval_t rpc_bench(int argc, char* argv[])
+{
+    size_t calls = argc > 1 ? strtoul(argv[1], NULL, 10) : RPC_BENCH_DEFAULT_CALLS;
+    if (!calls)
+        return SYS_ERR_INVALID_SIZE;
+    uint32_t* latencies = malloc(calls * sizeof(uint32_t));
+    if (!latencies)
+        return LIB_ERR_MALLOC_FAIL;
+
+    BENCH_PRINTF("rpc: %zu null RPCs (aos_rpc_send_number) to init\n", calls);
+    errval_t err = rpc_bench_run("waitset", false, latencies, calls);
+    if (err_is_ok(err))
+        err = rpc_bench_run("fast path", true, latencies, calls);
+    free(latencies);
+    return err;
+}
+
+errval_t rpc_clients_bench(int argc, char* argv[])
+{
+    size_t clients = argc > 1 ? strtoul(argv[1], NULL, 10) : RPC_CLIENTS_DEFAULT_CLIENTS;
+    char* calls = argc > 2 ? argv[2] : "";
+    bool slow = argc > 3 ? strtoul(argv[3], NULL, 10) : true;
+
+    BENCH_PRINTF("rpc-clients: %zu RAM cap clients%s\n", clients,
+        slow ? ", one shared buffer client" : "");
+    coreid_t core = disp_get_core_id();
+    domainid_t pid;
+    if (slow)
+    {
+        char* slow_argv[] = { "perfbench", "rpc-slow-client" };
+        ERROR_RET1(aos_rpc_process_spawn_with_args(get_init_rpc(), core, slow_argv, 2, &pid));
+    }
+    for (size_t i = 0; i < clients; ++i)
+    {
+        char label[16];
+        snprintf(label, sizeof(label), "client %zu", i);
+        char* client_argv[] = { "perfbench", "rpc-client", calls, label };
+        ERROR_RET1(aos_rpc_process_spawn_with_args(get_init_rpc(), core, client_argv, 4, &pid));
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t rpc_client_bench(int argc, char* argv[])
+{
+    size_t calls = argc > 1 && *argv[1] ? strtoul(argv[1], NULL, 10) : RPC_CLIENTS_DEFAULT_CALLS;
+    const char* label = argc > 2 ? argv[2] : "client";
+    if (!calls)
+        return SYS_ERR_INVALID_SIZE;
+    uint32_t* latencies = malloc(calls * sizeof(uint32_t));
+    if (!latencies)
+        return LIB_ERR_MALLOC_FAIL;
+
+    // Like memeater, but the memory goes back right away
+    errval_t err = SYS_ERR_OK;
+    for (size_t i = 0; i < calls && err_is_ok(err); ++i)
+    {
+        struct capref cap;
+        size_t bytes;
+        uint32_t start = get_cycle_count();
+        err = aos_rpc_get_ram_cap(get_init_rpc(), BASE_PAGE_SIZE, BASE_PAGE_SIZE, &cap, &bytes);
+        latencies[i] = get_cycle_count() - start;
+        if (err_is_ok(err))
+            err = aos_rpc_free_ram_cap(get_init_rpc(), cap, bytes);
+    }
+    if (err_is_ok(err))
+    {
+        qsort(latencies, calls, sizeof(uint32_t), rpc_bench_cmp);
+        BENCH_PRINTF("  %-10s %5zu RAM cap RPCs, p50 %7lu p99 %7lu p99.9 %7lu max %8lu cycles\n",
+            label, calls, latencies[calls / 2], latencies[calls * 99 / 100],
+            latencies[calls * 999 / 1000], latencies[calls - 1]);
+    }
+    free(latencies);
+    return err;
+}
+
+errval_t rpc_slow_client_bench(int argc, char* argv[])
+{
+    uint64_t cycles = 0;
+    for (int i = 0; i < RPC_CLIENTS_SLOW_CALLS; ++i)
+    {
+        uint32_t start = get_cycle_count();
+        ERROR_RET1(aos_rpc_request_shared_buffer(get_init_rpc(), RPC_CLIENTS_SLOW_BYTES));
+        cycles += get_cycle_count() - start;
+    }
+    BENCH_PRINTF("  %-10s %5d shared buffer RPCs, %llu cycles/call\n",
+        "slow", RPC_CLIENTS_SLOW_CALLS, cycles / RPC_CLIENTS_SLOW_CALLS);
+    return SYS_ERR_OK;
+}
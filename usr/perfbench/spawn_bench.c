@@ -0,0 +1,109 @@
+/**
+ * \file
+ * \brief Spawn latency, as seen by a client of init. The first spawn of a
+ * binary since boot loads its ELF (cold), later ones map init's cached
+ * image (warm), so run this before anything else has spawned the binary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "perfbench.h"
+
+#define SPAWN_BENCH_DEFAULT_COUNT 32
+#define SPAWN_BENCH_DEFAULT_BINARY "hello"
+
+static int spawn_bench_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+errval_t spawn_bench(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : SPAWN_BENCH_DEFAULT_COUNT;
+    char* binary = argc > 2 ? argv[2] : SPAWN_BENCH_DEFAULT_BINARY;
+    if (count < 2)
+        return SYS_ERR_INVALID_SIZE;
+    uint32_t* latencies = malloc(count * sizeof(uint32_t));
+    if (!latencies)
+        return LIB_ERR_MALLOC_FAIL;
+
+    BENCH_PRINTF("spawn: %zu x '%s' on core %d\n", count, binary, disp_get_core_id());
+    errval_t err = SYS_ERR_OK;
+    for (size_t i = 0; i < count && err_is_ok(err); ++i)
+    {
+        domainid_t pid;
+        uint32_t start = get_cycle_count();
+        err = aos_rpc_process_spawn(get_init_rpc(), binary, disp_get_core_id(), &pid);
+        latencies[i] = get_cycle_count() - start;
+    }
+    if (err_is_ok(err))
+    {
+        size_t warm = count - 1;
+        qsort(latencies + 1, warm, sizeof(uint32_t), spawn_bench_cmp);
+        BENCH_PRINTF("  cold %9lu cycles (%llu us)\n", latencies[0],
+            latencies[0] * 1000000ULL / BENCH_CPU_HZ);
+        BENCH_PRINTF("  warm %9lu cycles (%llu us) p50, p99 %9lu min %9lu\n",
+            latencies[1 + warm / 2], latencies[1 + warm / 2] * 1000000ULL / BENCH_CPU_HZ,
+            latencies[1 + warm * 99 / 100], latencies[1]);
+    }
+    free(latencies);
+    return err;
+}
+
+#define SPAWN_BATCH_BENCH_DEFAULT_COUNT 256
+#define SPAWN_BATCH_BENCH_CORES 0x3     // Cores 0 and 1
+
+static void spawn_batch_bench_report(const char* label, size_t count, uint32_t cycles)
+{
+    if (is_cycle_counter_overflow())
+        BENCH_PRINTF("  %-7s cycle counter wrapped, try a smaller count\n", label);
+    else
+        BENCH_PRINTF("  %-7s %10lu cycles (%llu ms), %llu us per process\n", label, cycles,
+            cycles * 1000ULL / BENCH_CPU_HZ, cycles * 1000000ULL / BENCH_CPU_HZ / count);
+}
+
+/**
+ * Spawns $count processes across cores 0 and 1, first with a single batch
+ * request, then with one request per process. Both cores have spawned the
+ * binary once before, so every spawn maps a cached image.
+ */
+errval_t spawn_batch_bench(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : SPAWN_BATCH_BENCH_DEFAULT_COUNT;
+    char* binary = argc > 2 ? argv[2] : SPAWN_BENCH_DEFAULT_BINARY;
+    if (!count || count > RPC_SPAWN_BATCH_MAX)
+        return SYS_ERR_INVALID_SIZE;
+
+    BENCH_PRINTF("spawn-batch: %zu x '%s' across cores 0 and 1\n", count, binary);
+    domainid_t pid;
+    ERROR_RET1(aos_rpc_process_spawn(get_init_rpc(), binary, 0, &pid));
+    ERROR_RET1(aos_rpc_process_spawn(get_init_rpc(), binary, 1, &pid));
+
+    domainid_t* pids;
+    size_t spawned;
+    reset_cycle_counter();
+    uint32_t start = get_cycle_count();
+    ERROR_RET1(aos_rpc_process_spawn_batch(get_init_rpc(), &binary, 1, count,
+        SPAWN_BATCH_BENCH_CORES, &pids, &spawned));
+    uint32_t cycles = get_cycle_count() - start;
+    free(pids);
+    if (spawned != count)
+    {
+        BENCH_PRINTF("  batch spawned only %zu\n", spawned);
+        return PROCMGR_ERR_RPC_SPAWN_FAILED;
+    }
+    spawn_batch_bench_report("batch", count, cycles);
+
+    errval_t err = SYS_ERR_OK;
+    reset_cycle_counter();
+    start = get_cycle_count();
+    for (size_t i = 0; i < count && err_is_ok(err); ++i)
+        err = aos_rpc_process_spawn(get_init_rpc(), binary, i % 2, &pid);
+    cycles = get_cycle_count() - start;
+    ERROR_RET1(err);
+    spawn_batch_bench_report("single", count, cycles);
+    return SYS_ERR_OK;
+}
@@ -0,0 +1,411 @@
+/**
+ * \file
+ * \brief URPC ping-pong and streaming between core 0 and core 1.
+ *
+ * 'urpc' runs on core 0: it shares a frame through the binding server,
+ * spawns 'urpc-peer' on core 1 and echoes its requests until told to stop.
+ * The peer measures one request in flight (ping-pong) and a window of
+ * asynchronous requests (streaming), using the cycle counter of core 1 only.
+ * It then moves a bulk payload both inline, split over ring messages, and
+ * as a single descriptor into the shared pool.
+ *
+ * 'urpc-wait' serves 'urpc-wait-peer' the same way. For each wait mode the
+ * peer measures ping-pong latency, then waits on a request that core 0
+ * holds for a while, with 'urpc-burn' spinning next to it on core 1: the
+ * loops the burner gets through show how much of the core the waiting
+ * thread leaves to others.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <aos/urpc/server.h>
+
+#include "perfbench.h"
+
+#define URPC_BENCH_PORT         4242
+#define URPC_BENCH_DEFAULT_MSGS 10000
+#define URPC_BENCH_DEFAULT_SIZE 32
+#define URPC_BENCH_DEFAULT_BULK (1024 * 1024)
+#define URPC_BENCH_POOL_SIZE    (8 * LARGE_PAGE_SIZE)
+#define URPC_BENCH_BULK_ROUNDS  16
+#define URPC_BENCH_BURN_CYCLES  (BENCH_CPU_HZ / 2)
+
+enum urpc_bench_opcodes
+{
+    URPC_BENCH_OP_NULL = 0,
+    URPC_BENCH_OP_ECHO,
+    URPC_BENCH_OP_STOP,
+    URPC_BENCH_OP_SUM,
+    URPC_BENCH_OP_SLEEP,
+    URPC_BENCH_OP_COUNT
+};
+
+static errval_t urpc_bench_handle_echo(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    return urpc_server_answer(buf, msg->data, msg->length);
+}
+
+static uint32_t urpc_bench_sum(const uint8_t* data, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; ++i)
+        sum += data[i];
+    return sum;
+}
+
+static errval_t urpc_bench_handle_sum(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    uint32_t sum = urpc_bench_sum(msg->data, msg->length);
+    return urpc_server_answer(buf, &sum, sizeof(sum));
+}
+
+static errval_t urpc_bench_handle_sleep(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    uint32_t cycles = *(uint32_t*)msg->data;
+    uint32_t start = get_cycle_count();
+    while (get_cycle_count() - start < cycles)
+        ;
+    return urpc_server_answer(buf, NULL, 0);
+}
+
+static errval_t urpc_bench_handle_stop(struct urpc_buffer* buf, struct urpc_message* msg, void* context)
+{
+    struct urpc_channel* channel = context;
+    channel->server_stop_now = true;
+    return SYS_ERR_OK;
+}
+
+static int urpc_bench_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void urpc_bench_report(const char* name, uint32_t* latencies, size_t msgs, uint64_t cycles)
+{
+    qsort(latencies, msgs, sizeof(uint32_t), urpc_bench_cmp);
+    uint64_t per_msg = cycles / msgs;
+    BENCH_PRINTF("  %-10s %6zu msgs, %7llu msgs/s, latency p50 %6lu p90 %6lu p99 %6lu cycles\n",
+        name, msgs, per_msg ? BENCH_CPU_HZ / per_msg : 0,
+        latencies[msgs / 2], latencies[msgs * 9 / 10], latencies[msgs * 99 / 100]);
+}
+
+/**
+ * One request in flight: the latency is the full round-trip.
+ */
+static errval_t urpc_bench_ping_pong(struct urpc_buffer* buf, const char* name, char* payload, size_t size,
+        uint32_t* latencies, size_t msgs)
+{
+    uint64_t cycles = 0;
+    for (size_t i = 0; i < msgs; ++i)
+    {
+        size_t answer_size;
+        uint32_t start = get_cycle_count();
+        ERROR_RET1(urpc_client_send_receive_fixed_size(buf, URPC_BENCH_OP_ECHO, payload, size,
+            payload, size, &answer_size));
+        latencies[i] = get_cycle_count() - start;
+        cycles += latencies[i];
+    }
+    urpc_bench_report(name, latencies, msgs, cycles);
+    return SYS_ERR_OK;
+}
+
+/**
+ * Keep a window of requests in flight and wait for them in order. The
+ * latency of a message is the time from sending to its completion.
+ */
+static errval_t urpc_bench_stream(struct urpc_buffer* buf, char* payload, size_t size,
+        uint32_t* latencies, size_t msgs)
+{
+    size_t window = buf->requests.num_slots;
+    struct urpc_future* futures = malloc(window * sizeof(struct urpc_future));
+    char* answers = malloc(window * (size ? size : 1));
+    if (!futures || !answers)
+        return LIB_ERR_MALLOC_FAIL;
+
+    errval_t err = SYS_ERR_OK;
+    size_t sent = 0, done = 0;
+    uint64_t cycles = 0;
+    uint32_t last = get_cycle_count();
+    while (done < msgs && err_is_ok(err))
+    {
+        while (sent < msgs && sent - done < window && err_is_ok(err))
+        {
+            latencies[sent] = get_cycle_count();
+            err = urpc_client_send_async(buf, URPC_BENCH_OP_ECHO, payload, size,
+                answers + (sent % window) * size, size, &futures[sent % window], NULL, NOP_CLOSURE);
+            ++sent;
+        }
+        if (err_is_fail(err))
+            break;
+        err = urpc_future_wait(&futures[done % window]);
+        uint32_t now = get_cycle_count();
+        latencies[done] = now - latencies[done];
+        ++done;
+        cycles += now - last;
+        last = now;
+    }
+    if (err_is_ok(err))
+        urpc_bench_report("streaming", latencies, msgs, cycles);
+    free(answers);
+    free(futures);
+    return err;
+}
+
+static void urpc_bench_report_bulk(const char* name, size_t bytes, uint64_t cycles)
+{
+    uint64_t per_round = cycles / URPC_BENCH_BULK_ROUNDS;
+    BENCH_PRINTF("  %-10s %7zu bytes, %7llu cycles, %5llu MB/s\n", name, bytes, per_round,
+        per_round ? (uint64_t)bytes * BENCH_CPU_HZ / per_round / (1024 * 1024) : 0);
+}
+
+/**
+ * Bulk transfer split into ring-sized messages, all in flight at once.
+ */
+static errval_t urpc_bench_bulk_inline(struct urpc_buffer* buf, uint8_t* payload, size_t bytes)
+{
+    size_t chunk = URPC_MAX_DATA_SIZE(buf);
+    size_t count = DIVIDE_ROUND_UP(bytes, chunk);
+    struct urpc_future* futures = malloc(count * sizeof(struct urpc_future));
+    uint32_t* sums = malloc(count * sizeof(uint32_t));
+    if (!futures || !sums)
+        return LIB_ERR_MALLOC_FAIL;
+
+    errval_t err = SYS_ERR_OK;
+    uint64_t cycles = 0;
+    for (int round = 0; round < URPC_BENCH_BULK_ROUNDS && err_is_ok(err); ++round)
+    {
+        uint32_t start = get_cycle_count();
+        size_t sent = 0;
+        for (; sent < count && err_is_ok(err); ++sent)
+        {
+            size_t offset = sent * chunk;
+            err = urpc_client_send_async(buf, URPC_BENCH_OP_SUM, payload + offset, MIN(chunk, bytes - offset),
+                &sums[sent], sizeof(uint32_t), &futures[sent], NULL, NOP_CLOSURE);
+        }
+        if (err_is_fail(err))
+            --sent;
+        uint32_t sum = 0;
+        for (size_t i = 0; i < sent; ++i)
+        {
+            errval_t wait_err = urpc_future_wait(&futures[i]);
+            if (err_is_ok(err))
+                err = wait_err;
+            sum += sums[i];
+        }
+        cycles += (uint32_t)(get_cycle_count() - start);
+        if (err_is_ok(err) && sum != urpc_bench_sum(payload, bytes))
+            err = URPC_ERR_PROTOCOL_ERROR;
+    }
+    if (err_is_ok(err))
+        urpc_bench_report_bulk("inline", bytes, cycles);
+    free(sums);
+    free(futures);
+    return err;
+}
+
+/**
+ * Bulk transfer as one descriptor. The payload is copied into the pool once,
+ * standing in for a producer that writes it there directly.
+ */
+static errval_t urpc_bench_bulk_desc(struct urpc_buffer* buf, uint8_t* payload, size_t bytes)
+{
+    uint64_t cycles = 0;
+    for (int round = 0; round < URPC_BENCH_BULK_ROUNDS; ++round)
+    {
+        uint32_t start = get_cycle_count();
+        void* shared;
+        ERROR_RET1(urpc_client_alloc(buf, bytes, &shared));
+        memcpy(shared, payload, bytes);
+        uint32_t sum;
+        ERROR_RET1(urpc_client_send_desc_receive_fixed_size(buf, URPC_BENCH_OP_SUM, shared, bytes,
+            &sum, sizeof(sum), NULL));
+        cycles += (uint32_t)(get_cycle_count() - start);
+        if (sum != urpc_bench_sum(payload, bytes))
+            return URPC_ERR_PROTOCOL_ERROR;
+    }
+    urpc_bench_report_bulk("descriptor", bytes, cycles);
+    return SYS_ERR_OK;
+}
+
+/**
+ * Stops the server on core 0 and the pump thread of our side.
+ */
+static void urpc_bench_teardown(struct urpc_buffer* buf)
+{
+    char answer;
+    errval_t err = urpc_client_send_receive_fixed_size(buf, URPC_BENCH_OP_STOP, NULL, 0,
+        &answer, sizeof(answer), NULL);
+    if (err_is_fail(err))
+        DEBUG_ERR(err, "stopping the urpc bench server");
+    err = urpc_client_stop_pump(buf);
+    if (err_is_fail(err))
+        DEBUG_ERR(err, "stopping the urpc pump thread");
+}
+
+static errval_t urpc_bench_connect(struct urpc_channel* channel)
+{
+    struct capref frame;
+    ERROR_RET1(slot_alloc(&frame));
+    ERROR_RET1(aos_connect_to_port(get_init_rpc(), URPC_BENCH_PORT, &frame));
+    struct frame_identity frame_id;
+    ERROR_RET1(frame_identify(frame, &frame_id));
+    void* buffer;
+    ERROR_RET1(paging_map_frame_attr(get_current_paging_state(), &buffer, frame_id.bytes,
+        frame, VREGION_FLAGS_READ_WRITE, NULL, NULL));
+
+    ERROR_RET1(urpc_channel_init(channel, buffer, URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_SLAVE, URPC_BENCH_OP_COUNT));
+    return urpc_channel_attach_pool(channel, buffer + URPC_DEFAULT_FRAME_SIZE,
+        frame_id.bytes - URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_SLAVE);
+}
+
+errval_t urpc_bench_peer(int argc, char* argv[])
+{
+    size_t msgs = argc > 1 ? strtoul(argv[1], NULL, 10) : URPC_BENCH_DEFAULT_MSGS;
+    size_t size = argc > 2 ? strtoul(argv[2], NULL, 10) : URPC_BENCH_DEFAULT_SIZE;
+    size_t bulk = argc > 3 ? strtoul(argv[3], NULL, 10) : URPC_BENCH_DEFAULT_BULK;
+    if (!msgs || !bulk)
+        return SYS_ERR_INVALID_SIZE;
+
+    struct urpc_channel channel;
+    ERROR_RET1(urpc_bench_connect(&channel));
+    struct urpc_buffer* buf = &channel.buffer_send;
+    if (size > URPC_MAX_DATA_SIZE(buf))
+        return URPC_ERR_URPC_BUFFER_TOO_SMALL_FOR_SEND;
+
+    char* payload = calloc(1, size ? size : 1);
+    uint32_t* latencies = malloc(msgs * sizeof(uint32_t));
+    uint8_t* bulk_payload = malloc(bulk);
+    if (!payload || !latencies || !bulk_payload)
+        return LIB_ERR_MALLOC_FAIL;
+    for (size_t i = 0; i < bulk; ++i)
+        bulk_payload[i] = i * 7;
+
+    BENCH_PRINTF("urpc: %zu msgs of %zu bytes, core %d -> core 0, %u slots per ring\n",
+        msgs, size, disp_get_core_id(), buf->requests.num_slots);
+    errval_t err = urpc_bench_ping_pong(buf, "ping-pong", payload, size, latencies, msgs);
+    if (err_is_ok(err))
+        err = urpc_bench_stream(buf, payload, size, latencies, msgs);
+    if (err_is_ok(err))
+        err = urpc_bench_bulk_inline(buf, bulk_payload, bulk);
+    if (err_is_ok(err))
+        err = urpc_bench_bulk_desc(buf, bulk_payload, bulk);
+
+    urpc_bench_teardown(buf);
+    free(bulk_payload);
+    free(latencies);
+    free(payload);
+    return err;
+}
+
+/**
+ * Share a frame on URPC_BENCH_PORT, spawn $peer on core 1 with our
+ * arguments and serve it until it sends URPC_BENCH_OP_STOP.
+ */
+static errval_t urpc_bench_serve(const char* peer, int argc, char* argv[])
+{
+    if (disp_get_core_id() != 0)
+        return SPAWN_ERR_WRONG_CORE_ID;
+
+    struct capref frame;
+    size_t bytes;
+    ERROR_RET1(frame_alloc(&frame, URPC_DEFAULT_FRAME_SIZE + URPC_BENCH_POOL_SIZE, &bytes));
+    void* buffer;
+    ERROR_RET1(paging_map_frame_attr(get_current_paging_state(), &buffer, bytes,
+        frame, VREGION_FLAGS_READ_WRITE, NULL, NULL));
+    memset(buffer, 0, bytes);
+
+    struct urpc_channel channel;
+    ERROR_RET1(urpc_channel_init(&channel, buffer, URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_MASTER, URPC_BENCH_OP_COUNT));
+    ERROR_RET1(urpc_channel_attach_pool(&channel, buffer + URPC_DEFAULT_FRAME_SIZE,
+        bytes - URPC_DEFAULT_FRAME_SIZE, URPC_CHAN_MASTER));
+    ERROR_RET1(urpc_server_register_handler(&channel, URPC_BENCH_OP_ECHO, urpc_bench_handle_echo, NULL));
+    ERROR_RET1(urpc_server_register_handler(&channel, URPC_BENCH_OP_STOP, urpc_bench_handle_stop, &channel));
+    ERROR_RET1(urpc_server_register_handler(&channel, URPC_BENCH_OP_SUM, urpc_bench_handle_sum, NULL));
+    ERROR_RET1(urpc_server_register_handler(&channel, URPC_BENCH_OP_SLEEP, urpc_bench_handle_sleep, NULL));
+    ERROR_RET1(aos_rpc_create_server_socket(get_init_rpc(), frame, URPC_BENCH_PORT));
+
+    char* peer_argv[] = { "perfbench", (char*)peer,
+        argc > 1 ? argv[1] : "", argc > 2 ? argv[2] : "", argc > 3 ? argv[3] : "" };
+    int peer_argc = MIN(argc, 4) + 1;
+    domainid_t pid;
+    ERROR_RET1(aos_rpc_process_spawn_with_args(get_init_rpc(), 1, peer_argv, peer_argc, &pid));
+
+    // Serve the peer until it sends URPC_BENCH_OP_STOP
+    return urpc_server_start_listen(&channel, false);
+}
+
+errval_t urpc_bench(int argc, char* argv[])
+{
+    return urpc_bench_serve("urpc-peer", argc, argv);
+}
+
+static const char* urpc_wait_bench_modes[] = { "spin", "adaptive", "park" };
+
+errval_t urpc_wait_bench(int argc, char* argv[])
+{
+    return urpc_bench_serve("urpc-wait-peer", argc, argv);
+}
+
+errval_t urpc_wait_bench_peer(int argc, char* argv[])
+{
+    size_t msgs = argc > 1 ? strtoul(argv[1], NULL, 10) : URPC_BENCH_DEFAULT_MSGS;
+    uint32_t spin = argc > 2 ? strtoul(argv[2], NULL, 10) : URPC_DEFAULT_SPIN_CYCLES;
+    if (!msgs)
+        return SYS_ERR_INVALID_SIZE;
+
+    struct urpc_channel channel;
+    ERROR_RET1(urpc_bench_connect(&channel));
+    struct urpc_buffer* buf = &channel.buffer_send;
+    char payload[URPC_BENCH_DEFAULT_SIZE] = { 0 };
+    uint32_t* latencies = malloc(msgs * sizeof(uint32_t));
+    if (!latencies)
+        return LIB_ERR_MALLOC_FAIL;
+
+    BENCH_PRINTF("urpc-wait: %zu msgs per mode, spin %lu cycles, burner runs %llu cycles\n",
+        msgs, spin, URPC_BENCH_BURN_CYCLES);
+    errval_t err = SYS_ERR_OK;
+    for (int mode = URPC_WAIT_SPIN; mode <= URPC_WAIT_PARK && err_is_ok(err); ++mode)
+    {
+        urpc_buffer_set_wait(buf, mode, spin);
+        err = urpc_bench_ping_pong(buf, urpc_wait_bench_modes[mode], payload, sizeof(payload), latencies, msgs);
+        if (err_is_fail(err))
+            break;
+
+        // Wait on core 0 while the burner runs here, it prints what it got
+        char window[16];
+        snprintf(window, sizeof(window), "%llu", URPC_BENCH_BURN_CYCLES);
+        char* burn_argv[] = { "perfbench", "urpc-burn", window, (char*)urpc_wait_bench_modes[mode] };
+        domainid_t pid;
+        err = aos_rpc_process_spawn_with_args(get_init_rpc(), disp_get_core_id(), burn_argv, 4, &pid);
+        if (err_is_fail(err))
+            break;
+        uint32_t hold = 2 * URPC_BENCH_BURN_CYCLES;
+        uint32_t parks = buf->parks;
+        char answer;
+        err = urpc_client_send_receive_fixed_size(buf, URPC_BENCH_OP_SLEEP, &hold, sizeof(hold),
+            &answer, sizeof(answer), NULL);
+        BENCH_PRINTF("  %-10s parked %lu times while core 0 held the request\n",
+            urpc_wait_bench_modes[mode], buf->parks - parks);
+    }
+
+    urpc_bench_teardown(buf);
+    free(latencies);
+    return err;
+}
+
+/**
+ * Count loops for a number of cycles, next to a waiting urpc-wait-peer.
+ */
+errval_t urpc_bench_burn(int argc, char* argv[])
+{
+    uint32_t window = argc > 1 ? strtoul(argv[1], NULL, 10) : URPC_BENCH_BURN_CYCLES;
+    const char* label = argc > 2 ? argv[2] : "";
+    volatile uint64_t loops = 0;
+    uint32_t start = get_cycle_count();
+    while (get_cycle_count() - start < window)
+        ++loops;
+    BENCH_PRINTF("  %-10s burner: %llu loops in %lu cycles\n", label, loops, window);
+    return SYS_ERR_OK;
+}
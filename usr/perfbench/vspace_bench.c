@@ -0,0 +1,106 @@
+/**
+ * \file
+ * \brief Page-fault rate and paging_alloc latency against the number of
+ * vspace blocks.
+ *
+ * Every lazily backed page that faults is split off into its own Paged
+ * block, so the block map grows with the number of faults. With an O(n)
+ * block lookup the fault rate drops as the run progresses. Fault-around
+ * is turned off for the run so that every touched page faults.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "perfbench.h"
+
+#define VSPACE_BENCH_DEFAULT_PAGES  2048
+#define VSPACE_BENCH_REPORT_EVERY   256
+#define VSPACE_BENCH_ALLOCS         256
+
+static size_t vspace_bench_num_blocks(struct paging_state* st)
+{
+#ifdef PAGING_STORE_AS_LIST
+    return st->blocks.num_blocks;
+#else
+    return 0;
+#endif
+}
+
+static void vspace_bench_report(const char* name, size_t count, uint64_t cycles,
+        struct paging_state* st)
+{
+    uint64_t per_op = cycles / count;
+    BENCH_PRINTF("  %-10s %5zu ops, %8llu cycles/op, %7llu ops/s, %5zu blocks\n",
+        name, count, per_op, per_op ? BENCH_CPU_HZ / per_op : 0,
+        vspace_bench_num_blocks(st));
+}
+
+/**
+ * Touch every page of a lazily allocated region, in windows of
+ * VSPACE_BENCH_REPORT_EVERY faults.
+ */
+static errval_t vspace_bench_faults(struct paging_state* st, size_t pages)
+{
+    char* region;
+    ERROR_RET1(paging_alloc(st, (void**)&region, pages * BASE_PAGE_SIZE, NULL));
+
+    uint64_t window = 0;
+    for (size_t i = 0; i < pages; ++i)
+    {
+        uint32_t start = get_cycle_count();
+        region[i * BASE_PAGE_SIZE] = (char)i;
+        window += get_cycle_count() - start;
+        if ((i + 1) % VSPACE_BENCH_REPORT_EVERY == 0)
+        {
+            vspace_bench_report("fault", VSPACE_BENCH_REPORT_EVERY, window, st);
+            window = 0;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * paging_alloc latency once the block map is large.
+ */
+static errval_t vspace_bench_allocs(struct paging_state* st)
+{
+    uint64_t cycles = 0;
+    for (size_t i = 0; i < VSPACE_BENCH_ALLOCS; ++i)
+    {
+        void* buf;
+        uint32_t start = get_cycle_count();
+        ERROR_RET1(paging_alloc(st, &buf, BASE_PAGE_SIZE, NULL));
+        cycles += get_cycle_count() - start;
+    }
+    vspace_bench_report("alloc", VSPACE_BENCH_ALLOCS, cycles, st);
+    return SYS_ERR_OK;
+}
+
+errval_t vspace_bench(int argc, char* argv[])
+{
+    size_t pages = argc > 1 ? strtoul(argv[1], NULL, 10) : VSPACE_BENCH_DEFAULT_PAGES;
+    bool check = argc > 2 && !strcmp(argv[2], "check");
+    if (pages < VSPACE_BENCH_REPORT_EVERY)
+        return LIB_ERR_RAM_ALLOC_WRONG_SIZE;
+
+    struct paging_state* st = get_current_paging_state();
+    size_t fault_around = st->fault_around;
+    bool fault_sections = st->fault_sections;
+    ERROR_RET1(paging_set_fault_around(st, BASE_PAGE_SIZE, false));
+#ifdef PAGING_STORE_AS_LIST
+    vm_block_set_self_check(st, check);
+#endif
+    BENCH_PRINTF("vspace: %zu lazily mapped pages%s\n", pages,
+        check ? ", index self-check on" : "");
+
+    errval_t err = vspace_bench_faults(st, pages);
+    if (err_is_ok(err))
+        err = vspace_bench_allocs(st);
+
+#ifdef PAGING_STORE_AS_LIST
+    vm_block_set_self_check(st, false);
+#endif
+    ERROR_RET1(paging_set_fault_around(st, fault_around, fault_sections));
+    return err;
+}
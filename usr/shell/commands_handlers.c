@@ -1,4 +1,5 @@
 #include <aos/aos_rpc.h>
+#include <aos/deferred.h>
 #include <fs/fs.h>
 #include <fs/dirent.h>
 
@@ -13,6 +14,8 @@ Commands:
     - [OK] oncore
     - [OK] ps
     - [OK] help
+    - [OK] ramcache
+    - [OK] top
 */
 
 static void handle_help(char* const argv[], int argc)
@@ -39,26 +42,148 @@ static void handle_args(char* const argv[], int argc)
 
 static void handle_ps(char* const argv[], int argc)
 {
-    domainid_t* pidptr;
-    uint32_t pidcount;
-	errval_t err = aos_rpc_process_get_all_pids(get_init_rpc(), &pidptr, &pidcount);
-	if (err_is_fail(err)){
-		DEBUG_ERR(err, "Could not get PIDs");
-		return;
-	}
-    SHELL_STDOUT("%u running processes:\n", pidcount);
-	char* name;
-	for (int i = 0; i < pidcount; i++) {
-		err = aos_rpc_process_get_name(get_init_rpc(), pidptr[i], &name);
-		if (err_is_ok(err))
-		{
-			SHELL_STDOUT("\t%d\t\"%s\"\n", pidptr[i], name);
-			free(name);
-		}
-		else
-			DEBUG_ERR(err, "Could not get domain name [pid=%d]\n", pidptr[i]);
-	}
-	free(pidptr);
+    struct aos_process_info* procs;
+    size_t count;
+    errval_t err = aos_rpc_process_snapshot(get_init_rpc(), &procs, &count);
+    if (err_is_fail(err))
+    {
+        DEBUG_ERR(err, "Could not get the process list");
+        return;
+    }
+    SHELL_STDOUT("%zu running processes:\n", count);
+    SHELL_STDOUT("\tPID\tCORE\tSTATE\t\tNAME\n");
+    for (size_t i = 0; i < count; i++)
+        SHELL_STDOUT("\t%d\t%d\t%s\t\"%s\"\n", procs[i].pid, procs[i].core_id,
+            procs[i].state == AOS_PROCESS_RUNNING ? "running " : "starting", procs[i].name);
+    free(procs);
+}
+
+static void handle_ramcache(char* const argv[], int argc)
+{
+    struct aos_ram_cache_stats stats;
+    errval_t err = aos_rpc_get_ram_cache_stats(get_init_rpc(), &stats);
+    if (err_is_fail(err))
+    {
+        DEBUG_ERR(err, "Could not get RAM cache stats");
+        return;
+    }
+    uint32_t requests = stats.hits + stats.misses;
+    SHELL_STDOUT("RAM cache: %u requests, %u hits (%u%%), %u misses\n",
+        requests, stats.hits, requests ? stats.hits * 100 / requests : 0, stats.misses);
+    SHELL_STDOUT("\t%u refills (%u caps)\n", stats.refills, stats.refilled_caps);
+    SHELL_STDOUT("\tfrees: %u cached, %u returned to mm\n",
+        stats.frees_cached, stats.frees_returned);
+    SHELL_STDOUT("\tcached now: %u x 4KiB, %u x 64KiB\n",
+        stats.cached_small, stats.cached_large);
+}
+
+#define TOP_DEFAULT_INTERVAL_MS 1000
+#define TOP_DEFAULT_REFRESHES 10
+
+// Both lists are in PID order
+static const char* top_process_name(struct aos_process_info* procs, size_t count, domainid_t pid)
+{
+    size_t low = 0;
+    size_t high = count;
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (procs[mid].pid == pid)
+            return procs[mid].name;
+        if (procs[mid].pid < pid)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return "?";
+}
+
+static uint64_t top_previous_cpu(struct aos_process_usage* usage, size_t count, domainid_t pid)
+{
+    size_t low = 0;
+    size_t high = count;
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (usage[mid].pid == pid)
+            return usage[mid].cpu_us;
+        if (usage[mid].pid < pid)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return 0;
+}
+
+/**
+ * Prints the CPU and RAM usage of all processes $refreshes times, every
+ * $interval_ms. CPU% is of one core, over the last interval.
+ */
+static void handle_top(char* const argv[], int argc)
+{
+    unsigned long interval_ms = argc >= 2 ? strtoul(argv[1], NULL, 10) : TOP_DEFAULT_INTERVAL_MS;
+    unsigned long refreshes = argc >= 3 ? strtoul(argv[2], NULL, 10) : TOP_DEFAULT_REFRESHES;
+    if (!interval_ms || !refreshes)
+    {
+        SHELL_STDOUT("Syntax: %s [interval_ms] [refreshes]\n", argv[0]);
+        return;
+    }
+
+    struct aos_process_usage* previous;
+    size_t previous_count;
+    errval_t err = aos_rpc_process_usage(get_init_rpc(), &previous, &previous_count);
+    if (err_is_fail(err))
+    {
+        DEBUG_ERR(err, "Could not get the process usage");
+        return;
+    }
+    systime_t previous_time = get_system_time();
+    for (unsigned long i = 0; i < refreshes && err_is_ok(err); ++i)
+    {
+        err = barrelfish_usleep(interval_ms * 1000);
+        if (err_is_fail(err))
+            break;
+
+        struct aos_process_usage* usage;
+        size_t count;
+        err = aos_rpc_process_usage(get_init_rpc(), &usage, &count);
+        if (err_is_fail(err))
+            break;
+        systime_t now = get_system_time();
+        uint64_t elapsed_us = MAX(now - previous_time, 1);
+
+        struct aos_process_info* procs;
+        size_t procs_count;
+        err = aos_rpc_process_snapshot(get_init_rpc(), &procs, &procs_count);
+        if (err_is_fail(err))
+        {
+            free(usage);
+            break;
+        }
+
+        SHELL_STDOUT("top: %zu processes, every %lu ms (%lu/%lu)\n", count, interval_ms,
+            i + 1, refreshes);
+        SHELL_STDOUT("\tPID\tCORE\tCPU%%\tCPU ms\tSWITCHES\tRAM KiB\tCAPS\tSPAWN KiB\tNAME\n");
+        for (size_t j = 0; j < count; ++j)
+        {
+            struct aos_process_usage* u = &usage[j];
+            uint64_t cpu_us = u->cpu_us - MIN(u->cpu_us,
+                top_previous_cpu(previous, previous_count, u->pid));
+            uint64_t permille = cpu_us * 1000 / elapsed_us;
+            SHELL_STDOUT("\t%d\t%lu\t%llu.%llu\t%llu\t%lu\t\t%llu\t%lu\t%llu\t\t\"%s\"\n",
+                u->pid, u->core_id, permille / 10, permille % 10, u->cpu_us / 1000,
+                u->dispatches, u->ram_bytes / 1024, u->ram_caps, u->spawn_bytes / 1024,
+                top_process_name(procs, procs_count, u->pid));
+        }
+        free(procs);
+        free(previous);
+        previous = usage;
+        previous_count = count;
+        previous_time = now;
+    }
+    if (err_is_fail(err))
+        DEBUG_ERR(err, "Could not get the process usage");
+    free(previous);
 }
 
 static int thread_demo(void* tid)
@@ -404,7 +529,9 @@ struct command_handler_entry* shell_get_command_table(void)
         {.name = "oncore",      .handler = handle_oncore},
         {.name = "ps",          .handler = handle_ps},
         {.name = "pwd",         .handler = handle_pwd},
+        {.name = "ramcache",    .handler = handle_ramcache},
         {.name = "threads",     .handler = handle_threads},
+        {.name = "top",         .handler = handle_top},
         {.name = "wc",          .handler = handle_wc},
         {.name = NULL,          .handler = handle_fallback}
     };